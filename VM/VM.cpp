@@ -39,10 +39,12 @@ Operands format is as follows:
         3 bits for bit number in byte
             0..7: Bit number
 
-    16 bits for the operand address
+    16 bits for the operand address, or for K the index of the constant
+    in the constant pool (the value itself, 1 to 8 bytes, in version 0)
 ==============================
 
-The first 2 bytes of the program are the size of the program in bytes.
+The program starts with a header holding the size of the program in bytes
+and the sizes of the inputs, outputs and memories (see programFormat.h).
 ==============================
 
 The last 4 bytes of the program are the Checksum of the program.
@@ -85,9 +87,15 @@ The implemented instructions are as follows:
 33 TON (Timer On Delay): TON(ntimer, IN, PT, prescaler, OUT); Example TON(K5, IX0.0, 10,1,QX0.1)
 34 TOF (Timer Off Delay): TOF operand;
 35 ) (close parentheses): ); "Stract instruction from stack";
-36 TP (Timer Pulse);
+36 TP (Timer Pulse): TP(ntimer, IN, PT, prescaler, OUT, ET);
 37 R_TRIGGER (Rising edge detection) R_TRIGGER (ntrigger,IN, QO);
 38 F_TRIGGER (Falling edge detection) F_TRIGGER (ntrigger,IN, QO);
+
+The table of getNumOp used to be misordered after TOF: ), TP and
+F_TRIGGER were read with 5, 3 and 0 operands, and TP was encoded with 5.
+A program.bin compiled then, without header (version 0), that holds one
+of these instructions is decoded wrongly now and must be compiled again:
+version 0 does not tell the two encodings apart.
 */
 
 #include "VM.h"
@@ -96,11 +104,6 @@ The implemented instructions are as follows:
 #include "counter.h"
 #include "trigger.h"
 #include <stdio.h>
-StackElement poppedElement;
-Stack *stack;
-Timer *timers;
-Counter *counters;
-Trigger *triggers;
 
 
 /**
@@ -117,11 +120,31 @@ uint8_t getNumOp(uint8_t inst) {
     NumOpADD, NumOpSUB, NumOpMUL, NumOpDIV, NumOpMOD,
     NumOpGT, NumOpGE, NumOpEQ, NumOpNE, NumOpLT,
     NumOpLE, NumOpCTU, NumOpCTD, NumOpTON, NumOpTOF,
-    NumOpTP, NumOpRTRIGGER, NumOpFTRIGGER, NumOpq
+    NumOpq, NumOpTP, NumOpRTRIGGER, NumOpFTRIGGER
   };
   return(n[inst]);
 }
 
+/**
+ * Gets the mnemonic of an instruction.
+ *
+ * @param inst The instruction.
+ * @return The mnemonic, as in the IL source.
+ */
+const char *getOpcodeName(uint8_t inst) {
+  static const char *names[NumInstructions] = {
+    "LD", "LDN", "ST", "STN", "S",
+    "R", "MOV", "AND", "AND(", "ANDN",
+    "ANDN(", "OR", "OR(", "ORN", "ORN(",
+    "XOR", "XOR(", "XORN", "XORN(", "NOT",
+    "ADD", "SUB", "MUL", "DIV", "MOD",
+    "GT", "GE", "EQ", "NE", "LT",
+    "LE", "CTU", "CTD", "TON", "TOF",
+    ")", "TP", "RTRIGGER", "FTRIGGER"
+  };
+  return inst < NumInstructions ? names[inst] : "?";
+}
+
 /**
  * Gets a bit from a byte.
  *
@@ -157,7 +180,7 @@ uint8_t setBit(uint8_t byte, uint8_t bitNumber, uint8_t value) {
  * @param bitNumber The number of the bit to get.
  * @return The value of the bit.
  */
-uint8_t getBitFormAddress(uint8_t *memory, uint16_t address,
+uint8_t getBitFormAddress(uint8_t *memory, uint32_t address,
                           uint8_t bitNumber) {
   return getBit(memory[address], bitNumber);
 }
@@ -170,7 +193,7 @@ uint8_t getBitFormAddress(uint8_t *memory, uint16_t address,
  * @param bitNumber The number of the bit to set.
  * @param value The value to set the bit to.
  */
-void setBitInAddress(uint8_t *memory, uint16_t address, uint8_t bitNumber,
+void setBitInAddress(uint8_t *memory, uint32_t address, uint8_t bitNumber,
                      uint8_t value) {
   memory[address] = setBit(memory[address], bitNumber, value);
 }
@@ -182,7 +205,7 @@ void setBitInAddress(uint8_t *memory, uint16_t address, uint8_t bitNumber,
  * @param address The address in the memory to get the byte from.
  * @return The value of the byte.
  */
-int16_t getWordFromAddress(uint8_t *memory, uint16_t address) {
+int16_t getWordFromAddress(uint8_t *memory, uint32_t address) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   return (u.i16[0]);
@@ -195,7 +218,7 @@ int16_t getWordFromAddress(uint8_t *memory, uint16_t address) {
  * @param address The address in the memory to set the byte in.
  * @param value The value to set the byte to.
  */
-void setWordInAddress(uint8_t *memory, uint16_t address, int16_t value) {
+void setWordInAddress(uint8_t *memory, uint32_t address, int16_t value) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   u.i16[0] = value;
@@ -208,7 +231,7 @@ void setWordInAddress(uint8_t *memory, uint16_t address, int16_t value) {
  * @param address The address in the memory to get the double word from.
  * @return The value of the double word.
  */
-int32_t getDoubleWordFromAddress(uint8_t *memory, uint16_t address) {
+int32_t getDoubleWordFromAddress(uint8_t *memory, uint32_t address) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   return (u.i32[0]);
@@ -221,7 +244,7 @@ int32_t getDoubleWordFromAddress(uint8_t *memory, uint16_t address) {
  * @param address The address in the memory to set the double word in.
  * @param value The value to set the double word to.
  */
-void setDoubleWordInAddress(uint8_t *memory, uint16_t address, uint32_t value) {
+void setDoubleWordInAddress(uint8_t *memory, uint32_t address, uint32_t value) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   u.i32[0] = value;
@@ -234,7 +257,7 @@ void setDoubleWordInAddress(uint8_t *memory, uint16_t address, uint32_t value) {
  * @param address The address in the memory to get the long word from.
  * @return The value of the long word.
  */
-int64_t getLongWordFromAddress(uint8_t *memory, uint16_t address) {
+int64_t getLongWordFromAddress(uint8_t *memory, uint32_t address) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   return (u.i64[0]);
@@ -247,7 +270,7 @@ int64_t getLongWordFromAddress(uint8_t *memory, uint16_t address) {
  * @param address The address in the memory to set the long word in.
  * @param value The value to set the long word to.
  */
-void setLongWordInAddress(uint8_t *memory, uint16_t address, uint64_t value) {
+void setLongWordInAddress(uint8_t *memory, uint32_t address, uint64_t value) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   u.i64[0] = value;
@@ -260,7 +283,7 @@ void setLongWordInAddress(uint8_t *memory, uint16_t address, uint64_t value) {
  * @param address The address in the memory to get the float from.
  * @return The value of the float.
  */
-float getFloatFromAddress(uint8_t *memory, uint16_t address) {
+float getFloatFromAddress(uint8_t *memory, uint32_t address) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   return (u.f[0]);
@@ -273,167 +296,198 @@ float getFloatFromAddress(uint8_t *memory, uint16_t address) {
  * @param address The address in the memory to set the float in.
  * @param value The value to set the float to.
  */
-void setFloatInAddress(uint8_t *memory, uint16_t address, float value) {
+void setFloatInAddress(uint8_t *memory, uint32_t address, float value) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   u.f[0] = value;
 }
 
 /**
- * Gets a int8_t from a operand.
- * 
- * @param oper The operand to get the value from.
- * @param program The program buffer.
+ * Gets the buffer of the register of an operand: the region of the process
+ * image for I, Q and M, or the constants for K.
+ *
+ * @param oper The operand to get the buffer for.
+ * @param constants The K constants (Program.constants).
  * @param data The data structure containing the memory and register values.
-*/
-int8_t operandValueToInt8(Operand *oper, uint8_t *program, Data *data)
+ * @return The buffer of the register.
+ */
+uint8_t *getOperandBase(const Operand *oper, uint8_t *constants, Data *data)
 {
-  uint8_t *buffer = NULL;
   if(oper->registertype == I)
-  {
-    buffer = data->Inputs;
-  }
-   if(oper->registertype == K)
-  {
-    buffer = program;
-  }
+    return data->Inputs;
+  if(oper->registertype == Q)
+    return data->Outputs;
   if(oper->registertype == M)
-  {
-    buffer = data->Memories;
-  }
+    return data->Memories;
+  return constants;
+}
+
+/**
+ * Gets the size in bytes of a memory type.
+ *
+ * @param memorytype The memory type.
+ * @return The size in bytes.
+ */
+uint8_t getMemoryTypeSize(uint8_t memorytype)
+{
+  static const uint8_t sizes[] = {1, 1, 2, 4, 8, 4}; // X, B, W, D, L, R
+  if(memorytype > R)
+    return 0;
+  return sizes[memorytype];
+}
+
+/**
+ * Gets the size of the register region of an operand.
+ *
+ * @param oper The operand.
+ * @param data The data structure containing the memory and register values.
+ * @return The size of the region in bytes.
+ */
+uint16_t getRegionSize(const Operand *oper, Data *data)
+{
+  if(oper->registertype == I)
+    return data->inputSize;
   if(oper->registertype == Q)
-  {
-    buffer = data->Outputs;
+    return data->outputSize;
+  return data->memorySize;
+}
+
+/**
+ * Resolves the base pointer of the operands of an instruction.
+ *
+ * @param instr The instruction to resolve.
+ * @param constants The K constants (Program.constants).
+ * @param data The data structure containing the memory and register values.
+ */
+void resolveInstruction(Instruction *instr, uint8_t *constants, Data *data)
+{
+  for (uint8_t i = 0; i < instr->num_operands; i++) {
+    instr->operands[i].base = getOperandBase(&instr->operands[i], constants, data);
   }
+}
+
+/**
+ * Resolves the base pointer of the operands of a decoded program, so reading
+ * an operand is a single indexed load. The addresses are checked against the
+ * sizes of the process image.
+ *
+ * @param program The decoded program.
+ * @param data The data structure the program runs on.
+ * @return The error code.
+ */
+uint8_t resolveOperands(Program *program, Data *data)
+{
+  for (uint32_t i = 0; i < program->numInstructions; i++) {
+    Instruction *instr = &program->instructions[i];
+    resolveInstruction(instr, program->constants, data);
+    for (uint8_t j = 0; j < instr->num_operands; j++) {
+      const Operand *oper = &instr->operands[j];
+      if(oper->registertype == K)
+        continue;
+      if((uint32_t)oper->address + getMemoryTypeSize(oper->memorytype) >
+         getRegionSize(oper, data)) {
+        printf("Error: Address %d out of the process image in instruction %d\n",
+               oper->address, i);
+        return criticalError;
+      }
+    }
+  }
+  return noError;
+}
+
+/**
+ * Gets a int8_t from a operand.
+ * 
+ * @param oper The operand to get the value from, with its base resolved.
+*/
+int8_t operandValueToInt8(const Operand *oper)
+{
   if(oper->memorytype == R){
-    return (int8_t)getFloatFromAddress(buffer, oper->address);
+    return (int8_t)getFloatFromAddress(oper->base, oper->address);
   }
-  return (int8_t)buffer[oper->address];
+  return (int8_t)oper->base[oper->address];
 }
 
 /**
  * Gets a int16_t from a operand.
  * 
- * @param oper The operand to get the value from.
- * @param program The program buffer.
- * @param data The data structure containing the memory and register values.
+ * @param oper The operand to get the value from, with its base resolved.
 */
-int16_t operandValueToInt16(Operand *oper, uint8_t *program, Data *data)
+int16_t operandValueToInt16(const Operand *oper)
 {
-  uint8_t *buffer = NULL;
-  if(oper->registertype == I)
-  {
-    buffer = data->Inputs;
-  }
-   if(oper->registertype == K)
-  {
-    buffer = program;
-  }
-  if(oper->registertype == M)
-  {
-    buffer = data->Memories;
-  }
-  if(oper->registertype == Q)
-  {
-    buffer = data->Outputs;
-  }
-    if(oper->memorytype == R){
-    return (int16_t)getFloatFromAddress(buffer, oper->address);
+  if(oper->memorytype == R){
+    return (int16_t)getFloatFromAddress(oper->base, oper->address);
   }
-  return getWordFromAddress(buffer, oper->address);
+  return getWordFromAddress(oper->base, oper->address);
 }
 
 /**
  * Gets a int32_t from a operand.
  * 
- * @param oper The operand to get the value from.
- * @param program The program buffer.
- * @param data The data structure containing the memory and register values.
+ * @param oper The operand to get the value from, with its base resolved.
 */
-int32_t operandValueToInt32(Operand *oper, uint8_t *program, Data *data)
+int32_t operandValueToInt32(const Operand *oper)
 {
-  uint8_t *buffer = NULL;
-  if(oper->registertype == I)
-  {
-    buffer = data->Inputs;
-  }
-   if(oper->registertype == K)
-  {
-    buffer = program;
-  }
-  if(oper->registertype == M)
-  {
-    buffer = data->Memories;
-  }
-  if(oper->registertype == Q)
-  {
-    buffer = data->Outputs;
-  }
-    if(oper->memorytype == R){
-    return (int32_t)getFloatFromAddress(buffer, oper->address);
+  if(oper->memorytype == R){
+    return (int32_t)getFloatFromAddress(oper->base, oper->address);
   }
-  return getDoubleWordFromAddress(buffer, oper->address);
+  return getDoubleWordFromAddress(oper->base, oper->address);
 }
 
 /**
  * Gets a int64_t from a operand.
  * 
- * @param oper The operand to get the value from.
- * @param program The program buffer.
- * @param data The data structure containing the memory and register values.
+ * @param oper The operand to get the value from, with its base resolved.
 */
-int64_t operandValueToInt64(Operand *oper, uint8_t *program, Data *data)
+int64_t operandValueToInt64(const Operand *oper)
 {
-    uint8_t *buffer = NULL;
-  if(oper->registertype == I)
-  {
-    buffer = data->Inputs;
-  }
-   if(oper->registertype == K)
-  {
-    buffer = program;
-  }
-  if(oper->registertype == M)
-  {
-    buffer = data->Memories;
-  }
-  if(oper->registertype == Q)
-  {
-    buffer = data->Outputs;
-  }
-    if(oper->memorytype == R){
-    return (int64_t)getFloatFromAddress(buffer, oper->address);
+  if(oper->memorytype == R){
+    return (int64_t)getFloatFromAddress(oper->base, oper->address);
   }
-  return getLongWordFromAddress(buffer, oper->address);
+  return getLongWordFromAddress(oper->base, oper->address);
 }
 
 /**
  * Gets a float from a operand.
  * 
- * @param oper The operand to get the value from.
- * @param program The program buffer.
- * @param data The data structure containing the memory and register values.
+ * @param oper The operand to get the value from, with its base resolved.
 */
-float operandValueToFloat(Operand *oper, uint8_t *program, Data *data)
+float operandValueToFloat(const Operand *oper)
 {
-  uint8_t *buffer = NULL;
-  if(oper->registertype == I)
-  {
-    buffer = data->Inputs;
-  }
-   if(oper->registertype == K)
-  {
-    buffer = program;
-  }
-  if(oper->registertype == M)
-  {
-    buffer = data->Memories;
-  }
-  if(oper->registertype == Q)
-  {
-    buffer = data->Outputs;
-  }
-  return getFloatFromAddress(buffer, oper->address);
+  return getFloatFromAddress(oper->base, oper->address);
+}
+
+/**
+ * Gets the bit of an I, Q or M operand.
+ *
+ * @param oper The operand to get the bit from, with its base resolved.
+ * @return The value of the bit.
+ */
+static inline uint8_t operandBit(const Operand *oper)
+{
+  return getBit(oper->base[oper->address], oper->bitNumber);
+}
+
+/**
+ * Sets the bit of a Q or M operand.
+ *
+ * @param oper The operand to set the bit in, with its base resolved.
+ * @param value The value to set the bit to.
+ */
+static inline void setOperandBit(const Operand *oper, uint8_t value)
+{
+  setBitInAddress(oper->base, oper->address, oper->bitNumber, value);
+}
+
+/**
+ * Checks if the program can write to an operand (outputs and memories).
+ *
+ * @param oper The operand to check.
+ * @return 1 if the operand can be written.
+ */
+static inline uint8_t isWritable(const Operand *oper)
+{
+  return oper->registertype == Q || oper->registertype == M;
 }
 
 /**
@@ -441,43 +495,52 @@ float operandValueToFloat(Operand *oper, uint8_t *program, Data *data)
  *
  * @param buffer The buffer containing the instructions.
  * @param pos The position in the buffer to read the instruction from.
- * @return The instruction read from the buffer.
+ * @param instr The instruction to store the result in.
+ * @param constantPool The K operands are indexes in the constant pool
+ * (version 1 on), their address is then the position in the pool.
  */
-Instruction readInstruction(uint8_t *buffer, uint16_t *position) {
-  Instruction instr;
-  uint16_t pos = (*position);
-  instr.opcode = buffer[pos];
-  instr.num_operands = getNumOp(instr.opcode);
+void readInstruction(uint8_t *buffer, uint32_t *position, Instruction *instr,
+                     uint8_t constantPool) {
+  uint32_t pos = (*position);
+  instr->opcode = buffer[pos];
+  instr->num_operands = getNumOp(instr->opcode);
   pos++;
-  for (uint16_t i = 0; i < instr.num_operands; i++) {
-    instr.operands[i].memorytype = buffer[pos] >> 5;
-    instr.operands[i].registertype = (buffer[pos] >> 3) & 0x03;
-    instr.operands[i].bitNumber = buffer[pos] & 0x07;
+  for (uint16_t i = 0; i < instr->num_operands; i++) {
+    instr->operands[i].memorytype = buffer[pos] >> 5;
+    instr->operands[i].registertype = (buffer[pos] >> 3) & 0x03;
+    instr->operands[i].bitNumber = buffer[pos] & 0x07;
     pos++;
-    if(instr.operands[i].registertype != K)
+    if(instr->operands[i].registertype != K)
     {
-      instr.operands[i].address = getWordFromAddress(buffer, pos);
+      instr->operands[i].address = getWordFromAddress(buffer, pos);
+      pos += 2;
+    }
+    else if(constantPool)
+    {
+      // values are aligned on their size in the pool
+      instr->operands[i].address =
+          (uint32_t)(uint16_t)getWordFromAddress(buffer, pos) *
+          getMemoryTypeSize(instr->operands[i].memorytype);
       pos += 2;
     }
     else
     {
-      instr.operands[i].address = pos;
-      if(instr.operands[i].memorytype == X)
+      instr->operands[i].address = pos;
+      if(instr->operands[i].memorytype == X)
         pos += 1;
-      else if(instr.operands[i].memorytype == B)
+      else if(instr->operands[i].memorytype == B)
         pos += 1;
-      else if(instr.operands[i].memorytype == W)
+      else if(instr->operands[i].memorytype == W)
         pos += 2;
-      else if(instr.operands[i].memorytype == D)
+      else if(instr->operands[i].memorytype == D)
         pos += 4;
-      else if(instr.operands[i].memorytype == L)
+      else if(instr->operands[i].memorytype == L)
         pos += 8;
-      else if(instr.operands[i].memorytype == R)
+      else if(instr->operands[i].memorytype == R)
         pos += 4;
     }
   }
   *position = pos;
-  return instr;
 }
 
 /**
@@ -486,404 +549,205 @@ Instruction readInstruction(uint8_t *buffer, uint16_t *position) {
  * @param instr The instruction to execute.
  * @param data The data structure containing the memory and register values.
  */
-void executeInstruction(uint8_t *buffer, Instruction instr, Data *data) {
+void executeInstruction(const Instruction *instr, Data *data) {
   int8_t temp8 = 0;
   int16_t temp16 = 0;
   int32_t temp32 = 0;
   int64_t temp64 = 0;
   float tempf = 0;
-  switch (instr.opcode) {
+  switch (instr->opcode) {
   case InstLD:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == I)
-        data->accumulator =
-            getBitFormAddress(data->Inputs, instr.operands[0].address,
-                              instr.operands[0].bitNumber);
-      else if (instr.operands[0].registertype == Q)
+    if (instr->operands[0].memorytype == X) {
+      if (instr->operands[0].registertype == K)
         data->accumulator =
-            getBitFormAddress(data->Outputs, instr.operands[0].address,
-                              instr.operands[0].bitNumber);
-      else if (instr.operands[0].registertype == M)
-        data->accumulator =
-            getBitFormAddress(data->Memories, instr.operands[0].address,
-                              instr.operands[0].bitNumber);
-      else if (instr.operands[0].registertype == K)
-        data->accumulator = 
-             operandValueToInt8(&instr.operands[0], buffer, data) == 0 ? 0 : 1;      
+            operandValueToInt8(&instr->operands[0]) == 0 ? 0 : 1;
+      else
+        data->accumulator = operandBit(&instr->operands[0]);
     }
     break;
   case InstLDN:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == I)
-        data->accumulator =
-            (getBitFormAddress(data->Inputs, instr.operands[0].address,
-                               instr.operands[0].bitNumber)) == 0 ? 1 : 0;
-      else if (instr.operands[0].registertype == Q)
+    if (instr->operands[0].memorytype == X) {
+      if (instr->operands[0].registertype == K)
         data->accumulator =
-            (getBitFormAddress(data->Outputs, instr.operands[0].address,
-                               instr.operands[0].bitNumber)) == 0 ? 1 : 0;
-      else if (instr.operands[0].registertype == M)
-        data->accumulator =
-            (getBitFormAddress(data->Memories, instr.operands[0].address,
-                               instr.operands[0].bitNumber)) == 0 ? 1 : 0;
-    else if (instr.operands[0].registertype == K)
-        data->accumulator = 
-             operandValueToInt8(&instr.operands[0], buffer, data) == 0 ? 1 : 0;      
+            operandValueToInt8(&instr->operands[0]) == 0 ? 1 : 0;
+      else
+        data->accumulator = (operandBit(&instr->operands[0])) == 0 ? 1 : 0;
     }
     break;
   case InstST:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == Q)
-        setBitInAddress(data->Outputs, instr.operands[0].address,
-                        instr.operands[0].bitNumber, data->accumulator);
-      else if (instr.operands[0].registertype == M)
-        setBitInAddress(data->Memories, instr.operands[0].address,
-                        instr.operands[0].bitNumber, data->accumulator);
+    if (instr->operands[0].memorytype == X) {
+      if (isWritable(&instr->operands[0]))
+        setOperandBit(&instr->operands[0], data->accumulator);
     }
     break;
   case InstSTN:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == Q)
-        setBitInAddress(data->Outputs, instr.operands[0].address,
-                        instr.operands[0].bitNumber,
-                        (data->accumulator == 0) ? 1 : 0);
-      else if (instr.operands[0].registertype == M)
-        setBitInAddress(data->Memories, instr.operands[0].address,
-                        instr.operands[0].bitNumber,
-                        (data->accumulator == 0) ? 1 : 0);
+    if (instr->operands[0].memorytype == X) {
+      if (isWritable(&instr->operands[0]))
+        setOperandBit(&instr->operands[0], (data->accumulator == 0) ? 1 : 0);
     }
     break;
   case InstS:
     if (data->accumulator == 1) {
-      if (instr.operands[0].memorytype == X) {
-        if (instr.operands[0].registertype == Q)
-          setBitInAddress(data->Outputs, instr.operands[0].address,
-                          instr.operands[0].bitNumber, 1);
-        else if (instr.operands[0].registertype == M)
-          setBitInAddress(data->Memories, instr.operands[0].address,
-                          instr.operands[0].bitNumber, 1);
+      if (instr->operands[0].memorytype == X) {
+        if (isWritable(&instr->operands[0]))
+          setOperandBit(&instr->operands[0], 1);
       }
     }
     break;
   case InstR:
     if (data->accumulator == 1) {
-      if (instr.operands[0].memorytype == X) {
-        if (instr.operands[0].registertype == Q)
-          setBitInAddress(data->Outputs, instr.operands[0].address,
-                          instr.operands[0].bitNumber, 0);
-        else if (instr.operands[0].registertype == M)
-          setBitInAddress(data->Memories, instr.operands[0].address,
-                          instr.operands[0].bitNumber, 0);
+      if (instr->operands[0].memorytype == X) {
+        if (isWritable(&instr->operands[0]))
+          setOperandBit(&instr->operands[0], 0);
       }
     }
     break;
   case InstMOV:
     if (data->accumulator == 1) {
-      if (instr.operands[1].memorytype == X) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        if (instr.operands[1].registertype == Q)
-          setBitInAddress(data->Outputs, instr.operands[1].address,
-                          instr.operands[1].bitNumber, temp8);
-        else if (instr.operands[1].registertype == M)
-          setBitInAddress(data->Memories, instr.operands[1].address,
-                          instr.operands[1].bitNumber, temp8);
-      }
-      if (instr.operands[1].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        if (instr.operands[1].registertype == Q)
-          data->Outputs[instr.operands[1].address] = (uint8_t)temp8;
-        else if (instr.operands[1].registertype == M)
-          data->Memories[instr.operands[1].address] = (uint8_t)temp8;
-      }
-      if (instr.operands[1].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        if (instr.operands[1].registertype == Q)
-          setWordInAddress(data->Outputs, instr.operands[1].address, temp16);
-        else if (instr.operands[1].registertype == M)
-          setWordInAddress(data->Memories, instr.operands[1].address, temp16);
-      }
-      if (instr.operands[1].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        if (instr.operands[1].registertype == Q)
-          setDoubleWordInAddress(data->Outputs, instr.operands[1].address,
-                                 temp32);
-        else if (instr.operands[1].registertype == M)
-          setDoubleWordInAddress(data->Memories, instr.operands[1].address,
+      if (instr->operands[1].memorytype == X) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        if (isWritable(&instr->operands[1]))
+          setOperandBit(&instr->operands[1], temp8);
+      }
+      if (instr->operands[1].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        if (isWritable(&instr->operands[1]))
+          instr->operands[1].base[instr->operands[1].address] = (uint8_t)temp8;
+      }
+      if (instr->operands[1].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        if (isWritable(&instr->operands[1]))
+          setWordInAddress(instr->operands[1].base, instr->operands[1].address,
+                           temp16);
+      }
+      if (instr->operands[1].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        if (isWritable(&instr->operands[1]))
+          setDoubleWordInAddress(instr->operands[1].base, instr->operands[1].address,
                                  temp32);
       }
-      if (instr.operands[1].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        if (instr.operands[1].registertype == Q)
-          setLongWordInAddress(data->Outputs, instr.operands[1].address,
-                               temp64);
-        else if (instr.operands[1].registertype == M)
-          setLongWordInAddress(data->Memories, instr.operands[1].address,
+      if (instr->operands[1].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        if (isWritable(&instr->operands[1]))
+          setLongWordInAddress(instr->operands[1].base, instr->operands[1].address,
                                temp64);
       }
-      if (instr.operands[1].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        if (instr.operands[1].registertype == Q)
-          setFloatInAddress(data->Outputs, instr.operands[1].address, tempf);
-        else if (instr.operands[1].registertype == M)
-          setFloatInAddress(data->Memories, instr.operands[1].address,tempf);
+      if (instr->operands[1].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        if (isWritable(&instr->operands[1]))
+          setFloatInAddress(instr->operands[1].base, instr->operands[1].address,
+                            tempf);
       }
     }
     break;
   case InstAND:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == I)
-        data->accumulator =
-            data->accumulator & getBitFormAddress(data->Inputs,
-                                                  instr.operands[0].address,
-                                                  instr.operands[0].bitNumber);
-      else if (instr.operands[0].registertype == Q)
-        data->accumulator =
-            data->accumulator & getBitFormAddress(data->Outputs,
-                                                  instr.operands[0].address,
-                                                  instr.operands[0].bitNumber);
-      else if (instr.operands[0].registertype == M)
-        data->accumulator =
-            data->accumulator & getBitFormAddress(data->Memories,
-                                                  instr.operands[0].address,
-                                                  instr.operands[0].bitNumber);
-    } else if(instr.operands[0].memorytype == B &&  instr.operands[0].registertype == K){
+    if (instr->operands[0].memorytype == X) {
+      if (instr->operands[0].registertype != K)
+        data->accumulator = data->accumulator & operandBit(&instr->operands[0]);
+    } else if(instr->operands[0].memorytype == B &&  instr->operands[0].registertype == K){
       data->accumulator =
-        data->accumulator & operandValueToInt8(&instr.operands[0], buffer, data);
+        data->accumulator & operandValueToInt8(&instr->operands[0]);
     }
     break;
   case InstANDp:
-    push(stack, InstAND, data->accumulator);
-    if (instr.num_operands == 1) {
-      if (instr.operands[0].memorytype == X) {
-        if (instr.operands[0].registertype == I)
-          data->accumulator =
-              getBitFormAddress(data->Inputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == Q)
-          data->accumulator =
-              getBitFormAddress(data->Outputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == M)
-          data->accumulator =
-              getBitFormAddress(data->Memories, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
+    push(data->stack, InstAND, data->accumulator);
+    if (instr->num_operands == 1) {
+      if (instr->operands[0].memorytype == X) {
+        if (instr->operands[0].registertype != K)
+          data->accumulator = operandBit(&instr->operands[0]);
       }
     }
     break;
   case InstANDN:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == I)
+    if (instr->operands[0].memorytype == X) {
+      if (instr->operands[0].registertype != K)
         data->accumulator =
-            data->accumulator &
-            (getBitFormAddress(data->Inputs, instr.operands[0].address,
-                               instr.operands[0].bitNumber) == 0 ? 1 : 0);
-      else if (instr.operands[0].registertype == Q)
-        data->accumulator =
-            data->accumulator &
-            (getBitFormAddress(data->Outputs, instr.operands[0].address,
-                               instr.operands[0].bitNumber) == 0 ? 1 : 0);
-      else if (instr.operands[0].registertype == M)
-        data->accumulator =
-            data->accumulator &
-            (getBitFormAddress(data->Memories, instr.operands[0].address,
-                               instr.operands[0].bitNumber) == 0 ? 1 : 0);
-    } else if(instr.operands[0].memorytype == B &&  instr.operands[0].registertype == K){
+            data->accumulator & (operandBit(&instr->operands[0]) == 0 ? 1 : 0);
+    } else if(instr->operands[0].memorytype == B &&  instr->operands[0].registertype == K){
       data->accumulator =
-        data->accumulator & (operandValueToInt8(&instr.operands[0], buffer, data) == 0 ? 1 : 0);
+        data->accumulator & (operandValueToInt8(&instr->operands[0]) == 0 ? 1 : 0);
     }
     break;
   case InstANDNp:
-    push(stack, InstANDN, data->accumulator);
-    if (instr.num_operands == 1) {
-      if (instr.operands[0].memorytype == X) {
-        if (instr.operands[0].registertype == I)
-          data->accumulator =
-              getBitFormAddress(data->Inputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == Q)
-          data->accumulator =
-              getBitFormAddress(data->Outputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == M)
-          data->accumulator =
-              getBitFormAddress(data->Memories, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
+    push(data->stack, InstANDN, data->accumulator);
+    if (instr->num_operands == 1) {
+      if (instr->operands[0].memorytype == X) {
+        if (instr->operands[0].registertype != K)
+          data->accumulator = operandBit(&instr->operands[0]);
       }
     }
     break;
   case InstOR:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == I)
-        data->accumulator =
-            data->accumulator |
-            getBitFormAddress(data->Inputs, instr.operands[0].address,
-                              instr.operands[0].bitNumber);
-      else if (instr.operands[0].registertype == Q)
-        data->accumulator =
-            data->accumulator |
-            getBitFormAddress(data->Outputs, instr.operands[0].address,
-                              instr.operands[0].bitNumber);
-      else if (instr.operands[0].registertype == M)
-        data->accumulator =
-            data->accumulator |
-            getBitFormAddress(data->Memories, instr.operands[0].address,
-                              instr.operands[0].bitNumber);
-    } else if(instr.operands[0].memorytype == B &&  instr.operands[0].registertype == K){
+    if (instr->operands[0].memorytype == X) {
+      if (instr->operands[0].registertype != K)
+        data->accumulator = data->accumulator | operandBit(&instr->operands[0]);
+    } else if(instr->operands[0].memorytype == B &&  instr->operands[0].registertype == K){
       data->accumulator =
-        data->accumulator | operandValueToInt8(&instr.operands[0], buffer, data);
+        data->accumulator | operandValueToInt8(&instr->operands[0]);
     }
     break;
   case InstORp:
-    push(stack, InstOR, data->accumulator);
-    if (instr.num_operands == 1) {
-      if (instr.operands[0].memorytype == X) {
-        if (instr.operands[0].registertype == I)
-          data->accumulator =
-              getBitFormAddress(data->Inputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == Q)
-          data->accumulator =
-              getBitFormAddress(data->Outputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == M)
-          data->accumulator =
-              getBitFormAddress(data->Memories, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
+    push(data->stack, InstOR, data->accumulator);
+    if (instr->num_operands == 1) {
+      if (instr->operands[0].memorytype == X) {
+        if (instr->operands[0].registertype != K)
+          data->accumulator = operandBit(&instr->operands[0]);
       }
     }
     break;
   case InstORN:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == I)
-        data->accumulator =
-            data->accumulator |
-            (getBitFormAddress(data->Inputs, instr.operands[0].address,
-                               instr.operands[0].bitNumber) == 0
-                 ? 1
-                 : 0);
-      else if (instr.operands[0].registertype == Q)
+    if (instr->operands[0].memorytype == X) {
+      if (instr->operands[0].registertype != K)
         data->accumulator =
-            data->accumulator |
-            (getBitFormAddress(data->Outputs, instr.operands[0].address,
-                               instr.operands[0].bitNumber) == 0
-                 ? 1
-                 : 0);
-      else if (instr.operands[0].registertype == M)
-        data->accumulator =
-            data->accumulator |
-            (getBitFormAddress(data->Memories, instr.operands[0].address,
-                               instr.operands[0].bitNumber) == 0
-                 ? 1
-                 : 0);
-    } else if(instr.operands[0].memorytype == B &&  instr.operands[0].registertype == K){
+            data->accumulator | (operandBit(&instr->operands[0]) == 0 ? 1 : 0);
+    } else if(instr->operands[0].memorytype == B &&  instr->operands[0].registertype == K){
       data->accumulator =
-        data->accumulator | (operandValueToInt8(&instr.operands[0], buffer, data) == 0 ? 1 : 0);
+        data->accumulator | (operandValueToInt8(&instr->operands[0]) == 0 ? 1 : 0);
     }
     break;
   case InstORNp:
-    push(stack, InstORN, data->accumulator);
-    if (instr.num_operands == 1) {
-      if (instr.operands[0].memorytype == X) {
-        if (instr.operands[0].registertype == I)
-          data->accumulator =
-              getBitFormAddress(data->Inputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == Q)
-          data->accumulator =
-              getBitFormAddress(data->Outputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == M)
-          data->accumulator =
-              getBitFormAddress(data->Memories, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
+    push(data->stack, InstORN, data->accumulator);
+    if (instr->num_operands == 1) {
+      if (instr->operands[0].memorytype == X) {
+        if (instr->operands[0].registertype != K)
+          data->accumulator = operandBit(&instr->operands[0]);
       }
     }
     break;
   case InstXOR:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == I)
-        data->accumulator =
-            data->accumulator ^ getBitFormAddress(data->Inputs,
-                                                  instr.operands[0].address,
-                                                  instr.operands[0].bitNumber);
-      else if (instr.operands[0].registertype == Q)
-        data->accumulator =
-            data->accumulator ^ getBitFormAddress(data->Outputs,
-                                                  instr.operands[0].address,
-                                                  instr.operands[0].bitNumber);
-      else if (instr.operands[0].registertype == M)
-        data->accumulator =
-            data->accumulator ^ getBitFormAddress(data->Memories,
-                                                  instr.operands[0].address,
-                                                  instr.operands[0].bitNumber);
-    }else if(instr.operands[0].memorytype == B &&  instr.operands[0].registertype == K){
+    if (instr->operands[0].memorytype == X) {
+      if (instr->operands[0].registertype != K)
+        data->accumulator = data->accumulator ^ operandBit(&instr->operands[0]);
+    }else if(instr->operands[0].memorytype == B &&  instr->operands[0].registertype == K){
       data->accumulator =
-        data->accumulator ^ operandValueToInt8(&instr.operands[0], buffer, data);
+        data->accumulator ^ operandValueToInt8(&instr->operands[0]);
     }
     break;
   case InstXORp:
-    push(stack, InstXOR, data->accumulator);
-    if (instr.num_operands == 1) {
-      if (instr.operands[0].memorytype == X) {
-        if (instr.operands[0].registertype == I)
-          data->accumulator =
-              getBitFormAddress(data->Inputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == Q)
-          data->accumulator =
-              getBitFormAddress(data->Outputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == M)
-          data->accumulator =
-              getBitFormAddress(data->Memories, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
+    push(data->stack, InstXOR, data->accumulator);
+    if (instr->num_operands == 1) {
+      if (instr->operands[0].memorytype == X) {
+        if (instr->operands[0].registertype != K)
+          data->accumulator = operandBit(&instr->operands[0]);
       }
     }
     break;
   case InstXORN:
-    if (instr.operands[0].memorytype == X) {
-      if (instr.operands[0].registertype == I)
-        data->accumulator =
-            data->accumulator ^
-            (getBitFormAddress(data->Inputs, instr.operands[0].address,
-                               instr.operands[0].bitNumber) == 0
-                 ? 1
-                 : 0);
-      else if (instr.operands[0].registertype == Q)
-        data->accumulator =
-            data->accumulator ^
-            (getBitFormAddress(data->Outputs, instr.operands[0].address,
-                               instr.operands[0].bitNumber) == 0
-                 ? 1
-                 : 0);
-      else if (instr.operands[0].registertype == M)
+    if (instr->operands[0].memorytype == X) {
+      if (instr->operands[0].registertype != K)
         data->accumulator =
-            data->accumulator ^
-            (getBitFormAddress(data->Memories, instr.operands[0].address,
-                               instr.operands[0].bitNumber) == 0
-                 ? 1
-                 : 0);
-    }else if(instr.operands[0].memorytype == B &&  instr.operands[0].registertype == K){
+            data->accumulator ^ (operandBit(&instr->operands[0]) == 0 ? 1 : 0);
+    }else if(instr->operands[0].memorytype == B &&  instr->operands[0].registertype == K){
       data->accumulator =
-        data->accumulator ^ (operandValueToInt8(&instr.operands[0], buffer, data) == 0 ? 1 : 0);
+        data->accumulator ^ (operandValueToInt8(&instr->operands[0]) == 0 ? 1 : 0);
     }
     break;
   case InstXORNp:
-    push(stack, InstXORN, data->accumulator);
-    if (instr.num_operands == 1) {
-      if (instr.operands[0].memorytype == X) {
-        if (instr.operands[0].registertype == I)
-          data->accumulator =
-              getBitFormAddress(data->Inputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == Q)
-          data->accumulator =
-              getBitFormAddress(data->Outputs, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
-        else if (instr.operands[0].registertype == M)
-          data->accumulator =
-              getBitFormAddress(data->Memories, instr.operands[0].address,
-                                instr.operands[0].bitNumber);
+    push(data->stack, InstXORN, data->accumulator);
+    if (instr->num_operands == 1) {
+      if (instr->operands[0].memorytype == X) {
+        if (instr->operands[0].registertype != K)
+          data->accumulator = operandBit(&instr->operands[0]);
       }
     }
     break;
@@ -892,282 +756,213 @@ void executeInstruction(uint8_t *buffer, Instruction instr, Data *data) {
     break;
   case InstADD:
     if (data->accumulator == 1) {
-      if (instr.operands[2].memorytype == X) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 + operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setBitInAddress(data->Outputs, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-        else if (instr.operands[2].registertype == M)
-          setBitInAddress(data->Memories, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-      }
-      if (instr.operands[2].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 + operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          data->Outputs[instr.operands[2].address] = (uint8_t)temp8;
-        else if (instr.operands[2].registertype == M)
-          data->Memories[instr.operands[2].address] = (uint8_t)temp8;
-      }
-      if (instr.operands[2].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        temp16 = temp16 + operandValueToInt16(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setWordInAddress(data->Outputs, instr.operands[2].address, temp16);
-        else if (instr.operands[2].registertype == M)
-          setWordInAddress(data->Memories, instr.operands[2].address, temp16);
-      }
-      if (instr.operands[2].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        temp32 = temp32 + operandValueToInt32(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setDoubleWordInAddress(data->Outputs, instr.operands[2].address,
-                                 temp32);
-        else if (instr.operands[2].registertype == M)
-          setDoubleWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == X) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 + operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setOperandBit(&instr->operands[2], temp8);
+      }
+      if (instr->operands[2].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 + operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          instr->operands[2].base[instr->operands[2].address] = (uint8_t)temp8;
+      }
+      if (instr->operands[2].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        temp16 = temp16 + operandValueToInt16(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setWordInAddress(instr->operands[2].base, instr->operands[2].address,
+                           temp16);
+      }
+      if (instr->operands[2].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        temp32 = temp32 + operandValueToInt32(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setDoubleWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                  temp32);
       }
-      if (instr.operands[2].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        temp64 = temp64 + operandValueToInt64(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setLongWordInAddress(data->Outputs, instr.operands[2].address,
-                               temp64);
-        else if (instr.operands[2].registertype == M)
-          setLongWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        temp64 = temp64 + operandValueToInt64(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setLongWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                temp64);
       }
-      if (instr.operands[2].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        tempf = tempf + operandValueToFloat(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setFloatInAddress(data->Outputs, instr.operands[2].address, tempf);
-        else if (instr.operands[2].registertype == M)
-          setFloatInAddress(data->Memories, instr.operands[2].address, tempf);
+      if (instr->operands[2].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        tempf = tempf + operandValueToFloat(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setFloatInAddress(instr->operands[2].base, instr->operands[2].address,
+                            tempf);
       }
     }
     break;
   case InstSUB:
     if (data->accumulator == 1) {
-      if (instr.operands[2].memorytype == X) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 - operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setBitInAddress(data->Outputs, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-        else if (instr.operands[2].registertype == M)
-          setBitInAddress(data->Memories, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-      }
-      if (instr.operands[2].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 - operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          data->Outputs[instr.operands[2].address] = (uint8_t)temp8;
-        else if (instr.operands[2].registertype == M)
-          data->Memories[instr.operands[2].address] = (uint8_t)temp8;
-      }
-      if (instr.operands[2].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        temp16 = temp16 - operandValueToInt16(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setWordInAddress(data->Outputs, instr.operands[2].address, temp16);
-        else if (instr.operands[2].registertype == M)
-          setWordInAddress(data->Memories, instr.operands[2].address, temp16);
-      }
-      if (instr.operands[2].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        temp32 = temp32 - operandValueToInt32(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setDoubleWordInAddress(data->Outputs, instr.operands[2].address,
-                                 temp32);
-        else if (instr.operands[2].registertype == M)
-          setDoubleWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == X) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 - operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setOperandBit(&instr->operands[2], temp8);
+      }
+      if (instr->operands[2].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 - operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          instr->operands[2].base[instr->operands[2].address] = (uint8_t)temp8;
+      }
+      if (instr->operands[2].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        temp16 = temp16 - operandValueToInt16(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setWordInAddress(instr->operands[2].base, instr->operands[2].address,
+                           temp16);
+      }
+      if (instr->operands[2].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        temp32 = temp32 - operandValueToInt32(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setDoubleWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                  temp32);
       }
-      if (instr.operands[2].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        temp64 = temp64 - operandValueToInt64(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setLongWordInAddress(data->Outputs, instr.operands[2].address,
-                               temp64);
-        else if (instr.operands[2].registertype == M)
-          setLongWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        temp64 = temp64 - operandValueToInt64(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setLongWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                temp64);
       }
-      if (instr.operands[2].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        tempf = tempf - operandValueToFloat(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setFloatInAddress(data->Outputs, instr.operands[2].address, tempf);
-        else if (instr.operands[2].registertype == M)
-          setFloatInAddress(data->Memories, instr.operands[2].address, tempf);
+      if (instr->operands[2].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        tempf = tempf - operandValueToFloat(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setFloatInAddress(instr->operands[2].base, instr->operands[2].address,
+                            tempf);
       }
     }
     break;
   case InstMUL:
     if (data->accumulator == 1) {
-      if (instr.operands[2].memorytype == X) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 * operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setBitInAddress(data->Outputs, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-        else if (instr.operands[2].registertype == M)
-          setBitInAddress(data->Memories, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-      }
-      if (instr.operands[2].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 * operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          data->Outputs[instr.operands[2].address] = (uint8_t)temp8;
-        else if (instr.operands[2].registertype == M)
-          data->Memories[instr.operands[2].address] = (uint8_t)temp8;
-      }
-      if (instr.operands[2].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        temp16 = temp16 * operandValueToInt16(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setWordInAddress(data->Outputs, instr.operands[2].address, temp16);
-        else if (instr.operands[2].registertype == M)
-          setWordInAddress(data->Memories, instr.operands[2].address, temp16);
-      }
-      if (instr.operands[2].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        temp32 = temp32 * operandValueToInt32(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setDoubleWordInAddress(data->Outputs, instr.operands[2].address,
-                                 temp32);
-        else if (instr.operands[2].registertype == M)
-          setDoubleWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == X) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 * operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setOperandBit(&instr->operands[2], temp8);
+      }
+      if (instr->operands[2].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 * operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          instr->operands[2].base[instr->operands[2].address] = (uint8_t)temp8;
+      }
+      if (instr->operands[2].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        temp16 = temp16 * operandValueToInt16(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setWordInAddress(instr->operands[2].base, instr->operands[2].address,
+                           temp16);
+      }
+      if (instr->operands[2].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        temp32 = temp32 * operandValueToInt32(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setDoubleWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                  temp32);
       }
-      if (instr.operands[2].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        temp64 = temp64 * operandValueToInt64(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setLongWordInAddress(data->Outputs, instr.operands[2].address,
-                               temp64);
-        else if (instr.operands[2].registertype == M)
-          setLongWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        temp64 = temp64 * operandValueToInt64(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setLongWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                temp64);
       }
-      if (instr.operands[2].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        tempf = tempf * operandValueToFloat(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setFloatInAddress(data->Outputs, instr.operands[2].address, tempf);
-        else if (instr.operands[2].registertype == M)
-          setFloatInAddress(data->Memories, instr.operands[2].address, tempf);
+      if (instr->operands[2].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        tempf = tempf * operandValueToFloat(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setFloatInAddress(instr->operands[2].base, instr->operands[2].address,
+                            tempf);
       }
     }
     break;
   case InstDIV:
     if (data->accumulator == 1) {
-      if (instr.operands[2].memorytype == X) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 / operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setBitInAddress(data->Outputs, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-        else if (instr.operands[2].registertype == M)
-          setBitInAddress(data->Memories, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-      }
-      if (instr.operands[2].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 / operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          data->Outputs[instr.operands[2].address] = (uint8_t)temp8;
-        else if (instr.operands[2].registertype == M)
-          data->Memories[instr.operands[2].address] = (uint8_t)temp8;
-      }
-      if (instr.operands[2].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        temp16 = temp16 / operandValueToInt16(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setWordInAddress(data->Outputs, instr.operands[2].address, temp16);
-        else if (instr.operands[2].registertype == M)
-          setWordInAddress(data->Memories, instr.operands[2].address, temp16);
-      }
-      if (instr.operands[2].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        temp32 = temp32 / operandValueToInt32(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setDoubleWordInAddress(data->Outputs, instr.operands[2].address,
-                                 temp32);
-        else if (instr.operands[2].registertype == M)
-          setDoubleWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == X) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 / operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setOperandBit(&instr->operands[2], temp8);
+      }
+      if (instr->operands[2].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 / operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          instr->operands[2].base[instr->operands[2].address] = (uint8_t)temp8;
+      }
+      if (instr->operands[2].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        temp16 = temp16 / operandValueToInt16(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setWordInAddress(instr->operands[2].base, instr->operands[2].address,
+                           temp16);
+      }
+      if (instr->operands[2].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        temp32 = temp32 / operandValueToInt32(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setDoubleWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                  temp32);
       }
-      if (instr.operands[2].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        temp64 = temp64 / operandValueToInt64(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setLongWordInAddress(data->Outputs, instr.operands[2].address,
-                               temp64);
-        else if (instr.operands[2].registertype == M)
-          setLongWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        temp64 = temp64 / operandValueToInt64(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setLongWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                temp64);
       }
-      if (instr.operands[2].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        tempf = tempf / operandValueToFloat(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setFloatInAddress(data->Outputs, instr.operands[2].address, tempf);
-        else if (instr.operands[2].registertype == M)
-          setFloatInAddress(data->Memories, instr.operands[2].address, tempf);
+      if (instr->operands[2].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        tempf = tempf / operandValueToFloat(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setFloatInAddress(instr->operands[2].base, instr->operands[2].address,
+                            tempf);
       }
     }
     break;
   case InstMOD:
     if (data->accumulator == 1) {
-      if (instr.operands[2].memorytype == X) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 % operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setBitInAddress(data->Outputs, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-        else if (instr.operands[2].registertype == M)
-          setBitInAddress(data->Memories, instr.operands[2].address,
-                          instr.operands[2].bitNumber, temp8);
-      }
-      if (instr.operands[2].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        temp8 = temp8 % operandValueToInt8(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          data->Outputs[instr.operands[2].address] = (uint8_t)temp8;
-        else if (instr.operands[2].registertype == M)
-          data->Memories[instr.operands[2].address] = (uint8_t)temp8;
-      }
-      if (instr.operands[2].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        temp16 = temp16 % operandValueToInt16(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setWordInAddress(data->Outputs, instr.operands[2].address, temp16);
-        else if (instr.operands[2].registertype == M)
-          setWordInAddress(data->Memories, instr.operands[2].address, temp16);
-      }
-      if (instr.operands[2].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        temp32 = temp32 % operandValueToInt32(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setDoubleWordInAddress(data->Outputs, instr.operands[2].address,
-                                 temp32);
-        else if (instr.operands[2].registertype == M)
-          setDoubleWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == X) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 % operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setOperandBit(&instr->operands[2], temp8);
+      }
+      if (instr->operands[2].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        temp8 = temp8 % operandValueToInt8(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          instr->operands[2].base[instr->operands[2].address] = (uint8_t)temp8;
+      }
+      if (instr->operands[2].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        temp16 = temp16 % operandValueToInt16(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setWordInAddress(instr->operands[2].base, instr->operands[2].address,
+                           temp16);
+      }
+      if (instr->operands[2].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        temp32 = temp32 % operandValueToInt32(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setDoubleWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                  temp32);
       }
-      if (instr.operands[2].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        temp64 = temp64 % operandValueToInt64(&instr.operands[1], buffer, data);
-        if (instr.operands[2].registertype == Q)
-          setLongWordInAddress(data->Outputs, instr.operands[2].address,
-                               temp64);
-        else if (instr.operands[2].registertype == M)
-          setLongWordInAddress(data->Memories, instr.operands[2].address,
+      if (instr->operands[2].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        temp64 = temp64 % operandValueToInt64(&instr->operands[1]);
+        if (isWritable(&instr->operands[2]))
+          setLongWordInAddress(instr->operands[2].base, instr->operands[2].address,
                                temp64);
       }
       // No float modulo
@@ -1175,175 +970,176 @@ void executeInstruction(uint8_t *buffer, Instruction instr, Data *data) {
     break;
   case InstGT:
     if (data->accumulator == 1) {
-      if (instr.operands[1].memorytype == X) {
-        temp8 = getBit(operandValueToInt8(&instr.operands[0], buffer, data),instr.operands[0].bitNumber);
-        data->accumulator = (temp8 > getBit(operandValueToInt8(&instr.operands[1], buffer, data),
-                            instr.operands[1].bitNumber) ? 1 : 0);
+      if (instr->operands[1].memorytype == X) {
+        temp8 = getBit(operandValueToInt8(&instr->operands[0]),instr->operands[0].bitNumber);
+        data->accumulator = (temp8 > getBit(operandValueToInt8(&instr->operands[1]),
+                            instr->operands[1].bitNumber) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        data->accumulator = (temp8 > operandValueToInt8(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        data->accumulator = (temp8 > operandValueToInt8(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        data->accumulator = (temp16 > operandValueToInt16(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        data->accumulator = (temp16 > operandValueToInt16(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        data->accumulator = (temp32 > operandValueToInt32(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        data->accumulator = (temp32 > operandValueToInt32(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        data->accumulator = (temp64 > operandValueToInt64(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        data->accumulator = (temp64 > operandValueToInt64(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        data->accumulator = (tempf > operandValueToFloat(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        data->accumulator = (tempf > operandValueToFloat(&instr->operands[1]) ? 1 : 0);
       }
     }
     break;
   case InstGE:
     if (data->accumulator == 1) {
-      if (instr.operands[1].memorytype == X) {
-        temp8 = getBit(operandValueToInt8(&instr.operands[0], buffer, data),instr.operands[0].bitNumber);
-        data->accumulator = (temp8 >= getBit(operandValueToInt8(&instr.operands[1], buffer, data),instr.operands[1].bitNumber) ? 1 : 0);
+      if (instr->operands[1].memorytype == X) {
+        temp8 = getBit(operandValueToInt8(&instr->operands[0]),instr->operands[0].bitNumber);
+        data->accumulator = (temp8 >= getBit(operandValueToInt8(&instr->operands[1]),instr->operands[1].bitNumber) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        data->accumulator = (temp8 >= operandValueToInt8(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        data->accumulator = (temp8 >= operandValueToInt8(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        data->accumulator = (temp16 >= operandValueToInt16(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        data->accumulator = (temp16 >= operandValueToInt16(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        data->accumulator = (temp32 >= operandValueToInt32(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        data->accumulator = (temp32 >= operandValueToInt32(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        data->accumulator = (temp64 >= operandValueToInt64(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        data->accumulator = (temp64 >= operandValueToInt64(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        data->accumulator = (tempf >= operandValueToFloat(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        data->accumulator = (tempf >= operandValueToFloat(&instr->operands[1]) ? 1 : 0);
       }
     }
     break;
   case InstEQ:
     if (data->accumulator == 1) {
-      if (instr.operands[1].memorytype == X) {
-        temp8 = getBit(operandValueToInt8(&instr.operands[0], buffer, data),instr.operands[0].bitNumber);
-        data->accumulator = (temp8 == getBit(operandValueToInt8(&instr.operands[1], buffer, data),instr.operands[1].bitNumber) ? 1 : 0);
+      if (instr->operands[1].memorytype == X) {
+        temp8 = getBit(operandValueToInt8(&instr->operands[0]),instr->operands[0].bitNumber);
+        data->accumulator = (temp8 == getBit(operandValueToInt8(&instr->operands[1]),instr->operands[1].bitNumber) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        data->accumulator = (temp8 == operandValueToInt8(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        data->accumulator = (temp8 == operandValueToInt8(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        data->accumulator = (temp16 == operandValueToInt16(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        data->accumulator = (temp16 == operandValueToInt16(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        data->accumulator = (temp32 == operandValueToInt32(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        data->accumulator = (temp32 == operandValueToInt32(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        data->accumulator = (temp64 == operandValueToInt64(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        data->accumulator = (temp64 == operandValueToInt64(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        data->accumulator = (tempf == operandValueToFloat(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        data->accumulator = (tempf == operandValueToFloat(&instr->operands[1]) ? 1 : 0);
       }
     }
     break;
   case InstNE:
     if (data->accumulator == 1) {
-      if (instr.operands[1].memorytype == X) {
-        temp8 = getBit(operandValueToInt8(&instr.operands[0], buffer, data),instr.operands[0].bitNumber);
-        data->accumulator = (temp8 != getBit(operandValueToInt8(&instr.operands[1], buffer, data),instr.operands[1].bitNumber) ? 1 : 0);
+      if (instr->operands[1].memorytype == X) {
+        temp8 = getBit(operandValueToInt8(&instr->operands[0]),instr->operands[0].bitNumber);
+        data->accumulator = (temp8 != getBit(operandValueToInt8(&instr->operands[1]),instr->operands[1].bitNumber) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        data->accumulator = (temp8 != operandValueToInt8(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        data->accumulator = (temp8 != operandValueToInt8(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        data->accumulator = (temp16 != operandValueToInt16(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        data->accumulator = (temp16 != operandValueToInt16(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        data->accumulator = (temp32 != operandValueToInt32(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        data->accumulator = (temp32 != operandValueToInt32(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        data->accumulator = (temp64 != operandValueToInt64(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        data->accumulator = (temp64 != operandValueToInt64(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        data->accumulator = (tempf != operandValueToFloat(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        data->accumulator = (tempf != operandValueToFloat(&instr->operands[1]) ? 1 : 0);
       }
     }
     break;
   case InstLT:
     if (data->accumulator == 1) {
-      if (instr.operands[1].memorytype == X) {
-        temp8 = getBit(operandValueToInt8(&instr.operands[0], buffer, data),instr.operands[0].bitNumber);
-        data->accumulator = (temp8 < getBit(operandValueToInt8(&instr.operands[1], buffer, data),instr.operands[1].bitNumber) ? 1 : 0);
+      if (instr->operands[1].memorytype == X) {
+        temp8 = getBit(operandValueToInt8(&instr->operands[0]),instr->operands[0].bitNumber);
+        data->accumulator = (temp8 < getBit(operandValueToInt8(&instr->operands[1]),instr->operands[1].bitNumber) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        data->accumulator = (temp8 < operandValueToInt8(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        data->accumulator = (temp8 < operandValueToInt8(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        data->accumulator = (temp16 < operandValueToInt16(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        data->accumulator = (temp16 < operandValueToInt16(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        data->accumulator = (temp32 < operandValueToInt32(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        data->accumulator = (temp32 < operandValueToInt32(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        data->accumulator = (temp64 < operandValueToInt64(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        data->accumulator = (temp64 < operandValueToInt64(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        data->accumulator = (tempf < operandValueToFloat(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        data->accumulator = (tempf < operandValueToFloat(&instr->operands[1]) ? 1 : 0);
       }
     }
     break;
   case InstLE:
       if (data->accumulator == 1) {
-      if (instr.operands[1].memorytype == X) {
-        temp8 = getBit(operandValueToInt8(&instr.operands[0], buffer, data),instr.operands[0].bitNumber);
-        data->accumulator = (temp8 <= getBit(operandValueToInt8(&instr.operands[1], buffer, data),instr.operands[1].bitNumber) ? 1 : 0);
+      if (instr->operands[1].memorytype == X) {
+        temp8 = getBit(operandValueToInt8(&instr->operands[0]),instr->operands[0].bitNumber);
+        data->accumulator = (temp8 <= getBit(operandValueToInt8(&instr->operands[1]),instr->operands[1].bitNumber) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == B) {
-        temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-        data->accumulator = (temp8 <= operandValueToInt8(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == B) {
+        temp8 = operandValueToInt8(&instr->operands[0]);
+        data->accumulator = (temp8 <= operandValueToInt8(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == W) {
-        temp16 = operandValueToInt16(&instr.operands[0], buffer, data);
-        data->accumulator = (temp16 <= operandValueToInt16(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == W) {
+        temp16 = operandValueToInt16(&instr->operands[0]);
+        data->accumulator = (temp16 <= operandValueToInt16(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == D) {
-        temp32 = operandValueToInt32(&instr.operands[0], buffer, data);
-        data->accumulator = (temp32 <= operandValueToInt32(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == D) {
+        temp32 = operandValueToInt32(&instr->operands[0]);
+        data->accumulator = (temp32 <= operandValueToInt32(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == L) {
-        temp64 = operandValueToInt64(&instr.operands[0], buffer, data);
-        data->accumulator = (temp64 <= operandValueToInt64(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == L) {
+        temp64 = operandValueToInt64(&instr->operands[0]);
+        data->accumulator = (temp64 <= operandValueToInt64(&instr->operands[1]) ? 1 : 0);
       }
-      if (instr.operands[1].memorytype == R) {
-        tempf = operandValueToFloat(&instr.operands[0], buffer, data);
-        data->accumulator = (tempf <= operandValueToFloat(&instr.operands[1], buffer, data) ? 1 : 0);
+      if (instr->operands[1].memorytype == R) {
+        tempf = operandValueToFloat(&instr->operands[0]);
+        data->accumulator = (tempf <= operandValueToFloat(&instr->operands[1]) ? 1 : 0);
       }
     }
     break;
-  case Instq:
-    pop(stack, &poppedElement);
+  case Instq: {
+    StackElement poppedElement = {0, 0}; // Unchanged on stack underflow
+    pop(data->stack, &poppedElement);
     if(poppedElement.instruction == InstAND ||poppedElement.instruction == InstOR ||
       poppedElement.instruction == InstANDN ||poppedElement.instruction == InstORN ||
       poppedElement.instruction == InstXOR ||poppedElement.instruction == InstXORN ){
@@ -1356,6 +1152,7 @@ void executeInstruction(uint8_t *buffer, Instruction instr, Data *data) {
 		    ops[0].registertype=K;
 		    ops[0].bitNumber=0;
 		    ops[0].address=0;
+		    ops[0].base=lbuffer;
 		    Instruction in;
 		    //in = {poppedElement.instruction,nop,{*ops}};
 		    in.opcode = poppedElement.instruction;
@@ -1365,7 +1162,7 @@ void executeInstruction(uint8_t *buffer, Instruction instr, Data *data) {
 		    }
         lbuffer[0] = poppedElement.value;
         lbuffer[1] = 0;
-        executeInstruction(lbuffer,in, data);
+        executeInstruction(&in, data);
     }
     /*
     switch (poppedElement.instruction) {
@@ -1394,160 +1191,101 @@ void executeInstruction(uint8_t *buffer, Instruction instr, Data *data) {
         break;
     }*/
     break;
+  }
   case InstTON: // TON(ntimer, IN, ticks, prescaler, OUT) Example TON(K5,
                 // IX0.0, K10,K1,QX0.1
 
-    temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-    if (instr.operands[1].registertype == I) {
-      timers[temp8].IN =
-          (getBitFormAddress(data->Inputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == M) {
-      timers[temp8].IN =
-          (getBitFormAddress(data->Memories, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == Q) {
-      timers[temp8].IN =
-          (getBitFormAddress(data->Outputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
+    temp8 = operandValueToInt8(&instr->operands[0]);
+    if (instr->operands[1].registertype != K) {
+      data->timers[temp8].IN = (operandBit(&instr->operands[1]) == 0 ? 0 : 1);
     }
 
-    if (instr.operands[2].registertype == K) {
-      timers[temp8].PT = operandValueToInt16(&instr.operands[2], buffer, data);
-    } else if (instr.operands[2].registertype == M) {
-      timers[temp8].PT =
-          getWordFromAddress(data->Memories, instr.operands[2].address);
+    if (instr->operands[2].registertype == K) {
+      data->timers[temp8].PT = operandValueToInt16(&instr->operands[2]);
+    } else if (instr->operands[2].registertype == M) {
+      data->timers[temp8].PT =
+          getWordFromAddress(data->Memories, instr->operands[2].address);
     }
 
-    if (instr.operands[3].registertype == K) {
-      timers[temp8].prescaler =
-          operandValueToInt8(&instr.operands[3], buffer, data);
-    } else if (instr.operands[3].registertype == M) {
-      timers[temp8].prescaler = (uint8_t)(getWordFromAddress(
-          data->Memories, instr.operands[2].address));
+    if (instr->operands[3].registertype == K) {
+      data->timers[temp8].prescaler =
+          operandValueToInt8(&instr->operands[3]);
+    } else if (instr->operands[3].registertype == M) {
+      data->timers[temp8].prescaler = (uint8_t)(getWordFromAddress(
+          data->Memories, instr->operands[2].address));
     }
 
-    runTimerTON(&timers[temp8]);
+    runTimerTON(&data->timers[temp8], data->elapsedTicks);
 
-    if (instr.operands[4].registertype == Q) {
-      setBitInAddress(data->Outputs, instr.operands[4].address,
-                      instr.operands[4].bitNumber, timers[temp8].QO);
-    } else if (instr.operands[4].registertype == M) {
-      setBitInAddress(data->Memories, instr.operands[4].address,
-                      instr.operands[4].bitNumber, timers[temp8].QO);
+    if (isWritable(&instr->operands[4])) {
+      setOperandBit(&instr->operands[4], data->timers[temp8].QO);
     }
 
-    setWordInAddress(data->Memories, instr.operands[5].address, timers[temp8].ET);
+    setWordInAddress(data->Memories, instr->operands[5].address, data->timers[temp8].ET);
 
     break;
 
   case InstTOF: // TOF(ntimer, IN, ticks, prescaler, OUT) Example TOF(K5,
                 // IX0.0, K10,K1,QX0.1
-    temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-    if (instr.operands[1].registertype == I) {
-      timers[temp8].IN =
-          (getBitFormAddress(data->Inputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == M) {
-      timers[temp8].IN =
-          (getBitFormAddress(data->Memories, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == Q) {
-      timers[temp8].IN =
-          (getBitFormAddress(data->Outputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
+    temp8 = operandValueToInt8(&instr->operands[0]);
+    if (instr->operands[1].registertype != K) {
+      data->timers[temp8].IN = (operandBit(&instr->operands[1]) == 0 ? 0 : 1);
     }
 
-    if (instr.operands[2].registertype == K) {
-      timers[temp8].PT = operandValueToInt16(&instr.operands[2], buffer, data);
-    } else if (instr.operands[2].registertype == M) {
-      timers[temp8].PT =
-          getWordFromAddress(data->Memories, instr.operands[2].address);
+    if (instr->operands[2].registertype == K) {
+      data->timers[temp8].PT = operandValueToInt16(&instr->operands[2]);
+    } else if (instr->operands[2].registertype == M) {
+      data->timers[temp8].PT =
+          getWordFromAddress(data->Memories, instr->operands[2].address);
     }
 
-    if (instr.operands[3].registertype == K) {
-      timers[temp8].prescaler =
-          operandValueToInt8(&instr.operands[3], buffer, data);
-    } else if (instr.operands[3].registertype == M) {
-      timers[temp8].prescaler = (uint8_t)(getWordFromAddress(
-          data->Memories, instr.operands[2].address));
+    if (instr->operands[3].registertype == K) {
+      data->timers[temp8].prescaler =
+          operandValueToInt8(&instr->operands[3]);
+    } else if (instr->operands[3].registertype == M) {
+      data->timers[temp8].prescaler = (uint8_t)(getWordFromAddress(
+          data->Memories, instr->operands[2].address));
     }
 
-    runTimerTOF(&timers[temp8]);
+    runTimerTOF(&data->timers[temp8], data->elapsedTicks);
 
-    if (instr.operands[4].registertype == Q) {
-      setBitInAddress(data->Outputs, instr.operands[4].address,
-                      instr.operands[4].bitNumber, timers[temp8].QO);
-    } else if (instr.operands[4].registertype == M) {
-      setBitInAddress(data->Memories, instr.operands[4].address,
-                      instr.operands[4].bitNumber, timers[temp8].QO);
+    if (isWritable(&instr->operands[4])) {
+      setOperandBit(&instr->operands[4], data->timers[temp8].QO);
     }
 
-    setWordInAddress(data->Memories, instr.operands[5].address, timers[temp8].ET);
+    setWordInAddress(data->Memories, instr->operands[5].address, data->timers[temp8].ET);
 
     break;
 
   case InstTP: // TOF(ntimer, IN, PT, prescaler, OUT) Example TOF(K5,
                // IX0.0, K10,K1,QX0.1
-    temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-    if (instr.operands[1].registertype == I) {
-      timers[temp8].IN =
-          (getBitFormAddress(data->Inputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == M) {
-      timers[temp8].IN =
-          (getBitFormAddress(data->Memories, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == Q) {
-      timers[temp8].IN =
-          (getBitFormAddress(data->Outputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
+    temp8 = operandValueToInt8(&instr->operands[0]);
+    if (instr->operands[1].registertype != K) {
+      data->timers[temp8].IN = (operandBit(&instr->operands[1]) == 0 ? 0 : 1);
     }
 
-    if (instr.operands[2].registertype == K) {
-      timers[temp8].PT = operandValueToInt16(&instr.operands[2], buffer, data);
-    } else if (instr.operands[2].registertype == M) {
-      timers[temp8].PT =
-          getWordFromAddress(data->Memories, instr.operands[2].address);
+    if (instr->operands[2].registertype == K) {
+      data->timers[temp8].PT = operandValueToInt16(&instr->operands[2]);
+    } else if (instr->operands[2].registertype == M) {
+      data->timers[temp8].PT =
+          getWordFromAddress(data->Memories, instr->operands[2].address);
     }
 
-    if (instr.operands[3].registertype == K) {
-      timers[temp8].prescaler =
-          operandValueToInt8(&instr.operands[3], buffer, data);
-    } else if (instr.operands[3].registertype == M) {
-      timers[temp8].prescaler = (uint8_t)(getWordFromAddress(
-          data->Memories, instr.operands[2].address));
+    if (instr->operands[3].registertype == K) {
+      data->timers[temp8].prescaler =
+          operandValueToInt8(&instr->operands[3]);
+    } else if (instr->operands[3].registertype == M) {
+      data->timers[temp8].prescaler = (uint8_t)(getWordFromAddress(
+          data->Memories, instr->operands[2].address));
     }
 
-    runTimerTP(&timers[temp8]);
+    runTimerTP(&data->timers[temp8], data->elapsedTicks);
 
-    if (instr.operands[4].registertype == Q) {
-      setBitInAddress(data->Outputs, instr.operands[4].address,
-                      instr.operands[4].bitNumber, timers[temp8].QO);
-    } else if (instr.operands[4].registertype == M) {
-      setBitInAddress(data->Memories, instr.operands[4].address,
-                      instr.operands[4].bitNumber, timers[temp8].QO);
+    if (isWritable(&instr->operands[4])) {
+      setOperandBit(&instr->operands[4], data->timers[temp8].QO);
     }
 
-    setWordInAddress(data->Memories, instr.operands[5].address, timers[temp8].ET);
+    setWordInAddress(data->Memories, instr->operands[5].address, data->timers[temp8].ET);
 
     break;
 
@@ -1557,59 +1295,29 @@ void executeInstruction(uint8_t *buffer, Instruction instr, Data *data) {
                   // RST -> Reset counter
                   // OUT -> Output
                   // CV -> Current value of the counter
-      temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-      if (instr.operands[1].registertype == I) {
-        counters[temp8].CO =
-            (getBitFormAddress(data->Inputs, instr.operands[1].address,
-                               instr.operands[1].bitNumber) == 0 ? 0 : 1);
-      } else if (instr.operands[1].registertype == M) {
-        counters[temp8].CO =
-            (getBitFormAddress(data->Memories, instr.operands[1].address,
-                               instr.operands[1].bitNumber) == 0 ? 0 : 1);
-      } else if (instr.operands[1].registertype == Q) {
-        counters[temp8].CO =
-            (getBitFormAddress(data->Outputs, instr.operands[1].address,
-                               instr.operands[1].bitNumber) == 0 ? 0 : 1);
-      }
-
-      if (instr.operands[2].registertype == K) {
-        counters[temp8].PV = operandValueToInt16(&instr.operands[2], buffer, data);
-      } else if (instr.operands[2].registertype == M) {
-        counters[temp8].PV =
-            getWordFromAddress(data->Memories, instr.operands[2].address);
-      }
-
-      if (instr.operands[3].registertype == I) {
-        counters[temp8].R_LD =
-            (getBitFormAddress(data->Inputs, instr.operands[3].address,
-                               instr.operands[3].bitNumber) == 0
-                 ? 0
-                 : 1);
-      } else if (instr.operands[3].registertype == M) {
-        counters[temp8].R_LD =
-            (getBitFormAddress(data->Memories, instr.operands[3].address,
-                               instr.operands[3].bitNumber) == 0
-                 ? 0
-                 : 1);
-      } else if (instr.operands[3].registertype == Q) {
-        counters[temp8].R_LD =
-            (getBitFormAddress(data->Outputs, instr.operands[3].address,
-                               instr.operands[3].bitNumber) == 0
-                 ? 0
-                 : 1);
-      }
-
-      runCounterUp(&counters[temp8]);
-
-      if (instr.operands[4].registertype == Q) {
-        setBitInAddress(data->Outputs, instr.operands[4].address,
-                        instr.operands[4].bitNumber, counters[temp8].QO);
-      } else if (instr.operands[4].registertype == M) {
-        setBitInAddress(data->Memories, instr.operands[4].address,
-                        instr.operands[4].bitNumber, counters[temp8].QO);
-      }
-
-      setWordInAddress(data->Memories, instr.operands[5].address, counters[temp8].CV);
+      temp8 = operandValueToInt8(&instr->operands[0]);
+      if (instr->operands[1].registertype != K) {
+        data->counters[temp8].CO = (operandBit(&instr->operands[1]) == 0 ? 0 : 1);
+      }
+
+      if (instr->operands[2].registertype == K) {
+        data->counters[temp8].PV = operandValueToInt16(&instr->operands[2]);
+      } else if (instr->operands[2].registertype == M) {
+        data->counters[temp8].PV =
+            getWordFromAddress(data->Memories, instr->operands[2].address);
+      }
+
+      if (instr->operands[3].registertype != K) {
+        data->counters[temp8].R_LD = (operandBit(&instr->operands[3]) == 0 ? 0 : 1);
+      }
+
+      runCounterUp(&data->counters[temp8]);
+
+      if (isWritable(&instr->operands[4])) {
+        setOperandBit(&instr->operands[4], data->counters[temp8].QO);
+      }
+
+      setWordInAddress(data->Memories, instr->operands[5].address, data->counters[temp8].CV);
 
     break;
 
@@ -1620,128 +1328,52 @@ void executeInstruction(uint8_t *buffer, Instruction instr, Data *data) {
                 // LD -> Load counter
                 // OUT -> Output
                 // CV -> Current value of the counter
-    temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-    if (instr.operands[1].registertype == I) {
-      counters[temp8].CO =
-          (getBitFormAddress(data->Inputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == M) {
-      counters[temp8].CO =
-          (getBitFormAddress(data->Memories, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == Q) {
-      counters[temp8].CO =
-          (getBitFormAddress(data->Outputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
+    temp8 = operandValueToInt8(&instr->operands[0]);
+    if (instr->operands[1].registertype != K) {
+      data->counters[temp8].CO = (operandBit(&instr->operands[1]) == 0 ? 0 : 1);
     }
 
-    if (instr.operands[2].registertype == K) {
-      counters[temp8].PV = operandValueToInt16(&instr.operands[2], buffer, data);
-    } else if (instr.operands[2].registertype == M) {
-      counters[temp8].PV =
-          getWordFromAddress(data->Memories, instr.operands[2].address);
+    if (instr->operands[2].registertype == K) {
+      data->counters[temp8].PV = operandValueToInt16(&instr->operands[2]);
+    } else if (instr->operands[2].registertype == M) {
+      data->counters[temp8].PV =
+          getWordFromAddress(data->Memories, instr->operands[2].address);
     }
 
-    if (instr.operands[3].registertype == I) {
-      counters[temp8].R_LD =
-          (getBitFormAddress(data->Inputs, instr.operands[3].address,
-                             instr.operands[3].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[3].registertype == M) {
-      counters[temp8].R_LD =
-          (getBitFormAddress(data->Memories, instr.operands[3].address,
-                             instr.operands[3].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[3].registertype == Q) {
-      counters[temp8].R_LD =
-          (getBitFormAddress(data->Outputs, instr.operands[3].address,
-                             instr.operands[3].bitNumber) == 0
-               ? 0
-               : 1);
+    if (instr->operands[3].registertype != K) {
+      data->counters[temp8].R_LD = (operandBit(&instr->operands[3]) == 0 ? 0 : 1);
     }
 
 
-    runCounterDown(&counters[temp8]);
+    runCounterDown(&data->counters[temp8]);
 
-    if (instr.operands[4].registertype == Q) {
-      setBitInAddress(data->Outputs, instr.operands[4].address,
-                      instr.operands[4].bitNumber, counters[temp8].QO);
-    } else if (instr.operands[4].registertype == M) {
-      setBitInAddress(data->Memories, instr.operands[4].address,
-                      instr.operands[4].bitNumber, counters[temp8].QO);
+    if (isWritable(&instr->operands[4])) {
+      setOperandBit(&instr->operands[4], data->counters[temp8].QO);
     }
 
-      setWordInAddress(data->Memories, instr.operands[5].address, counters[temp8].CV);
+      setWordInAddress(data->Memories, instr->operands[5].address, data->counters[temp8].CV);
 
     break;
   case InstRTRIGGER://R_TRIGGER (ntrigger,IN, QO)
-    temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-    if (instr.operands[1].registertype == I) {
-      triggers[temp8].CLK =
-          (getBitFormAddress(data->Inputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == M) {
-      triggers[temp8].CLK =
-          (getBitFormAddress(data->Memories, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
-    } else if (instr.operands[1].registertype == Q) {
-      triggers[temp8].CLK =
-          (getBitFormAddress(data->Outputs, instr.operands[1].address,
-                             instr.operands[1].bitNumber) == 0
-               ? 0
-               : 1);
+    temp8 = operandValueToInt8(&instr->operands[0]);
+    if (instr->operands[1].registertype != K) {
+      data->triggers[temp8].CLK = (operandBit(&instr->operands[1]) == 0 ? 0 : 1);
     }
-    runRTrigger(&triggers[temp8]);
-
-    if (instr.operands[2].registertype == Q) {
-      setBitInAddress(data->Outputs, instr.operands[2].address,
-                      instr.operands[2].bitNumber, triggers[temp8].QO);
-    } else if (instr.operands[2].registertype == M) {
-      setBitInAddress(data->Memories, instr.operands[2].address,
-                      instr.operands[2].bitNumber, triggers[temp8].QO);
+    runRTrigger(&data->triggers[temp8]);
+
+    if (isWritable(&instr->operands[2])) {
+      setOperandBit(&instr->operands[2], data->triggers[temp8].QO);
     }
     break;
 
     case InstFTRIGGER://R_TRIGGER (ntrigger,IN, QO)
-      temp8 = operandValueToInt8(&instr.operands[0], buffer, data);
-      if (instr.operands[1].registertype == I) {
-        triggers[temp8].CLK =
-            (getBitFormAddress(data->Inputs, instr.operands[1].address,
-                               instr.operands[1].bitNumber) == 0
-                 ? 0
-                 : 1);
-      } else if (instr.operands[1].registertype == M) {
-        triggers[temp8].CLK =
-            (getBitFormAddress(data->Memories, instr.operands[1].address,
-                               instr.operands[1].bitNumber) == 0
-                 ? 0
-                 : 1);
-      } else if (instr.operands[1].registertype == Q) {
-        triggers[temp8].CLK =
-            (getBitFormAddress(data->Outputs, instr.operands[1].address,
-                               instr.operands[1].bitNumber) == 0
-                 ? 0
-                 : 1);
-      }
-      runFTrigger(&triggers[temp8]);
-      if (instr.operands[2].registertype == Q) {
-        setBitInAddress(data->Outputs, instr.operands[2].address,
-                        instr.operands[2].bitNumber, triggers[temp8].QO);
-      } else if (instr.operands[2].registertype == M) {
-        setBitInAddress(data->Memories, instr.operands[2].address,
-                        instr.operands[2].bitNumber, triggers[temp8].QO);
+      temp8 = operandValueToInt8(&instr->operands[0]);
+      if (instr->operands[1].registertype != K) {
+        data->triggers[temp8].CLK = (operandBit(&instr->operands[1]) == 0 ? 0 : 1);
+      }
+      runFTrigger(&data->triggers[temp8]);
+      if (isWritable(&instr->operands[2])) {
+        setOperandBit(&instr->operands[2], data->triggers[temp8].QO);
       }
       break;
     // TODO:  CTU, CTD, TON, TOF etc
@@ -1750,26 +1382,176 @@ void executeInstruction(uint8_t *buffer, Instruction instr, Data *data) {
   }
 }
 
+/**
+ * Gets the arena size needed by allocateMemory for a program.
+ *
+ * @param header The header of the program.
+ * @return The size in bytes.
+ */
+uint32_t getRequiredMemory(const ProgramHeader *header) {
+  return (uint32_t)header->inputSize + header->outputSize + header->memorySize +
+         CacheLineSize;
+}
+
+/**
+ * Allocates the process image with the sizes declared in the program header.
+ *
+ * @param data The data structure to allocate.
+ * @param header The header of the program.
+ * @param arena The arena to allocate from.
+ * @return The error code.
+ */
+uint8_t allocateMemory(Data *data, const ProgramHeader *header, Arena *arena) {
+  uint32_t imageSize = (uint32_t)header->inputSize + header->outputSize +
+                       header->memorySize;
+  uint8_t *image = (uint8_t *)arenaAlloc(arena, imageSize, CacheLineSize);
+  if (image == NULL) {
+    printf("Error allocating the process image\n");
+    return criticalError;
+  }
+  data->Inputs = image;
+  data->Outputs = data->Inputs + header->inputSize;
+  data->Memories = data->Outputs + header->outputSize;
+  data->inputSize = header->inputSize;
+  data->outputSize = header->outputSize;
+  data->memorySize = header->memorySize;
+  data->imageSize = imageSize;
+  data->accumulator = 0;
+  return noError;
+}
+
 /**
  * Initializes the memory.
  *
- * @param data The data structure containing the memory and register values.
+ * @param data The data structure containing the memory and register values,
+ * allocated with allocateMemory.
  */
 void initializeMemory(Data *data, Timer *atimers, Counter *acounters, Trigger *atriggers, Stack *astack) {
-  for (uint16_t i = 0; i < MemorySize; i++) {
-    data->Memories[i] = 0;
-  }
-  for (uint16_t i = 0; i < InputSize; i++) {
-    data->Inputs[i] = 0;
+  memset(getProcessImage(data), 0, data->imageSize);
+  data->elapsedTicks = 0;
+  attachResources(data, atimers, acounters, atriggers, astack);
+}
+
+/**
+ * Selects the timers, counters, triggers and stack used by the instructions.
+ *
+ * @param data The data structure containing the memory and register values.
+ * @param atimers The timers.
+ * @param acounters The counters.
+ * @param atriggers The triggers.
+ * @param astack The stack.
+ */
+void attachResources(Data *data, Timer *atimers, Counter *acounters, Trigger *atriggers, Stack *astack) {
+  data->timers = atimers;
+  data->counters = acounters;
+  data->triggers = atriggers;
+  data->stack = astack;
+}
+
+/**
+ * Advances the time base of the timers.
+ *
+ * @param data The data structure containing the memory and register values.
+ * @param nticks The number of ticks elapsed.
+ */
+void updateTicks(Data *data, uint32_t nticks) {
+  data->elapsedTicks += nticks;
+}
+
+/**
+ * Gets the process image: inputs, outputs and memories in one contiguous
+ * buffer of data->imageSize bytes.
+ *
+ * @param data The data structure containing the memory and register values.
+ * @return The process image.
+ */
+uint8_t *getProcessImage(Data *data) {
+  return data->Inputs;
+}
+
+/**
+ * Copies the process image to a snapshot buffer of data->imageSize bytes.
+ *
+ * @param data The data structure containing the memory and register values.
+ * @param snapshot The buffer to copy the process image to.
+ */
+void snapshotProcessImage(Data *data, uint8_t *snapshot) {
+  memcpy(snapshot, getProcessImage(data), data->imageSize);
+}
+
+/**
+ * Restores the process image from a snapshot buffer.
+ *
+ * @param data The data structure containing the memory and register values.
+ * @param snapshot The buffer to copy the process image from.
+ */
+void restoreProcessImage(Data *data, const uint8_t *snapshot) {
+  memcpy(getProcessImage(data), snapshot, data->imageSize);
+}
+
+/**
+ * Compares the process image with a snapshot.
+ *
+ * @param data The data structure containing the memory and register values.
+ * @param snapshot The snapshot to compare with.
+ * @return The offset of the first different byte, or -1 if they are equal.
+ */
+int32_t diffProcessImage(Data *data, const uint8_t *snapshot) {
+  uint8_t *image = getProcessImage(data);
+  if (memcmp(image, snapshot, data->imageSize) == 0) {
+    return -1;
   }
-  for (uint16_t i = 0; i < OutputSize; i++) {
-    data->Outputs[i] = 0;
+  for (uint32_t i = 0; i < data->imageSize; i++) {
+    if (image[i] != snapshot[i]) {
+      return (int32_t)i;
+    }
   }
+  return -1;
+}
 
-  timers = atimers;
-  counters = acounters;
-  triggers = atriggers;
-  stack = astack;
+/**
+ * Verifies that the constant timer, counter and trigger numbers of a decoded
+ * program are within the available resources.
+ *
+ * @param program The decoded program.
+ * @param numTimers The number of timers available.
+ * @param numCounters The number of counters available.
+ * @param numTriggers The number of triggers available.
+ * @return The error code.
+ */
+uint8_t checkResources(Program *program, uint8_t numTimers, uint8_t numCounters,
+                       uint8_t numTriggers) {
+  for (uint32_t i = 0; i < program->numInstructions; i++) {
+    const Instruction *instr = &program->instructions[i];
+    uint8_t available;
+    switch (instr->opcode) {
+    case InstTON:
+    case InstTOF:
+    case InstTP:
+      available = numTimers;
+      break;
+    case InstCTU:
+    case InstCTD:
+      available = numCounters;
+      break;
+    case InstRTRIGGER:
+    case InstFTRIGGER:
+      available = numTriggers;
+      break;
+    default:
+      continue;
+    }
+    // Numbers read from a register are only known at run time
+    if (instr->operands[0].registertype != K) {
+      continue;
+    }
+    uint8_t number = (uint8_t)operandValueToInt8(&instr->operands[0]);
+    if (number >= available) {
+      printf("Error: Resource %d not available in instruction %d\n", number, i);
+      return criticalError;
+    }
+  }
+  return noError;
 }
 
 /**
@@ -1778,10 +1560,157 @@ void initializeMemory(Data *data, Timer *atimers, Counter *acounters, Trigger *a
  * @param buffer The buffer containing the program.
  * @return The size of the program.
  */
-uint16_t getProgramSize(uint8_t *buffer) {
-  DataUnion u;
-  u.u8 = buffer;
-  return (u.u16[0]);
+uint32_t getProgramSize(uint8_t *buffer) {
+  ProgramHeader header;
+  if (readProgramHeader(buffer, &header) != 0) {
+    return 0;
+  }
+  return header.programSize;
+}
+
+/**
+ * Sets where the K constants of a program are read: the constant pool from
+ * version 1 on, in place when it is aligned in the buffer, otherwise from
+ * an aligned copy; the program buffer before.
+ *
+ * @param buffer The buffer containing the program, its sections checked.
+ * @param program The program, its header read.
+ * @return The error code.
+ */
+static uint8_t setProgramConstants(uint8_t *buffer, Program *program) {
+  SectionEntry pool;
+  if (!hasConstantPool(&program->header)) {
+    // The constants are inline in the instructions
+    program->constants = buffer;
+    program->constantsSize = program->header.codeEnd;
+    return noError;
+  }
+  findConstantPool(buffer, &program->header, &pool);
+  program->constants = buffer + pool.offset;
+  program->constantsSize = pool.size;
+  if (((uintptr_t)program->constants & (ConstantPoolAlign - 1)) == 0) {
+    return noError;
+  }
+  // malloc aligns on 8 bytes at least
+  program->constantsCopy = (uint8_t *)malloc(pool.size > 0 ? pool.size : 1);
+  if (program->constantsCopy == NULL) {
+    printf("Error allocating memory for the constant pool\n");
+    return criticalError;
+  }
+  memcpy(program->constantsCopy, program->constants, pool.size);
+  program->constants = program->constantsCopy;
+  return noError;
+}
+
+/**
+ * Decodes the whole program into an array of instructions.
+ *
+ * The operand bytes and the position of the K constants are parsed only
+ * once, when the program is loaded. The scan loop then iterates directly
+ * over program->instructions.
+ *
+ * @param buffer The buffer containing the program.
+ * @param program The program structure to store the decoded instructions in.
+ * @return The error code.
+ */
+uint8_t decodeProgram(uint8_t *buffer, Program *program) {
+  uint32_t codeEnd;
+  uint32_t pos;
+  uint32_t count = 0;
+  uint8_t constantPool;
+  Instruction instr;
+
+  program->buffer = buffer;
+  program->constants = NULL;
+  program->constantsSize = 0;
+  program->constantsCopy = NULL;
+  program->instructions = NULL;
+  program->numInstructions = 0;
+  program->groups = NULL;
+  program->chains = NULL;
+  program->numGroups = 0;
+  program->numChains = 0;
+
+  if (readProgramHeader(buffer, &program->header) != 0) {
+    printf("Error: Invalid program header\n");
+    return criticalError;
+  }
+  if (checkProgramSections(buffer, &program->header) != 0) {
+    printf("Error: Invalid section table\n");
+    return criticalError;
+  }
+  // The section table follows the instructions from version 1 on
+  codeEnd = program->header.codeEnd;
+  pos = program->header.headerSize;
+  constantPool = hasConstantPool(&program->header);
+  if (setProgramConstants(buffer, program) != noError) {
+    return criticalError;
+  }
+
+  // First pass: validate the opcodes and the constants and count the
+  // instructions
+  while (pos < codeEnd) {
+    if (buffer[pos] >= NumInstructions) {
+      printf("Error: Invalid opcode %d at position %d\n", buffer[pos], pos);
+      freeProgram(program);
+      return criticalError;
+    }
+    uint32_t start = pos;
+    readInstruction(buffer, &pos, &instr, constantPool);
+    for (uint8_t i = 0; constantPool && i < instr.num_operands; i++) {
+      const Operand *oper = &instr.operands[i];
+      if (oper->registertype == K &&
+          oper->address + getMemoryTypeSize(oper->memorytype) >
+              program->constantsSize) {
+        printf("Error: Constant out of the constant pool at position %d\n",
+               start);
+        freeProgram(program);
+        return criticalError;
+      }
+    }
+    count++;
+  }
+  if (pos != codeEnd) {
+    printf("Error: Truncated instruction at the end of the program\n");
+    freeProgram(program);
+    return criticalError;
+  }
+
+  program->instructions = (Instruction *)malloc(count * sizeof(Instruction));
+  if (program->instructions == NULL && count > 0) {
+    printf("Error allocating memory for the decoded program\n");
+    freeProgram(program);
+    return criticalError;
+  }
+
+  // Second pass: decode the instructions
+  pos = program->header.headerSize;
+  for (uint32_t i = 0; i < count; i++) {
+    program->instructions[i].address = pos;
+    readInstruction(buffer, &pos, &program->instructions[i], constantPool);
+  }
+  program->numInstructions = count;
+  return noError;
+}
+
+/**
+ * Releases the instructions, fused chains and constants of a decoded
+ * program.
+ *
+ * @param program The decoded program.
+ */
+void freeProgram(Program *program) {
+  free(program->instructions);
+  free(program->groups);
+  free(program->chains);
+  free(program->constantsCopy);
+  program->instructions = NULL;
+  program->numInstructions = 0;
+  program->groups = NULL;
+  program->chains = NULL;
+  program->numGroups = 0;
+  program->numChains = 0;
+  program->constantsCopy = NULL;
 }
 
 /**
@@ -1791,14 +1720,12 @@ uint16_t getProgramSize(uint8_t *buffer) {
  * @return The error code.
  */
 uint8_t verifyProgramIntegrity(uint8_t *buffer) {
-  uint32_t calculatedSize = 0;
-  uint32_t spectedSize;
-  uint16_t programSize = getProgramSize(buffer);
-  for (uint16_t i = 0; i < programSize; i++) {
-    calculatedSize += buffer[i];
+  ProgramHeader header;
+  if (readProgramHeader(buffer, &header) != 0) {
+    return criticalError;
   }
-  spectedSize = getDoubleWordFromAddress(buffer,programSize);
-  if(calculatedSize == spectedSize)
+  // Byte sum in version 0, CRC32C from version 1 on
+  if (computeProgramCheck(buffer, &header) == readProgramCheck(buffer, &header))
     return noError;
   else
     return criticalError;
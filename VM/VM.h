@@ -10,6 +10,7 @@
 #include "stack.h"
 #include "timer.h"
 #include "counter.h"
+#include "arena.h"
 
 // Instructions
 #define InstLD 0
@@ -52,6 +53,8 @@
 #define InstRTRIGGER 37 
 #define InstFTRIGGER 38 
 
+#define NumInstructions 39
+
 // Number of operands
 #define NumOpLD 1
 #define NumOpLDN 1
@@ -89,7 +92,7 @@
 #define NumOpTON 6
 #define NumOpTOF 6
 #define NumOpq 0
-#define NumOpTP 5 
+#define NumOpTP 6 
 #define NumOpRTRIGGER 3 
 #define NumOpFTRIGGER 3
 
@@ -116,27 +119,79 @@
 #define MaxOpers 6
 
 // Data structure
+// Holds the whole state of one VM instance, there is no global state, so
+// several instances can run in the same process (one per thread).
+// Inputs, outputs and memories are stored contiguously in this order in the
+// process image, so it can be copied or compared with a single memcpy. The
+// sizes come from the program header, see allocateMemory.
 typedef struct stData {
   // Memory variables
-  uint8_t Memories[MemorySize]; // Memories in bytes
-  uint8_t Inputs[InputSize];    // Inputs in bytes
-  uint8_t Outputs[OutputSize];  // Outputs in bytes
+  uint8_t *Inputs;     // Inputs in bytes (start of the process image)
+  uint8_t *Outputs;    // Outputs in bytes
+  uint8_t *Memories;   // Memories in bytes
+  uint16_t inputSize;  // Size of the inputs in bytes
+  uint16_t outputSize; // Size of the outputs in bytes
+  uint16_t memorySize; // Size of the memories in bytes
+  uint32_t imageSize;  // Size of the process image in bytes
   uint8_t accumulator;
+  // Resources, see initializeMemory
+  Timer *timers;
+  Counter *counters;
+  Trigger *triggers;
+  Stack *stack;
+  volatile uint32_t elapsedTicks; // Time base of the timers, see updateTicks
 } Data;
 
 typedef struct stOperand {
   uint8_t memorytype;
   uint8_t registertype;
   uint8_t bitNumber;
-  uint16_t address; // Or constant value if type is K
+  uint32_t address; // Or position of the constant in Program.constants if K
+  uint8_t *base;    // Buffer of the register, set by resolveOperands
 } Operand;
 
 typedef struct stInstruction {
   uint8_t opcode;
   uint8_t num_operands;
+  uint8_t handler; // Specialized handler selected by prepareDispatch
+  uint32_t chain;   // Fused chain starting here, if handler is hFused
+  uint32_t address; // Position in the program buffer, set by decodeProgram
   Operand operands[MaxOpers];
 } Instruction;
 
+// Bits of a boolean chain tested at once in a 64-bit window of the process
+// image, see prepareDispatch
+typedef struct stBitGroup {
+  const uint8_t *window; // First byte of the 8-byte window
+  uint64_t mask;         // Bits of the group in the window
+  uint64_t invert;       // Negated bits (LDN, ANDN, ORN, XORN)
+  uint8_t op;            // InstLD, InstAND, InstOR or InstXOR
+} BitGroup;
+
+// Straight-line LD/AND/OR/XOR sequence replaced by its bit groups
+typedef struct stBitChain {
+  uint32_t firstGroup; // First group in Program.groups
+  uint32_t numGroups;
+  uint32_t length; // Number of instructions of the sequence
+} BitChain;
+
+// Program decoded once at load time, so the scan loop does not parse the
+// operand bytes again on every cycle
+typedef struct stProgram {
+  uint8_t *buffer;           // Program as read from program.bin
+  ProgramHeader header;      // Header of the program
+  uint8_t *constants;        // K constants: the constant pool, or the buffer
+                             // when the constants are inline (version 0)
+  uint32_t constantsSize;
+  uint8_t *constantsCopy;    // Aligned copy of the pool, NULL if read in place
+  Instruction *instructions; // Pre-decoded instructions in execution order
+  uint32_t numInstructions;
+  BitGroup *groups; // Bit groups of the fused chains
+  BitChain *chains; // Fused chains, see prepareDispatch
+  uint32_t numGroups;
+  uint32_t numChains;
+} Program;
+
 // Union to convert data types: uint8, uint16, uint32, uint64, int8, int16, int32, int64
 typedef union {
   uint8_t *u8;
@@ -152,18 +207,35 @@ typedef union {
 
 // Function prototypes
 uint8_t getNumOp(uint8_t inst);
+const char *getOpcodeName(uint8_t inst);
+uint32_t getRequiredMemory(const ProgramHeader *header);
+uint8_t allocateMemory(Data *data, const ProgramHeader *header, Arena *arena);
 void initializeMemory(Data *data, Timer *atimers, Counter *acounters, Trigger *atriggers, Stack *astack);
-void executeInstruction(uint8_t *buffer, Instruction instr, Data *data);
-Instruction readInstruction(uint8_t *buffer, uint16_t *position);
-uint16_t getProgramSize(uint8_t *buffer);
+void attachResources(Data *data, Timer *atimers, Counter *acounters, Trigger *atriggers, Stack *astack);
+void updateTicks(Data *data, uint32_t nticks);
+void executeInstruction(const Instruction *instr, Data *data);
+void readInstruction(uint8_t *buffer, uint32_t *position, Instruction *instr,
+                     uint8_t constantPool);
+uint32_t getProgramSize(uint8_t *buffer);
+uint8_t decodeProgram(uint8_t *buffer, Program *program);
+void freeProgram(Program *program);
 uint8_t verifyProgramIntegrity(uint8_t *buffer);
-int8_t operandValueToInt8(Operand *oper, uint8_t *program, Data *data);
-int16_t operandValueToInt16(Operand *oper, uint8_t *program, Data *data);
-void setWordInAddress(uint8_t *memory, uint16_t address, int16_t value);
-void setDoubleWordInAddress(uint8_t *memory, uint16_t address, uint32_t value);
-void setLongWordInAddress(uint8_t *memory, uint16_t address, uint64_t value);
-int16_t getWordFromAddress(uint8_t *memory, uint16_t address);
-int32_t getDoubleWordFromAddress(uint8_t *memory, uint16_t address);
-int64_t getLongWordFromAddress(uint8_t *memory, uint16_t address);
-float getFloatFromAddress(uint8_t *memory, uint16_t address);
+uint8_t *getProcessImage(Data *data);
+void snapshotProcessImage(Data *data, uint8_t *snapshot);
+void restoreProcessImage(Data *data, const uint8_t *snapshot);
+int32_t diffProcessImage(Data *data, const uint8_t *snapshot);
+void resolveInstruction(Instruction *instr, uint8_t *constants, Data *data);
+uint8_t resolveOperands(Program *program, Data *data);
+uint8_t getMemoryTypeSize(uint8_t memorytype);
+uint8_t checkResources(Program *program, uint8_t numTimers, uint8_t numCounters,
+                       uint8_t numTriggers);
+int8_t operandValueToInt8(const Operand *oper);
+int16_t operandValueToInt16(const Operand *oper);
+void setWordInAddress(uint8_t *memory, uint32_t address, int16_t value);
+void setDoubleWordInAddress(uint8_t *memory, uint32_t address, uint32_t value);
+void setLongWordInAddress(uint8_t *memory, uint32_t address, uint64_t value);
+int16_t getWordFromAddress(uint8_t *memory, uint32_t address);
+int32_t getDoubleWordFromAddress(uint8_t *memory, uint32_t address);
+int64_t getLongWordFromAddress(uint8_t *memory, uint32_t address);
+float getFloatFromAddress(uint8_t *memory, uint32_t address);
 #endif
\ No newline at end of file
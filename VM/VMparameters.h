@@ -1,15 +1,19 @@
 #ifndef VMPARAMETERS_H_INCLUDED
 #define VMPARAMETERS_H_INCLUDED
 
-// Memory definition
-#define MemorySize 10 // Size of the memory in bytes
-// Input definition
-#define InputSize 10 // Number of inputs in bytes
-// Output definition
-#define OutputSize 10 // Number of outputs in bytes
-// Stack definition
+// Memory, input and output sizes are read from the program header, the
+// defaults for programs without header are defined in programFormat.h
+#include "programFormat.h"
+
+// Default number of resources, the fixed-size build (fixedVM.h) takes them as
+// template parameters
 #define STACK_MAX_SIZE 10 // Maximum stack size
-// Timers definition
-#define MAX_TEMPS 10 // Maximum timers available
+#define MAX_TIMERS 10     // Maximum timers available
+#define MAX_COUNTERS 10   // Maximum counters available
+#define MAX_TRIGGERS 10   // Maximum triggers available
+// Time base of the timers
+#define TickPeriodNs 1000000 // Duration of a tick in nanoseconds (1 ms)
+// Alignment of the process image
+#define CacheLineSize 64 // Size of a cache line in bytes
 
 #endif // VMPARAMETERS_H_INCLUDED
\ No newline at end of file
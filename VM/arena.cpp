@@ -0,0 +1,44 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+// Error codes
+#define noError 0 // No error
+#define warning 1 // Warning, the execution continues
+#define criticalError 2 // Critical error, the execution stops
+
+// Initialize the arena with a block of size bytes
+uint8_t initArena(Arena *arena, uint32_t size) {
+  arena->block = (uint8_t *)malloc(size);
+  arena->size = size;
+  arena->used = 0;
+  if (arena->block == NULL) {
+    printf("Error: allocating %lu bytes for the arena\n", (unsigned long)size);
+    arena->size = 0;
+    return criticalError;
+  }
+  return noError;
+}
+
+// Allocate size bytes aligned to alignment (power of 2), NULL if full
+void *arenaAlloc(Arena *arena, uint32_t size, uint32_t alignment) {
+  uintptr_t address = (uintptr_t)(arena->block + arena->used);
+  uintptr_t aligned = (address + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  uint32_t start = arena->used + (uint32_t)(aligned - address);
+  if (start > arena->size || size > arena->size - start) {
+    printf("Error: arena full\n");
+    return NULL;
+  }
+  arena->used = start + size;
+  return arena->block + start;
+}
+
+// Release all the allocations, keeping the block
+void resetArena(Arena *arena) { arena->used = 0; }
+
+// Release the block
+void freeArena(Arena *arena) {
+  free(arena->block);
+  arena->block = NULL;
+  arena->size = 0;
+  arena->used = 0;
+}
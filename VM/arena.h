@@ -0,0 +1,22 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+
+/*
+Arena allocator: one block allocated when the program is loaded, from
+which the VM takes its memory with a simple bump pointer. Everything is
+released at once with freeArena.
+*/
+typedef struct {
+  uint8_t *block; // Allocated block
+  uint32_t size;  // Size of the block in bytes
+  uint32_t used;  // Bytes in use
+} Arena;
+
+uint8_t initArena(Arena *arena, uint32_t size);
+void *arenaAlloc(Arena *arena, uint32_t size, uint32_t alignment);
+void resetArena(Arena *arena);
+void freeArena(Arena *arena);
+
+#endif // ARENA_H
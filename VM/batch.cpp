@@ -0,0 +1,341 @@
+#include "batch.h"
+#include "dispatch.h"
+
+/*
+  Lane vectors: the same byte of LaneVectorSize lanes
+*/
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+typedef __m256i LaneVector;
+#define LaneVectorSize 32
+#define laneLoad(p) _mm256_loadu_si256((const __m256i *)(p))
+#define laneStore(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define laneSet(x) _mm256_set1_epi8((char)(x))
+#define laneAnd(a, b) _mm256_and_si256(a, b)
+#define laneAndNot(a, b) _mm256_andnot_si256(a, b) // ~a & b
+#define laneOr(a, b) _mm256_or_si256(a, b)
+#define laneXor(a, b) _mm256_xor_si256(a, b)
+#define laneEq(a, b) _mm256_cmpeq_epi8(a, b)
+// Only bit 0 of each byte is used after the shift, so 16-bit shifts are fine
+#define laneShiftRight(v, n) _mm256_srl_epi16(v, _mm_cvtsi32_si128(n))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128i LaneVector;
+#define LaneVectorSize 16
+#define laneLoad(p) _mm_loadu_si128((const __m128i *)(p))
+#define laneStore(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define laneSet(x) _mm_set1_epi8((char)(x))
+#define laneAnd(a, b) _mm_and_si128(a, b)
+#define laneAndNot(a, b) _mm_andnot_si128(a, b) // ~a & b
+#define laneOr(a, b) _mm_or_si128(a, b)
+#define laneXor(a, b) _mm_xor_si128(a, b)
+#define laneEq(a, b) _mm_cmpeq_epi8(a, b)
+// Only bit 0 of each byte is used after the shift, so 16-bit shifts are fine
+#define laneShiftRight(v, n) _mm_srl_epi16(v, _mm_cvtsi32_si128(n))
+#else
+typedef uint8_t LaneVector;
+#define LaneVectorSize 1
+#define laneLoad(p) (*(p))
+#define laneStore(p, v) (*(p) = (v))
+#define laneSet(x) ((uint8_t)(x))
+#define laneAnd(a, b) ((uint8_t)((a) & (b)))
+#define laneAndNot(a, b) ((uint8_t)(~(a) & (b)))
+#define laneOr(a, b) ((uint8_t)((a) | (b)))
+#define laneXor(a, b) ((uint8_t)((a) ^ (b)))
+#define laneEq(a, b) ((uint8_t)((a) == (b) ? 0xFF : 0x00))
+#define laneShiftRight(v, n) ((uint8_t)((v) >> (n)))
+#endif
+
+static_assert(BatchLaneAlign % LaneVectorSize == 0,
+              "The lanes must fill whole lane vectors");
+
+// Runs statement on every lane vector, with acc, bit and byte loaded
+#define FOR_LANES(statement)                                                   \
+  for (uint16_t l = 0; l < numLanes; l += LaneVectorSize) {                    \
+    LaneVector acc = laneLoad(accumulator + l);                                \
+    LaneVector byte = laneLoad(row + l);                                       \
+    LaneVector bit = laneAnd(laneShiftRight(byte, bitNumber), one);            \
+    (void)acc, (void)byte, (void)bit;                                          \
+    statement;                                                                 \
+  }
+
+/**
+ * Runs a bit logic instruction on all the lanes.
+ *
+ * @param handler The specialized handler of the instruction.
+ * @param row The operand byte of all the lanes.
+ * @param bitNumber The operand bit.
+ * @param accumulator The accumulators of the lanes.
+ * @param numLanes The number of lanes.
+ */
+static void runKernel(uint8_t handler, uint8_t *row, uint8_t bitNumber,
+                      uint8_t *accumulator, uint16_t numLanes) {
+  const LaneVector one = laneSet(1);
+  const LaneVector zero = laneSet(0);
+  const LaneVector mask = laneSet(1 << bitNumber);
+  (void)zero;
+  (void)mask;
+  if (handler >= hLD_I && handler <= hXORN_M) {
+    // Loads are ordered LD, LDN, AND, ANDN, OR, ORN, XOR, XORN
+    switch ((handler - hLD_I) / 3) {
+    case 0: FOR_LANES(laneStore(accumulator + l, bit)) break;
+    case 1: FOR_LANES(laneStore(accumulator + l, laneXor(bit, one))) break;
+    case 2: FOR_LANES(laneStore(accumulator + l, laneAnd(acc, bit))) break;
+    case 3:
+      FOR_LANES(laneStore(accumulator + l, laneAnd(acc, laneXor(bit, one))))
+      break;
+    case 4: FOR_LANES(laneStore(accumulator + l, laneOr(acc, bit))) break;
+    case 5:
+      FOR_LANES(laneStore(accumulator + l, laneOr(acc, laneXor(bit, one))))
+      break;
+    case 6: FOR_LANES(laneStore(accumulator + l, laneXor(acc, bit))) break;
+    default:
+      FOR_LANES(laneStore(accumulator + l, laneXor(acc, laneXor(bit, one))))
+      break;
+    }
+    return;
+  }
+  if (handler >= hST_Q && handler <= hR_M) {
+    // Stores are ordered ST, STN, S, R
+    switch ((handler - hST_Q) / 2) {
+    case 0:
+      FOR_LANES(laneStore(row + l,
+                          laneOr(laneAndNot(mask, byte),
+                                 laneAndNot(laneEq(acc, zero), mask))))
+      break;
+    case 1:
+      FOR_LANES(laneStore(row + l, laneOr(laneAndNot(mask, byte),
+                                          laneAnd(laneEq(acc, zero), mask))))
+      break;
+    case 2:
+      FOR_LANES(laneStore(row + l,
+                          laneOr(byte, laneAnd(laneEq(acc, one), mask))))
+      break;
+    default:
+      FOR_LANES(laneStore(row + l,
+                          laneAndNot(laneAnd(laneEq(acc, one), mask), byte)))
+      break;
+    }
+    return;
+  }
+  // NOT
+  FOR_LANES(laneStore(accumulator + l, laneAnd(laneEq(acc, zero), one)))
+}
+
+/**
+ * Gets the bytes of the process image used by an operand.
+ *
+ * @param batch The batch.
+ * @param oper The operand, resolved on the scratch image.
+ * @param offset The offset of the first byte in the process image.
+ * @return The number of bytes, 0 for constants.
+ */
+static uint8_t getOperandBytes(Batch *batch, const Operand *oper,
+                               uint32_t *offset) {
+  if (oper->registertype == K) {
+    return 0;
+  }
+  *offset = (uint32_t)(oper->base + oper->address -
+                       getProcessImage(&batch->scratch));
+  return getMemoryTypeSize(oper->memorytype);
+}
+
+/**
+ * Runs an instruction without kernel lane by lane through executeInstruction.
+ *
+ * @param batch The batch.
+ * @param instr The instruction, resolved on the scratch image.
+ */
+static void runGeneric(Batch *batch, const Instruction *instr) {
+  uint8_t *scratch = getProcessImage(&batch->scratch);
+  uint16_t numLanes = batch->numLanes;
+  for (uint16_t lane = 0; lane < numLanes; lane++) {
+    uint32_t offset;
+    uint8_t bytes;
+    for (uint8_t j = 0; j < instr->num_operands; j++) {
+      bytes = getOperandBytes(batch, &instr->operands[j], &offset);
+      for (uint8_t b = 0; b < bytes; b++) {
+        scratch[offset + b] = batch->image[(offset + b) * numLanes + lane];
+      }
+    }
+    batch->scratch.accumulator = batch->accumulator[lane];
+    attachResources(&batch->scratch, &batch->timers[lane * MAX_TIMERS],
+                    &batch->counters[lane * MAX_COUNTERS],
+                    &batch->triggers[lane * MAX_TRIGGERS],
+                    &batch->stacks[lane]);
+    executeInstruction(instr, &batch->scratch);
+    batch->accumulator[lane] = batch->scratch.accumulator;
+    for (uint8_t j = 0; j < instr->num_operands; j++) {
+      bytes = getOperandBytes(batch, &instr->operands[j], &offset);
+      for (uint8_t b = 0; b < bytes; b++) {
+        batch->image[(offset + b) * numLanes + lane] = scratch[offset + b];
+      }
+    }
+  }
+}
+
+/**
+ * Initializes a batch of lanes running a program.
+ *
+ * The program buffer must stay valid while the batch runs, the K constants
+ * are read from it.
+ *
+ * @param batch The batch to initialize.
+ * @param buffer The buffer containing the program.
+ * @param numLanes The number of lanes, rounded up to BatchLaneAlign.
+ * @return The error code.
+ */
+uint8_t initBatch(Batch *batch, uint8_t *buffer, uint16_t numLanes) {
+  ProgramHeader header;
+  memset(batch, 0, sizeof(*batch));
+  if (verifyProgramIntegrity(buffer) != noError ||
+      readProgramHeader(buffer, &header) != 0) {
+    printf("Error: Invalid program\n");
+    return criticalError;
+  }
+  if (numLanes == 0 || numLanes > 0xFFFF - BatchLaneAlign) {
+    printf("Error: Invalid number of lanes %d\n", numLanes);
+    return criticalError;
+  }
+  uint16_t n = (uint16_t)((numLanes + BatchLaneAlign - 1) / BatchLaneAlign *
+                          BatchLaneAlign);
+  if (decodeProgram(buffer, &batch->program) != noError) {
+    return criticalError;
+  }
+
+  uint32_t imageSize = (uint32_t)header.inputSize + header.outputSize +
+                       header.memorySize;
+  uint32_t laneSize = imageSize + 1 + MAX_TIMERS * sizeof(Timer) +
+                      MAX_COUNTERS * sizeof(Counter) +
+                      MAX_TRIGGERS * sizeof(Trigger) + sizeof(Stack) +
+                      STACK_MAX_SIZE * sizeof(StackElement);
+  // in 64 bits, the lanes of a large image can exceed the 32-bit arena;
+  // the sizes of the allocations below are all smaller than the total
+  uint64_t size = (uint64_t)getRequiredMemory(&header) +
+                  (uint64_t)n * laneSize + batch->program.numInstructions +
+                  8 * CacheLineSize;
+  if (size > UINT32_MAX) {
+    printf("Error: %u lanes of %u bytes do not fit in the arena\n", n,
+           laneSize);
+    freeProgram(&batch->program);
+    return criticalError;
+  }
+  if (initArena(&batch->arena, (uint32_t)size) != noError) {
+    freeProgram(&batch->program);
+    return criticalError;
+  }
+  Arena *arena = &batch->arena;
+  batch->numLanes = n;
+  batch->imageSize = imageSize;
+  batch->image = (uint8_t *)arenaAlloc(arena, imageSize * n, CacheLineSize);
+  batch->accumulator = (uint8_t *)arenaAlloc(arena, n, CacheLineSize);
+  batch->kernels = (uint8_t *)arenaAlloc(arena, batch->program.numInstructions,
+                                         1);
+  batch->timers = (Timer *)arenaAlloc(arena, n * MAX_TIMERS * sizeof(Timer),
+                                      alignof(Timer));
+  batch->counters = (Counter *)arenaAlloc(
+      arena, n * MAX_COUNTERS * sizeof(Counter), alignof(Counter));
+  batch->triggers = (Trigger *)arenaAlloc(
+      arena, n * MAX_TRIGGERS * sizeof(Trigger), alignof(Trigger));
+  batch->stacks = (Stack *)arenaAlloc(arena, n * sizeof(Stack), alignof(Stack));
+  StackElement *elements = (StackElement *)arenaAlloc(
+      arena, n * STACK_MAX_SIZE * sizeof(StackElement), alignof(StackElement));
+  if (batch->image == NULL || batch->accumulator == NULL ||
+      batch->kernels == NULL || batch->timers == NULL ||
+      batch->counters == NULL || batch->triggers == NULL ||
+      batch->stacks == NULL || elements == NULL ||
+      allocateMemory(&batch->scratch, &header, arena) != noError) {
+    freeBatch(batch);
+    return criticalError;
+  }
+
+  memset(batch->image, 0, imageSize * n);
+  for (uint16_t lane = 0; lane < n; lane++) {
+    initializeTimer(&batch->timers[lane * MAX_TIMERS], MAX_TIMERS);
+    initializeCounter(&batch->counters[lane * MAX_COUNTERS], MAX_COUNTERS);
+    initializeTrigger(&batch->triggers[lane * MAX_TRIGGERS], MAX_TRIGGERS);
+    initStack(&batch->stacks[lane], &elements[lane * STACK_MAX_SIZE],
+              STACK_MAX_SIZE);
+  }
+  initializeMemory(&batch->scratch, batch->timers, batch->counters,
+                   batch->triggers, batch->stacks);
+  if (resolveOperands(&batch->program, &batch->scratch) != noError ||
+      checkResources(&batch->program, MAX_TIMERS, MAX_COUNTERS,
+                     MAX_TRIGGERS) != noError) {
+    freeBatch(batch);
+    return criticalError;
+  }
+  for (uint32_t i = 0; i < batch->program.numInstructions; i++) {
+    batch->kernels[i] = selectHandler(&batch->program.instructions[i]);
+  }
+  return noError;
+}
+
+/**
+ * Sets the inputs of a lane.
+ *
+ * @param batch The batch.
+ * @param lane The lane.
+ * @param inputs The inputs, the input size of the program in bytes.
+ */
+void setLaneInputs(Batch *batch, uint16_t lane, const uint8_t *inputs) {
+  for (uint16_t b = 0; b < batch->scratch.inputSize; b++) {
+    batch->image[b * batch->numLanes + lane] = inputs[b];
+  }
+}
+
+/**
+ * Copies the process image of a lane.
+ *
+ * @param batch The batch.
+ * @param lane The lane.
+ * @param image The buffer to copy the image to, imageSize bytes.
+ */
+void getLaneImage(Batch *batch, uint16_t lane, uint8_t *image) {
+  for (uint32_t b = 0; b < batch->imageSize; b++) {
+    image[b] = batch->image[b * batch->numLanes + lane];
+  }
+}
+
+/**
+ * Runs one scan of the program on all the lanes.
+ *
+ * @param batch The batch.
+ */
+void runBatch(Batch *batch) {
+  uint8_t *scratch = getProcessImage(&batch->scratch);
+  memset(batch->accumulator, 0, batch->numLanes);
+  for (uint32_t i = 0; i < batch->program.numInstructions; i++) {
+    const Instruction *instr = &batch->program.instructions[i];
+    uint8_t handler = batch->kernels[i];
+    if (handler == hGeneric) {
+      runGeneric(batch, instr);
+    } else {
+      // NOT has no operand, it runs on the first byte with no effect on it
+      const Operand *oper = &instr->operands[0];
+      uint32_t offset = 0;
+      uint8_t bitNumber = 0;
+      if (handler != hNOT) {
+        offset = (uint32_t)(oper->base + oper->address - scratch);
+        bitNumber = oper->bitNumber;
+      }
+      runKernel(handler, &batch->image[offset * batch->numLanes], bitNumber,
+                batch->accumulator, batch->numLanes);
+    }
+  }
+}
+
+/**
+ * Releases a batch.
+ *
+ * @param batch The batch.
+ */
+void freeBatch(Batch *batch) {
+  freeProgram(&batch->program);
+  freeArena(&batch->arena);
+  batch->image = NULL;
+  batch->accumulator = NULL;
+  batch->kernels = NULL;
+  batch->numLanes = 0;
+}
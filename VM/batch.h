@@ -0,0 +1,45 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "VM.h"
+
+/*
+Batch execution: one program scanned on many independent instances (lanes)
+in lockstep, e.g. to test a program against many input vectors.
+
+The process images of the lanes are stored structure-of-arrays: byte b of
+lane l is at image[b * numLanes + l], so the same byte of all the lanes is
+contiguous. The bit logic instructions (the specialized handlers of
+dispatch.h) run on all the lanes at once with SIMD kernels, 32 lanes per
+AVX2 operation or 16 per SSE2 operation. The other instructions run lane by
+lane through executeInstruction on a scratch image of one lane, so they keep
+exactly the semantics of the scalar VM.
+
+Each lane has its own accumulator, timers, counters, triggers and stack.
+*/
+
+#define BatchLaneAlign 32 // The number of lanes is rounded up to this
+
+typedef struct stBatch {
+  uint16_t numLanes;    // Number of lanes, multiple of BatchLaneAlign
+  uint32_t imageSize;   // Size of the process image of one lane
+  uint8_t *image;       // Process images of the lanes (structure-of-arrays)
+  uint8_t *accumulator; // Accumulator of each lane
+  uint8_t *kernels;     // Handler of each instruction, see dispatch.h
+  Program program;      // Program resolved on the scratch image
+  Data scratch;         // Image of one lane for the generic instructions
+  Timer *timers;        // MAX_TIMERS per lane
+  Counter *counters;    // MAX_COUNTERS per lane
+  Trigger *triggers;    // MAX_TRIGGERS per lane
+  Stack *stacks;        // One stack per lane
+  Arena arena;          // Memory of the batch
+} Batch;
+
+// Function prototypes
+uint8_t initBatch(Batch *batch, uint8_t *buffer, uint16_t numLanes);
+void setLaneInputs(Batch *batch, uint16_t lane, const uint8_t *inputs);
+void getLaneImage(Batch *batch, uint16_t lane, uint8_t *image);
+void runBatch(Batch *batch);
+void freeBatch(Batch *batch);
+
+#endif // BATCH_H
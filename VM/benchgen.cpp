@@ -0,0 +1,213 @@
+#include "benchgen.h"
+#include <stdarg.h>
+
+#define BenchInputBytes 16 // Inputs used by the programs
+#define BenchOutputBytes 16 // Outputs used by the programs
+#define BenchBitMemories 32 // Memory bytes used as bits
+#define BenchWordBase 64 // First memory word used by the arithmetic
+#define BenchWords 32 // Memory words used by the arithmetic
+#define BenchValueBase 128 // First memory word for the ET/CV values
+#define MaxNesting 3 // Nesting of the parenthesis, below STACK_MAX_SIZE
+
+typedef struct stGenerator {
+  char *out;
+  uint32_t size;
+  uint32_t length;
+  uint8_t overflow;
+  uint32_t seed;
+} Generator;
+
+static const char *mixNames[NumMixes] = {"boolean", "arithmetic",
+                                         "timer_counter", "parenthesis"};
+
+/**
+ * Gets the name of a mix.
+ *
+ * @param mix The mix.
+ * @return The name.
+ */
+const char *getMixName(uint8_t mix) {
+  return mix < NumMixes ? mixNames[mix] : "unknown";
+}
+
+static uint32_t nextRandom(Generator *gen, uint32_t range) {
+  gen->seed = gen->seed * 1664525u + 1013904223u;
+  return (gen->seed >> 16) % range;
+}
+
+static void emit(Generator *gen, const char *format, ...) {
+  va_list args;
+  if (gen->overflow) {
+    return;
+  }
+  va_start(args, format);
+  int n = vsnprintf(gen->out + gen->length, gen->size - gen->length, format,
+                    args);
+  va_end(args);
+  if (n < 0 || (uint32_t)n >= gen->size - gen->length) {
+    gen->overflow = 1;
+    return;
+  }
+  gen->length += (uint32_t)n;
+}
+
+// A bit of I, Q or M (readable)
+static void emitBit(Generator *gen) {
+  switch (nextRandom(gen, 3)) {
+  case 0:
+    emit(gen, " IX%u.%u", nextRandom(gen, BenchInputBytes), nextRandom(gen, 8));
+    break;
+  case 1:
+    emit(gen, " QX%u.%u", nextRandom(gen, BenchOutputBytes),
+         nextRandom(gen, 8));
+    break;
+  default:
+    emit(gen, " MX%u.%u", nextRandom(gen, BenchBitMemories),
+         nextRandom(gen, 8));
+    break;
+  }
+}
+
+// A bit of Q or M (writable)
+static void emitDestination(Generator *gen) {
+  if (nextRandom(gen, 2) == 0) {
+    emit(gen, " QX%u.%u", nextRandom(gen, BenchOutputBytes),
+         nextRandom(gen, 8));
+  } else {
+    emit(gen, " MX%u.%u", nextRandom(gen, BenchBitMemories),
+         nextRandom(gen, 8));
+  }
+}
+
+static void emitWord(Generator *gen) {
+  emit(gen, " MW%u", BenchWordBase + 2 * nextRandom(gen, BenchWords));
+}
+
+static void generateBoolean(Generator *gen) {
+  static const char *terms[] = {"AND", "ANDN", "OR", "ORN", "XOR", "XORN"};
+  static const char *stores[] = {"ST", "STN", "S", "R"};
+  emit(gen, nextRandom(gen, 4) == 0 ? "LDN" : "LD");
+  emitBit(gen);
+  emit(gen, "\n");
+  uint32_t n = 2 + nextRandom(gen, 4);
+  for (uint32_t i = 0; i < n; i++) {
+    emit(gen, "%s", terms[nextRandom(gen, 6)]);
+    emitBit(gen);
+    emit(gen, "\n");
+  }
+  emit(gen, "%s", stores[nextRandom(gen, 4)]);
+  emitDestination(gen);
+  emit(gen, "\n");
+}
+
+static void generateArithmetic(Generator *gen) {
+  static const char *operations[] = {"ADD", "SUB", "MUL", "DIV", "MOD"};
+  static const char *comparisons[] = {"GT", "GE", "EQ", "NE", "LT", "LE"};
+  uint32_t op = nextRandom(gen, 5);
+  emit(gen, "LD KX1\n%s", operations[op]);
+  emitWord(gen);
+  if (op >= 3) {
+    emit(gen, " KW%u", 1 + nextRandom(gen, 99)); // Nonzero divisor
+  } else if (nextRandom(gen, 2) == 0) {
+    emit(gen, " KW%u", nextRandom(gen, 1000));
+  } else {
+    emitWord(gen);
+  }
+  emitWord(gen);
+  emit(gen, "\nLD KX1\n%s", comparisons[nextRandom(gen, 6)]);
+  emitWord(gen);
+  emit(gen, " KW%u\nST", nextRandom(gen, 1000));
+  emitDestination(gen);
+  emit(gen, "\n");
+}
+
+static void generateTimerCounter(Generator *gen, uint32_t rung) {
+  static const char *blocks[] = {"TON", "TOF", "TP", "CTU",
+                                 "CTD", "RTRIGGER", "FTRIGGER"};
+  uint32_t block = rung % 7;
+  uint32_t number = (rung / 7) % 10; // Below MAX_TIMERS, MAX_COUNTERS...
+  uint32_t value = BenchValueBase + 2 * (rung % 32);
+  emit(gen, "LD KX1\n%s KB%u IX%u.%u", blocks[block], number,
+       nextRandom(gen, BenchInputBytes), nextRandom(gen, 8));
+  if (block <= 2) { // PT, prescaler, OUT, ET
+    emit(gen, " KW%u KB1", 1 + nextRandom(gen, 1000));
+    emitDestination(gen);
+    emit(gen, " MW%u\n", value);
+  } else if (block <= 4) { // PV, RST/LD, OUT, CV
+    emit(gen, " KW%u IX%u.%u", 1 + nextRandom(gen, 100),
+         nextRandom(gen, BenchInputBytes), nextRandom(gen, 8));
+    emitDestination(gen);
+    emit(gen, " MW%u\n", value);
+  } else { // OUT
+    emitDestination(gen);
+    emit(gen, "\n");
+  }
+}
+
+static void generateGroup(Generator *gen, uint8_t depth) {
+  static const char *opens[] = {"AND(", "ANDN(", "OR(", "ORN(", "XOR("};
+  static const char *terms[] = {"AND", "ANDN", "OR", "ORN"};
+  emit(gen, "%s", opens[nextRandom(gen, 5)]);
+  emitBit(gen);
+  emit(gen, "\n");
+  uint32_t n = 1 + nextRandom(gen, 2);
+  for (uint32_t i = 0; i < n; i++) {
+    if (depth < MaxNesting && nextRandom(gen, 3) == 0) {
+      generateGroup(gen, depth + 1);
+    } else {
+      emit(gen, "%s", terms[nextRandom(gen, 4)]);
+      emitBit(gen);
+      emit(gen, "\n");
+    }
+  }
+  emit(gen, ")\n");
+}
+
+static void generateParenthesis(Generator *gen) {
+  emit(gen, "LD");
+  emitBit(gen);
+  emit(gen, "\n");
+  uint32_t n = 1 + nextRandom(gen, 2);
+  for (uint32_t i = 0; i < n; i++) {
+    generateGroup(gen, 1);
+  }
+  emit(gen, "ST");
+  emitDestination(gen);
+  emit(gen, "\n");
+}
+
+/**
+ * Generates the IL source of a synthetic program.
+ *
+ * @param mix The mix of instructions (MixBoolean...).
+ * @param rungs The number of rungs.
+ * @param out The buffer for the source, null terminated.
+ * @param size The size of the buffer.
+ * @return The length of the source, or 0 when it does not fit the buffer.
+ */
+uint32_t generateProgram(uint8_t mix, uint32_t rungs, char *out,
+                         uint32_t size) {
+  Generator gen = {out, size, 0, 0, 12345u + mix};
+  if (size == 0 || mix >= NumMixes) {
+    return 0;
+  }
+  out[0] = '\0';
+  emit(&gen, "# Synthetic %s program, %u rungs\n", getMixName(mix), rungs);
+  for (uint32_t r = 0; r < rungs && !gen.overflow; r++) {
+    switch (mix) {
+    case MixBoolean:
+      generateBoolean(&gen);
+      break;
+    case MixArithmetic:
+      generateArithmetic(&gen);
+      break;
+    case MixTimerCounter:
+      generateTimerCounter(&gen, r);
+      break;
+    case MixParenthesis:
+      generateParenthesis(&gen);
+      break;
+    }
+  }
+  return gen.overflow ? 0 : gen.length;
+}
@@ -0,0 +1,33 @@
+#ifndef BENCHGEN_H
+#define BENCHGEN_H
+
+#include "VM.h"
+
+/*
+Synthetic IL programs for the benchmark suite.
+
+Each program is a sequence of rungs of one mix:
+MixBoolean -> LD/LDN, 2 to 5 AND/ANDN/OR/ORN/XOR/XORN terms and a
+              ST/STN/S/R, on I, Q and M bits
+MixArithmetic -> ADD/SUB/MUL/DIV/MOD on words and a comparison that sets
+                 an output bit
+MixTimerCounter -> TON/TOF/TP timers, CTU/CTD counters and R/F triggers
+MixParenthesis -> bit logic with AND(/ANDN(/OR(/ORN(/XOR( ... ) nested up
+                  to 3 levels
+
+The operands come from a fixed seed, the same size and mix always generate
+the same program.
+*/
+
+#define MixBoolean 0
+#define MixArithmetic 1
+#define MixTimerCounter 2
+#define MixParenthesis 3
+#define NumMixes 4
+
+// Function prototypes
+const char *getMixName(uint8_t mix);
+uint32_t generateProgram(uint8_t mix, uint32_t rungs, char *out,
+                         uint32_t size);
+
+#endif // BENCHGEN_H
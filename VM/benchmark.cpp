@@ -0,0 +1,598 @@
+#include "benchmark.h"
+#include "dispatch.h"
+#include "clock.h"
+#include "fixedVM.h"
+#include "batch.h"
+#include "benchgen.h"
+#include "programFile.h"
+
+/*
+  Benchmark of the execution paths of the VM
+*/
+
+#define ENGINE_DECODE 0   // readInstruction and resolve on every scan
+#define ENGINE_COPY 1     // copy of the decoded instruction (pass by value)
+#define ENGINE_POINTER 2  // pointer into the decoded instructions
+#define ENGINE_THREADED 3 // threaded dispatch, see dispatch.h
+#define ENGINE_FIXED 4    // threaded dispatch on the fixed-size VM
+#define NumEngines 5
+
+static const char *EngineNames[] = {"decode", "copy", "pointer", "threaded",
+                                    "fixed"};
+
+// VM with the default sizes fixed at build time, see fixedVM.h
+static FixedVM<DefaultConfig> fixedVM;
+
+/**
+ * Runs one scan of the program with an execution path.
+ *
+ * @param engine The execution path.
+ * @param program The decoded program.
+ * @param data The data structure containing the memory and register values.
+ */
+static void runScan(uint8_t engine, Program *program, Data *data) {
+  uint8_t *buffer = program->buffer;
+  data->accumulator = 0;
+  if (engine == ENGINE_DECODE) {
+    uint32_t programSize = program->header.codeEnd;
+    uint32_t pos = program->header.headerSize;
+    uint8_t constantPool = hasConstantPool(&program->header);
+    Instruction instr;
+    while (pos < programSize) {
+      readInstruction(buffer, &pos, &instr, constantPool);
+      resolveInstruction(&instr, program->constants, data);
+      executeInstruction(&instr, data);
+    }
+  } else if (engine == ENGINE_COPY) {
+    for (uint32_t i = 0; i < program->numInstructions; i++) {
+      Instruction instr = program->instructions[i];
+      executeInstruction(&instr, data);
+    }
+  } else if (engine == ENGINE_POINTER) {
+    for (uint32_t i = 0; i < program->numInstructions; i++) {
+      executeInstruction(&program->instructions[i], data);
+    }
+  } else if (engine == ENGINE_THREADED) {
+    runProgram(program, data);
+  } else if (engine == ENGINE_FIXED) {
+    scanFixedVM(&fixedVM, data->Inputs, data->Outputs);
+  }
+}
+
+/**
+ * Measures the cycles and time per instruction of each execution path.
+ *
+ * prepareDispatch must have been called on the program.
+ *
+ * @param program The decoded program.
+ * @param data The data structure containing the memory and register values.
+ * @param scans The number of scans to run with each execution path.
+ */
+void benchmarkEngines(Program *program, Data *data, uint32_t scans) {
+  uint64_t instructions = (uint64_t)scans * program->numInstructions;
+  if (instructions == 0) {
+    printf("Error: empty program\n");
+    return;
+  }
+  printf("Benchmark: %d instructions, %lu scans\n", program->numInstructions,
+         (unsigned long)scans);
+  printf("engine\t\tcycles/instr\tns/instr\n");
+  for (uint8_t engine = 0; engine < NumEngines; engine++) {
+    // The fixed-size VM takes over the timers, counters, triggers and stack
+    if (engine == ENGINE_FIXED &&
+        loadFixedVM(&fixedVM, program->buffer) != noError) {
+      printf("The program does not fit the fixed-size VM\n");
+      break;
+    }
+    // Warm up the caches and the branch predictors
+    for (uint32_t s = 0; s < scans / 10 + 1; s++) {
+      runScan(engine, program, data);
+    }
+    uint64_t startNs = getMonotonicNs();
+    uint64_t startCycles = readCycleCounter();
+    for (uint32_t s = 0; s < scans; s++) {
+      runScan(engine, program, data);
+    }
+    uint64_t cycles = readCycleCounter() - startCycles;
+    uint64_t ns = getMonotonicNs() - startNs;
+    printf("%-8s\t%.2f\t\t%.2f\n", EngineNames[engine],
+           (double)cycles / (double)instructions,
+           (double)ns / (double)instructions);
+    if (engine == ENGINE_FIXED) {
+      unloadFixedVM(&fixedVM);
+    }
+  }
+}
+
+/**
+ * Measures the time per instruction and lane of the batch execution.
+ *
+ * @param buffer The buffer containing the program.
+ * @param inputs The inputs of the first lane, the other lanes get variations.
+ * @param lanes The number of lanes.
+ * @param scans The number of scans to run.
+ */
+void benchmarkBatch(uint8_t *buffer, const uint8_t *inputs, uint16_t lanes,
+                    uint32_t scans) {
+  Batch batch;
+  if (initBatch(&batch, buffer, lanes) != noError) {
+    printf("Error initializing the batch\n");
+    return;
+  }
+  uint8_t *laneInputs = (uint8_t *)malloc(batch.scratch.inputSize);
+  if (laneInputs == NULL) {
+    freeBatch(&batch);
+    return;
+  }
+  for (uint16_t lane = 0; lane < batch.numLanes; lane++) {
+    for (uint16_t b = 0; b < batch.scratch.inputSize; b++) {
+      laneInputs[b] = (uint8_t)(inputs[b] ^ (lane * (b + 1)));
+    }
+    setLaneInputs(&batch, lane, laneInputs);
+  }
+  free(laneInputs);
+
+  uint64_t startNs = getMonotonicNs();
+  for (uint32_t s = 0; s < scans; s++) {
+    runBatch(&batch);
+  }
+  uint64_t ns = getMonotonicNs() - startNs;
+  double laneInstructions =
+      (double)scans * batch.numLanes * batch.program.numInstructions;
+  printf("batch\t\t%d lanes\t%.2f ns/instr/lane\t%.0f lane scans/s\n",
+         batch.numLanes, laneInstructions > 0 ? ns / laneInstructions : 0.0,
+         ns > 0 ? (double)scans * batch.numLanes * 1e9 / (double)ns : 0.0);
+  freeBatch(&batch);
+}
+
+/*
+  Benchmark suite: synthetic programs of each mix (see benchgen.h), compiled
+  with the VMcompiler and measured with the threaded dispatch and with
+  executeInstruction. The results are written as JSON to compare releases.
+*/
+
+#define SuiteFormat 1 // Version of the JSON results
+#define SuiteSourceSize 262144 // Largest generated source
+
+// A VM instance for one program of the suite
+typedef struct stSuiteVM {
+  Program program;
+  Data data;
+  Arena arena;
+  Timer timers[MAX_TIMERS];
+  Counter counters[MAX_COUNTERS];
+  Trigger triggers[MAX_TRIGGERS];
+  StackElement stackElements[STACK_MAX_SIZE];
+  Stack stack;
+} SuiteVM;
+
+typedef struct stSuiteResult {
+  uint32_t programBytes;
+  uint32_t instructions;
+  double threadedNs;  // ns per scan, threaded dispatch
+  double executeNs;   // ns per scan, executeInstruction
+  uint32_t opcodeCount[NumInstructions]; // Instructions of each opcode
+  double opcodeNs[NumInstructions];      // ns per executeInstruction
+} SuiteResult;
+
+/**
+ * Loads a program into a VM instance of the suite.
+ *
+ * @param vm The VM.
+ * @param buffer The buffer containing the program.
+ * @return The error code.
+ */
+static uint8_t loadSuiteVM(SuiteVM *vm, uint8_t *buffer) {
+  ProgramHeader header;
+  memset(vm, 0, sizeof(*vm));
+  if (verifyProgramIntegrity(buffer) != noError ||
+      readProgramHeader(buffer, &header) != 0) {
+    printf("Error: Invalid program\n");
+    return criticalError;
+  }
+  if (initArena(&vm->arena, getRequiredMemory(&header)) != noError) {
+    return criticalError;
+  }
+  if (allocateMemory(&vm->data, &header, &vm->arena) != noError) {
+    freeArena(&vm->arena);
+    return criticalError;
+  }
+  initStack(&vm->stack, vm->stackElements, STACK_MAX_SIZE);
+  initializeTimer(vm->timers, MAX_TIMERS);
+  initializeCounter(vm->counters, MAX_COUNTERS);
+  initializeTrigger(vm->triggers, MAX_TRIGGERS);
+  initializeMemory(&vm->data, vm->timers, vm->counters, vm->triggers,
+                   &vm->stack);
+  if (decodeProgram(buffer, &vm->program) != noError ||
+      resolveOperands(&vm->program, &vm->data) != noError ||
+      checkResources(&vm->program, MAX_TIMERS, MAX_COUNTERS, MAX_TRIGGERS) !=
+          noError ||
+      prepareDispatch(&vm->program, &vm->data) != noError) {
+    freeProgram(&vm->program);
+    freeArena(&vm->arena);
+    return criticalError;
+  }
+  return noError;
+}
+
+// Inputs of a scan, changing from scan to scan so the branches vary
+static void setSuiteInputs(Data *data, uint32_t scan) {
+  uint32_t seed = scan * 2654435761u;
+  for (uint16_t i = 0; i < data->inputSize; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    data->Inputs[i] = (uint8_t)(seed >> 24);
+  }
+}
+
+/**
+ * Measures one program of the suite.
+ *
+ * @param vm The VM with the program loaded.
+ * @param scans The number of scans of each measurement.
+ * @param result Receives the results.
+ */
+static void measureSuiteProgram(SuiteVM *vm, uint32_t scans,
+                                SuiteResult *result) {
+  Program *program = &vm->program;
+  Data *data = &vm->data;
+  // The inputs change every 16 scans, outside the timed part
+  uint32_t block = 16;
+
+  // Threaded dispatch
+  uint64_t ns = 0;
+  for (uint32_t s = 0; s < scans; s += block) {
+    setSuiteInputs(data, s / block);
+    uint64_t start = getMonotonicNs();
+    for (uint32_t b = 0; b < block; b++) {
+      data->accumulator = 0;
+      runProgram(program, data);
+    }
+    ns += getMonotonicNs() - start;
+  }
+  result->threadedNs = (double)ns / (double)scans;
+
+  // executeInstruction
+  ns = 0;
+  for (uint32_t s = 0; s < scans; s += block) {
+    setSuiteInputs(data, s / block);
+    uint64_t start = getMonotonicNs();
+    for (uint32_t b = 0; b < block; b++) {
+      data->accumulator = 0;
+      for (uint32_t i = 0; i < program->numInstructions; i++) {
+        executeInstruction(&program->instructions[i], data);
+      }
+    }
+    ns += getMonotonicNs() - start;
+  }
+  result->executeNs = (double)ns / (double)scans;
+
+  // Each executeInstruction between two reads of the cycle counter, minus the
+  // cost of the reads, and the cycles converted to ns with the clock
+  uint64_t overhead = UINT64_MAX;
+  for (uint32_t i = 0; i < 1000; i++) {
+    uint64_t c0 = readCycleCounter();
+    uint64_t c1 = readCycleCounter();
+    if (c1 - c0 < overhead) {
+      overhead = c1 - c0;
+    }
+  }
+  uint64_t cycles[NumInstructions] = {0};
+  memset(result->opcodeCount, 0, sizeof(result->opcodeCount));
+  uint64_t startNs = getMonotonicNs();
+  uint64_t startCycles = readCycleCounter();
+  uint32_t opcodeScans = scans / 4 + 1;
+  for (uint32_t s = 0; s < opcodeScans; s++) {
+    if (s % block == 0) {
+      setSuiteInputs(data, s / block);
+    }
+    data->accumulator = 0;
+    for (uint32_t i = 0; i < program->numInstructions; i++) {
+      const Instruction *instr = &program->instructions[i];
+      uint64_t c0 = readCycleCounter();
+      executeInstruction(instr, data);
+      uint64_t c = readCycleCounter() - c0;
+      cycles[instr->opcode] += c > overhead ? c - overhead : 0;
+      result->opcodeCount[instr->opcode]++;
+    }
+  }
+  double nsPerCycle = (double)(getMonotonicNs() - startNs) /
+                      (double)(readCycleCounter() - startCycles);
+  for (uint8_t op = 0; op < NumInstructions; op++) {
+    result->opcodeNs[op] =
+        result->opcodeCount[op] > 0
+            ? cycles[op] * nsPerCycle / result->opcodeCount[op]
+            : 0.0;
+    result->opcodeCount[op] /= opcodeScans; // Per scan, i.e. in the program
+  }
+}
+
+/**
+ * Writes the results of one program as a JSON object.
+ *
+ * @param file The results file.
+ * @param mix The mix of the program.
+ * @param rungs The number of rungs of the program.
+ * @param r The results.
+ * @param first The first object of the list, without a separator.
+ */
+static void writeSuiteResult(FILE *file, uint8_t mix, uint32_t rungs,
+                             const SuiteResult *r, uint8_t first) {
+  double instrNs = r->instructions > 0 ? r->threadedNs / r->instructions : 0;
+  double execNs = r->instructions > 0 ? r->executeNs / r->instructions : 0;
+  fprintf(file, "%s    {\n      \"mix\": \"%s\",\n", first ? "" : ",\n",
+          getMixName(mix));
+  fprintf(file, "      \"rungs\": %u,\n      \"instructions\": %u,\n", rungs,
+          r->instructions);
+  fprintf(file, "      \"bytes\": %u,\n", r->programBytes);
+  fprintf(file,
+          "      \"threaded\": {\"ns_per_scan\": %.1f, \"scans_per_s\": %.0f, "
+          "\"instr_per_s\": %.0f, \"ns_per_instr\": %.3f},\n",
+          r->threadedNs, 1e9 / r->threadedNs, 1e9 / instrNs, instrNs);
+  fprintf(file,
+          "      \"execute\": {\"ns_per_scan\": %.1f, \"scans_per_s\": %.0f, "
+          "\"instr_per_s\": %.0f, \"ns_per_instr\": %.3f},\n",
+          r->executeNs, 1e9 / r->executeNs, 1e9 / execNs, execNs);
+  fprintf(file, "      \"opcodes\": [");
+  first = 1;
+  for (uint8_t op = 0; op < NumInstructions; op++) {
+    if (r->opcodeCount[op] == 0) {
+      continue;
+    }
+    fprintf(file, "%s\n        {\"opcode\": \"%s\", \"count\": %u, \"ns\": %.2f}",
+            first ? "" : ",", getOpcodeName(op), r->opcodeCount[op],
+            r->opcodeNs[op]);
+    first = 0;
+  }
+  fprintf(file, "\n      ]\n    }");
+}
+
+/**
+ * Generates the program of a mix and writes its IL source.
+ *
+ * @param mix The mix of the program.
+ * @param rungs The number of rungs of the program.
+ * @param source Buffer of SuiteSourceSize bytes for the source.
+ * @param ilName The name of the IL file.
+ * @return The error code.
+ */
+static uint8_t writeSuiteSource(uint8_t mix, uint32_t rungs, char *source,
+                                const char *ilName) {
+  uint32_t length = generateProgram(mix, rungs, source, SuiteSourceSize);
+  FILE *file = fopen(ilName, "w");
+  if (length == 0 || file == NULL) {
+    printf("Error generating %s\n", ilName);
+    if (file != NULL) {
+      fclose(file);
+    }
+    return criticalError;
+  }
+  fwrite(source, 1, length, file);
+  fclose(file);
+  return noError;
+}
+
+/**
+ * Compiles an IL file with the VMcompiler and maps the program.
+ *
+ * @param compiler The command of the VMcompiler.
+ * @param options The options of the compiler, before -o.
+ * @param ilName The name of the IL file.
+ * @param binName The name of the program.
+ * @param logName Receives the warnings and errors of the compiler.
+ * @param binFile Receives the mapped program.
+ * @return The error code.
+ */
+static uint8_t compileSuiteProgram(const char *compiler, const char *options,
+                                   const char *ilName, const char *binName,
+                                   const char *logName, ProgramFile *binFile) {
+  char command[512];
+  remove(binName);
+  snprintf(command, sizeof(command), "%s %s -o %s %s > %s", compiler, options,
+           binName, ilName, logName);
+  // the compiler exits with a nonzero status on any error
+  if (system(command) != 0 || mapProgramFile(binName, binFile) != noError) {
+    printf("Error compiling %s, see %s\n", ilName, logName);
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Runs the benchmark suite: generates a program of each mix, compiles it
+ * with the VMcompiler and measures it.
+ *
+ * @param compiler The command of the VMcompiler.
+ * @param resultsFile The name of the JSON results file.
+ * @param rungs The number of rungs of each program.
+ * @param scans The number of scans of each measurement.
+ * @return The error code.
+ */
+uint8_t benchmarkSuite(const char *compiler, const char *resultsFile,
+                       uint32_t rungs, uint32_t scans) {
+  char *source = (char *)malloc(SuiteSourceSize);
+  FILE *results = fopen(resultsFile, "w");
+  if (source == NULL || results == NULL) {
+    printf("Error opening the results file %s\n", resultsFile);
+    free(source);
+    if (results != NULL) {
+      fclose(results);
+    }
+    return criticalError;
+  }
+  if (scans < 16) {
+    scans = 16;
+  }
+  fprintf(results, "{\n  \"format\": %d,\n  \"scans\": %u,\n  \"programs\": [\n",
+          SuiteFormat, scans);
+  printf("mix\t\tinstr\tthreaded ns/instr\texecute ns/instr\tscans/s\n");
+  uint8_t error = noError;
+  for (uint8_t mix = 0; mix < NumMixes && error == noError; mix++) {
+    char ilName[64], binName[64], logName[64];
+    snprintf(ilName, sizeof(ilName), "bench_%s.il", getMixName(mix));
+    snprintf(binName, sizeof(binName), "bench_%s.bin", getMixName(mix));
+    snprintf(logName, sizeof(logName), "bench_%s.log", getMixName(mix));
+    if (writeSuiteSource(mix, rungs, source, ilName) != noError) {
+      error = criticalError;
+      break;
+    }
+    ProgramFile binFile;
+    if (compileSuiteProgram(compiler, "-q", ilName, binName, logName,
+                            &binFile) != noError) {
+      error = criticalError;
+      break;
+    }
+    SuiteVM *vm = (SuiteVM *)malloc(sizeof(SuiteVM));
+    if (vm == NULL || loadSuiteVM(vm, binFile.buffer) != noError) {
+      printf("Error loading %s\n", binName);
+      unmapProgramFile(&binFile);
+      free(vm);
+      error = criticalError;
+      break;
+    }
+    SuiteResult result;
+    result.programBytes = vm->program.header.programSize;
+    result.instructions = vm->program.numInstructions;
+    measureSuiteProgram(vm, scans, &result);
+    writeSuiteResult(results, mix, rungs, &result, mix == 0);
+    printf("%-14s\t%u\t%.2f\t\t\t%.2f\t\t\t%.0f\n", getMixName(mix),
+           result.instructions, result.threadedNs / result.instructions,
+           result.executeNs / result.instructions, 1e9 / result.threadedNs);
+    freeProgram(&vm->program);
+    freeArena(&vm->arena);
+    free(vm);
+    unmapProgramFile(&binFile);
+  }
+  fprintf(results, "\n  ]\n}\n");
+  fclose(results);
+  free(source);
+  return error;
+}
+
+/*
+  Differential check of the optimizer: the program of each mix compiled with
+  the peephole optimizer runs on the threaded dispatch next to the same
+  program compiled with -n run by executeInstruction, with the same inputs
+  and ticks, and the outputs and memories are compared after every scan.
+*/
+
+/**
+ * Compares the process image of two VMs after a scan.
+ *
+ * @param a The VM of the optimized program.
+ * @param b The VM of the program compiled with -n.
+ * @return The first byte that differs, or UINT32_MAX when they are equal.
+ */
+static uint32_t compareSuiteImages(const SuiteVM *a, const SuiteVM *b) {
+  uint16_t outputs = a->data.outputSize < b->data.outputSize
+                         ? a->data.outputSize
+                         : b->data.outputSize;
+  uint16_t memories = a->data.memorySize < b->data.memorySize
+                          ? a->data.memorySize
+                          : b->data.memorySize;
+  for (uint16_t i = 0; i < outputs; i++) {
+    if (a->data.Outputs[i] != b->data.Outputs[i]) {
+      return i;
+    }
+  }
+  for (uint16_t i = 0; i < memories; i++) {
+    if (a->data.Memories[i] != b->data.Memories[i]) {
+      return (uint32_t)outputs + i;
+    }
+  }
+  return UINT32_MAX;
+}
+
+/**
+ * Runs the differential check of the optimizer on the programs of the
+ * benchmark suite.
+ *
+ * @param compiler The command of the VMcompiler.
+ * @param rungs The number of rungs of each program.
+ * @param scans The number of scans compared.
+ * @return The error code, criticalError when a program differs.
+ */
+uint8_t checkOptimizer(const char *compiler, uint32_t rungs, uint32_t scans) {
+  char *source = (char *)malloc(SuiteSourceSize);
+  SuiteVM *vms = (SuiteVM *)malloc(2 * sizeof(SuiteVM));
+  if (source == NULL || vms == NULL) {
+    printf("Error allocating memory for the check\n");
+    free(source);
+    free(vms);
+    return criticalError;
+  }
+  uint8_t error = noError;
+  for (uint8_t mix = 0; mix < NumMixes; mix++) {
+    char ilName[64], binName[2][64], logName[2][64];
+    snprintf(ilName, sizeof(ilName), "check_%s.il", getMixName(mix));
+    snprintf(binName[0], sizeof(binName[0]), "check_%s.bin", getMixName(mix));
+    snprintf(binName[1], sizeof(binName[1]), "check_%s_n.bin",
+             getMixName(mix));
+    snprintf(logName[0], sizeof(logName[0]), "check_%s.log", getMixName(mix));
+    snprintf(logName[1], sizeof(logName[1]), "check_%s_n.log",
+             getMixName(mix));
+    if (writeSuiteSource(mix, rungs, source, ilName) != noError) {
+      error = criticalError;
+      break;
+    }
+    ProgramFile binFiles[2];
+    uint8_t loaded = 0;
+    for (uint8_t v = 0; v < 2; v++) {
+      if (compileSuiteProgram(compiler, v == 0 ? "-q" : "-q -n", ilName,
+                              binName[v], logName[v],
+                              &binFiles[v]) != noError) {
+        break;
+      }
+      if (loadSuiteVM(&vms[v], binFiles[v].buffer) != noError) {
+        printf("Error loading %s\n", binName[v]);
+        unmapProgramFile(&binFiles[v]);
+        break;
+      }
+      loaded++;
+    }
+    if (loaded < 2) {
+      if (loaded == 1) {
+        freeProgram(&vms[0].program);
+        freeArena(&vms[0].arena);
+        unmapProgramFile(&binFiles[0]);
+      }
+      error = criticalError;
+      break;
+    }
+
+    uint32_t scan = 0;
+    uint32_t differs = UINT32_MAX;
+    for (; scan < scans && differs == UINT32_MAX; scan++) {
+      for (uint8_t v = 0; v < 2; v++) {
+        setSuiteInputs(&vms[v].data, scan / 16);
+        updateTicks(&vms[v].data, 1);
+        vms[v].data.accumulator = 0;
+      }
+      runProgram(&vms[0].program, &vms[0].data);
+      Program *program = &vms[1].program;
+      for (uint32_t i = 0; i < program->numInstructions; i++) {
+        executeInstruction(&program->instructions[i], &vms[1].data);
+      }
+      differs = compareSuiteImages(&vms[0], &vms[1]);
+    }
+    if (differs == UINT32_MAX) {
+      printf("%-14s\t%u/%u instructions\t%u scans equal\n", getMixName(mix),
+             vms[0].program.numInstructions, vms[1].program.numInstructions,
+             scans);
+    } else {
+      printf("%-14s\tdiffers at scan %u, %s byte %u\n", getMixName(mix),
+             scan - 1, differs < vms[0].data.outputSize ? "output" : "memory",
+             differs < vms[0].data.outputSize
+                 ? differs
+                 : differs - vms[0].data.outputSize);
+      error = criticalError;
+    }
+    for (uint8_t v = 0; v < 2; v++) {
+      freeProgram(&vms[v].program);
+      freeArena(&vms[v].arena);
+      unmapProgramFile(&binFiles[v]);
+    }
+  }
+  free(vms);
+  free(source);
+  return error;
+}
@@ -0,0 +1,14 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "VM.h"
+
+// Function prototypes
+void benchmarkEngines(Program *program, Data *data, uint32_t scans);
+void benchmarkBatch(uint8_t *buffer, const uint8_t *inputs, uint16_t lanes,
+                    uint32_t scans);
+uint8_t benchmarkSuite(const char *compiler, const char *resultsFile,
+                       uint32_t rungs, uint32_t scans);
+uint8_t checkOptimizer(const char *compiler, uint32_t rungs, uint32_t scans);
+
+#endif // BENCHMARK_H
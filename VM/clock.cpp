@@ -0,0 +1,86 @@
+#include "clock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_RDTSC
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define HAS_RDTSC
+#endif
+
+/**
+ * Gets the time of a monotonic clock.
+ *
+ * @return The time in nanoseconds.
+ */
+uint64_t getMonotonicNs(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL +
+         (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL /
+             (uint64_t)frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * Reads the CPU cycle counter.
+ *
+ * @return The number of cycles, or nanoseconds when the architecture has no
+ * cycle counter available.
+ */
+uint64_t readCycleCounter(void) {
+#ifdef HAS_RDTSC
+  return __rdtsc();
+#else
+  return getMonotonicNs();
+#endif
+}
+
+/**
+ * Suspends the calling thread for at least a time.
+ *
+ * @param ns The time in nanoseconds (milliseconds resolution on Windows).
+ */
+void sleepNs(uint64_t ns) {
+#ifdef _WIN32
+  Sleep((DWORD)((ns + 999999ULL) / 1000000ULL));
+#else
+  struct timespec ts;
+  ts.tv_sec = (time_t)(ns / 1000000000ULL);
+  ts.tv_nsec = (long)(ns % 1000000000ULL);
+  nanosleep(&ts, NULL);
+#endif
+}
+
+/**
+ * Suspends the calling thread until a time of the monotonic clock.
+ *
+ * @param deadlineNs The time in nanoseconds, as returned by getMonotonicNs.
+ */
+void sleepUntilNs(uint64_t deadlineNs) {
+#ifdef _WIN32
+  uint64_t now = getMonotonicNs();
+  if (deadlineNs > now) {
+    sleepNs(deadlineNs - now);
+  }
+#else
+  struct timespec ts;
+  ts.tv_sec = (time_t)(deadlineNs / 1000000000ULL);
+  ts.tv_nsec = (long)(deadlineNs % 1000000000ULL);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+#endif
+}
@@ -0,0 +1,21 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+/*
+Time sources used to measure the execution of the VM.
+getMonotonicNs -> nanoseconds of a monotonic clock
+readCycleCounter -> CPU time stamp counter (rdtsc) on x86, nanoseconds on
+                    other architectures
+sleepNs -> suspends the calling thread
+sleepUntilNs -> suspends the calling thread until a time of getMonotonicNs,
+                absolute deadlines do not accumulate the wake-up delays
+*/
+
+uint64_t getMonotonicNs(void);
+uint64_t readCycleCounter(void);
+void sleepNs(uint64_t ns);
+void sleepUntilNs(uint64_t deadlineNs);
+
+#endif // CLOCK_H
@@ -3,7 +3,7 @@
 #include <stdio.h>
 
 void initializeCounter(Counter counters[], uint8_t size) {
-  for (int aux = 0; (aux < size) && (aux < MAX_COUNTERS); aux++) {
+  for (int aux = 0; aux < size; aux++) {
     counters[aux].CO = 0;
     counters[aux].R_LD = 0;
     counters[aux].PV = 0;
@@ -40,9 +40,10 @@ void runCounterDown(Counter *counter) {
     counter->CO_ = 0;
   }
   counter->QO = (counter->CV <= 0) ? 1 : 0;
+  /*
   printf("CV:%d\n", counter->CV);
   printf("PV:%d\n", counter->PV);
   printf("Qo:%d\n", counter->QO);
   printf("IN:%d\n", counter->CO);
-  
+  */
 }
\ No newline at end of file
@@ -3,8 +3,6 @@
 #ifndef COUNTER_H
 #define COUNTER_H
 
-#define MAX_COUNTERS 10 // Maximum timers available
-
 /*
 Structure for counter
 */
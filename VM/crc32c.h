@@ -0,0 +1,143 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+CRC32C (Castagnoli polynomial, reflected 0x82F63B78), the integrity check
+of program.bin from version 1 on. Shared by the VM and the VMcompiler.
+
+Unlike the byte sum of the older versions, it detects swapped bytes, every
+burst error up to 32 bits and every error of up to 3 bits in programs up
+to 256 MB.
+
+On x86 processors with SSE4.2 the crc32 instruction processes 8 bytes per
+instruction; the processor is checked at run time, so the binaries still
+run on older processors. Otherwise the CRC is computed 8 bytes at a time
+with tables built by the C++ compiler (slicing-by-8).
+*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define Crc32cHardware
+#endif
+
+#define Crc32cPolynomial 0x82F63B78u
+
+typedef struct stCrc32cTables {
+  uint32_t t[8][256];
+} Crc32cTables;
+
+/**
+ * Builds the tables of the slicing-by-8 CRC.
+ *
+ * @return The tables.
+ */
+constexpr Crc32cTables buildCrc32cTables() {
+  Crc32cTables tables = {};
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ ((crc & 1) ? Crc32cPolynomial : 0);
+    }
+    tables.t[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (uint8_t k = 1; k < 8; k++) {
+      uint32_t prev = tables.t[k - 1][i];
+      tables.t[k][i] = (prev >> 8) ^ tables.t[0][prev & 0xFF];
+    }
+  }
+  return tables;
+}
+
+constexpr Crc32cTables Crc32cTable = buildCrc32cTables();
+
+static_assert(Crc32cTable.t[0][1] == 0xF26B8303u, "CRC32C table");
+
+/**
+ * Updates a CRC32C with the tables.
+ *
+ * @param crc The CRC so far, inverted.
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @return The updated CRC, inverted.
+ */
+static inline uint32_t updateCrc32cTable(uint32_t crc, const uint8_t *data,
+                                         size_t size) {
+  const Crc32cTables &tables = Crc32cTable;
+  while (size >= 8) {
+    uint32_t lo = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+                         ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+    crc = tables.t[7][lo & 0xFF] ^ tables.t[6][(lo >> 8) & 0xFF] ^
+          tables.t[5][(lo >> 16) & 0xFF] ^ tables.t[4][lo >> 24] ^
+          tables.t[3][data[4]] ^ tables.t[2][data[5]] ^ tables.t[1][data[6]] ^
+          tables.t[0][data[7]];
+    data += 8;
+    size -= 8;
+  }
+  while (size > 0) {
+    crc = (crc >> 8) ^ tables.t[0][(crc ^ *data) & 0xFF];
+    data++;
+    size--;
+  }
+  return crc;
+}
+
+#ifdef Crc32cHardware
+/**
+ * Updates a CRC32C with the SSE4.2 crc32 instruction.
+ *
+ * @param crc The CRC so far, inverted.
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @return The updated CRC, inverted.
+ */
+__attribute__((target("sse4.2"))) static inline uint32_t
+updateCrc32cHardware(uint32_t crc, const uint8_t *data, size_t size) {
+#ifdef __x86_64__
+  uint64_t crc64 = crc;
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += 8;
+    size -= 8;
+  }
+  crc = (uint32_t)crc64;
+#endif
+  while (size >= 4) {
+    uint32_t word;
+    memcpy(&word, data, 4);
+    crc = _mm_crc32_u32(crc, word);
+    data += 4;
+    size -= 4;
+  }
+  while (size > 0) {
+    crc = _mm_crc32_u8(crc, *data);
+    data++;
+    size--;
+  }
+  return crc;
+}
+#endif
+
+/**
+ * Computes the CRC32C of a buffer.
+ *
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @return The CRC.
+ */
+static inline uint32_t computeCrc32c(const uint8_t *data, size_t size) {
+#ifdef Crc32cHardware
+  if (__builtin_cpu_supports("sse4.2")) {
+    return ~updateCrc32cHardware(0xFFFFFFFFu, data, size);
+  }
+#endif
+  return ~updateCrc32cTable(0xFFFFFFFFu, data, size);
+}
+
+#endif // CRC32C_H
@@ -0,0 +1,92 @@
+#include "cyclic.h"
+#include "dispatch.h"
+#include "clock.h"
+
+/**
+ * Runs the scans of a program on a fixed cycle time.
+ *
+ * @param program The decoded program, prepared by prepareDispatch.
+ * @param data The data structure containing the memory and register values.
+ * @param cycleUs The cycle time in microseconds.
+ * @param numScans The number of scans to run, 0 to run until the hook stops.
+ * @param beforeScan Called before each scan, e.g. to read the inputs. May be
+ * NULL.
+ * @param user Passed to the hook.
+ * @param stats Receives the statistics of the loop.
+ * @param telemetry The shared telemetry block, or NULL.
+ * @param reloader Swaps in the new programs between two scans, or NULL.
+ */
+void runCyclic(Program *program, Data *data, uint32_t cycleUs,
+               uint64_t numScans, CycleHook beforeScan, void *user,
+               CycleStats *stats, TelemetryBlock *telemetry,
+               Reloader *reloader) {
+  uint64_t cycleNs = (uint64_t)cycleUs * 1000;
+  memset(stats, 0, sizeof(*stats));
+  stats->minJitterNs = UINT64_MAX;
+  if (cycleNs == 0) {
+    return;
+  }
+
+  uint64_t base = getMonotonicNs();
+  uint64_t release = base;
+  uint64_t ticks = 0; // Ticks given to the timers so far
+  while (numScans == 0 || stats->scans < numScans) {
+    sleepUntilNs(release);
+    uint64_t start = getMonotonicNs();
+    uint64_t jitter = start - release;
+    if (jitter < stats->minJitterNs) {
+      stats->minJitterNs = jitter;
+    }
+    if (jitter > stats->maxJitterNs) {
+      stats->maxJitterNs = jitter;
+    }
+    stats->sumJitterNs += jitter;
+
+    uint64_t releaseTicks = (release - base) / TickPeriodNs;
+    updateTicks(data, (uint32_t)(releaseTicks - ticks));
+    ticks = releaseTicks;
+
+    if (beforeScan != NULL && beforeScan(data, user) != 0) {
+      break;
+    }
+    program = applyReload(reloader, program);
+    uint64_t io = getMonotonicNs();
+    data->accumulator = 0;
+    runProgram(program, data);
+    stats->scans++;
+
+    uint64_t end = getMonotonicNs();
+    uint64_t missed = 0;
+    if (end - start > stats->maxDurationNs) {
+      stats->maxDurationNs = end - start;
+    }
+    release += cycleNs;
+    if (end > release) {
+      // Skip the releases missed, keeping the phase
+      missed = (end - release) / cycleNs + 1;
+      release += missed * cycleNs;
+      stats->overruns += missed;
+    }
+    recordScanTelemetry(telemetry, end - io, io - start, jitter, missed);
+  }
+  if (stats->scans == 0) {
+    stats->minJitterNs = 0;
+  }
+}
+
+/**
+ * Prints the statistics of a fixed-period scan loop.
+ *
+ * @param stats The statistics.
+ * @param cycleUs The cycle time in microseconds.
+ */
+void printCycleStats(const CycleStats *stats, uint32_t cycleUs) {
+  double mean = stats->scans > 0 ? (double)stats->sumJitterNs / stats->scans
+                                 : 0.0;
+  printf("Cycle %lu us: %lu scans, %lu overruns\n", (unsigned long)cycleUs,
+         (unsigned long)stats->scans, (unsigned long)stats->overruns);
+  printf("Jitter (us): min %.1f, mean %.1f, max %.1f\n",
+         stats->minJitterNs / 1000.0, mean / 1000.0,
+         stats->maxJitterNs / 1000.0);
+  printf("Max scan time (us): %.1f\n", stats->maxDurationNs / 1000.0);
+}
@@ -0,0 +1,47 @@
+#ifndef CYCLIC_H
+#define CYCLIC_H
+
+#include "VM.h"
+#include "telemetry.h"
+#include "reload.h"
+
+/*
+Fixed-period scan loop.
+
+The scans are released on a fixed cycle time: the n-th release is at
+start + n * cycle, and the thread sleeps until it with an absolute deadline,
+so the wake-up delays do not accumulate into a drift.
+
+The time base of the timers (elapsedTicks) is derived from the release
+times, not from the time the scan actually starts, so TON, TOF and TP see
+exactly cycle / TickPeriodNs ticks per scan whatever the jitter.
+
+A scan that ends after the next release is an overrun. The releases already
+missed are skipped, the loop keeps its phase and the ticks keep following
+the clock.
+
+Optionally every scan is also recorded in a telemetry block in shared
+memory, see telemetry.h, and a new program.bin is swapped in between two
+scans, see reload.h.
+*/
+
+// Called before each scan, returns nonzero to stop the loop
+typedef uint8_t (*CycleHook)(Data *data, void *user);
+
+typedef struct stCycleStats {
+  uint64_t scans;         // Scans completed
+  uint64_t overruns;      // Releases missed
+  uint64_t minJitterNs;   // Minimum delay from release to start
+  uint64_t maxJitterNs;   // Maximum delay from release to start
+  uint64_t sumJitterNs;   // To compute the mean delay
+  uint64_t maxDurationNs; // Maximum scan duration
+} CycleStats;
+
+// Function prototypes
+void runCyclic(Program *program, Data *data, uint32_t cycleUs,
+               uint64_t numScans, CycleHook beforeScan, void *user,
+               CycleStats *stats, TelemetryBlock *telemetry,
+               Reloader *reloader);
+void printCycleStats(const CycleStats *stats, uint32_t cycleUs);
+
+#endif // CYCLIC_H
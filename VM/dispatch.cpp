@@ -0,0 +1,390 @@
+#include "dispatch.h"
+
+/*
+  Specialized instruction handlers
+*/
+
+typedef void (*Handler)(const Instruction *instr, Data *data);
+
+// Bit of the first operand in a memory region
+#define OPERAND_BIT(region)                                                    \
+  ((data->region[instr->operands[0].address] >>                               \
+    instr->operands[0].bitNumber) & 0x01)
+
+// Handlers that combine a bit of I, Q or M with the accumulator
+#define DEFINE_LOAD_HANDLERS(name, expression)                                 \
+  static inline void handle##name##_I(const Instruction *instr,                \
+                                      Data *data) {                           \
+    uint8_t bit = OPERAND_BIT(Inputs);                                         \
+    expression;                                                                \
+  }                                                                            \
+  static inline void handle##name##_Q(const Instruction *instr,                \
+                                      Data *data) {                           \
+    uint8_t bit = OPERAND_BIT(Outputs);                                        \
+    expression;                                                                \
+  }                                                                            \
+  static inline void handle##name##_M(const Instruction *instr,                \
+                                      Data *data) {                           \
+    uint8_t bit = OPERAND_BIT(Memories);                                       \
+    expression;                                                                \
+  }
+
+// Handlers that write the accumulator to a bit of Q or M
+#define DEFINE_STORE_HANDLERS(name, expression)                                \
+  static inline void handle##name##_Q(const Instruction *instr,                \
+                                      Data *data) {                           \
+    uint8_t *byte = &data->Outputs[instr->operands[0].address];                \
+    uint8_t mask = (uint8_t)(1 << instr->operands[0].bitNumber);               \
+    expression;                                                                \
+  }                                                                            \
+  static inline void handle##name##_M(const Instruction *instr,                \
+                                      Data *data) {                           \
+    uint8_t *byte = &data->Memories[instr->operands[0].address];               \
+    uint8_t mask = (uint8_t)(1 << instr->operands[0].bitNumber);               \
+    expression;                                                                \
+  }
+
+DEFINE_LOAD_HANDLERS(LD, data->accumulator = bit)
+DEFINE_LOAD_HANDLERS(LDN, data->accumulator = bit ^ 0x01)
+DEFINE_LOAD_HANDLERS(AND, data->accumulator &= bit)
+DEFINE_LOAD_HANDLERS(ANDN, data->accumulator &= bit ^ 0x01)
+DEFINE_LOAD_HANDLERS(OR, data->accumulator |= bit)
+DEFINE_LOAD_HANDLERS(ORN, data->accumulator |= bit ^ 0x01)
+DEFINE_LOAD_HANDLERS(XOR, data->accumulator ^= bit)
+DEFINE_LOAD_HANDLERS(XORN, data->accumulator ^= bit ^ 0x01)
+
+DEFINE_STORE_HANDLERS(ST, *byte = (uint8_t)((*byte & ~mask) |
+                                            (data->accumulator != 0 ? mask : 0)))
+DEFINE_STORE_HANDLERS(STN, *byte = (uint8_t)((*byte & ~mask) |
+                                             (data->accumulator == 0 ? mask : 0)))
+DEFINE_STORE_HANDLERS(S, if (data->accumulator == 1) *byte |= mask)
+DEFINE_STORE_HANDLERS(R, if (data->accumulator == 1) *byte &= (uint8_t)~mask)
+
+static inline void handleNOT(const Instruction *, Data *data) {
+  data->accumulator = (data->accumulator == 0) ? 1 : 0;
+}
+
+static inline void handleGeneric(const Instruction *instr, Data *data) {
+  executeInstruction(instr, data);
+}
+
+/**
+ * Selects the specialized handler of an instruction.
+ *
+ * @param instr The instruction to select the handler for.
+ * @return The handler index.
+ */
+uint8_t selectHandler(const Instruction *instr) {
+  const Operand *oper = &instr->operands[0];
+  if (instr->opcode == InstNOT) {
+    return hNOT;
+  }
+  if (instr->num_operands != 1 || oper->memorytype != X ||
+      oper->registertype == K) {
+    return hGeneric;
+  }
+  // The handlers of each instruction are ordered I, Q, M
+  uint8_t reg = oper->registertype;
+  switch (instr->opcode) {
+  case InstLD: return hLD_I + reg;
+  case InstLDN: return hLDN_I + reg;
+  case InstAND: return hAND_I + reg;
+  case InstANDN: return hANDN_I + reg;
+  case InstOR: return hOR_I + reg;
+  case InstORN: return hORN_I + reg;
+  case InstXOR: return hXOR_I + reg;
+  case InstXORN: return hXORN_I + reg;
+  default:
+    break;
+  }
+  // Inputs are never written
+  if (reg == I) {
+    return hGeneric;
+  }
+  switch (instr->opcode) {
+  case InstST: return hST_Q + (reg - Q);
+  case InstSTN: return hSTN_Q + (reg - Q);
+  case InstS: return hS_Q + (reg - Q);
+  case InstR: return hR_Q + (reg - Q);
+  default:
+    return hGeneric;
+  }
+}
+
+/*
+  Fused bit logic chains
+*/
+
+#define WindowSize 8 // Bytes tested at once by a bit group
+
+// Parity of the set bits of a word
+static inline uint8_t parity64(uint64_t value) {
+#if defined(__GNUC__)
+  return (uint8_t)__builtin_parityll(value);
+#else
+  value ^= value >> 32;
+  value ^= value >> 16;
+  value ^= value >> 8;
+  value ^= value >> 4;
+  value ^= value >> 2;
+  value ^= value >> 1;
+  return (uint8_t)(value & 0x01);
+#endif
+}
+
+/**
+ * Updates the accumulator with a bit group.
+ *
+ * @param group The bit group.
+ * @param accumulator The accumulator before the group.
+ * @return The accumulator after the group.
+ */
+static inline uint8_t runGroup(const BitGroup *group, uint8_t accumulator) {
+  uint64_t word;
+  memcpy(&word, group->window, sizeof(word));
+  word = (word ^ group->invert) & group->mask;
+  switch (group->op) {
+  case InstLD: return word == group->mask;
+  case InstAND: return accumulator & (word == group->mask);
+  case InstOR: return accumulator | (word != 0);
+  default: return accumulator ^ parity64(word);
+  }
+}
+
+/**
+ * Runs a fused chain.
+ *
+ * @param program The decoded program.
+ * @param chain The chain to run.
+ * @param data The data structure containing the memory and register values.
+ */
+static inline void runChain(const Program *program, const BitChain *chain,
+                            Data *data) {
+  const BitGroup *group = &program->groups[chain->firstGroup];
+  const BitGroup *end = group + chain->numGroups;
+  uint8_t accumulator = data->accumulator;
+  for (; group < end; group++) {
+    accumulator = runGroup(group, accumulator);
+  }
+  data->accumulator = accumulator;
+}
+
+#if VM_BIT_FUSION
+// Bit logic instructions that can be part of a chain
+static inline uint8_t isChainable(const Instruction *instr) {
+  return instr->handler >= hLD_I && instr->handler <= hXORN_M;
+}
+
+/**
+ * Gets the bit of a byte of the window as a 64-bit mask, in the byte order
+ * of the loads done by runGroup.
+ *
+ * @param byte The byte in the window.
+ * @param bit The bit in the byte.
+ * @return The mask.
+ */
+static uint64_t windowBit(uint16_t byte, uint8_t bit) {
+  uint8_t bytes[WindowSize] = {0};
+  uint64_t mask;
+  bytes[byte] = (uint8_t)(1 << bit);
+  memcpy(&mask, bytes, sizeof(mask));
+  return mask;
+}
+
+/**
+ * Adds a bit logic instruction to the last group of a chain, or to a new
+ * group when it cannot be merged.
+ *
+ * @param program The decoded program.
+ * @param chain The chain being built.
+ * @param instr The instruction to add.
+ * @param data The data structure the program runs on.
+ */
+static void addToChain(Program *program, BitChain *chain,
+                       const Instruction *instr, Data *data) {
+  const Operand *oper = &instr->operands[0];
+  uint8_t *image = getProcessImage(data);
+  uint32_t offset = (uint32_t)(oper->base + oper->address - image);
+  uint8_t negated = 0;
+  uint8_t op;
+  switch (instr->opcode) {
+  case InstLDN: negated = 1; /* fall through */
+  case InstLD: op = InstLD; break;
+  case InstANDN: negated = 1; /* fall through */
+  case InstAND: op = InstAND; break;
+  case InstORN: negated = 1; /* fall through */
+  case InstOR: op = InstOR; break;
+  case InstXORN: negated = 1; /* fall through */
+  default: op = InstXOR; break;
+  }
+
+  BitGroup *group = NULL;
+  if (chain->numGroups > 0 && op != InstLD) {
+    group = &program->groups[program->numGroups - 1];
+    uint32_t start = (uint32_t)(group->window - image);
+    // An AND after a LD extends the same conjunction
+    uint8_t sameOp = group->op == op || (group->op == InstLD && op == InstAND);
+    // A group tests each bit once (XOR x XOR x, AND x ANDN x)
+    if (!sameOp || offset < start || offset >= start + WindowSize ||
+        (group->mask & windowBit((uint16_t)(offset - start),
+                                 oper->bitNumber)) != 0) {
+      group = NULL;
+    }
+  }
+  if (group == NULL) {
+    // Keep the window inside the process image
+    uint32_t start = offset;
+    if (start > data->imageSize - WindowSize) {
+      start = data->imageSize - WindowSize;
+    }
+    group = &program->groups[program->numGroups++];
+    group->window = image + start;
+    group->mask = 0;
+    group->invert = 0;
+    group->op = op;
+    chain->numGroups++;
+  }
+  uint64_t bit = windowBit((uint16_t)(offset - (group->window - image)),
+                           oper->bitNumber);
+  group->mask |= bit;
+  if (negated) {
+    group->invert |= bit;
+  }
+}
+
+/**
+ * Fuses the straight-line bit logic sequences of a program into chains of
+ * bit groups. A sequence is only fused when it needs fewer groups than
+ * instructions.
+ *
+ * @param program The decoded program, with the handlers selected.
+ * @param data The data structure the program runs on.
+ * @return The error code.
+ */
+static uint8_t fuseChains(Program *program, Data *data) {
+  uint32_t n = program->numInstructions;
+  Instruction *instrs = program->instructions;
+
+  free(program->groups);
+  free(program->chains);
+  program->groups = NULL;
+  program->chains = NULL;
+  program->numGroups = 0;
+  program->numChains = 0;
+  // The windows are read with 64-bit loads
+  if (n < 2 || data->imageSize < WindowSize) {
+    return noError;
+  }
+  program->groups = (BitGroup *)malloc(n * sizeof(BitGroup));
+  program->chains = (BitChain *)malloc((n / 2) * sizeof(BitChain));
+  if (program->groups == NULL || program->chains == NULL) {
+    printf("Error allocating the fused chains\n");
+    return criticalError;
+  }
+
+  uint32_t i = 0;
+  while (i < n) {
+    uint32_t end = i;
+    while (end < n && isChainable(&instrs[end])) {
+      end++;
+    }
+    if (end - i < 2) {
+      i = (end > i) ? end : i + 1;
+      continue;
+    }
+    BitChain *chain = &program->chains[program->numChains];
+    chain->firstGroup = program->numGroups;
+    chain->numGroups = 0;
+    chain->length = end - i;
+    for (uint32_t j = i; j < end; j++) {
+      addToChain(program, chain, &instrs[j], data);
+    }
+    if (chain->numGroups < chain->length) {
+      instrs[i].handler = hFused;
+      instrs[i].chain = program->numChains++;
+    } else {
+      program->numGroups = chain->firstGroup;
+    }
+    i = end;
+  }
+  return noError;
+}
+
+#endif // VM_BIT_FUSION
+
+/**
+ * Selects the handler of every instruction of a decoded program and fuses
+ * its bit logic sequences.
+ *
+ * The operands must be resolved (resolveOperands) on the same data.
+ *
+ * @param program The decoded program.
+ * @param data The data structure the program runs on.
+ * @return The error code.
+ */
+uint8_t prepareDispatch(Program *program, Data *data) {
+  for (uint32_t i = 0; i < program->numInstructions; i++) {
+    program->instructions[i].handler = selectHandler(&program->instructions[i]);
+  }
+#if VM_BIT_FUSION
+  return fuseChains(program, data);
+#else
+  return noError;
+#endif
+}
+
+#if !VM_COMPUTED_GOTO
+#define DISPATCH_FUNCTION(name) handle##name,
+static const Handler handlers[NumHandlers] = {
+    DISPATCH_HANDLERS(DISPATCH_FUNCTION)};
+#undef DISPATCH_FUNCTION
+#endif
+
+/**
+ * Runs one scan of a decoded program through the specialized handlers and
+ * the fused chains.
+ *
+ * prepareDispatch must have been called on the program.
+ *
+ * @param program The decoded program.
+ * @param data The data structure containing the memory and register values.
+ */
+void runProgram(Program *program, Data *data) {
+  const Instruction *instr = program->instructions;
+  const Instruction *end = instr + program->numInstructions;
+  if (instr == end) {
+    return;
+  }
+#if VM_COMPUTED_GOTO
+#define DISPATCH_LABEL(name) &&label##name,
+  static void *labels[NumHandlers] = {DISPATCH_HANDLERS(DISPATCH_LABEL)
+                                          &&labelFused};
+#undef DISPATCH_LABEL
+#define DISPATCH_CASE(name)                                                    \
+  label##name:                                                                 \
+  handle##name(instr, data);                                                   \
+  if (++instr == end)                                                          \
+    return;                                                                    \
+  goto *labels[instr->handler];
+
+  goto *labels[instr->handler];
+  DISPATCH_HANDLERS(DISPATCH_CASE)
+#undef DISPATCH_CASE
+labelFused:
+  runChain(program, &program->chains[instr->chain], data);
+  instr += program->chains[instr->chain].length;
+  if (instr == end)
+    return;
+  goto *labels[instr->handler];
+#else
+  while (instr < end) {
+    if (instr->handler == hFused) {
+      runChain(program, &program->chains[instr->chain], data);
+      instr += program->chains[instr->chain].length;
+    } else {
+      handlers[instr->handler](instr, data);
+      instr++;
+    }
+  }
+#endif
+}
@@ -0,0 +1,66 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "VM.h"
+
+/*
+Threaded dispatch engine.
+
+Each decoded instruction gets a handler specialized for its (opcode, memory
+type, register type) combination, so the bit logic instructions run without
+the nested if-chains of executeInstruction. Instructions without a
+specialized handler fall back to executeInstruction.
+
+With GCC/Clang the handlers are chained with computed goto ("labels as
+values"), otherwise a table of function pointers is used.
+
+Straight-line sequences of bit logic instructions (LD, LDN, AND, ANDN, OR,
+ORN, XOR, XORN on IX, QX and MX) are fused into a chain of bit groups: the
+bits of consecutive instructions with the same operation that fall in the
+same 8 bytes of the process image are tested with one 64-bit load, e.g.
+
+    LD IX0.0; AND IX0.1; ANDN IX1.7  ->  acc = ((word ^ invert) & mask) == mask
+
+Define VM_NO_BIT_FUSION to run every instruction on its own handler.
+*/
+
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+#ifndef VM_NO_BIT_FUSION
+#define VM_BIT_FUSION 1
+#else
+#define VM_BIT_FUSION 0
+#endif
+
+// Handler list: Generic + bit logic on I, Q and M (in this order)
+#define DISPATCH_HANDLERS(H)                                                   \
+  H(Generic)                                                                   \
+  H(LD_I) H(LD_Q) H(LD_M)                                                      \
+  H(LDN_I) H(LDN_Q) H(LDN_M)                                                   \
+  H(AND_I) H(AND_Q) H(AND_M)                                                   \
+  H(ANDN_I) H(ANDN_Q) H(ANDN_M)                                                \
+  H(OR_I) H(OR_Q) H(OR_M)                                                      \
+  H(ORN_I) H(ORN_Q) H(ORN_M)                                                   \
+  H(XOR_I) H(XOR_Q) H(XOR_M)                                                   \
+  H(XORN_I) H(XORN_Q) H(XORN_M)                                                \
+  H(ST_Q) H(ST_M)                                                              \
+  H(STN_Q) H(STN_M)                                                            \
+  H(S_Q) H(S_M)                                                                \
+  H(R_Q) H(R_M)                                                                \
+  H(NOT)
+
+#define DISPATCH_ENUM(name) h##name,
+// hFused runs a whole chain and is dispatched apart from the other handlers
+enum { DISPATCH_HANDLERS(DISPATCH_ENUM) hFused, NumHandlers };
+#undef DISPATCH_ENUM
+
+// Function prototypes
+uint8_t selectHandler(const Instruction *instr);
+uint8_t prepareDispatch(Program *program, Data *data);
+void runProgram(Program *program, Data *data);
+
+#endif // DISPATCH_H
@@ -0,0 +1,149 @@
+#ifndef FIXEDVM_H
+#define FIXEDVM_H
+
+#include "VM.h"
+#include "dispatch.h"
+
+/*
+Fixed-size VM build.
+
+For targets where the process image and the number of resources are known
+when the firmware is built, FixedVM holds all the VM state in one object
+sized by template parameters, so nothing is allocated at run time and the
+compiler sees the sizes as constants: the copies of the inputs and outputs
+become fixed-length moves and the loops over the timers, counters and
+triggers can be unrolled.
+
+The defaults come from VMparameters.h, which stays the only place where the
+sizes are defined:
+
+    FixedVM<DefaultConfig> vm;                      // default sizes
+    FixedVM<VMConfig<4, 4, 32, 2, 2, 0, 4>> small;  // a small target
+
+A program is accepted when the sizes of its header fit in the configuration
+and its constant timer, counter and trigger numbers are available.
+*/
+
+template <uint16_t InputBytes, uint16_t OutputBytes, uint16_t MemoryBytes,
+          uint8_t Timers, uint8_t Counters, uint8_t Triggers,
+          uint8_t StackSize>
+struct VMConfig {
+  static constexpr uint16_t inputSize = InputBytes;
+  static constexpr uint16_t outputSize = OutputBytes;
+  static constexpr uint16_t memorySize = MemoryBytes;
+  static constexpr uint32_t imageSize =
+      (uint32_t)InputBytes + OutputBytes + MemoryBytes;
+  static constexpr uint8_t numTimers = Timers;
+  static constexpr uint8_t numCounters = Counters;
+  static constexpr uint8_t numTriggers = Triggers;
+  static constexpr uint8_t stackSize = StackSize;
+
+  static_assert(imageSize > 0, "The process image cannot be empty");
+  static_assert(StackSize > 0, "The stack needs at least one element");
+};
+
+typedef VMConfig<InputSize, OutputSize, MemorySize, MAX_TIMERS, MAX_COUNTERS,
+                 MAX_TRIGGERS, STACK_MAX_SIZE>
+    DefaultConfig;
+
+// Arrays of zero resources are not allowed, keep one unused element
+#define FIXED_COUNT(n) ((n) > 0 ? (n) : 1)
+
+template <typename Config> struct FixedVM {
+  alignas(CacheLineSize) uint8_t image[Config::imageSize];
+  Timer timers[FIXED_COUNT(Config::numTimers)];
+  Counter counters[FIXED_COUNT(Config::numCounters)];
+  Trigger triggers[FIXED_COUNT(Config::numTriggers)];
+  StackElement stackElements[Config::stackSize];
+  Stack stack;
+  Data data;
+  Program program;
+};
+
+/**
+ * Loads a program into a fixed-size VM.
+ *
+ * The program buffer must stay valid while the VM runs, the K constants are
+ * read from it.
+ *
+ * @param vm The VM to load the program into.
+ * @param buffer The buffer containing the program.
+ * @return The error code.
+ */
+template <typename Config>
+uint8_t loadFixedVM(FixedVM<Config> *vm, uint8_t *buffer) {
+  ProgramHeader header;
+  if (verifyProgramIntegrity(buffer) != noError) {
+    printf("Program integrity error\n");
+    return criticalError;
+  }
+  if (readProgramHeader(buffer, &header) != 0) {
+    printf("Invalid program header\n");
+    return criticalError;
+  }
+  if (header.inputSize > Config::inputSize ||
+      header.outputSize > Config::outputSize ||
+      header.memorySize > Config::memorySize) {
+    printf("Error: The program needs more memory than the VM provides\n");
+    return criticalError;
+  }
+
+  Data *data = &vm->data;
+  data->Inputs = vm->image;
+  data->Outputs = vm->image + Config::inputSize;
+  data->Memories = data->Outputs + Config::outputSize;
+  data->inputSize = Config::inputSize;
+  data->outputSize = Config::outputSize;
+  data->memorySize = Config::memorySize;
+  data->imageSize = Config::imageSize;
+  data->accumulator = 0;
+
+  initStack(&vm->stack, vm->stackElements, Config::stackSize);
+  initializeTimer(vm->timers, Config::numTimers);
+  initializeCounter(vm->counters, Config::numCounters);
+  initializeTrigger(vm->triggers, Config::numTriggers);
+  initializeMemory(data, vm->timers, vm->counters, vm->triggers, &vm->stack);
+
+  if (decodeProgram(buffer, &vm->program) != noError) {
+    return criticalError;
+  }
+  if (resolveOperands(&vm->program, data) != noError ||
+      checkResources(&vm->program, Config::numTimers, Config::numCounters,
+                     Config::numTriggers) != noError) {
+    freeProgram(&vm->program);
+    return criticalError;
+  }
+  if (prepareDispatch(&vm->program, data) != noError) {
+    freeProgram(&vm->program);
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Runs one scan: copies the inputs in, runs the program and copies the
+ * outputs out.
+ *
+ * @param vm The VM with a program loaded by loadFixedVM.
+ * @param inputs The inputs, Config::inputSize bytes.
+ * @param outputs The buffer for the outputs, Config::outputSize bytes.
+ */
+template <typename Config>
+void scanFixedVM(FixedVM<Config> *vm, const uint8_t *inputs,
+                 uint8_t *outputs) {
+  memcpy(vm->data.Inputs, inputs, Config::inputSize);
+  vm->data.accumulator = 0;
+  runProgram(&vm->program, &vm->data);
+  memcpy(outputs, vm->data.Outputs, Config::outputSize);
+}
+
+/**
+ * Releases the program of a fixed-size VM.
+ *
+ * @param vm The VM.
+ */
+template <typename Config> void unloadFixedVM(FixedVM<Config> *vm) {
+  freeProgram(&vm->program);
+}
+
+#endif // FIXEDVM_H
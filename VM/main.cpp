@@ -3,6 +3,16 @@
 #include "timer.h"
 #include "counter.h"
 #include "trigger.h"
+#include "dispatch.h"
+#include "benchmark.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "cyclic.h"
+#include "trace.h"
+#include "profiler.h"
+#include "telemetry.h"
+#include "programFile.h"
+#include "reload.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////
 // Only for testing
@@ -19,7 +29,7 @@
  * @param operand2 The third operand.
  * @return The new position in the buffer after encoding the instruction.
  */
-uint16_t encodeInstruction(uint8_t *buffer, uint16_t bufPos, uint8_t opperation,
+uint32_t encodeInstruction(uint8_t *buffer, uint32_t bufPos, uint8_t opperation,
                            Operand operand[], uint64_t Kn[]) {
   buffer[bufPos] = opperation;
   uint8_t num_operands = getNumOp(opperation);
@@ -57,57 +67,14 @@ uint16_t encodeInstruction(uint8_t *buffer, uint16_t bufPos, uint8_t opperation,
   return bufPos;
 }
 
-/**
- * Gets the size of a file.
- * 
- * @param filename The name of the file to get the size of.
- * @return The size of the file.
-*/
-uint32_t getProgramSizeFromFile(const char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (file == NULL) {
-    printf("Error opening file %s\n", filename);
-    return 0;
-  }
-  uint32_t size = 0;
-  while (!feof(file)) {
-    fgetc(file);
-    size++;
-  }
-  fclose(file);
-  return size;
-}
-
-/**
- * Reads a program from a file.
- * 
- * @param filename The name of the file to read the program from.
- * @param buffer The buffer to read the program into.
- * @return The error code.
-*/
-uint8_t readProgramFromFile(const char *filename, uint8_t *buffer) {
-  FILE *file = fopen(filename, "rb");
-  if (file == NULL) {
-    printf("Error opening file %s\n", filename);
-    return criticalError;
-  }
-  uint16_t i = 0;
-  int c;
-  while ((c = fgetc(file)) != EOF) {
-    buffer[i] = (uint8_t)c;
-    i++;
-  }
-  fclose(file);
-  return noError;
-}
-
 /**
  * Prints an instruction.
  *
  * @param instr The instruction to print.
+ * @param constants The K constants of the program (Program.constants).
  */
-void printInstruction(Instruction instr, uint8_t *program) {
-  switch (instr.opcode) {
+void printInstruction(const Instruction *instr, uint8_t *constants) {
+  switch (instr->opcode) {
   case InstLD: printf("LD "); break;
   case InstLDN: printf("LDN "); break;
   case InstST: printf("ST "); break;
@@ -150,65 +117,65 @@ void printInstruction(Instruction instr, uint8_t *program) {
   default:
     break;
   }
-  for (uint16_t i = 0; i < instr.num_operands; i++) {
-    if (instr.operands[i].memorytype == X) {
-      if (instr.operands[i].registertype == I)
-        printf("IX%d.%d ", instr.operands[i].address,
-               instr.operands[i].bitNumber);
-      else if (instr.operands[i].registertype == Q)
-        printf("QX%d.%d ", instr.operands[i].address,
-               instr.operands[i].bitNumber);
-      else if (instr.operands[i].registertype == M)
-        printf("MX%d.%d ", instr.operands[i].address,
-               instr.operands[i].bitNumber);
-      else if (instr.operands[i].registertype == K)
-          printf("KX%d ", (program[instr.operands[i].address])==0?0:1);
-    } else if (instr.operands[i].memorytype == B) {
-      if (instr.operands[i].registertype == I)
-        printf("IB%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == Q)
-        printf("QB%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == M)
-        printf("MB%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == K)
-        printf("KB%d ", program[instr.operands[i].address]);
-    } else if (instr.operands[i].memorytype == W) {
-      if (instr.operands[i].registertype == I)
-        printf("IW%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == Q)
-        printf("QW%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == M)
-        printf("MW%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == K)
-        printf("KW%d ", getWordFromAddress(program, instr.operands[i].address));
-    } else if (instr.operands[i].memorytype == D) {
-      if (instr.operands[i].registertype == I)
-        printf("ID%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == Q)
-        printf("QD%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == M)
-        printf("MD%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == K)
-        printf("KD%d ", getDoubleWordFromAddress(program, instr.operands[i].address));
-    } else if (instr.operands[i].memorytype == L) {
-      if (instr.operands[i].registertype == I)
-        printf("IL%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == Q)
-        printf("QL%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == M)
-        printf("ML%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == K)
-        printf("KD%ld ", getLongWordFromAddress(program, instr.operands[i].address));
+  for (uint16_t i = 0; i < instr->num_operands; i++) {
+    if (instr->operands[i].memorytype == X) {
+      if (instr->operands[i].registertype == I)
+        printf("IX%d.%d ", instr->operands[i].address,
+               instr->operands[i].bitNumber);
+      else if (instr->operands[i].registertype == Q)
+        printf("QX%d.%d ", instr->operands[i].address,
+               instr->operands[i].bitNumber);
+      else if (instr->operands[i].registertype == M)
+        printf("MX%d.%d ", instr->operands[i].address,
+               instr->operands[i].bitNumber);
+      else if (instr->operands[i].registertype == K)
+          printf("KX%d ", (constants[instr->operands[i].address])==0?0:1);
+    } else if (instr->operands[i].memorytype == B) {
+      if (instr->operands[i].registertype == I)
+        printf("IB%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == Q)
+        printf("QB%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == M)
+        printf("MB%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == K)
+        printf("KB%d ", constants[instr->operands[i].address]);
+    } else if (instr->operands[i].memorytype == W) {
+      if (instr->operands[i].registertype == I)
+        printf("IW%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == Q)
+        printf("QW%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == M)
+        printf("MW%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == K)
+        printf("KW%d ", getWordFromAddress(constants, instr->operands[i].address));
+    } else if (instr->operands[i].memorytype == D) {
+      if (instr->operands[i].registertype == I)
+        printf("ID%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == Q)
+        printf("QD%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == M)
+        printf("MD%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == K)
+        printf("KD%d ", getDoubleWordFromAddress(constants, instr->operands[i].address));
+    } else if (instr->operands[i].memorytype == L) {
+      if (instr->operands[i].registertype == I)
+        printf("IL%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == Q)
+        printf("QL%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == M)
+        printf("ML%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == K)
+        printf("KD%ld ", getLongWordFromAddress(constants, instr->operands[i].address));
     }
-    else if (instr.operands[i].memorytype == R) {
-      if (instr.operands[i].registertype == I)
-        printf("IR%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == Q)
-        printf("QR%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == M)
-        printf("MR%d ", instr.operands[i].address);
-      else if (instr.operands[i].registertype == K){
-        printf("KR%f ",getFloatFromAddress(program, instr.operands[i].address));
+    else if (instr->operands[i].memorytype == R) {
+      if (instr->operands[i].registertype == I)
+        printf("IR%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == Q)
+        printf("QR%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == M)
+        printf("MR%d ", instr->operands[i].address);
+      else if (instr->operands[i].registertype == K){
+        printf("KR%f ",getFloatFromAddress(constants, instr->operands[i].address));
       }        
     }
   }
@@ -222,19 +189,19 @@ void printInstruction(Instruction instr, uint8_t *program) {
  */
 void printMemory(Data *data) {
   printf("\t");
-  for (uint16_t i = 0; i < MemorySize; i++) {
+  for (uint16_t i = 0; i < data->memorySize; i++) {
     printf("%d\t", i);
   }
   printf("\nI:\t");
-  for (uint16_t i = 0; i < InputSize; i++) {
+  for (uint16_t i = 0; i < data->inputSize; i++) {
     printf("%X\t", data->Inputs[i]);
   }
   printf("\nM:\t");
-  for (uint16_t i = 0; i < MemorySize; i++) {
+  for (uint16_t i = 0; i < data->memorySize; i++) {
     printf("%X\t", data->Memories[i]);
   }
   printf("\nQ:\t");
-  for (uint16_t i = 0; i < OutputSize; i++) {
+  for (uint16_t i = 0; i < data->outputSize; i++) {
     printf("%X\t", data->Outputs[i]);
   }
   printf("\nAccumulator = %d", data->accumulator);
@@ -244,9 +211,9 @@ void printMemory(Data *data) {
 
 // append the sum of all bytes of the program to the end of the program in 32 bits format
 void encodeProgramCS(uint8_t *program) {
-  uint16_t size = getProgramSize(program);
+  uint32_t size = getProgramSize(program);
   uint32_t sum = 0;
-  for (uint16_t i = 0; i < size; i++) {
+  for (uint32_t i = 0; i < size; i++) {
     sum += program[i];
   }
   program[size] = (uint8_t)(sum >> 24) & 0xFF;
@@ -255,9 +222,9 @@ void encodeProgramCS(uint8_t *program) {
   program[size + 3] = (uint8_t)sum & 0xFF;
 }
 
-void printProgramInHEX(uint8_t *program, uint16_t size) {
+void printProgramInHEX(uint8_t *program, uint32_t size) {
   printf("\n{");
-  for (uint16_t i = 0; i < size; i++) {
+  for (uint32_t i = 0; i < size; i++) {
     printf("0x%02X", program[i]);
     if (i < size - 1)
       printf(",");
@@ -278,19 +245,244 @@ void readInputsfromFile(Data *data, const char *filename) {
     printf("Error opening file %s\n", filename);
     return;
   }
-  for (uint16_t i = 0; i < InputSize; i++) {
+  for (uint16_t i = 0; i < data->inputSize; i++) {
     fscanf(file, "%X", &tmp);
     data->Inputs[i]=(uint8_t)tmp;
   }
   fclose(file);
 }
 
-int main() {
+/**
+ * Reads the inputs before each scan of the fixed-period loop.
+ *
+ * @param data The data structure to read the inputs into.
+ * @param user The name of the file to read the inputs from.
+ * @return 0 to keep running.
+*/
+uint8_t readCycleInputs(Data *data, void *user) {
+  readInputsfromFile(data, (const char *)user);
+  return 0;
+}
+
+/**
+ * Runs scans without console output.
+ *
+ * @param decoded The decoded program, prepared by prepareDispatch.
+ * @param data The data structure containing the memory and register values.
+ * @param scans The number of scans to run.
+ * @param trace The trace sink, or NULL to run without tracing.
+ * @param traceInstructions Also trace every instruction, through the
+ * instruction-by-instruction loop.
+ * @return The time taken in nanoseconds.
+*/
+uint64_t runHeadless(Program *decoded, Data *data, uint64_t scans,
+                     TraceSink *trace, uint8_t traceInstructions) {
+  uint64_t start = getMonotonicNs();
+  if (trace == NULL) {
+    for (uint64_t s = 0; s < scans; s++) {
+      data->accumulator = 0;
+      runProgram(decoded, data);
+    }
+  } else if (!traceInstructions) {
+    for (uint64_t s = 0; s < scans; s++) {
+      data->accumulator = 0;
+      runProgram(decoded, data);
+      traceScan(trace, s, data);
+    }
+  } else {
+    for (uint64_t s = 0; s < scans; s++) {
+      data->accumulator = 0;
+      for (uint32_t i = 0; i < decoded->numInstructions; i++) {
+        executeInstruction(&decoded->instructions[i], data);
+        traceInstruction(trace, i, &decoded->instructions[i], data);
+      }
+      traceScan(trace, s, data);
+    }
+  }
+  return getMonotonicNs() - start;
+}
+
+/**
+ * Prints the telemetry published by another VM every second.
+ *
+ * @param name The name of the shared memory segment.
+ * @param seconds The time to monitor, 0 until the process is stopped.
+ * @return The exit code.
+*/
+int runMonitor(const char *name, uint32_t seconds) {
+  Telemetry telemetry;
+  TelemetryBlock snapshot;
+  if (openTelemetry(&telemetry, name) != noError) {
+    return 1;
+  }
+  for (uint32_t s = 0; seconds == 0 || s < seconds; s++) {
+    if (readTelemetry(telemetry.block, &snapshot) == noError) {
+      printTelemetry(&snapshot);
+    } else {
+      printf("Telemetry not available\n");
+    }
+    printf("--------------------------------------------------\n");
+    sleepNs(1000000000ULL);
+  }
+  closeTelemetry(&telemetry);
+  return 0;
+}
+
+/**
+ * Runs several programs on the scan scheduler, each one with its own scan
+ * period, and prints the statistics of the tasks.
+ *
+ * @param specs The tasks, as program.bin:period in microseconds.
+ * @param count The number of tasks.
+ * @param seconds The time to run.
+ * @return The exit code.
+*/
+int runTasks(char **specs, uint16_t count, uint32_t seconds) {
+  Scheduler scheduler;
+  ProgramFile *files = (ProgramFile *)calloc(count, sizeof(ProgramFile));
+  uint16_t mapped = 0;
+  int result = 1;
+  if (files == NULL || initScheduler(&scheduler, count, 0) != noError) {
+    free(files);
+    return 1;
+  }
+  for (; mapped < count; mapped++) {
+    // The period follows the last ':', the file name may hold one
+    char *separator = strrchr(specs[mapped], ':');
+    uint32_t periodUs = separator != NULL ? (uint32_t)strtoul(separator + 1, NULL, 10) : 0;
+    if (separator == NULL || periodUs == 0) {
+      printf("Error: Invalid task %s, expected program.bin:period\n", specs[mapped]);
+      break;
+    }
+    *separator = '\0';
+    if (mapProgramFile(specs[mapped], &files[mapped]) != noError) {
+      printf("Error reading the program from file %s\n", specs[mapped]);
+      break;
+    }
+    if (addTask(&scheduler, files[mapped].buffer, periodUs) < 0) {
+      mapped++;
+      break;
+    }
+    readInputsfromFile(&scheduler.tasks[mapped].data, "inputs.txt");
+  }
+  if (mapped == count && scheduler.numTasks == count) {
+    printf("Running %d tasks on %d workers\n", scheduler.numTasks, scheduler.numWorkers);
+    if (startScheduler(&scheduler) == noError) {
+      sleepNs((uint64_t)seconds * 1000000000ULL);
+      stopScheduler(&scheduler);
+      printSchedulerStats(&scheduler);
+      result = 0;
+    }
+  }
+  freeScheduler(&scheduler);
+  for (uint16_t i = 0; i < mapped; i++) {
+    if (files[i].buffer != NULL) {
+      unmapProgramFile(&files[i]);
+    }
+  }
+  free(files);
+  return result;
+}
+
+/*
+Command line:
+  (none)                 interactive mode, traces every instruction
+  -headless <scans>      runs the scans without console output
+  -trace <file>          headless, records the process image after each scan
+  -trace-all <file>      headless, also records every instruction
+  -profile <scans> [hot] runs the scans measuring every instruction and
+                         prints a flat profile and the hot instructions,
+                         with their source lines from program.bin.lines
+  -cyclic <us> [scans]   runs the scans on a fixed cycle time, until stopped
+                         when no number of scans is given
+  -telemetry <name>      with -cyclic, publishes the scan times in the
+                         shared memory segment <name>
+  -reload                with -cyclic, swaps in a new program.bin between
+                         two scans, keeping the process image and the
+                         timers, counters and triggers
+  -monitor <name> [s]    prints the telemetry of a running VM every second
+  -tasks <s> <program.bin:us> ...
+                         runs the programs on the scan scheduler for s
+                         seconds, each one with its own period in us
+  -suite <compiler> <results.json> [rungs]
+                         generates, compiles and measures the synthetic
+                         programs of the benchmark suite
+  -check <compiler> [rungs]
+                         runs the programs of the suite compiled with and
+                         without the optimizer (-n) and compares the
+                         outputs and memories after every scan
+*/
+int main(int argc, char *argv[]) {
+  uint64_t headlessScans = 0;
+  const char *traceFile = NULL;
+  uint8_t traceInstructions = 0;
+  uint64_t profileScans = 0;
+  uint16_t hotInstructions = DefaultHotInstructions;
+  uint32_t cycleUs = 0;
+  uint64_t cycleScans = 0;
+  const char *telemetryName = NULL;
+  uint8_t reload = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-headless") == 0 && i + 1 < argc) {
+      headlessScans = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "-profile") == 0 && i + 1 < argc) {
+      profileScans = strtoull(argv[++i], NULL, 10);
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        hotInstructions = (uint16_t)strtoul(argv[++i], NULL, 10);
+      }
+    } else if (strcmp(argv[i], "-cyclic") == 0 && i + 1 < argc) {
+      cycleUs = (uint32_t)strtoul(argv[++i], NULL, 10);
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        cycleScans = strtoull(argv[++i], NULL, 10);
+      }
+    } else if (strcmp(argv[i], "-telemetry") == 0 && i + 1 < argc) {
+      telemetryName = argv[++i];
+    } else if (strcmp(argv[i], "-reload") == 0) {
+      reload = 1;
+    } else if (strcmp(argv[i], "-monitor") == 0 && i + 1 < argc) {
+      uint32_t seconds = i + 2 < argc ? (uint32_t)strtoul(argv[i + 2], NULL, 10) : 0;
+      return runMonitor(argv[i + 1], seconds);
+    } else if (strcmp(argv[i], "-tasks") == 0 && i + 2 < argc) {
+      uint32_t seconds = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+      int count = 0;
+      while (i + 2 + count < argc && argv[i + 2 + count][0] != '-') {
+        count++;
+      }
+      if (count == 0 || count > UINT16_MAX) {
+        printf("Error: -tasks needs at least one program.bin:period\n");
+        return 1;
+      }
+      return runTasks(&argv[i + 2], (uint16_t)count, seconds);
+    } else if (strcmp(argv[i], "-suite") == 0 && i + 2 < argc) {
+      uint32_t rungs = i + 3 < argc ? (uint32_t)strtoul(argv[i + 3], NULL, 10) : 100;
+      return benchmarkSuite(argv[i + 1], argv[i + 2], rungs, 20000) == noError ? 0 : 1;
+    } else if (strcmp(argv[i], "-check") == 0 && i + 1 < argc) {
+      uint32_t rungs = i + 2 < argc ? (uint32_t)strtoul(argv[i + 2], NULL, 10) : 100;
+      return checkOptimizer(argv[i + 1], rungs, 2000) == noError ? 0 : 1;
+    } else if ((strcmp(argv[i], "-trace") == 0 || strcmp(argv[i], "-trace-all") == 0) && i + 1 < argc) {
+      traceInstructions = strcmp(argv[i], "-trace-all") == 0;
+      traceFile = argv[++i];
+    } else {
+      printf("Usage: %s [-headless <scans>] [-trace <file> | -trace-all <file>]\n", argv[0]);
+      printf("       %s -profile <scans> [hot]\n", argv[0]);
+      printf("       %s -cyclic <us> [scans] [-telemetry <name>] [-reload]\n", argv[0]);
+      printf("       %s -monitor <name> [seconds]\n", argv[0]);
+      printf("       %s -tasks <seconds> <program.bin:us> [program.bin:us ...]\n", argv[0]);
+      printf("       %s -suite <compiler> <results.json> [rungs]\n", argv[0]);
+      printf("       %s -check <compiler> [rungs]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (traceFile != NULL && headlessScans == 0) {
+    headlessScans = 1;
+  }
+
   // debug data + timers + counters + triggers in bytes
   uint8_t debugData[sizeof(Data) + MAX_TIMERS * sizeof(Timer) + MAX_COUNTERS * sizeof(Counter) + MAX_TRIGGERS * sizeof(Trigger) + sizeof(Stack)];
   // Stack initalization
+  StackElement stackElements[STACK_MAX_SIZE];
   Stack stack;
-  initStack(&stack);
+  initStack(&stack, stackElements, STACK_MAX_SIZE);
 
   // timer initialization
   Timer timers[MAX_TIMERS];
@@ -310,32 +502,26 @@ int main() {
 
   // #define Prati
   #define Kerschbaumer 
+  // #define Threaded // Runs the scans through the threaded dispatch engine
+  // #define Benchmark // Measures the execution paths instead of running the scans
   
-  #ifdef Kerschbaumer
+  // program.bin, also the file watched by -reload in every build
   const char *filename = "..//VMcompiler//program.bin";
-  // dynamically allocate a buffer to store the program
-  uint32_t fileSize = getProgramSizeFromFile(filename);
-  uint8_t *program = (uint8_t *)malloc(fileSize);
-  if (program == NULL) {
-    printf("Error allocating memory for the program\n");
-    return 0;
-  }
 
-  // read the program from the file
-  if (readProgramFromFile(filename, program) != noError) {
+  #ifdef Kerschbaumer
+  // map the program read only, the VM runs on the mapping
+  ProgramFile programFile;
+  if (mapProgramFile(filename, &programFile) != noError) {
     printf("Error reading the program from file\n");
     return 0;
   }
+  uint8_t *program = programFile.buffer;
   #endif // End of Kerschbaumer
 
-  Data data;
-  uint16_t bufPos = 2;
-  uint16_t programSize = 0;
- 
-  initializeMemory(&data,timers,counters,triggers,&stack);
-
   #ifdef Prati
   uint8_t program[1000];// = (uint8_t *)malloc(fileSize);
+  uint32_t bufPos = 2;
+  uint32_t programSize = 0;
     
   // Test program
   // LD IX0.0
@@ -433,11 +619,6 @@ int main() {
 
   encodeProgramCS(program); 
   
-   // Set the inputs
-  data.Inputs[0] = 0b00001111;
-  data.Inputs[1] = 0b00000001;
-  data.Inputs[2] = 0b00000000;
-  
   #endif // End of Prati
   
   // Run the program
@@ -445,34 +626,170 @@ int main() {
     printf("Program integrity error\n");
     return 1;
   }
+
+  // The process image is sized by the program header
+  ProgramHeader header;
+  if(readProgramHeader(program, &header) != 0) {
+    printf("Invalid program header\n");
+    return 1;
+  }
+  Arena arena;
+  if(initArena(&arena, getRequiredMemory(&header)) != noError) {
+    printf("Error allocating memory for the process image\n");
+    return 1;
+  }
+  Data data;
+  if(allocateMemory(&data, &header, &arena) != noError) {
+    return 1;
+  }
+  initializeMemory(&data,timers,counters,triggers,&stack);
+
+  #ifdef Prati
+   // Set the inputs
+  data.Inputs[0] = 0b00001111;
+  data.Inputs[1] = 0b00000001;
+  data.Inputs[2] = 0b00000000;
+  #endif // End of Prati
   
+  // Decode the program once, the scan loop only iterates the instructions
+  Program decoded;
+  if(decodeProgram(program, &decoded) != noError) {
+    printf("Error decoding the program\n");
+    return 1;
+  }
+  if(resolveOperands(&decoded, &data) != noError) {
+    printf("Error resolving the operands\n");
+    return 1;
+  }
+  if(checkResources(&decoded, MAX_TIMERS, MAX_COUNTERS, MAX_TRIGGERS) != noError) {
+    return 1;
+  }
+  if(prepareDispatch(&decoded, &data) != noError) {
+    return 1;
+  }
+
+  #ifdef Benchmark
+  #ifdef Kerschbaumer
+    readInputsfromFile(&data, "inputs.txt");
+  #endif // End of Kerschbaumer
+  benchmarkEngines(&decoded, &data, 100000);
+  benchmarkBatch(program, data.Inputs, 256, 10000);
+  freeProgram(&decoded);
+  freeArena(&arena);
+  return 0;
+  #endif // End of Benchmark
+
+  if (cycleUs > 0) {
+    // The timers advance with the clock
+    Telemetry telemetry;
+    telemetry.block = NULL;
+    if (telemetryName != NULL && createTelemetry(&telemetry, telemetryName, cycleUs) != noError) {
+      return 1;
+    }
+    CycleStats cycleStats;
+    Reloader reloader;
+    Reloader *reloading = NULL;
+    if (reload) {
+      if (startReloader(&reloader, filename, &data, MAX_TIMERS, MAX_COUNTERS, MAX_TRIGGERS) != noError) {
+        return 1;
+      }
+      reloading = &reloader;
+    }
+    #ifdef Kerschbaumer
+      runCyclic(&decoded, &data, cycleUs, cycleScans, readCycleInputs, (void *)"inputs.txt", &cycleStats, telemetry.block, reloading);
+    #else
+      runCyclic(&decoded, &data, cycleUs, cycleScans, NULL, NULL, &cycleStats, telemetry.block, reloading);
+    #endif // End of Kerschbaumer
+    if (reloading != NULL) {
+      // the counters are read once the watcher thread is joined
+      stopReloader(&reloader);
+      printf("%u programs reloaded, %u rejected\n", reloader.reloads, reloader.rejected);
+    }
+    closeTelemetry(&telemetry);
+    printMemory(&data);
+    printCycleStats(&cycleStats, cycleUs);
+    freeProgram(&decoded);
+    freeArena(&arena);
+    return 0;
+  }
+
+  if (profileScans > 0) {
+    #ifdef Kerschbaumer
+      readInputsfromFile(&data, "inputs.txt");
+    #endif // End of Kerschbaumer
+    Profile profile;
+    if (initProfile(&profile, &decoded) != noError) {
+      return 1;
+    }
+    // the source lines of the instructions, written by the compiler
+    char linesName[512];
+    snprintf(linesName, sizeof(linesName), "%s.lines", filename);
+    loadSourceLines(&profile, &decoded, linesName);
+    for (uint64_t s = 0; s < profileScans; s++) {
+      profileScan(&profile, &decoded, &data);
+    }
+    printProfile(&profile, &decoded, hotInstructions);
+    freeProfile(&profile);
+    freeProgram(&decoded);
+    freeArena(&arena);
+    return 0;
+  }
+
+  if (headlessScans > 0) {
+    #ifdef Kerschbaumer
+      readInputsfromFile(&data, "inputs.txt");
+    #endif // End of Kerschbaumer
+    TraceSink trace;
+    if (traceFile != NULL && openTraceSink(&trace, traceFile, 0) != noError) {
+      return 1;
+    }
+    uint64_t ns = runHeadless(&decoded, &data, headlessScans,
+                              traceFile != NULL ? &trace : NULL, traceInstructions);
+    if (traceFile != NULL) {
+      closeTraceSink(&trace);
+    }
+    printMemory(&data);
+    printf("%lu scans in %.3f ms: %.1f ns/scan, %.1f M instructions/s\n",
+           (unsigned long)headlessScans, ns / 1e6, (double)ns / headlessScans,
+           (double)headlessScans * decoded.numInstructions * 1e3 / (ns > 0 ? ns : 1));
+    freeProgram(&decoded);
+    freeArena(&arena);
+    return 0;
+  }
+
   printMemory(&data);
-  programSize = getProgramSize(program);
   int c=0;
 
   while (c != 'q')
   {
-    bufPos = 2;
     data.accumulator = 0;    
 
     #ifdef Kerschbaumer
       readInputsfromFile(&data, "inputs.txt");
     #endif // End of Kerschbaumer
 
-    while (bufPos < programSize) {
-      Instruction instr = readInstruction(program, &bufPos);
-      printInstruction(instr, program);
-      executeInstruction(program, instr, &data);
+    #ifdef Threaded
+      runProgram(&decoded, &data);
+      printMemory(&data);
+    #else
+    for (uint32_t i = 0; i < decoded.numInstructions; i++) {
+      printInstruction(&decoded.instructions[i], decoded.constants);
+      executeInstruction(&decoded.instructions[i], &data);
       printMemory(&data);
       }
+    #endif // End of Threaded
     printf("Press 'q <enter>' to quit, or '<enter>' to continue\n");
     printf("######################################################################\n");
     c = getchar();
   }
    
+  freeProgram(&decoded);
+  freeArena(&arena);
   //printProgramInHEX(program, programSize+4);
   //printf("Size = %d\n", programSize);
-  //free(program);
+  #ifdef Kerschbaumer
+  unmapProgramFile(&programFile);
+  #endif // End of Kerschbaumer
   //getchar();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include "profiler.h"
+#include "clock.h"
+
+// Instruction of the hot list
+typedef struct stHotEntry {
+  uint32_t index;
+  uint64_t cycles;
+} HotEntry;
+
+/**
+ * Initializes a profile for a program.
+ *
+ * @param profile The profile.
+ * @param program The decoded program.
+ * @return The error code.
+ */
+uint8_t initProfile(Profile *profile, const Program *program) {
+  memset(profile, 0, sizeof(*profile));
+  profile->numInstructions = program->numInstructions;
+  profile->instructions = (ProfileEntry *)calloc(
+      program->numInstructions > 0 ? program->numInstructions : 1,
+      sizeof(ProfileEntry));
+  if (profile->instructions == NULL) {
+    printf("Error allocating the profile\n");
+    return criticalError;
+  }
+  profile->overhead = UINT64_MAX;
+  for (uint16_t i = 0; i < 1000; i++) {
+    uint64_t c0 = readCycleCounter();
+    uint64_t c1 = readCycleCounter();
+    if (c1 - c0 < profile->overhead) {
+      profile->overhead = c1 - c0;
+    }
+  }
+  profile->startNs = getMonotonicNs();
+  profile->startCycles = readCycleCounter();
+  return noError;
+}
+
+/**
+ * Releases the source line map of a profile.
+ *
+ * @param source The map.
+ */
+static void freeSourceLines(SourceLines *source) {
+  for (uint32_t i = 0; i < source->numFiles; i++) {
+    free(source->files[i]);
+  }
+  free(source->files);
+  free(source->file);
+  free(source->lines);
+  memset(source, 0, sizeof(*source));
+}
+
+/**
+ * Adds a source file to the line map.
+ *
+ * @param source The map.
+ * @param name The name of the file, up to the end of the line.
+ * @return The error code.
+ */
+static uint8_t addSourceFile(SourceLines *source, char *name) {
+  char *count = strrchr(name, ' ');
+  if (count == NULL) {
+    return criticalError;
+  }
+  *count = '\0';
+  char **files = (char **)realloc(source->files,
+                                  (source->numFiles + 1) * sizeof(char *));
+  if (files == NULL) {
+    return criticalError;
+  }
+  source->files = files;
+  files[source->numFiles] = strdup(name);
+  if (files[source->numFiles] == NULL) {
+    return criticalError;
+  }
+  source->numFiles++;
+  return noError;
+}
+
+/**
+ * Reads the source line of each instruction from the line map the compiler
+ * writes next to the program. The map is ignored unless it describes this
+ * program (size and CRC) and all its instructions.
+ *
+ * @param profile The profile, initialized for the program.
+ * @param program The decoded program.
+ * @param filename The name of the map, program.bin.lines.
+ * @return The error code, warning without a usable map.
+ */
+uint8_t loadSourceLines(Profile *profile, const Program *program,
+                        const char *filename) {
+  SourceLines *source = &profile->source;
+  FILE *file = fopen(filename, "r");
+  if (file == NULL) {
+    printf("No source line map %s\n", filename);
+    return warning;
+  }
+  char line[512];
+  unsigned int size = 0;
+  unsigned int check = 0;
+  uint8_t error = warning;
+  if (fgets(line, sizeof(line), file) != NULL &&
+      sscanf(line, "program %u 0x%X", &size, &check) == 2 &&
+      size == program->header.programSize + 4 &&
+      check == readProgramCheck(program->buffer, &program->header)) {
+    uint32_t n = program->numInstructions > 0 ? program->numInstructions : 1;
+    source->file = (uint32_t *)malloc(n * sizeof(uint32_t));
+    source->lines = (uint32_t *)malloc(n * sizeof(uint32_t));
+    error = source->file != NULL && source->lines != NULL ? noError
+                                                          : criticalError;
+    while (error == noError && fgets(line, sizeof(line), file) != NULL) {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (strncmp(line, "file ", 5) == 0) {
+        error = addSourceFile(source, line + 5);
+      } else if (source->numFiles == 0 ||
+                 source->count == program->numInstructions) {
+        error = warning;
+      } else {
+        source->file[source->count] = source->numFiles - 1;
+        source->lines[source->count++] = (uint32_t)strtoul(line, NULL, 10);
+      }
+    }
+    if (error == noError && source->count != program->numInstructions) {
+      error = warning;
+    }
+  }
+  fclose(file);
+  if (error != noError) {
+    printf("Warning: %s does not match the program, no source lines\n",
+           filename);
+    freeSourceLines(source);
+  }
+  return error;
+}
+
+/**
+ * Runs one scan measuring every instruction.
+ *
+ * @param profile The profile, initialized for the program.
+ * @param program The decoded program.
+ * @param data The data structure containing the memory and register values.
+ */
+void profileScan(Profile *profile, Program *program, Data *data) {
+  data->accumulator = 0;
+  for (uint32_t i = 0; i < program->numInstructions; i++) {
+    const Instruction *instr = &program->instructions[i];
+    uint64_t c0 = readCycleCounter();
+    executeInstruction(instr, data);
+    uint64_t c = readCycleCounter() - c0;
+    c = c > profile->overhead ? c - profile->overhead : 0;
+    profile->opcodes[instr->opcode].count++;
+    profile->opcodes[instr->opcode].cycles += c;
+    profile->instructions[i].count++;
+    profile->instructions[i].cycles += c;
+  }
+  profile->scans++;
+}
+
+static int compareHot(const void *a, const void *b) {
+  uint64_t ca = ((const HotEntry *)a)->cycles;
+  uint64_t cb = ((const HotEntry *)b)->cycles;
+  return ca < cb ? 1 : (ca > cb ? -1 : 0);
+}
+
+/**
+ * Prints an operand as in the IL source.
+ *
+ * @param operand The operand.
+ * @param constants The K constants of the program.
+ */
+static void printOperand(const Operand *operand, uint8_t *constants) {
+  static const char registers[] = "IQMK";
+  static const char types[] = "XBWDLR";
+  printf(" %c%c", registers[operand->registertype & 3],
+         operand->memorytype < 6 ? types[operand->memorytype] : '?');
+  if (operand->registertype != K) {
+    printf("%d", operand->address);
+    if (operand->memorytype == X) {
+      printf(".%d", operand->bitNumber);
+    }
+  } else if (operand->memorytype == X || operand->memorytype == B) {
+    printf("%d", constants[operand->address]);
+  } else if (operand->memorytype == W) {
+    printf("%d", getWordFromAddress(constants, operand->address));
+  } else if (operand->memorytype == D) {
+    printf("%ld", (long)getDoubleWordFromAddress(constants, operand->address));
+  } else if (operand->memorytype == R) {
+    printf("%g", getFloatFromAddress(constants, operand->address));
+  }
+}
+
+/**
+ * Prints the flat profile by opcode and the hottest instructions.
+ *
+ * @param profile The profile.
+ * @param program The decoded program.
+ * @param hot The number of instructions of the hot list.
+ */
+void printProfile(const Profile *profile, const Program *program,
+                  uint16_t hot) {
+  uint64_t total = 0;
+  for (uint8_t op = 0; op < NumInstructions; op++) {
+    total += profile->opcodes[op].cycles;
+  }
+  uint64_t cycles = readCycleCounter() - profile->startCycles;
+  double nsPerCycle =
+      cycles > 0 ? (double)(getMonotonicNs() - profile->startNs) / cycles : 0;
+  double percent = total > 0 ? 100.0 / (double)total : 0.0;
+
+  printf("Flat profile: %lu scans, %.1f ns/scan\n",
+         (unsigned long)profile->scans,
+         profile->scans > 0 ? total * nsPerCycle / profile->scans : 0.0);
+  printf("opcode\t\texecutions\tcycles\t\t%%time\tcycles/exec\tns/exec\n");
+  HotEntry order[NumInstructions];
+  for (uint8_t op = 0; op < NumInstructions; op++) {
+    order[op].index = op;
+    order[op].cycles = profile->opcodes[op].cycles;
+  }
+  qsort(order, NumInstructions, sizeof(HotEntry), compareHot);
+  for (uint8_t i = 0; i < NumInstructions; i++) {
+    const ProfileEntry *e = &profile->opcodes[order[i].index];
+    if (e->count == 0) {
+      continue;
+    }
+    printf("%-8s\t%lu\t\t%lu\t\t%.1f\t%.1f\t\t%.1f\n",
+           getOpcodeName((uint8_t)order[i].index), (unsigned long)e->count,
+           (unsigned long)e->cycles, e->cycles * percent,
+           (double)e->cycles / e->count, e->cycles * nsPerCycle / e->count);
+  }
+
+  if (hot > profile->numInstructions) {
+    hot = profile->numInstructions;
+  }
+  HotEntry *list =
+      (HotEntry *)malloc((profile->numInstructions + 1) * sizeof(HotEntry));
+  if (list == NULL) {
+    return;
+  }
+  for (uint32_t i = 0; i < profile->numInstructions; i++) {
+    list[i].index = i;
+    list[i].cycles = profile->instructions[i].cycles;
+  }
+  qsort(list, profile->numInstructions, sizeof(HotEntry), compareHot);
+  printf("\nHot instructions\n");
+  printf("#\taddress\t%%time\tcycles/exec\tsource\t\tinstruction\n");
+  for (uint16_t i = 0; i < hot; i++) {
+    const Instruction *instr = &program->instructions[list[i].index];
+    const ProfileEntry *e = &profile->instructions[list[i].index];
+    printf("%d\t%d\t%.1f\t%.1f\t\t", list[i].index, instr->address,
+           e->cycles * percent,
+           e->count > 0 ? (double)e->cycles / e->count : 0.0);
+    const SourceLines *source = &profile->source;
+    if (list[i].index < source->count) {
+      printf("%s:%u\t", source->files[source->file[list[i].index]],
+             source->lines[list[i].index]);
+    } else {
+      printf("-\t\t");
+    }
+    printf("%s", getOpcodeName(instr->opcode));
+    for (uint8_t o = 0; o < instr->num_operands; o++) {
+      printOperand(&instr->operands[o], program->constants);
+    }
+    printf("\n");
+  }
+  free(list);
+}
+
+/**
+ * Releases a profile.
+ *
+ * @param profile The profile.
+ */
+void freeProfile(Profile *profile) {
+  free(profile->instructions);
+  profile->instructions = NULL;
+  freeSourceLines(&profile->source);
+}
@@ -0,0 +1,61 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "VM.h"
+
+/*
+Execution profiler.
+
+profileScan runs one scan instruction by instruction through
+executeInstruction and reads the cycle counter around each instruction, so
+the production paths (runProgram) carry no instrumentation at all. The
+cycles are accumulated per opcode and per instruction of the program, the
+cost of reading the counter is subtracted.
+
+printProfile prints a flat profile by opcode and the list of the hottest
+instructions with their position in program.bin. Instruction #n is the n-th
+instruction of program.bin, not of the IL source: the optimizer of the
+compiler removes and rewrites instructions. The source line of each one
+comes from the line map the compiler writes next to the program,
+program.bin.lines (see lines.h in VMcompiler); loadSourceLines reads it
+and the hot list prints file:line, or - without a map that matches the
+program.
+*/
+
+#define DefaultHotInstructions 20 // Length of the hot list
+
+typedef struct stProfileEntry {
+  uint64_t count;  // Executions
+  uint64_t cycles; // Cycles spent, without the measurement overhead
+} ProfileEntry;
+
+// Source line map of the program, program.bin.lines
+typedef struct stSourceLines {
+  char **files;      // Source files, in the order of the code
+  uint32_t numFiles;
+  uint32_t *file;    // File of each instruction
+  uint32_t *lines;   // Source line of each instruction, from 1
+  uint32_t count;    // Instructions of the map, 0 without a map
+} SourceLines;
+
+typedef struct stProfile {
+  ProfileEntry opcodes[NumInstructions];
+  ProfileEntry *instructions; // One per instruction of the program
+  uint32_t numInstructions;
+  uint64_t scans;
+  uint64_t overhead;    // Cycles of two consecutive counter reads
+  uint64_t startCycles; // To convert the cycles to ns
+  uint64_t startNs;
+  SourceLines source;
+} Profile;
+
+// Function prototypes
+uint8_t initProfile(Profile *profile, const Program *program);
+uint8_t loadSourceLines(Profile *profile, const Program *program,
+                        const char *filename);
+void profileScan(Profile *profile, Program *program, Data *data);
+void printProfile(const Profile *profile, const Program *program,
+                  uint16_t hot);
+void freeProfile(Profile *profile);
+
+#endif // PROFILER_H
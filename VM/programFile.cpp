@@ -0,0 +1,130 @@
+#include "programFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Checks that the program described by the header fits in the file.
+ *
+ * @param file The mapped file.
+ * @return The error code.
+ */
+static uint8_t checkProgramFile(const ProgramFile *file) {
+  ProgramHeader header;
+  // A header with magic is read up to its size, at least HeaderSize
+  // bytes, a program with its checksum is never shorter than that
+  if (file->size < HeaderSizeV0 ||
+      (readHeaderWord(file->buffer, 0) == ProgramMagic &&
+       (file->size < HeaderSize ||
+        file->size < file->buffer[HeaderLengthPos]))) {
+    return criticalError;
+  }
+  if (readProgramHeader(file->buffer, &header) != 0) {
+    return criticalError;
+  }
+  // The checksum follows the program
+  if ((uint64_t)header.programSize + 4 > file->size) {
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Maps a program file read only.
+ *
+ * @param filename The name of the file.
+ * @param file Receives the mapping.
+ * @return The error code.
+ */
+uint8_t mapProgramFile(const char *filename, ProgramFile *file) {
+  file->buffer = NULL;
+  file->size = 0;
+  file->handle = NULL;
+#ifdef _WIN32
+  HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    printf("Error opening file %s\n", filename);
+    return criticalError;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(handle, &size) || size.QuadPart > UINT32_MAX) {
+    printf("Error: Invalid size of file %s\n", filename);
+    CloseHandle(handle);
+    return criticalError;
+  }
+  file->size = (uint32_t)size.QuadPart;
+  if (file->size > 0) {
+    HANDLE mapping =
+        CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL) {
+      file->buffer = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      if (file->buffer == NULL) {
+        CloseHandle(mapping);
+      } else {
+        file->handle = mapping;
+      }
+    }
+  }
+  CloseHandle(handle);
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("Error opening file %s\n", filename);
+    return criticalError;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (uint64_t)info.st_size > UINT32_MAX) {
+    printf("Error: Invalid size of file %s\n", filename);
+    close(fd);
+    return criticalError;
+  }
+  file->size = (uint32_t)info.st_size;
+  if (file->size > 0) {
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE; // Fault the pages in with the same call
+#endif
+    void *view = mmap(NULL, file->size, PROT_READ, flags, fd, 0);
+    if (view != MAP_FAILED) {
+      file->buffer = (uint8_t *)view;
+    }
+  }
+  close(fd);
+#endif
+  if (file->buffer == NULL) {
+    printf("Error mapping file %s\n", filename);
+    return criticalError;
+  }
+  if (checkProgramFile(file) != noError) {
+    printf("Error: %s is truncated or not a program\n", filename);
+    unmapProgramFile(file);
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Unmaps a program file.
+ *
+ * @param file The mapping.
+ */
+void unmapProgramFile(ProgramFile *file) {
+  if (file->buffer == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(file->buffer);
+  CloseHandle((HANDLE)file->handle);
+#else
+  munmap(file->buffer, file->size);
+#endif
+  file->buffer = NULL;
+  file->size = 0;
+}
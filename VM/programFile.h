@@ -0,0 +1,34 @@
+#ifndef PROGRAMFILE_H
+#define PROGRAMFILE_H
+
+#include "VM.h"
+
+/*
+Loading of program.bin.
+
+The file is mapped read only (mmap, a file mapping on Windows) and the VM
+runs on the mapping: decodeProgram only records the position of the K
+constants and the scans read them in place, nothing is copied (the constant
+pool is aligned in the file, so it is aligned in the mapping too). Loading a
+program is then one mapping, whatever its size, and the VM instances that
+run the same file share its physical pages through the page cache.
+
+The VM never writes the program buffer, so the mapping stays read only; a
+write would fault instead of silently changing the program.
+
+Before the mapping is handed to the VM, the header is checked against the
+size of the file, so the checksum and the instructions are never read past
+the end of the mapping.
+*/
+
+typedef struct stProgramFile {
+  uint8_t *buffer; // The program, read only
+  uint32_t size;   // Size of the file in bytes
+  void *handle;    // Mapping handle (Windows)
+} ProgramFile;
+
+// Function prototypes
+uint8_t mapProgramFile(const char *filename, ProgramFile *file);
+void unmapProgramFile(ProgramFile *file);
+
+#endif // PROGRAMFILE_H
@@ -0,0 +1,375 @@
+#ifndef PROGRAMFORMAT_H
+#define PROGRAMFORMAT_H
+
+#include <stdint.h>
+#include "crc32c.h"
+
+/*
+Layout of program.bin, shared by the VM and the VMcompiler.
+
+Version 0 (no header):
+    2 bytes for the size of the program in bytes (including these 2 bytes)
+    Instructions
+    4 bytes for the checksum
+==============================
+
+Version 1:
+    2 bytes for the magic number "IL"
+    1 byte for the version
+    1 byte for the size of the header in bytes
+    4 bytes for the size of the program in bytes (including the header)
+    2 bytes for the size of the inputs in bytes
+    2 bytes for the size of the outputs in bytes
+    2 bytes for the size of the memories in bytes
+    2 bytes for the number of sections
+    4 bytes for the end of the instructions
+    4 bytes for the position of the section table
+    Instructions
+    Section table, up to the end of the program
+    4 bytes for the CRC32C of the program (see crc32c.h)
+==============================
+
+Each entry of the section table (SectionEntrySize bytes) describes a range
+of the program, one per source file for the code:
+    4 bytes for the position of the section
+    4 bytes for the size of the section in bytes
+    2 bytes for the type of the section
+    2 bytes reserved, 0
+    20 bytes for the name, padded with zeros (not terminated if 20 long)
+The code sections follow each other from the end of the header to the end
+of the instructions. The instructions do not depend on their position, so
+the code of a source file is the same wherever it is linked.
+
+In version 0 the value of a K operand follows its operand byte in the
+instruction, 1 to 8 bytes depending on the memory type. From version 1 on
+it is 2 bytes, like the address of the other operands: the index of the
+constant in the constant pool, a section of type SectionConstants between
+the end of the instructions and the section table. The pool starts at a
+position multiple of ConstantPoolAlign and holds each value once, the 8
+byte values first, then the 4, 2 and 1 byte values, so every value is
+aligned on its size; the value of an operand of size n is at the position
+index * n of the pool. X and B constants share the 1 byte values, D and R
+the 4 byte values. A program without constants has no pool.
+
+The checksum of version 0 is the 32-bit sum of the bytes of the program,
+size included. The checksum and the CRC follow the program, at
+the position given by its size, and are stored little endian.
+
+All the header fields are little endian.
+*/
+
+#define ProgramMagic 0x4C49 // "IL" read as a little endian word
+#define ProgramVersion 1    // Version written by the compiler
+
+// Header sizes
+#define HeaderSizeV0 2
+#define HeaderSize 24 // Current version
+
+// Position of the header fields
+#define HeaderVersionPos 2
+#define HeaderLengthPos 3
+#define HeaderProgramSizePos 4
+#define HeaderInputSizePos 8
+#define HeaderOutputSizePos 10
+#define HeaderMemorySizePos 12
+#define HeaderNumSectionsPos 14
+#define HeaderCodeEndPos 16
+#define HeaderSectionTablePos 20
+
+// Section table
+#define SectionEntrySize 32
+#define SectionNameSize 20
+#define SectionOffsetPos 0
+#define SectionSizePos 4
+#define SectionTypePos 8
+#define SectionNamePos 12
+#define SectionCode 1      // Instructions of one source file
+#define SectionConstants 2 // Constant pool
+#define MaxSections 65535
+
+// Constant pool
+#define ConstantPoolAlign 8
+#define MaxConstantIndex 65535
+
+// Default sizes, used for programs without header
+#define MemorySize 10 // Size of the memory in bytes
+#define InputSize 10  // Number of inputs in bytes
+#define OutputSize 10 // Number of outputs in bytes
+
+// Addresses are 16 bits
+#define MaxRegionSize 65535
+
+typedef struct stProgramHeader {
+  uint8_t version;      // 0 for programs without header
+  uint8_t headerSize;   // Position of the first instruction
+  uint32_t programSize; // Size of the program, the checksum starts here
+  uint16_t inputSize;   // Size of the inputs in bytes
+  uint16_t outputSize;  // Size of the outputs in bytes
+  uint16_t memorySize;  // Size of the memories in bytes
+  uint16_t numSections; // 0 in version 0
+  uint32_t codeEnd;     // End of the instructions
+  uint32_t sectionTablePos;
+} ProgramHeader;
+
+typedef struct stSectionEntry {
+  uint32_t offset; // Position of the section in the program
+  uint32_t size;   // Size in bytes
+  uint16_t type;
+  char name[SectionNameSize + 1]; // Terminated
+} SectionEntry;
+
+static inline uint16_t readHeaderWord(const uint8_t *buffer, uint16_t pos) {
+  return (uint16_t)(buffer[pos] | (buffer[pos + 1] << 8));
+}
+
+static inline void writeHeaderWord(uint8_t *buffer, uint16_t pos,
+                                   uint16_t value) {
+  buffer[pos] = (uint8_t)(value & 0xFF);
+  buffer[pos + 1] = (uint8_t)(value >> 8);
+}
+
+static inline uint32_t readHeaderDWord(const uint8_t *buffer, uint16_t pos) {
+  return (uint32_t)readHeaderWord(buffer, pos) |
+         ((uint32_t)readHeaderWord(buffer, pos + 2) << 16);
+}
+
+static inline void writeHeaderDWord(uint8_t *buffer, uint16_t pos,
+                                    uint32_t value) {
+  writeHeaderWord(buffer, pos, (uint16_t)(value & 0xFFFF));
+  writeHeaderWord(buffer, pos + 2, (uint16_t)(value >> 16));
+}
+
+/**
+ * Reads the header of a program.
+ *
+ * @param buffer The buffer containing the program.
+ * @param header The header to store the result in.
+ * @return 0 if the header is valid.
+ */
+static inline uint8_t readProgramHeader(const uint8_t *buffer,
+                                        ProgramHeader *header) {
+  // No section table in version 0
+  header->numSections = 0;
+  header->codeEnd = 0;
+  header->sectionTablePos = 0;
+  if (readHeaderWord(buffer, 0) != ProgramMagic) {
+    header->version = 0;
+    header->headerSize = HeaderSizeV0;
+    header->programSize = readHeaderWord(buffer, 0);
+    header->inputSize = InputSize;
+    header->outputSize = OutputSize;
+    header->memorySize = MemorySize;
+  } else {
+    header->version = buffer[HeaderVersionPos];
+    header->headerSize = buffer[HeaderLengthPos];
+    if (header->version != ProgramVersion ||
+        header->headerSize != HeaderSize) {
+      return 1;
+    }
+    header->programSize = readHeaderDWord(buffer, HeaderProgramSizePos);
+    header->inputSize = readHeaderWord(buffer, HeaderInputSizePos);
+    header->outputSize = readHeaderWord(buffer, HeaderOutputSizePos);
+    header->memorySize = readHeaderWord(buffer, HeaderMemorySizePos);
+    header->numSections = readHeaderWord(buffer, HeaderNumSectionsPos);
+    header->codeEnd = readHeaderDWord(buffer, HeaderCodeEndPos);
+    header->sectionTablePos = readHeaderDWord(buffer, HeaderSectionTablePos);
+  }
+  if (header->programSize < header->headerSize) {
+    return 1;
+  }
+  if (header->version == 0) {
+    header->codeEnd = header->programSize;
+    header->sectionTablePos = header->programSize;
+  } else if (header->codeEnd < header->headerSize ||
+             header->sectionTablePos < header->codeEnd ||
+             (uint64_t)header->sectionTablePos +
+                     (uint64_t)header->numSections * SectionEntrySize !=
+                 header->programSize) {
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Writes the header of a program (current version).
+ *
+ * @param buffer The buffer containing the program.
+ * @param header The header to write.
+ */
+static inline void writeProgramHeader(uint8_t *buffer,
+                                      const ProgramHeader *header) {
+  writeHeaderWord(buffer, 0, ProgramMagic);
+  buffer[HeaderVersionPos] = ProgramVersion;
+  buffer[HeaderLengthPos] = HeaderSize;
+  writeHeaderDWord(buffer, HeaderProgramSizePos, header->programSize);
+  writeHeaderWord(buffer, HeaderInputSizePos, header->inputSize);
+  writeHeaderWord(buffer, HeaderOutputSizePos, header->outputSize);
+  writeHeaderWord(buffer, HeaderMemorySizePos, header->memorySize);
+  writeHeaderWord(buffer, HeaderNumSectionsPos, header->numSections);
+  writeHeaderDWord(buffer, HeaderCodeEndPos, header->codeEnd);
+  writeHeaderDWord(buffer, HeaderSectionTablePos, header->sectionTablePos);
+}
+
+/**
+ * Reads an entry of the section table.
+ *
+ * @param buffer The buffer containing the program.
+ * @param header The header of the program.
+ * @param index The index of the section, less than numSections.
+ * @param section The entry to store the result in.
+ */
+static inline void readSectionEntry(const uint8_t *buffer,
+                                    const ProgramHeader *header,
+                                    uint16_t index, SectionEntry *section) {
+  const uint8_t *entry =
+      buffer + header->sectionTablePos + (uint32_t)index * SectionEntrySize;
+  section->offset = readHeaderDWord(entry, SectionOffsetPos);
+  section->size = readHeaderDWord(entry, SectionSizePos);
+  section->type = readHeaderWord(entry, SectionTypePos);
+  memcpy(section->name, entry + SectionNamePos, SectionNameSize);
+  section->name[SectionNameSize] = '\0';
+}
+
+/**
+ * Writes an entry of the section table.
+ *
+ * @param buffer The buffer containing the program.
+ * @param header The header of the program.
+ * @param index The index of the section, less than numSections.
+ * @param section The entry to write, the name is truncated.
+ */
+static inline void writeSectionEntry(uint8_t *buffer,
+                                     const ProgramHeader *header,
+                                     uint16_t index,
+                                     const SectionEntry *section) {
+  uint8_t *entry =
+      buffer + header->sectionTablePos + (uint32_t)index * SectionEntrySize;
+  writeHeaderDWord(entry, SectionOffsetPos, section->offset);
+  writeHeaderDWord(entry, SectionSizePos, section->size);
+  writeHeaderWord(entry, SectionTypePos, section->type);
+  writeHeaderWord(entry, SectionTypePos + 2, 0);
+  strncpy((char *)entry + SectionNamePos, section->name, SectionNameSize);
+}
+
+/**
+ * Checks if the K operands of a program are indexes in its constant pool.
+ *
+ * @param header The header of the program.
+ * @return 1 from version 1 on, 0 when the constants are inline.
+ */
+static inline uint8_t hasConstantPool(const ProgramHeader *header) {
+  return header->version >= 1;
+}
+
+/**
+ * Checks the section table: the code sections follow each other from the
+ * end of the header to the end of the instructions, and the constant pool,
+ * if any, is aligned between the instructions and the section table.
+ *
+ * @param buffer The buffer containing the program.
+ * @param header The header of the program.
+ * @return 0 if the section table is valid.
+ */
+static inline uint8_t checkProgramSections(const uint8_t *buffer,
+                                           const ProgramHeader *header) {
+  uint32_t codePos = header->headerSize;
+  uint8_t pools = 0;
+  for (uint16_t i = 0; i < header->numSections; i++) {
+    SectionEntry section;
+    readSectionEntry(buffer, header, i, &section);
+    if (section.type == SectionConstants) {
+      if (!hasConstantPool(header) || ++pools > 1 ||
+          section.offset < header->codeEnd ||
+          section.offset % ConstantPoolAlign != 0 ||
+          (uint64_t)section.offset + section.size > header->sectionTablePos) {
+        return 1;
+      }
+      continue;
+    }
+    if (section.type != SectionCode) {
+      continue;
+    }
+    if (section.offset != codePos ||
+        (uint64_t)section.offset + section.size > header->codeEnd) {
+      return 1;
+    }
+    codePos += section.size;
+  }
+  if (header->version >= 1 && codePos != header->codeEnd) {
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Finds the constant pool of a program, its section table checked.
+ *
+ * @param buffer The buffer containing the program.
+ * @param header The header of the program.
+ * @param pool Receives the section of the pool, empty without one.
+ * @return 1 if the program has a constant pool.
+ */
+static inline uint8_t findConstantPool(const uint8_t *buffer,
+                                       const ProgramHeader *header,
+                                       SectionEntry *pool) {
+  for (uint16_t i = 0; i < header->numSections; i++) {
+    readSectionEntry(buffer, header, i, pool);
+    if (pool->type == SectionConstants) {
+      return 1;
+    }
+  }
+  memset(pool, 0, sizeof(*pool));
+  return 0;
+}
+
+/**
+ * Computes the integrity check of a program: the sum of its bytes for
+ * version 0, its CRC32C from version 1 on.
+ *
+ * @param buffer The buffer containing the program.
+ * @param header The header of the program.
+ * @return The checksum or the CRC.
+ */
+static inline uint32_t computeProgramCheck(const uint8_t *buffer,
+                                           const ProgramHeader *header) {
+  if (header->version >= 1) {
+    return computeCrc32c(buffer, header->programSize);
+  }
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i < header->programSize; i++) {
+    sum += buffer[i];
+  }
+  return sum;
+}
+
+/**
+ * Reads the integrity check stored after a program.
+ *
+ * @param buffer The buffer containing the program.
+ * @param header The header of the program.
+ * @return The stored checksum or CRC.
+ */
+static inline uint32_t readProgramCheck(const uint8_t *buffer,
+                                        const ProgramHeader *header) {
+  const uint8_t *check = buffer + header->programSize;
+  return (uint32_t)check[0] | ((uint32_t)check[1] << 8) |
+         ((uint32_t)check[2] << 16) | ((uint32_t)check[3] << 24);
+}
+
+/**
+ * Writes the integrity check after a program.
+ *
+ * @param buffer The buffer containing the program, with 4 bytes after it.
+ * @param header The header of the program.
+ */
+static inline void writeProgramCheck(uint8_t *buffer,
+                                     const ProgramHeader *header) {
+  uint32_t value = computeProgramCheck(buffer, header);
+  uint8_t *check = buffer + header->programSize;
+  check[0] = (uint8_t)(value & 0xFF);
+  check[1] = (uint8_t)((value >> 8) & 0xFF);
+  check[2] = (uint8_t)((value >> 16) & 0xFF);
+  check[3] = (uint8_t)(value >> 24);
+}
+
+#endif // PROGRAMFORMAT_H
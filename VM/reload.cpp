@@ -0,0 +1,289 @@
+#include "reload.h"
+#include "dispatch.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/stat.h>
+#else
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Releases a program loaded by the watcher.
+ *
+ * @param loaded The program, may be NULL.
+ */
+static void releaseLoadedProgram(LoadedProgram *loaded) {
+  if (loaded == NULL) {
+    return;
+  }
+  freeProgram(&loaded->program);
+  unmapProgramFile(&loaded->file);
+  free(loaded);
+}
+
+/**
+ * Releases the programs retired by the scan thread.
+ *
+ * @param reloader The reloader.
+ */
+static void releaseRetired(Reloader *reloader) {
+  LoadedProgram *list =
+      __atomic_exchange_n(&reloader->retired, (LoadedProgram *)NULL,
+                          __ATOMIC_ACQUIRE);
+  while (list != NULL) {
+    LoadedProgram *next = list->next;
+    releaseLoadedProgram(list);
+    list = next;
+  }
+}
+
+/**
+ * Loads, verifies and prepares the program file for the running VM.
+ *
+ * @param reloader The reloader.
+ * @return The program ready to run, or NULL if rejected.
+ */
+static LoadedProgram *loadProgram(Reloader *reloader) {
+  LoadedProgram *loaded = (LoadedProgram *)calloc(1, sizeof(LoadedProgram));
+  if (loaded == NULL) {
+    return NULL;
+  }
+  if (mapProgramFile(reloader->path, &loaded->file) != noError) {
+    free(loaded);
+    return NULL;
+  }
+  uint8_t *buffer = loaded->file.buffer;
+  Data *data = reloader->data;
+  ProgramHeader header;
+  if (verifyProgramIntegrity(buffer) != noError ||
+      readProgramHeader(buffer, &header) != 0) {
+    printf("Reload: program integrity error\n");
+    releaseLoadedProgram(loaded);
+    return NULL;
+  }
+  if (header.inputSize > data->inputSize ||
+      header.outputSize > data->outputSize ||
+      header.memorySize > data->memorySize) {
+    printf("Reload: the program needs a larger process image, restart the VM\n");
+    releaseLoadedProgram(loaded);
+    return NULL;
+  }
+  if (decodeProgram(buffer, &loaded->program) != noError ||
+      resolveOperands(&loaded->program, data) != noError ||
+      checkResources(&loaded->program, reloader->numTimers,
+                     reloader->numCounters, reloader->numTriggers) !=
+          noError ||
+      prepareDispatch(&loaded->program, data) != noError) {
+    printf("Reload: invalid program\n");
+    releaseLoadedProgram(loaded);
+    return NULL;
+  }
+  return loaded;
+}
+
+/**
+ * Loads the new program file and publishes it for the scan thread.
+ *
+ * @param reloader The reloader.
+ */
+static void publishProgram(Reloader *reloader) {
+  releaseRetired(reloader);
+  LoadedProgram *loaded = loadProgram(reloader);
+  if (loaded == NULL) {
+    reloader->rejected++;
+    return;
+  }
+  printf("Reload: %s ready, %u instructions\n", reloader->path,
+         (unsigned)loaded->program.numInstructions);
+  // A program still pending was never run, it is replaced by the new one
+  LoadedProgram *previous =
+      __atomic_exchange_n(&reloader->pending, loaded, __ATOMIC_ACQ_REL);
+  releaseLoadedProgram(previous);
+}
+
+/**
+ * Watches the program file until the reloader is stopped.
+ *
+ * @param reloader The reloader.
+ */
+static void runWatcher(Reloader *reloader) {
+#ifdef _WIN32
+  HANDLE change = FindFirstChangeNotificationA(
+      reloader->directory, FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE |
+                                      FILE_NOTIFY_CHANGE_FILE_NAME);
+  if (change == INVALID_HANDLE_VALUE) {
+    printf("Reload: cannot watch %s\n", reloader->directory);
+    return;
+  }
+  struct _stat info;
+  time_t modified = _stat(reloader->path, &info) == 0 ? info.st_mtime : 0;
+  while (!__atomic_load_n(&reloader->stop, __ATOMIC_ACQUIRE)) {
+    if (WaitForSingleObject(change, ReloadPollMs) == WAIT_OBJECT_0) {
+      // The notification does not tell the file, compare its time
+      if (_stat(reloader->path, &info) == 0 && info.st_mtime != modified) {
+        modified = info.st_mtime;
+        publishProgram(reloader);
+      }
+      FindNextChangeNotification(change);
+    }
+    releaseRetired(reloader);
+  }
+  FindCloseChangeNotification(change);
+#else
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, reloader->directory,
+                                  IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    printf("Reload: cannot watch %s\n", reloader->directory);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return;
+  }
+  // Room for at least one event with the longest name
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (!__atomic_load_n(&reloader->stop, __ATOMIC_ACQUIRE)) {
+    struct pollfd wait = {fd, POLLIN, 0};
+    if (poll(&wait, 1, ReloadPollMs) > 0) {
+      uint8_t changed = 0;
+      ssize_t length;
+      while ((length = read(fd, events, sizeof(events))) > 0) {
+        for (char *p = events; p < events + length;) {
+          const struct inotify_event *event = (const struct inotify_event *)p;
+          if (event->len > 0 && strcmp(event->name, reloader->name) == 0) {
+            changed = 1;
+          }
+          p += sizeof(struct inotify_event) + event->len;
+        }
+      }
+      // Several events of the same update load the file once
+      if (changed) {
+        publishProgram(reloader);
+      }
+    }
+    releaseRetired(reloader);
+  }
+  close(fd);
+#endif
+}
+
+#ifdef _WIN32
+static DWORD WINAPI watcherThread(LPVOID arg) {
+  runWatcher((Reloader *)arg);
+  return 0;
+}
+#else
+static void *watcherThread(void *arg) {
+  runWatcher((Reloader *)arg);
+  return NULL;
+}
+#endif
+
+/**
+ * Starts watching a program file.
+ *
+ * @param reloader The reloader.
+ * @param path The program file the VM is running.
+ * @param data The process image of the running VM.
+ * @param numTimers The number of timers of the VM.
+ * @param numCounters The number of counters of the VM.
+ * @param numTriggers The number of triggers of the VM.
+ * @return The error code.
+ */
+uint8_t startReloader(Reloader *reloader, const char *path, Data *data,
+                      uint8_t numTimers, uint8_t numCounters,
+                      uint8_t numTriggers) {
+  memset(reloader, 0, sizeof(*reloader));
+  if (strlen(path) >= ReloadPathSize) {
+    printf("Reload: path too long\n");
+    return criticalError;
+  }
+  strcpy(reloader->path, path);
+  strcpy(reloader->directory, path);
+  char *slash = strrchr(reloader->directory, '/');
+#ifdef _WIN32
+  char *backslash = strrchr(reloader->directory, '\\');
+  if (backslash != NULL && (slash == NULL || backslash > slash)) {
+    slash = backslash;
+  }
+#endif
+  if (slash != NULL) {
+    *slash = '\0';
+    reloader->name = reloader->path + (slash - reloader->directory) + 1;
+  } else {
+    strcpy(reloader->directory, ".");
+    reloader->name = reloader->path;
+  }
+  reloader->data = data;
+  reloader->numTimers = numTimers;
+  reloader->numCounters = numCounters;
+  reloader->numTriggers = numTriggers;
+#ifdef _WIN32
+  reloader->thread = CreateThread(NULL, 0, watcherThread, reloader, 0, NULL);
+  uint8_t failed = reloader->thread == NULL;
+#else
+  uint8_t failed =
+      pthread_create(&reloader->thread, NULL, watcherThread, reloader) != 0;
+#endif
+  if (failed) {
+    printf("Error starting the reload watcher\n");
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Swaps in the pending program, if any. Called by the scan thread between
+ * two scans.
+ *
+ * @param reloader The reloader, may be NULL.
+ * @param program The program running.
+ * @return The program to run from the next scan on.
+ */
+Program *applyReload(Reloader *reloader, Program *program) {
+  if (reloader == NULL ||
+      __atomic_load_n(&reloader->pending, __ATOMIC_RELAXED) == NULL) {
+    return program;
+  }
+  LoadedProgram *next = __atomic_exchange_n(
+      &reloader->pending, (LoadedProgram *)NULL, __ATOMIC_ACQUIRE);
+  if (next == NULL) {
+    return program;
+  }
+  LoadedProgram *old = reloader->current;
+  reloader->current = next;
+  if (old != NULL) {
+    // Push onto the retired list, only the watcher takes it
+    old->next = __atomic_load_n(&reloader->retired, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&reloader->retired, &old->next, old,
+                                        1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+  }
+  __atomic_add_fetch(&reloader->reloads, 1, __ATOMIC_RELAXED);
+  return &next->program;
+}
+
+/**
+ * Stops the watcher and releases the programs loaded. The program
+ * returned by the last applyReload is released too, the scan loop must
+ * have stopped.
+ *
+ * @param reloader The reloader.
+ */
+void stopReloader(Reloader *reloader) {
+  __atomic_store_n(&reloader->stop, 1, __ATOMIC_RELEASE);
+#ifdef _WIN32
+  WaitForSingleObject((HANDLE)reloader->thread, INFINITE);
+  CloseHandle((HANDLE)reloader->thread);
+#else
+  pthread_join(reloader->thread, NULL);
+#endif
+  releaseRetired(reloader);
+  releaseLoadedProgram(reloader->pending);
+  releaseLoadedProgram(reloader->current);
+  reloader->pending = NULL;
+  reloader->current = NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "VM.h"
+#include "programFile.h"
+#include "scheduler.h"
+
+/*
+Online change: hot reload of program.bin without stopping the scan loop.
+
+A watcher thread waits for a new program.bin (inotify on Linux, a change
+notification of the directory on Windows). Off the scan thread it maps the
+file, verifies its integrity, decodes it, resolves its operands against
+the process image of the running VM and prepares the threaded dispatch.
+The program is then published as pending.
+
+The scan thread calls applyReload between two scans: when a program is
+pending it takes it with one atomic exchange and runs it from the next
+scan on. Data (process image), timers, counters and triggers are not
+touched, so the running timers and counts carry over and the update costs
+no scan at all. A program that does not verify, that addresses more than
+the process image of the running VM or more timers, counters or triggers
+than it has is rejected and the running program goes on.
+
+The program replaced is handed back to the watcher through a lock-free
+list and released there, so the scan thread never frees memory nor
+unmaps files.
+
+The compiler writes program.bin to a temporary file and renames it, so
+the file a running VM has mapped is never truncated under it.
+*/
+
+#define ReloadPathSize 512
+#define ReloadPollMs 100 // Period of the checks of the stop flag
+
+typedef struct stLoadedProgram LoadedProgram;
+struct stLoadedProgram {
+  ProgramFile file;
+  Program program;
+  LoadedProgram *next; // In the list of programs retired
+};
+
+typedef struct stReloader {
+  char path[ReloadPathSize];      // The program file watched
+  char directory[ReloadPathSize]; // Its directory
+  const char *name;               // File name in path
+  Data *data;                     // Process image of the running VM
+  uint8_t numTimers;
+  uint8_t numCounters;
+  uint8_t numTriggers;
+  ThreadHandle thread;
+  uint8_t stop;            // Stops the watcher (atomic)
+  LoadedProgram *pending;  // Verified and decoded, not running yet (atomic)
+  LoadedProgram *current;  // Running, NULL for the initial program
+  LoadedProgram *retired;  // Replaced, to release (atomic list)
+  uint32_t reloads;        // Programs swapped in (atomic)
+  uint32_t rejected;       // Programs rejected by the watcher, read after
+                           // stopReloader
+} Reloader;
+
+// Function prototypes
+uint8_t startReloader(Reloader *reloader, const char *path, Data *data,
+                      uint8_t numTimers, uint8_t numCounters,
+                      uint8_t numTriggers);
+Program *applyReload(Reloader *reloader, Program *program);
+void stopReloader(Reloader *reloader);
+
+#endif // RELOAD_H
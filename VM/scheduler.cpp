@@ -0,0 +1,407 @@
+#include "scheduler.h"
+#include "dispatch.h"
+#include "clock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+  Scan scheduler
+*/
+
+#define IdleSleepNs 100000 // Longest sleep of an idle worker (100 us)
+#define NoJob -1
+
+/*
+  Work deque (Chase-Lev). The owner pushes at the bottom, the jobs are taken
+  at the top, by the owner and by the other workers.
+*/
+
+/**
+ * Initializes a deque.
+ *
+ * @param deque The deque.
+ * @param capacity The minimum capacity.
+ * @return The error code.
+ */
+static uint8_t initDeque(WorkDeque *deque, uint16_t capacity) {
+  uint32_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  deque->items = (uint16_t *)malloc(size * sizeof(uint16_t));
+  deque->mask = size - 1;
+  deque->top = 0;
+  deque->bottom = 0;
+  if (deque->items == NULL) {
+    printf("Error allocating the work deque\n");
+    return criticalError;
+  }
+  return noError;
+}
+
+// Owner only
+static void pushJob(WorkDeque *deque, uint16_t job) {
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  __atomic_store_n(&deque->items[bottom & deque->mask], job, __ATOMIC_RELAXED);
+  __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+// Any worker
+static int32_t stealJob(WorkDeque *deque) {
+  int64_t top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST);
+  if (top >= bottom) {
+    return NoJob;
+  }
+  int32_t job =
+      __atomic_load_n(&deque->items[top & deque->mask], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NoJob;
+  }
+  return job;
+}
+
+/**
+ * Gets the number of cores available.
+ *
+ * @return The number of cores, at least 1.
+ */
+uint8_t getNumCores(void) {
+  long cores;
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  cores = (long)info.dwNumberOfProcessors;
+#else
+  cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (cores < 1) {
+    return 1;
+  }
+  return cores > MaxWorkers ? MaxWorkers : (uint8_t)cores;
+}
+
+/**
+ * Initializes a scheduler.
+ *
+ * @param scheduler The scheduler.
+ * @param maxTasks The maximum number of tasks.
+ * @param numWorkers The number of worker threads, 0 for one per core.
+ * @return The error code.
+ */
+uint8_t initScheduler(Scheduler *scheduler, uint16_t maxTasks,
+                      uint8_t numWorkers) {
+  memset(scheduler, 0, sizeof(*scheduler));
+  if (numWorkers == 0) {
+    numWorkers = getNumCores();
+  }
+  if (numWorkers > MaxWorkers || maxTasks == 0) {
+    printf("Error: Invalid scheduler configuration\n");
+    return criticalError;
+  }
+  scheduler->tasks = (PlcTask *)malloc(maxTasks * sizeof(PlcTask));
+  if (scheduler->tasks == NULL) {
+    printf("Error allocating the tasks\n");
+    return criticalError;
+  }
+  scheduler->maxTasks = maxTasks;
+  scheduler->numWorkers = numWorkers;
+  for (uint8_t i = 0; i < numWorkers; i++) {
+    Worker *worker = &scheduler->workers[i];
+    worker->scheduler = scheduler;
+    worker->index = i;
+    // A task has at most one pending scan
+    if (initDeque(&worker->deque, maxTasks) != noError) {
+      freeScheduler(scheduler);
+      return criticalError;
+    }
+  }
+  return noError;
+}
+
+/**
+ * Loads a program as a new task.
+ *
+ * The program buffer must stay valid while the scheduler runs, the K
+ * constants are read from it. Several tasks can share the same buffer.
+ *
+ * @param scheduler The scheduler, not running.
+ * @param buffer The buffer containing the program.
+ * @param periodUs The scan period in microseconds.
+ * @return The number of the task, or -1 on error.
+ */
+int32_t addTask(Scheduler *scheduler, uint8_t *buffer, uint32_t periodUs) {
+  ProgramHeader header;
+  if (scheduler->running || scheduler->numTasks >= scheduler->maxTasks ||
+      periodUs == 0) {
+    printf("Error: Cannot add a task\n");
+    return -1;
+  }
+  if (verifyProgramIntegrity(buffer) != noError ||
+      readProgramHeader(buffer, &header) != 0) {
+    printf("Error: Invalid program\n");
+    return -1;
+  }
+
+  PlcTask *task = &scheduler->tasks[scheduler->numTasks];
+  memset(task, 0, sizeof(*task));
+  if (initArena(&task->arena, getRequiredMemory(&header)) != noError) {
+    return -1;
+  }
+  if (allocateMemory(&task->data, &header, &task->arena) != noError) {
+    freeArena(&task->arena);
+    return -1;
+  }
+  initStack(&task->stack, task->stackElements, STACK_MAX_SIZE);
+  initializeTimer(task->timers, MAX_TIMERS);
+  initializeCounter(task->counters, MAX_COUNTERS);
+  initializeTrigger(task->triggers, MAX_TRIGGERS);
+  initializeMemory(&task->data, task->timers, task->counters, task->triggers,
+                   &task->stack);
+  if (decodeProgram(buffer, &task->program) != noError ||
+      resolveOperands(&task->program, &task->data) != noError ||
+      checkResources(&task->program, MAX_TIMERS, MAX_COUNTERS,
+                     MAX_TRIGGERS) != noError ||
+      prepareDispatch(&task->program, &task->data) != noError) {
+    freeProgram(&task->program);
+    freeArena(&task->arena);
+    return -1;
+  }
+  task->periodNs = (uint64_t)periodUs * 1000;
+  task->owner = (uint8_t)(scheduler->numTasks % scheduler->numWorkers);
+  return scheduler->numTasks++;
+}
+
+/**
+ * Counts a missed deadline of a task, once: the scan that ends late and the
+ * release found still pending at the same deadline are the same overrun.
+ *
+ * @param task The task.
+ * @param deadlineNs The deadline missed.
+ */
+static void countOverrun(PlcTask *task, uint64_t deadlineNs) {
+  if (__atomic_exchange_n(&task->missedNs, deadlineNs, __ATOMIC_RELAXED) !=
+      deadlineNs) {
+    __atomic_fetch_add(&task->overruns, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Runs one scan of a task.
+ *
+ * @param scheduler The scheduler.
+ * @param task The task, with a pending scan.
+ */
+static void runTask(Scheduler *scheduler, PlcTask *task) {
+  uint64_t start = getMonotonicNs();
+  uint64_t latency = start - task->releasedNs;
+  if (latency > task->maxLatencyNs) {
+    task->maxLatencyNs = latency;
+  }
+  task->data.elapsedTicks = (uint32_t)((start - task->startNs) / TickPeriodNs);
+  if (scheduler->beforeScan != NULL) {
+    scheduler->beforeScan(task, scheduler->user);
+  }
+  task->data.accumulator = 0;
+  runProgram(&task->program, &task->data);
+  if (scheduler->afterScan != NULL) {
+    scheduler->afterScan(task, scheduler->user);
+  }
+  uint64_t end = getMonotonicNs();
+  if (end - start > task->maxDurationNs) {
+    task->maxDurationNs = end - start;
+  }
+  if (end > task->deadlineNs) {
+    countOverrun(task, task->deadlineNs);
+  }
+  task->scans++;
+  __atomic_store_n(&task->pending, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Releases the due tasks of a worker.
+ *
+ * @param worker The worker.
+ * @param now The current time.
+ * @return The time of the next release of the tasks of the worker.
+ */
+static uint64_t releaseTasks(Worker *worker, uint64_t now) {
+  Scheduler *scheduler = worker->scheduler;
+  uint64_t next = now + IdleSleepNs;
+  for (uint16_t t = worker->index; t < scheduler->numTasks;
+       t += scheduler->numWorkers) {
+    PlcTask *task = &scheduler->tasks[t];
+    if (task->releaseNs <= now) {
+      if (__atomic_load_n(&task->pending, __ATOMIC_ACQUIRE)) {
+        // The previous scan is still queued or running, this release is
+        // skipped
+        countOverrun(task, task->releaseNs);
+      } else {
+        task->releasedNs = task->releaseNs;
+        task->deadlineNs = task->releaseNs + task->periodNs;
+        __atomic_store_n(&task->pending, 1, __ATOMIC_RELAXED);
+        pushJob(&worker->deque, t);
+      }
+      task->releaseNs += task->periodNs;
+      if (task->releaseNs <= now) {
+        // Releases missed while the worker was busy
+        uint64_t missed = (now - task->releaseNs) / task->periodNs + 1;
+        task->releaseNs += missed * task->periodNs;
+        __atomic_fetch_add(&task->overruns, missed, __ATOMIC_RELAXED);
+      }
+    }
+    if (task->releaseNs < next) {
+      next = task->releaseNs;
+    }
+  }
+  return next;
+}
+
+/**
+ * Main loop of a worker: releases its tasks, runs its jobs and steals jobs
+ * from the other workers when it has none.
+ *
+ * @param worker The worker.
+ */
+static void runWorker(Worker *worker) {
+  Scheduler *scheduler = worker->scheduler;
+  while (__atomic_load_n(&scheduler->running, __ATOMIC_ACQUIRE)) {
+    uint64_t now = getMonotonicNs();
+    uint64_t next = releaseTasks(worker, now);
+    // Oldest job first: the task released again after each of its scans
+    // cannot starve the others
+    int32_t job = stealJob(&worker->deque);
+    for (uint8_t i = 1; job == NoJob && i < scheduler->numWorkers; i++) {
+      Worker *victim =
+          &scheduler->workers[(worker->index + i) % scheduler->numWorkers];
+      job = stealJob(&victim->deque);
+      if (job != NoJob) {
+        worker->steals++;
+      }
+    }
+    if (job != NoJob) {
+      runTask(scheduler, &scheduler->tasks[job]);
+    } else if (next > now) {
+      sleepUntilNs(next);
+    }
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI workerThread(LPVOID arg) {
+  runWorker((Worker *)arg);
+  return 0;
+}
+#else
+static void *workerThread(void *arg) {
+  runWorker((Worker *)arg);
+  return NULL;
+}
+#endif
+
+/**
+ * Starts the worker threads. All the tasks are released now.
+ *
+ * @param scheduler The scheduler.
+ * @return The error code.
+ */
+uint8_t startScheduler(Scheduler *scheduler) {
+  uint64_t now = getMonotonicNs();
+  for (uint16_t t = 0; t < scheduler->numTasks; t++) {
+    scheduler->tasks[t].releaseNs = now;
+    scheduler->tasks[t].startNs = now;
+  }
+  __atomic_store_n(&scheduler->running, 1, __ATOMIC_RELEASE);
+  for (uint8_t i = 0; i < scheduler->numWorkers; i++) {
+    Worker *worker = &scheduler->workers[i];
+#ifdef _WIN32
+    worker->thread = CreateThread(NULL, 0, workerThread, worker, 0, NULL);
+    uint8_t failed = worker->thread == NULL;
+#else
+    uint8_t failed =
+        pthread_create(&worker->thread, NULL, workerThread, worker) != 0;
+#endif
+    if (failed) {
+      printf("Error starting the worker %d\n", i);
+      scheduler->numWorkers = i;
+      stopScheduler(scheduler);
+      return criticalError;
+    }
+  }
+  return noError;
+}
+
+/**
+ * Stops the worker threads, after the scans in progress.
+ *
+ * @param scheduler The scheduler.
+ */
+void stopScheduler(Scheduler *scheduler) {
+  __atomic_store_n(&scheduler->running, 0, __ATOMIC_RELEASE);
+  for (uint8_t i = 0; i < scheduler->numWorkers; i++) {
+#ifdef _WIN32
+    WaitForSingleObject((HANDLE)scheduler->workers[i].thread, INFINITE);
+    CloseHandle((HANDLE)scheduler->workers[i].thread);
+#else
+    pthread_join(scheduler->workers[i].thread, NULL);
+#endif
+  }
+}
+
+/**
+ * Prints the statistics of the tasks and workers.
+ *
+ * @param scheduler The scheduler.
+ */
+void printSchedulerStats(Scheduler *scheduler) {
+  uint64_t scans = 0, overruns = 0, maxLatency = 0, maxDuration = 0;
+  printf("task\tperiod(us)\tscans\toverruns\tmax latency(us)\tmax scan(us)\n");
+  for (uint16_t t = 0; t < scheduler->numTasks; t++) {
+    PlcTask *task = &scheduler->tasks[t];
+    scans += task->scans;
+    overruns += task->overruns;
+    if (task->maxLatencyNs > maxLatency) {
+      maxLatency = task->maxLatencyNs;
+    }
+    if (task->maxDurationNs > maxDuration) {
+      maxDuration = task->maxDurationNs;
+    }
+    // Only the tasks that missed deadlines
+    if (task->overruns > 0) {
+      printf("%d\t%lu\t\t%lu\t%lu\t\t%.1f\t\t%.1f\n", t,
+             (unsigned long)(task->periodNs / 1000), (unsigned long)task->scans,
+             (unsigned long)task->overruns, task->maxLatencyNs / 1000.0,
+             task->maxDurationNs / 1000.0);
+    }
+  }
+  printf("all\t\t\t%lu\t%lu\t\t%.1f\t\t%.1f\n", (unsigned long)scans,
+         (unsigned long)overruns, maxLatency / 1000.0, maxDuration / 1000.0);
+  for (uint8_t i = 0; i < scheduler->numWorkers; i++) {
+    printf("worker %d: %lu steals\n", i,
+           (unsigned long)scheduler->workers[i].steals);
+  }
+}
+
+/**
+ * Releases the tasks and deques of a stopped scheduler.
+ *
+ * @param scheduler The scheduler.
+ */
+void freeScheduler(Scheduler *scheduler) {
+  for (uint16_t t = 0; t < scheduler->numTasks; t++) {
+    freeProgram(&scheduler->tasks[t].program);
+    freeArena(&scheduler->tasks[t].arena);
+  }
+  for (uint8_t i = 0; i < MaxWorkers; i++) {
+    free(scheduler->workers[i].deque.items);
+    scheduler->workers[i].deque.items = NULL;
+  }
+  free(scheduler->tasks);
+  scheduler->tasks = NULL;
+  scheduler->numTasks = 0;
+}
@@ -0,0 +1,108 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "VM.h"
+
+/*
+Scan scheduler: runs many programs (tasks), each one with its own scan
+period, on a pool of worker threads.
+
+Every task belongs to one worker. When the release time of a task arrives
+its owner pushes a scan job onto the bottom of its own deque; workers take
+the oldest job at the top of their own deque and, when it is empty, steal
+from the top of the deques of the other workers (Chase-Lev work stealing),
+so the load spreads over all the cores without a shared queue, and the jobs
+of a worker run in the order of their release.
+
+The deadline of a scan is the next release of its task. A scan that
+finishes after its deadline, or a release found while the previous scan is
+still pending, counts as an overrun; the pending release is skipped, the
+task keeps its period. A late scan counts once: the release at its
+deadline, found pending, is the same overrun, the releases skipped after
+it count one each.
+
+Tasks are independent VM instances (one Data context each), the only
+shared state is the scheduling metadata.
+*/
+
+#define MaxWorkers 64 // Maximum number of worker threads
+
+#ifdef _WIN32
+typedef void *ThreadHandle; // HANDLE of the thread
+#else
+#include <pthread.h>
+typedef pthread_t ThreadHandle;
+#endif
+
+// Called by the worker running the scan, before and after it, to exchange
+// the inputs and outputs of a task
+typedef struct stPlcTask PlcTask;
+typedef void (*ScanHook)(PlcTask *task, void *user);
+
+struct stPlcTask {
+  // VM instance
+  Program program;
+  Data data;
+  Arena arena;
+  Timer timers[MAX_TIMERS];
+  Counter counters[MAX_COUNTERS];
+  Trigger triggers[MAX_TRIGGERS];
+  StackElement stackElements[STACK_MAX_SIZE];
+  Stack stack;
+  // Scheduling
+  uint64_t periodNs;   // Scan period
+  uint64_t releaseNs;  // Next release time
+  uint64_t releasedNs; // Release time of the pending scan
+  uint64_t deadlineNs; // Deadline of the pending scan
+  uint64_t startNs;    // Time base of the timers of the task
+  uint8_t owner;       // Worker that releases the task
+  uint8_t pending;     // A scan is queued or running (atomic)
+  // Statistics
+  uint64_t scans;         // Scans completed
+  uint64_t overruns;      // Deadlines missed or releases skipped (atomic)
+  uint64_t missedNs;      // Last deadline counted as an overrun (atomic)
+  uint64_t maxLatencyNs;  // Maximum delay from release to start
+  uint64_t maxDurationNs; // Maximum scan duration
+};
+
+// Lock-free deque of task numbers (Chase-Lev, fixed capacity)
+typedef struct stWorkDeque {
+  int64_t top;    // Stealing end (atomic)
+  int64_t bottom; // Owner end (atomic)
+  uint16_t *items;
+  uint32_t mask; // Capacity - 1, the capacity is a power of 2
+} WorkDeque;
+
+typedef struct stScheduler Scheduler;
+
+typedef struct stWorker {
+  Scheduler *scheduler;
+  uint8_t index;
+  WorkDeque deque;
+  uint64_t steals; // Jobs taken from other workers
+  ThreadHandle thread;
+} Worker;
+
+struct stScheduler {
+  PlcTask *tasks;
+  uint16_t numTasks;
+  uint16_t maxTasks;
+  Worker workers[MaxWorkers];
+  uint8_t numWorkers;
+  uint8_t running; // Workers keep running while set (atomic)
+  ScanHook beforeScan; // Optional, may be NULL
+  ScanHook afterScan;  // Optional, may be NULL
+  void *user;          // Passed to the hooks
+};
+
+// Function prototypes
+uint8_t getNumCores(void);
+uint8_t initScheduler(Scheduler *scheduler, uint16_t maxTasks,
+                      uint8_t numWorkers);
+int32_t addTask(Scheduler *scheduler, uint8_t *buffer, uint32_t periodUs);
+uint8_t startScheduler(Scheduler *scheduler);
+void stopScheduler(Scheduler *scheduler);
+void printSchedulerStats(Scheduler *scheduler);
+void freeScheduler(Scheduler *scheduler);
+
+#endif // SCHEDULER_H
@@ -8,11 +8,15 @@
   Boolean stack
 */
 
-// Initialize the stack
-void initStack(Stack *s) { s->top = -1; }
+// Initialize the stack on a storage of capacity elements
+void initStack(Stack *s, StackElement *elements, int capacity) {
+  s->elements = elements;
+  s->capacity = capacity;
+  s->top = -1;
+}
 
 // Check if the stack is full
-uint8_t isFull(Stack *s) { return s->top == MAX_SIZE - 1; }
+uint8_t isFull(Stack *s) { return s->top == s->capacity - 1; }
 
 // Check if the stack is empty
 uint8_t isEmpty(Stack *s) { return s->top == -1; }
@@ -4,8 +4,6 @@
 
 #include <stdint.h>
 
-#define MAX_SIZE 10 // Maximum stack size
-
 /*
 Stack structure for boolean values(accumulator)
 */
@@ -15,12 +13,13 @@ typedef struct {
 } StackElement;
 
 typedef struct {
-  StackElement elements[MAX_SIZE];
+  StackElement *elements; // Storage of capacity elements
+  int capacity;
   int top;
 } Stack;
 
 // Function prototypes for boolean stack
-void initStack(Stack *s);
+void initStack(Stack *s, StackElement *elements, int capacity);
 uint8_t isFull(Stack *s);
 uint8_t isEmpty(Stack *s);
 uint8_t push(Stack *s, char instruction, uint64_t value);
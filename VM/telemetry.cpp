@@ -0,0 +1,257 @@
+#include "telemetry.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define ReadRetries 1000 // Attempts to get a consistent copy of the block
+
+/**
+ * Builds the name of the shared memory segment.
+ *
+ * @param telemetry The telemetry, receives the name.
+ * @param name The name given by the user.
+ */
+static void setTelemetryName(Telemetry *telemetry, const char *name) {
+#ifdef _WIN32
+  snprintf(telemetry->name, TelemetryNameSize, "Local\\%s", name);
+#else
+  // POSIX names start with a slash
+  snprintf(telemetry->name, TelemetryNameSize, "%s%s",
+           name[0] == '/' ? "" : "/", name);
+#endif
+}
+
+/**
+ * Maps a shared memory segment.
+ *
+ * @param telemetry The telemetry, with the name set.
+ * @param create Create the segment for writing, or open it for reading.
+ * @return The error code.
+ */
+static uint8_t mapTelemetry(Telemetry *telemetry, uint8_t create) {
+  size_t size = sizeof(TelemetryBlock);
+#ifdef _WIN32
+  HANDLE mapping =
+      create ? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                                  (DWORD)size, telemetry->name)
+             : OpenFileMappingA(FILE_MAP_READ, FALSE, telemetry->name);
+  if (mapping == NULL) {
+    return criticalError;
+  }
+  void *view = MapViewOfFile(mapping, create ? FILE_MAP_WRITE : FILE_MAP_READ,
+                             0, 0, size);
+  if (view == NULL) {
+    CloseHandle(mapping);
+    return criticalError;
+  }
+  telemetry->handle = mapping;
+#else
+  int fd = create ? shm_open(telemetry->name, O_CREAT | O_RDWR, 0644)
+                  : shm_open(telemetry->name, O_RDONLY, 0);
+  if (fd < 0) {
+    return criticalError;
+  }
+  if (create && ftruncate(fd, (off_t)size) != 0) {
+    close(fd);
+    shm_unlink(telemetry->name);
+    return criticalError;
+  }
+  void *view = mmap(NULL, size, create ? PROT_READ | PROT_WRITE : PROT_READ,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) {
+    if (create) {
+      shm_unlink(telemetry->name);
+    }
+    return criticalError;
+  }
+  telemetry->handle = NULL;
+#endif
+  telemetry->block = (TelemetryBlock *)view;
+  telemetry->writer = create;
+  return noError;
+}
+
+/**
+ * Creates the shared memory segment of a scan loop.
+ *
+ * @param telemetry The telemetry.
+ * @param name The name of the segment.
+ * @param cycleUs The cycle time of the scan loop.
+ * @return The error code.
+ */
+uint8_t createTelemetry(Telemetry *telemetry, const char *name,
+                        uint32_t cycleUs) {
+  setTelemetryName(telemetry, name);
+  if (mapTelemetry(telemetry, 1) != noError) {
+    printf("Error creating the telemetry segment %s\n", telemetry->name);
+    return criticalError;
+  }
+  TelemetryBlock *block = telemetry->block;
+  memset(block, 0, sizeof(*block));
+  block->version = TelemetryVersion;
+  block->cycleUs = cycleUs;
+  // The magic last, a monitor ignores the block until it is initialized
+  __atomic_store_n(&block->magic, TelemetryMagic, __ATOMIC_RELEASE);
+  return noError;
+}
+
+/**
+ * Opens the shared memory segment of a running VM for reading.
+ *
+ * @param telemetry The telemetry.
+ * @param name The name of the segment.
+ * @return The error code.
+ */
+uint8_t openTelemetry(Telemetry *telemetry, const char *name) {
+  setTelemetryName(telemetry, name);
+  if (mapTelemetry(telemetry, 0) != noError) {
+    printf("Error opening the telemetry segment %s\n", telemetry->name);
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Adds a time to a histogram.
+ *
+ * @param histogram The histogram.
+ * @param ns The time in nanoseconds.
+ */
+static void recordHistogram(Histogram *histogram, uint64_t ns) {
+  uint8_t bucket = 0;
+  uint64_t value = ns >> 1;
+  while (value != 0 && bucket < HistogramBuckets - 1) {
+    bucket++;
+    value >>= 1;
+  }
+  histogram->buckets[bucket]++;
+  histogram->count++;
+  histogram->sumNs += ns;
+  if (ns > histogram->maxNs) {
+    histogram->maxNs = ns;
+  }
+}
+
+/**
+ * Records the times of one scan.
+ *
+ * @param block The telemetry block, NULL to record nothing.
+ * @param scanNs The duration of the program execution.
+ * @param ioNs The duration of the I/O update.
+ * @param jitterNs The delay from the release to the start of the scan.
+ * @param overruns The releases missed after this scan.
+ */
+void recordScanTelemetry(TelemetryBlock *block, uint64_t scanNs,
+                         uint64_t ioNs, uint64_t jitterNs, uint64_t overruns) {
+  if (block == NULL) {
+    return;
+  }
+  uint32_t sequence = block->sequence;
+  __atomic_store_n(&block->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  recordHistogram(&block->scan, scanNs);
+  recordHistogram(&block->io, ioNs);
+  recordHistogram(&block->jitter, jitterNs);
+  block->scans++;
+  block->overruns += overruns;
+  block->lastScanNs = scanNs;
+  __atomic_store_n(&block->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copies a consistent snapshot of a telemetry block.
+ *
+ * @param block The shared block.
+ * @param snapshot Receives the copy.
+ * @return The error code, criticalError when the block is not initialized or
+ * the writer kept it busy.
+ */
+uint8_t readTelemetry(const TelemetryBlock *block, TelemetryBlock *snapshot) {
+  if (__atomic_load_n(&block->magic, __ATOMIC_ACQUIRE) != TelemetryMagic ||
+      block->version != TelemetryVersion) {
+    return criticalError;
+  }
+  for (uint16_t i = 0; i < ReadRetries; i++) {
+    uint32_t before = __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE);
+    if (before & 1) {
+      continue;
+    }
+    memcpy(snapshot, (const void *)block, sizeof(*snapshot));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&block->sequence, __ATOMIC_RELAXED) == before) {
+      return noError;
+    }
+  }
+  return criticalError;
+}
+
+/**
+ * Gets an upper bound of a percentile of a histogram.
+ *
+ * @param histogram The histogram.
+ * @param percent The percentile.
+ * @return The upper limit of the bucket of the percentile, in ns.
+ */
+static uint64_t getPercentile(const Histogram *histogram, double percent) {
+  uint64_t target = (uint64_t)(histogram->count * percent / 100.0);
+  uint64_t seen = 0;
+  for (uint8_t b = 0; b < HistogramBuckets; b++) {
+    seen += histogram->buckets[b];
+    if (seen > target) {
+      return (2ULL << b) - 1;
+    }
+  }
+  return histogram->maxNs;
+}
+
+static void printHistogram(const char *name, const Histogram *histogram) {
+  printf("%-8s count %lu, mean %.1f us, p50 < %.1f us, p99 < %.1f us, "
+         "max %.1f us\n",
+         name, (unsigned long)histogram->count,
+         histogram->count > 0
+             ? histogram->sumNs / 1000.0 / (double)histogram->count
+             : 0.0,
+         getPercentile(histogram, 50) / 1000.0,
+         getPercentile(histogram, 99) / 1000.0, histogram->maxNs / 1000.0);
+}
+
+/**
+ * Prints a snapshot of the telemetry.
+ *
+ * @param snapshot The snapshot, see readTelemetry.
+ */
+void printTelemetry(const TelemetryBlock *snapshot) {
+  printf("Cycle %u us: %lu scans, %lu overruns, last scan %.1f us\n",
+         snapshot->cycleUs, (unsigned long)snapshot->scans,
+         (unsigned long)snapshot->overruns, snapshot->lastScanNs / 1000.0);
+  printHistogram("scan", &snapshot->scan);
+  printHistogram("io", &snapshot->io);
+  printHistogram("jitter", &snapshot->jitter);
+}
+
+/**
+ * Unmaps the segment. The writer also removes it.
+ *
+ * @param telemetry The telemetry.
+ */
+void closeTelemetry(Telemetry *telemetry) {
+  if (telemetry->block == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(telemetry->block);
+  CloseHandle((HANDLE)telemetry->handle);
+#else
+  munmap(telemetry->block, sizeof(TelemetryBlock));
+  if (telemetry->writer) {
+    shm_unlink(telemetry->name);
+  }
+#endif
+  telemetry->block = NULL;
+}
@@ -0,0 +1,69 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "VM.h"
+
+/*
+Scan telemetry in shared memory.
+
+The scan loop keeps histograms of the scan duration, of the I/O update time
+(reading the inputs before the scan) and of the release jitter in a shared
+memory segment (POSIX shm_open, a file mapping on Windows), so an external
+monitor can follow a running VM:
+
+    vm -cyclic 10000 -telemetry plc1     the VM publishes its telemetry
+    vm -monitor plc1                     another process prints it
+
+The histograms have log2 buckets: bucket k counts the times in
+[2^k, 2^(k+1)) ns, bucket 0 also counts 0 ns.
+
+There is one writer, the scan loop, which never waits for the readers: it
+makes the sequence number odd, updates the block and makes it even again.
+A reader copies the block and retries when the sequence was odd or changed
+during the copy (a seqlock).
+*/
+
+#define TelemetryMagic 0x4D4C5449 // "ITLM"
+#define TelemetryVersion 1
+#define HistogramBuckets 32 // Up to 2^32 ns, about 4 s
+#define TelemetryNameSize 64
+
+typedef struct stHistogram {
+  uint64_t count;
+  uint64_t sumNs;
+  uint64_t maxNs;
+  uint64_t buckets[HistogramBuckets];
+} Histogram;
+
+// Layout of the shared memory segment
+typedef struct stTelemetryBlock {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t sequence; // Odd while the writer updates the block
+  uint32_t cycleUs;  // Cycle time of the scan loop
+  uint64_t scans;
+  uint64_t overruns;
+  uint64_t lastScanNs;
+  Histogram scan;   // Duration of the program execution
+  Histogram io;     // Duration of the I/O update before the scan
+  Histogram jitter; // Delay from the release to the start of the scan
+} TelemetryBlock;
+
+typedef struct stTelemetry {
+  TelemetryBlock *block;
+  void *handle;   // File mapping on Windows
+  uint8_t writer; // Created the segment, removes it when closed
+  char name[TelemetryNameSize];
+} Telemetry;
+
+// Function prototypes
+uint8_t createTelemetry(Telemetry *telemetry, const char *name,
+                        uint32_t cycleUs);
+uint8_t openTelemetry(Telemetry *telemetry, const char *name);
+void recordScanTelemetry(TelemetryBlock *block, uint64_t scanNs,
+                         uint64_t ioNs, uint64_t jitterNs, uint64_t overruns);
+uint8_t readTelemetry(const TelemetryBlock *block, TelemetryBlock *snapshot);
+void printTelemetry(const TelemetryBlock *snapshot);
+void closeTelemetry(Telemetry *telemetry);
+
+#endif // TELEMETRY_H
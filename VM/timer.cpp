@@ -1,9 +1,8 @@
 #include "timer.h"
 //#include <stdio.h>
-volatile uint32_t ElapsedTicks = 0;
 
 void initializeTimer(Timer timers[], uint8_t size) {
-  for (int aux = 0; (aux < size) && (aux < MAX_TIMERS); aux++) {
+  for (int aux = 0; aux < size; aux++) {
     timers[aux].EN = 0;
     timers[aux].ET = 0;
     timers[aux].IN = 0;
@@ -15,9 +14,7 @@ void initializeTimer(Timer timers[], uint8_t size) {
   }
 }
 
-void updateTicks(uint8_t nticks) { ElapsedTicks += nticks; }
-
-void runTimerTOF(Timer *timer) {
+void runTimerTOF(Timer *timer, uint32_t ticks) {
   if (timer->IN == 1) {
     timer->QO = 1;
     timer->ET = 0;
@@ -26,10 +23,10 @@ void runTimerTOF(Timer *timer) {
   } else {
     if (timer->EN == 0 && timer->QO == 1) {
       timer->EN = 1;
-      timer->InitTicks = ElapsedTicks;
+      timer->InitTicks = ticks;
     }
     if (timer->EN == 1) {
-      timer->ET = (uint16_t)((ElapsedTicks - timer->InitTicks)/ (uint32_t)timer->prescaler);
+      timer->ET = (uint16_t)((ticks - timer->InitTicks)/ (uint32_t)timer->prescaler);
       if (timer->ET >= timer->PT) {
         timer->ET = 0;
         timer->QO = 0;
@@ -41,8 +38,8 @@ void runTimerTOF(Timer *timer) {
   }
 }
 
-void runTimerTON(Timer *timer) {
-  //printf("TotalTicks:%ld\n", (long)ElapsedTicks);
+void runTimerTON(Timer *timer, uint32_t ticks) {
+  //printf("TotalTicks:%ld\n", (long)ticks);
   if (timer->IN == 0) {
     timer->QO = 0;
     timer->ET = 0;
@@ -51,11 +48,11 @@ void runTimerTON(Timer *timer) {
   } else {
     if (timer->EN == 0 && timer->QO == 0) {
       timer->EN = 1;
-      timer->InitTicks = ElapsedTicks ;
+      timer->InitTicks = ticks ;
     }
     if (timer->EN == 1) {
       if (timer->ET < timer->PT) {
-        timer->ET = (uint16_t)((ElapsedTicks - timer->InitTicks)/ (uint32_t)timer->prescaler);
+        timer->ET = (uint16_t)((ticks - timer->InitTicks)/ (uint32_t)timer->prescaler);
       }
       if (timer->ET >= timer->PT) {
         timer->QO = 1;
@@ -72,7 +69,6 @@ void runTimerTON(Timer *timer) {
   printf("Qo:%d\n", timer->QO);
   printf("IN:%d\n", timer->IN);
   printf("Sta:%d\n", timer->state);
-  updateTicks(4);
   */
 }
 
@@ -80,14 +76,14 @@ void runTimerTON(Timer *timer) {
 // State 1 -> timer on, output on, input on
 // State 2 -> timer off, output off, input xx
 
-void runTimerTP(Timer *timer) {
+void runTimerTP(Timer *timer, uint32_t ticks) {
   if (timer->state == 0 && timer->IN == 1) {
     timer->state = 1;
     timer->EN = 1;
-    timer->InitTicks = ElapsedTicks;
+    timer->InitTicks = ticks;
     timer->QO = 1;
   } else if (timer->state == 1) {
-    timer->ET = (uint16_t)((ElapsedTicks - timer->InitTicks)/ (uint32_t)timer->prescaler);
+    timer->ET = (uint16_t)((ticks - timer->InitTicks)/ (uint32_t)timer->prescaler);
     if (timer->ET >= timer->PT) {
       timer->QO = 0;
       timer->ET = 0;
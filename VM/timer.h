@@ -18,10 +18,6 @@ ET -> Elapsed Ticks
 
 #include <stdint.h>
 
-#define MAX_TIMERS 10 // Maximum timers available
-
-extern volatile uint32_t ElapsedTicks;
-
 /*
 Structure for timers
 Not Thread Safe
@@ -38,9 +34,8 @@ typedef struct {
 } Timer;
 
 void initializeTimer(Timer *timers, uint8_t size);
-void updateTicks(uint8_t nticks);
-void runTimerTON(Timer *timer);
-void runTimerTOF(Timer *timer);
-void runTimerTP(Timer *timer);
+void runTimerTON(Timer *timer, uint32_t ticks);
+void runTimerTOF(Timer *timer, uint32_t ticks);
+void runTimerTP(Timer *timer, uint32_t ticks);
 
 #endif
\ No newline at end of file
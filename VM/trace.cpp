@@ -0,0 +1,144 @@
+#include "trace.h"
+
+// Longest record: the image line of a full process image plus the prefixes
+#define TraceRecordMax(data) (64 + 3 * (uint32_t)(data)->imageSize)
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+/**
+ * Opens a trace sink writing to a file.
+ *
+ * @param sink The sink.
+ * @param filename The name of the trace file.
+ * @param size The size of the buffer, 0 for TraceBufferSize.
+ * @return The error code.
+ */
+uint8_t openTraceSink(TraceSink *sink, const char *filename, uint32_t size) {
+  sink->size = size > 0 ? size : TraceBufferSize;
+  sink->used = 0;
+  sink->buffer = (char *)malloc(sink->size);
+  sink->file = fopen(filename, "w");
+  if (sink->buffer == NULL || sink->file == NULL) {
+    printf("Error opening the trace file %s\n", filename);
+    closeTraceSink(sink);
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Writes the buffered records to the file.
+ *
+ * @param sink The sink.
+ */
+void flushTraceSink(TraceSink *sink) {
+  if (sink->used > 0 && sink->file != NULL) {
+    fwrite(sink->buffer, 1, sink->used, sink->file);
+  }
+  sink->used = 0;
+}
+
+/**
+ * Flushes and closes a trace sink.
+ *
+ * @param sink The sink.
+ */
+void closeTraceSink(TraceSink *sink) {
+  flushTraceSink(sink);
+  if (sink->file != NULL) {
+    fclose(sink->file);
+  }
+  free(sink->buffer);
+  sink->file = NULL;
+  sink->buffer = NULL;
+  sink->size = 0;
+}
+
+/**
+ * Makes room for a record, flushing the buffer when needed.
+ *
+ * @param sink The sink.
+ * @param length The maximum length of the record.
+ * @return Where to write the record, or NULL when it does not fit the buffer.
+ */
+static char *reserveRecord(TraceSink *sink, uint32_t length) {
+  if (sink->used + length > sink->size) {
+    flushTraceSink(sink);
+    if (length > sink->size) {
+      return NULL;
+    }
+  }
+  return sink->buffer + sink->used;
+}
+
+static char *appendHex(char *out, uint64_t value, uint8_t digits) {
+  for (int8_t i = (int8_t)(digits - 1); i >= 0; i--) {
+    out[i] = hexDigits[value & 0xF];
+    value >>= 4;
+  }
+  return out + digits;
+}
+
+static char *appendText(char *out, const char *text) {
+  while (*text != '\0') {
+    *out++ = *text++;
+  }
+  return out;
+}
+
+static char *appendRegion(char *out, char name, const uint8_t *region,
+                          uint16_t size) {
+  *out++ = ' ';
+  *out++ = name;
+  *out++ = ':';
+  for (uint16_t i = 0; i < size; i++) {
+    *out++ = ' ';
+    out = appendHex(out, region[i], 2);
+  }
+  return out;
+}
+
+/**
+ * Records the process image after a scan.
+ *
+ * @param sink The sink.
+ * @param scan The number of the scan.
+ * @param data The data structure containing the memory and register values.
+ */
+void traceScan(TraceSink *sink, uint64_t scan, const Data *data) {
+  char *start = reserveRecord(sink, TraceRecordMax(data));
+  if (start == NULL) {
+    return;
+  }
+  char *out = appendText(start, "scan ");
+  out = appendHex(out, scan, 8);
+  out = appendRegion(out, 'I', data->Inputs, data->inputSize);
+  out = appendRegion(out, 'Q', data->Outputs, data->outputSize);
+  out = appendRegion(out, 'M', data->Memories, data->memorySize);
+  *out++ = '\n';
+  sink->used += (uint32_t)(out - start);
+}
+
+/**
+ * Records an executed instruction.
+ *
+ * @param sink The sink.
+ * @param index The index of the instruction in the program.
+ * @param instr The instruction.
+ * @param data The data structure containing the memory and register values.
+ */
+void traceInstruction(TraceSink *sink, uint32_t index,
+                      const Instruction *instr, const Data *data) {
+  char *start = reserveRecord(sink, 36);
+  if (start == NULL) {
+    return;
+  }
+  char *out = appendText(start, "  ");
+  out = appendHex(out, index, index > 0xFFFF ? 8 : 4);
+  out = appendText(out, " op ");
+  out = appendHex(out, instr->opcode, 2);
+  out = appendText(out, " acc ");
+  out = appendHex(out, data->accumulator, 2);
+  *out++ = '\n';
+  sink->used += (uint32_t)(out - start);
+}
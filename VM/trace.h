@@ -0,0 +1,36 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "VM.h"
+
+/*
+Buffered trace sink.
+
+The headless mode does no console I/O while it scans. When a trace is
+requested the records are formatted into a memory buffer, without printf,
+and the buffer is written to the file only when it is full and when the
+sink is closed.
+
+traceScan -> one line with the process image after a scan
+traceInstruction -> one line with the opcode and accumulator after an
+                    instruction
+*/
+
+#define TraceBufferSize 65536 // Default size of the trace buffer
+
+typedef struct stTraceSink {
+  FILE *file;
+  char *buffer;
+  uint32_t size;
+  uint32_t used;
+} TraceSink;
+
+// Function prototypes
+uint8_t openTraceSink(TraceSink *sink, const char *filename, uint32_t size);
+void traceScan(TraceSink *sink, uint64_t scan, const Data *data);
+void traceInstruction(TraceSink *sink, uint32_t index,
+                      const Instruction *instr, const Data *data);
+void flushTraceSink(TraceSink *sink);
+void closeTraceSink(TraceSink *sink);
+
+#endif // TRACE_H
@@ -3,8 +3,6 @@
 
 #include <stdint.h>
 
-#define MAX_TRIGGERS 10 // Maximum triggers available
-
 typedef struct {
   uint8_t CLK;         // Input
   uint8_t _M;         // Reserved
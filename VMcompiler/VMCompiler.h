@@ -5,7 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "VMparameters.h"
+#include "../VM/programFormat.h"
 
 // Instructions
 #define InstLD 0
@@ -85,12 +85,12 @@
 #define NumOpTON 6
 #define NumOpTOF 6
 #define NumOpq 0
-#define NumOpTP 5 
+#define NumOpTP 6 
 #define NumOpRTRIGGER 3 
 #define NumOpFTRIGGER 3
 
-// instruction names
-const char *InstNames[] = {
+// instruction names, see mnemonics.h for the lookup
+constexpr const char *InstNames[] = {
   "LD",
   "LDN",
   "ST",
@@ -170,7 +170,7 @@ typedef struct stOperand {
   uint8_t memorytype;
   uint8_t registertype;
   uint8_t bitNumber;
-  uint16_t address; // Or constant value if type is K
+  uint32_t address; // Or position of the constant in the program if K
 } Operand;
 
 typedef struct stInstruction {
@@ -179,6 +179,26 @@ typedef struct stInstruction {
   Operand operands[MaxOpers];
 } Instruction;
 
+// Longest token of the source, including the terminator
+#define MaxTokenSize 30
+
+// Largest encoded instruction: opcode, operands with 8-byte constants and
+// the terminator written after it
+#define MaxEncodedSize (1 + MaxOpers * 9 + 1)
+
+// Source file mapped into memory, read only
+typedef struct stSourceFile {
+  const uint8_t *text; // Not null terminated
+  uint32_t size;
+  void *handle;        // Mapping handle (Windows)
+} SourceFile;
+
+// Output buffer that grows as the program is compiled
+typedef struct stOutputBuffer {
+  uint8_t *data;
+  uint32_t capacity;
+} OutputBuffer;
+
 // Union to convert data types: uint8, uint16, uint32, uint64, int8, int16, int32, int64
 typedef union {
 	uint8_t *u8;
@@ -192,4 +212,25 @@ typedef union {
 	float *f;
 } DataUnion;
 
+// State of the optimizer between two rungs, see peephole.h
+typedef struct stPeepholeState PeepholeState;
+
+// Source lines of the instructions, see lines.h
+typedef struct stLineMap LineMap;
+
+// Function prototypes
+uint8_t mapSourceFile(const char *filename, SourceFile *source);
+void unmapSourceFile(SourceFile *source);
+uint8_t reserveOutput(OutputBuffer *out, uint32_t used, uint32_t bytes);
+uint8_t getNumOp(uint8_t inst);
+uint8_t getMemoryTypeSize(uint8_t memorytype);
+Instruction readInstruction(uint8_t *buffer, uint32_t *position);
+uint8_t compileInstructions(const uint8_t *text, uint32_t start, uint32_t end,
+                            OutputBuffer *out, uint32_t *outBufPos,
+                            ProgramHeader *header, uint8_t quiet,
+                            PeepholeState *state, LineMap *lines,
+                            uint32_t line);
+void listInstructions(uint8_t *program, uint32_t start, uint32_t end,
+                      uint8_t warnings);
+
 #endif
\ No newline at end of file
@@ -1,12 +0,0 @@
-#ifndef VMPARAMETERS_H_INCLUDED
-#define VMPARAMETERS_H_INCLUDED
-
-// Memory definition
-#define MemorySize 10 // Size of the memory in bytes
-// Input definition
-#define InputSize 10 // Number of inputs in bytes
-// Output definition
-#define OutputSize 10 // Number of outputs in bytes
-
-
-#endif // VMPARAMETERS_H_INCLUDED
\ No newline at end of file
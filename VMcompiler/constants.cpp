@@ -0,0 +1,428 @@
+#include "constants.h"
+
+/**
+ * Reads a little endian value.
+ *
+ * @param buffer The buffer.
+ * @param pos The position of the value.
+ * @param size The size of the value in bytes.
+ * @return The value.
+ */
+static uint64_t readValue(const uint8_t *buffer, uint32_t pos, uint8_t size) {
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < size; i++) {
+    value |= (uint64_t)buffer[pos + i] << (8 * i);
+  }
+  return value;
+}
+
+/**
+ * Writes a little endian value.
+ *
+ * @param buffer The buffer.
+ * @param pos The position of the value.
+ * @param size The size of the value in bytes.
+ * @param value The value.
+ */
+static void writeValue(uint8_t *buffer, uint32_t pos, uint8_t size,
+                       uint64_t value) {
+  for (uint8_t i = 0; i < size; i++) {
+    buffer[pos + i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+/**
+ * Hashes a value of a size for the hash table of the pool.
+ *
+ * @param value The value.
+ * @param size Its size.
+ * @return The hash.
+ */
+static uint32_t hashConstant(uint64_t value, uint8_t size) {
+  uint64_t hash = (value ^ ((uint64_t)size << 56)) * 0x9E3779B97F4A7C15ull;
+  return (uint32_t)(hash >> 32);
+}
+
+/**
+ * Initializes an empty pool.
+ *
+ * @param pool The pool.
+ */
+void initConstantPool(ConstantPool *pool) {
+  memset(pool, 0, sizeof(*pool));
+}
+
+/**
+ * Makes the hash table of the pool twice as large.
+ *
+ * @param pool The pool.
+ * @return The error code.
+ */
+static uint8_t growConstantSlots(ConstantPool *pool) {
+  uint32_t numSlots = pool->numSlots > 0 ? pool->numSlots * 2 : 256;
+  uint32_t *slots = (uint32_t *)calloc(numSlots, sizeof(uint32_t));
+  if (slots == NULL) {
+    printf("Error allocating memory for the constant pool\n");
+    return criticalError;
+  }
+  for (uint32_t i = 0; i < pool->count; i++) {
+    const ConstantEntry *entry = &pool->entries[i];
+    uint32_t s = hashConstant(entry->value, entry->size) & (numSlots - 1);
+    while (slots[s] != 0) {
+      s = (s + 1) & (numSlots - 1);
+    }
+    slots[s] = i + 1;
+  }
+  free(pool->slots);
+  pool->slots = slots;
+  pool->numSlots = numSlots;
+  return noError;
+}
+
+/**
+ * Adds a value to the pool, unless it is there already.
+ *
+ * @param pool The pool.
+ * @param value The value.
+ * @param size Its size in bytes.
+ * @param found Receives the entry of the value, NULL if not needed.
+ * @return The error code.
+ */
+static uint8_t addConstant(ConstantPool *pool, uint64_t value, uint8_t size,
+                           ConstantEntry **found) {
+  if (2 * (pool->count + 1) > pool->numSlots &&
+      growConstantSlots(pool) != noError) {
+    return criticalError;
+  }
+  uint32_t s = hashConstant(value, size) & (pool->numSlots - 1);
+  while (pool->slots[s] != 0) {
+    ConstantEntry *entry = &pool->entries[pool->slots[s] - 1];
+    if (entry->value == value && entry->size == size) {
+      if (found != NULL) {
+        *found = entry;
+      }
+      return noError;
+    }
+    s = (s + 1) & (pool->numSlots - 1);
+  }
+  if (pool->count == pool->capacity) {
+    uint32_t capacity = pool->capacity > 0 ? pool->capacity * 2 : 256;
+    ConstantEntry *entries = (ConstantEntry *)realloc(
+        pool->entries, capacity * sizeof(ConstantEntry));
+    if (entries == NULL) {
+      printf("Error allocating memory for the constant pool\n");
+      return criticalError;
+    }
+    pool->entries = entries;
+    pool->capacity = capacity;
+  }
+  ConstantEntry *entry = &pool->entries[pool->count];
+  entry->value = value;
+  entry->size = size;
+  entry->offset = 0;
+  entry->kept = 0;
+  pool->slots[s] = ++pool->count;
+  if (found != NULL) {
+    *found = entry;
+  }
+  return noError;
+}
+
+/**
+ * Finds a value of the pool.
+ *
+ * @param pool The pool.
+ * @param value The value.
+ * @param size Its size in bytes.
+ * @return The entry, NULL if the value is not in the pool.
+ */
+static const ConstantEntry *findConstant(const ConstantPool *pool,
+                                         uint64_t value, uint8_t size) {
+  if (pool->numSlots == 0) {
+    return NULL;
+  }
+  uint32_t s = hashConstant(value, size) & (pool->numSlots - 1);
+  while (pool->slots[s] != 0) {
+    const ConstantEntry *entry = &pool->entries[pool->slots[s] - 1];
+    if (entry->value == value && entry->size == size) {
+      return entry;
+    }
+    s = (s + 1) & (pool->numSlots - 1);
+  }
+  return NULL;
+}
+
+/**
+ * Adds the K constants used by a range of the code of the previous program
+ * to the pool, at the offset they have in its pool, and keeps the previous
+ * pool as the start of the new one.
+ *
+ * @param pool The pool, before the constants of the new code are collected.
+ * @param program The previous program.
+ * @param section The section of its constant pool.
+ * @param start The position of the first instruction.
+ * @param end The end of the range.
+ * @return The error code.
+ */
+uint8_t keepConstants(ConstantPool *pool, const uint8_t *program,
+                      const SectionEntry *section, uint32_t start,
+                      uint32_t end) {
+  uint32_t pos = start;
+  while (pos < end) {
+    uint8_t opcode = program[pos++];
+    // the opcode is checked before it indexes the table of getNumOp
+    if (opcode >= NumInstructions ||
+        pos + 3 * getNumOp(opcode) > end) {
+      printf("Error: invalid code in the previous program\n");
+      return criticalError;
+    }
+    uint8_t numOperands = getNumOp(opcode);
+    for (uint8_t i = 0; i < numOperands; i++) {
+      uint8_t type = program[pos];
+      uint16_t word = (uint16_t)readValue(program, pos + 1, 2);
+      pos += 3;
+      if (((type >> 3) & 0x03) != K) {
+        continue;
+      }
+      uint8_t size = getMemoryTypeSize(type >> 5);
+      uint32_t offset = (uint32_t)word * size;
+      if (size == 0 || offset + size > section->size) {
+        printf("Error: invalid constant in the previous program\n");
+        return criticalError;
+      }
+      uint32_t count = pool->count;
+      ConstantEntry *entry;
+      if (addConstant(pool, readValue(program, section->offset + offset, size),
+                      size, &entry) != noError) {
+        return criticalError;
+      }
+      if (pool->count > count) {
+        entry->offset = offset;
+        entry->kept = 1;
+      }
+    }
+  }
+  // the whole previous pool is kept, the values no longer used included
+  pool->keptValues = program + section->offset;
+  pool->keptSize = section->size;
+  return noError;
+}
+
+/**
+ * Adds the K constants of a range of the code to the pool.
+ *
+ * @param pool The pool.
+ * @param code The code, with the constants inline.
+ * @param start The position of the first instruction.
+ * @param end The end of the range.
+ * @return The error code.
+ */
+uint8_t collectConstants(ConstantPool *pool, uint8_t *code, uint32_t start,
+                         uint32_t end) {
+  uint32_t pos = start;
+  while (pos < end) {
+    Instruction instr = readInstruction(code, &pos);
+    for (uint8_t i = 0; i < instr.num_operands; i++) {
+      const Operand *operand = &instr.operands[i];
+      if (operand->registertype != K) {
+        continue;
+      }
+      uint8_t size = getMemoryTypeSize(operand->memorytype);
+      if (size == 0) {
+        printf("Error: invalid memory type of a constant\n");
+        return criticalError;
+      }
+      if (addConstant(pool, readValue(code, operand->address, size), size,
+                      NULL) != noError) {
+        return criticalError;
+      }
+    }
+  }
+  return noError;
+}
+
+/**
+ * Places the values in the pool, once all the constants are collected: the
+ * values kept from the previous program stay where they are, the others
+ * follow them in groups of 8, 4, 2 and 1 bytes, each group aligned on its
+ * size. Without new values the pool keeps its size, so the same code gives
+ * the same program.
+ *
+ * @param pool The pool.
+ * @return The error code: warning if an index does not fit 16 bits after
+ * the kept values, criticalError if it does not fit at all.
+ */
+uint8_t layoutConstantPool(ConstantPool *pool) {
+  uint32_t pos = pool->keptSize;
+  for (uint8_t group = 0; group < ConstantGroups; group++) {
+    uint32_t size = 8 >> group;
+    for (uint32_t i = 0; i < pool->count; i++) {
+      ConstantEntry *entry = &pool->entries[i];
+      if (entry->kept || entry->size != size) {
+        continue;
+      }
+      pos = (pos + size - 1) / size * size; // only a group with values
+      if (pos / size > MaxConstantIndex) {
+        if (pool->keptSize > 0) {
+          return warning;
+        }
+        printf("Error: too many constants, the index of the pool is 16 "
+               "bits\n");
+        return criticalError;
+      }
+      entry->offset = pos;
+      pos += size;
+    }
+  }
+  pool->size = pos;
+  return noError;
+}
+
+/**
+ * Encodes a range of the code again, with the index of the constants in
+ * the pool instead of their value.
+ *
+ * @param pool The pool, laid out, with the constants of the code.
+ * @param code The code, with the constants inline.
+ * @param start The position of the first instruction.
+ * @param end The end of the range.
+ * @param out The output buffer.
+ * @param outBufPos The position in the output buffer, moved after the code.
+ * @return The error code.
+ */
+uint8_t indexConstants(const ConstantPool *pool, uint8_t *code,
+                       uint32_t start, uint32_t end, OutputBuffer *out,
+                       uint32_t *outBufPos) {
+  uint32_t pos = start;
+  while (pos < end) {
+    if (reserveOutput(out, *outBufPos, MaxEncodedSize) != noError) {
+      return criticalError;
+    }
+    uint8_t *buffer = out->data;
+    uint32_t bufPos = *outBufPos;
+    Instruction instr = readInstruction(code, &pos);
+    buffer[bufPos++] = instr.opcode;
+    for (uint8_t i = 0; i < instr.num_operands; i++) {
+      const Operand *operand = &instr.operands[i];
+      uint16_t word = (uint16_t)operand->address;
+      buffer[bufPos] = operand->memorytype << 5 | operand->registertype << 3 |
+                       operand->bitNumber;
+      if (operand->registertype == K) {
+        uint8_t size = getMemoryTypeSize(operand->memorytype);
+        const ConstantEntry *entry =
+            findConstant(pool, readValue(code, operand->address, size), size);
+        if (entry == NULL) {
+          printf("Error: constant missing from the constant pool\n");
+          return criticalError;
+        }
+        word = (uint16_t)(entry->offset / size);
+      }
+      writeValue(buffer, bufPos + 1, 2, word);
+      bufPos += 3;
+    }
+    *outBufPos = bufPos;
+  }
+  return noError;
+}
+
+/**
+ * Appends the pool, aligned on ConstantPoolAlign.
+ *
+ * @param pool The pool, laid out.
+ * @param out The output buffer.
+ * @param outBufPos The position after the code, moved after the pool.
+ * @param section Receives the section of the pool.
+ * @return The error code.
+ */
+uint8_t writeConstantPool(const ConstantPool *pool, OutputBuffer *out,
+                          uint32_t *outBufPos, SectionEntry *section) {
+  uint32_t padding = (ConstantPoolAlign - *outBufPos % ConstantPoolAlign) %
+                     ConstantPoolAlign;
+  if (reserveOutput(out, *outBufPos, padding + pool->size) != noError) {
+    return criticalError;
+  }
+  // the previous pool first, then 0 in the alignment of the new groups
+  memset(out->data + *outBufPos, 0, padding + pool->size);
+  *outBufPos += padding;
+  if (pool->keptSize > 0) {
+    memcpy(out->data + *outBufPos, pool->keptValues, pool->keptSize);
+  }
+  for (uint32_t i = 0; i < pool->count; i++) {
+    const ConstantEntry *entry = &pool->entries[i];
+    writeValue(out->data, *outBufPos + entry->offset, entry->size,
+               entry->value);
+  }
+  memset(section, 0, sizeof(*section));
+  section->offset = *outBufPos;
+  section->size = pool->size;
+  section->type = SectionConstants;
+  strcpy(section->name, "constants");
+  *outBufPos += pool->size;
+  return noError;
+}
+
+/**
+ * Encodes a range of the code of a program with a constant pool again, with
+ * the constants inline.
+ *
+ * @param program The program.
+ * @param pool The section of its constant pool.
+ * @param start The position of the first instruction.
+ * @param end The end of the range.
+ * @param out The output buffer.
+ * @param outBufPos The position in the output buffer, moved after the code.
+ * @return The error code.
+ */
+uint8_t expandConstants(const uint8_t *program, const SectionEntry *pool,
+                        uint32_t start, uint32_t end, OutputBuffer *out,
+                        uint32_t *outBufPos) {
+  uint32_t pos = start;
+  while (pos < end) {
+    if (reserveOutput(out, *outBufPos, MaxEncodedSize) != noError) {
+      return criticalError;
+    }
+    uint8_t *buffer = out->data;
+    uint32_t bufPos = *outBufPos;
+    uint8_t opcode = program[pos++];
+    // the opcode is checked before it indexes the table of getNumOp
+    if (opcode >= NumInstructions ||
+        pos + 3 * getNumOp(opcode) > end) {
+      printf("Error: invalid code in the previous program\n");
+      return criticalError;
+    }
+    uint8_t numOperands = getNumOp(opcode);
+    buffer[bufPos++] = opcode;
+    for (uint8_t i = 0; i < numOperands; i++) {
+      uint8_t type = program[pos];
+      uint16_t word = (uint16_t)readValue(program, pos + 1, 2);
+      pos += 3;
+      buffer[bufPos++] = type;
+      if (((type >> 3) & 0x03) != K) {
+        writeValue(buffer, bufPos, 2, word);
+        bufPos += 2;
+        continue;
+      }
+      uint8_t size = getMemoryTypeSize(type >> 5);
+      if ((uint64_t)word * size + size > pool->size) {
+        printf("Error: invalid constant in the previous program\n");
+        return criticalError;
+      }
+      writeValue(buffer, bufPos, size,
+                 readValue(program, pool->offset + word * size, size));
+      bufPos += size;
+    }
+    *outBufPos = bufPos;
+  }
+  return noError;
+}
+
+/**
+ * Releases the pool.
+ *
+ * @param pool The pool.
+ */
+void freeConstantPool(ConstantPool *pool) {
+  free(pool->entries);
+  free(pool->slots);
+  initConstantPool(pool);
+}
@@ -0,0 +1,69 @@
+#ifndef CONSTANTS_H
+#define CONSTANTS_H
+
+#include "VMCompiler.h"
+
+/*
+Constant pool of program.bin (version 1, see programFormat.h).
+
+The instructions are compiled with their K constants inline, as in
+version 0: the optimizer, the listing and the incremental compilation work
+on that code. When the whole program is compiled, a first pass collects
+the constants, each value once per size, a second pass encodes the code
+again with the index of each constant in the pool instead of its value.
+The pool is written after the code, aligned on ConstantPoolAlign, the 8
+byte values first and the 1 byte values last, in the order they are first
+used in the program; the same source gives the same pool. The index of a
+value is its offset in the pool divided by its size.
+
+The code of the previous program, read back by the incremental
+compilation, has its constants expanded inline again (expandConstants).
+So that an edit does not move the other constants, and the patch stays
+the size of the edit, the incremental compilation keeps the offset of
+every constant the previous program uses (keepConstants) and adds the new
+ones after the previous pool, grouped by size the same way; without new
+values the pool is the previous one, byte for byte. The values no longer
+used stay in the pool; a full compilation, without -i, packs the pool
+again, as does -i when an index would not fit 16 bits.
+*/
+
+// Values of 8, 4, 2 and 1 bytes, in the order of the pool
+#define ConstantGroups 4
+
+typedef struct stConstantEntry {
+  uint64_t value;
+  uint32_t offset; // Position in the pool, set by layoutConstantPool
+  uint8_t size;    // 1, 2, 4 or 8 bytes
+  uint8_t kept;    // Offset kept from the previous program
+} ConstantEntry;
+
+typedef struct stConstantPool {
+  ConstantEntry *entries; // Values in the order found
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t *slots;   // Hash table of the entries, index + 1, 0 when empty
+  uint32_t numSlots; // Power of 2
+  const uint8_t *keptValues; // Previous pool, in the previous program
+  uint32_t keptSize; // Size of the previous pool, the new values follow
+  uint32_t size;     // Size of the pool in bytes
+} ConstantPool;
+
+// Function prototypes
+void initConstantPool(ConstantPool *pool);
+uint8_t keepConstants(ConstantPool *pool, const uint8_t *program,
+                      const SectionEntry *section, uint32_t start,
+                      uint32_t end);
+uint8_t collectConstants(ConstantPool *pool, uint8_t *code, uint32_t start,
+                         uint32_t end);
+uint8_t layoutConstantPool(ConstantPool *pool);
+uint8_t indexConstants(const ConstantPool *pool, uint8_t *code,
+                       uint32_t start, uint32_t end, OutputBuffer *out,
+                       uint32_t *outBufPos);
+uint8_t writeConstantPool(const ConstantPool *pool, OutputBuffer *out,
+                          uint32_t *outBufPos, SectionEntry *section);
+uint8_t expandConstants(const uint8_t *program, const SectionEntry *pool,
+                        uint32_t start, uint32_t end, OutputBuffer *out,
+                        uint32_t *outBufPos);
+void freeConstantPool(ConstantPool *pool);
+
+#endif // CONSTANTS_H
@@ -0,0 +1,556 @@
+#include "incremental.h"
+#include "constants.h"
+
+/**
+ * Hashes the text of a rung (FNV-1a, 64 bits).
+ *
+ * @param text The text.
+ * @param length The length of the text.
+ * @return The hash.
+ */
+static uint64_t hashRung(const uint8_t *text, uint32_t length) {
+  uint64_t hash = 14695981039346656037ull;
+  for (uint32_t i = 0; i < length; i++) {
+    hash = (hash ^ text[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+/**
+ * Gets the position of the next line.
+ *
+ * @param text The source.
+ * @param size The size of the source.
+ * @param pos A position in the current line.
+ * @return The position after the end of the line.
+ */
+static uint32_t nextLine(const uint8_t *text, uint32_t size, uint32_t pos) {
+  const uint8_t *end = (const uint8_t *)memchr(text + pos, '\n', size - pos);
+  return end != NULL ? (uint32_t)(end - text) + 1 : size;
+}
+
+/**
+ * Checks if a line starts a rung (its first token is LD or LDN).
+ *
+ * @param text The source.
+ * @param size The size of the source.
+ * @param pos The start of the line.
+ * @return 1 if the line starts a rung.
+ */
+uint8_t startsRung(const uint8_t *text, uint32_t size, uint32_t pos) {
+  while (pos < size && (text[pos] == ' ' || text[pos] == '\t')) {
+    pos++;
+  }
+  if (pos + 2 > size || text[pos] != 'L' || text[pos + 1] != 'D') {
+    return 0;
+  }
+  pos += 2;
+  if (pos < size && text[pos] == 'N') {
+    pos++;
+  }
+  return pos == size || text[pos] == ' ' || text[pos] == '\t' ||
+         text[pos] == '\r' || text[pos] == '\n';
+}
+
+/**
+ * Finds the end of the rung that starts at a position.
+ *
+ * @param text The source.
+ * @param size The size of the source.
+ * @param pos The start of the rung.
+ * @return The start of the next rung, or the size of the source.
+ */
+static uint32_t findRungEnd(const uint8_t *text, uint32_t size, uint32_t pos) {
+  pos = nextLine(text, size, pos);
+  while (pos < size && !startsRung(text, size, pos)) {
+    pos = nextLine(text, size, pos);
+  }
+  return pos;
+}
+
+/**
+ * Finds a rung in the cache.
+ *
+ * @param cache The cache.
+ * @param hash The hash of the text of the rung.
+ * @param length The length of the text.
+ * @param stateIn The state of the optimizer when the rung starts.
+ * @return The entry, or NULL if the rung is not in the cache.
+ */
+static const RungEntry *findRung(const RungCache *cache, uint64_t hash,
+                                 uint32_t length, uint32_t stateIn) {
+  if (!cache->valid) {
+    return NULL;
+  }
+  uint32_t mask = cache->numSlots - 1;
+  for (uint32_t s = (uint32_t)hash & mask; cache->slots[s] != 0;
+       s = (s + 1) & mask) {
+    const RungEntry *entry = &cache->entries[cache->slots[s] - 1];
+    if (entry->hash == hash && entry->textLength == length &&
+        entry->stateIn == stateIn) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Builds the name of a file that goes with the output file.
+ *
+ * @param name The buffer for the name.
+ * @param size The size of the buffer.
+ * @param outFilename The name of the output file.
+ * @param extension The extension added to it.
+ * @return The error code.
+ */
+static uint8_t getCompanionName(char *name, size_t size,
+                                const char *outFilename,
+                                const char *extension) {
+  if ((size_t)snprintf(name, size, "%s%s", outFilename, extension) >= size) {
+    printf("Error: file name too long %s\n", outFilename);
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Checks that the previous program is the one described by the cache and
+ * finds its constant pool.
+ *
+ * @param cache The cache, with the previous program mapped.
+ * @return The error code.
+ */
+static uint8_t checkPreviousProgram(RungCache *cache) {
+  const SourceFile *previous = &cache->previous;
+  ProgramHeader header;
+  if (previous->size != cache->header.programSize ||
+      previous->size < HeaderSize + 4 ||
+      readProgramHeader(previous->text, &header) != 0 ||
+      header.version != ProgramVersion ||
+      header.programSize + 4 != previous->size ||
+      checkProgramSections(previous->text, &header) != 0) {
+    return criticalError;
+  }
+  // The code of the rungs refers to the constants of its pool
+  findConstantPool(previous->text, &header, &cache->pool);
+  uint32_t check = computeProgramCheck(previous->text, &header);
+  if (check != readProgramCheck(previous->text, &header) ||
+      check != cache->header.programCheck) {
+    return criticalError;
+  }
+  for (uint32_t i = 0; i < cache->header.numRungs; i++) {
+    const RungEntry *entry = &cache->entries[i];
+    if (entry->codeOffset < header.headerSize ||
+        (uint64_t)entry->codeOffset + entry->codeSize > header.codeEnd ||
+        (uint64_t)entry->firstInstruction + entry->numInstructions >
+            cache->header.numLines) {
+      return criticalError;
+    }
+  }
+  return noError;
+}
+
+/**
+ * Loads the cache of the last compilation and maps its program.
+ *
+ * Without a cache, or when the output file is not the program it
+ * describes, the cache is left empty and everything is compiled.
+ *
+ * @param cache The cache.
+ * @param outFilename The name of the output file.
+ * @param optimized The program is compiled with the optimizer.
+ * @return The error code, noError if the cache can be used.
+ */
+uint8_t loadRungCache(RungCache *cache, const char *outFilename,
+                      uint8_t optimized) {
+  char name[512];
+  memset(cache, 0, sizeof(*cache));
+  if (getCompanionName(name, sizeof(name), outFilename, ".cache") != noError) {
+    return criticalError;
+  }
+  FILE *file = fopen(name, "rb");
+  if (file == NULL) {
+    return criticalError;
+  }
+  uint8_t ok = fread(&cache->header, sizeof(cache->header), 1, file) == 1 &&
+               cache->header.magic == RungCacheMagic &&
+               cache->header.version == RungCacheVersion &&
+               cache->header.optimized == optimized;
+  if (ok) {
+    uint32_t n = cache->header.numRungs;
+    uint32_t l = cache->header.numLines;
+    cache->entries = (RungEntry *)malloc((n > 0 ? n : 1) * sizeof(RungEntry));
+    cache->lines = (uint32_t *)malloc((l > 0 ? l : 1) * sizeof(uint32_t));
+    ok = cache->entries != NULL && cache->lines != NULL &&
+         fread(cache->entries, sizeof(RungEntry), n, file) == n &&
+         fread(cache->lines, sizeof(uint32_t), l, file) == l;
+  }
+  fclose(file);
+  // The code of the rungs is in the previous program
+  FILE *program = ok ? fopen(outFilename, "rb") : NULL;
+  if (program != NULL) {
+    fclose(program);
+    ok = mapSourceFile(outFilename, &cache->previous) == noError &&
+         checkPreviousProgram(cache) == noError;
+  } else {
+    ok = 0;
+  }
+  if (ok) {
+    uint32_t numSlots = 16;
+    while (numSlots < 2 * cache->header.numRungs) {
+      numSlots *= 2;
+    }
+    cache->slots = (uint32_t *)calloc(numSlots, sizeof(uint32_t));
+    ok = cache->slots != NULL;
+    cache->numSlots = numSlots;
+    for (uint32_t i = 0; ok && i < cache->header.numRungs; i++) {
+      const RungEntry *entry = &cache->entries[i];
+      uint32_t s = (uint32_t)entry->hash & (numSlots - 1);
+      while (cache->slots[s] != 0) {
+        s = (s + 1) & (numSlots - 1);
+      }
+      cache->slots[s] = i + 1;
+    }
+  }
+  if (!ok) {
+    freeRungCache(cache);
+    return criticalError;
+  }
+  cache->valid = 1;
+  return noError;
+}
+
+/**
+ * Adds a rung to the list of the program being compiled.
+ *
+ * @param rungs The list.
+ * @param entry The rung.
+ * @return The error code.
+ */
+static uint8_t addRung(RungList *rungs, const RungEntry *entry) {
+  if (rungs->count == rungs->capacity) {
+    uint32_t capacity = rungs->capacity > 0 ? rungs->capacity * 2 : 256;
+    RungEntry *entries =
+        (RungEntry *)realloc(rungs->entries, capacity * sizeof(RungEntry));
+    if (entries == NULL) {
+      printf("Error: allocating memory for the rungs\n");
+      return criticalError;
+    }
+    rungs->entries = entries;
+    rungs->capacity = capacity;
+  }
+  rungs->entries[rungs->count++] = *entry;
+  return noError;
+}
+
+/**
+ * Compiles the source rung by rung, copying the code of the rungs found in
+ * the cache.
+ *
+ * @param cache The cache of the last compilation.
+ * @param text The source.
+ * @param size The size of the source.
+ * @param out The output buffer.
+ * @param outBufPos The position in the output buffer, moved after the code.
+ * @param header The header, its sizes grow with the addresses used.
+ * @param quiet Does not print the instructions.
+ * @param state The state of the optimizer, NULL without the optimizer.
+ * @param rungs Receives the rungs of the program, for the next cache.
+ * @param lines Receives the source line of each instruction.
+ * @return The error code.
+ */
+uint8_t compileIncremental(RungCache *cache, const uint8_t *text,
+                           uint32_t size, OutputBuffer *out,
+                           uint32_t *outBufPos, ProgramHeader *header,
+                           uint8_t quiet, PeepholeState *state,
+                           RungList *rungs, LineMap *lines) {
+  uint32_t compiled = 0;
+  uint32_t pos = 0;
+  uint32_t line = 1;
+  while (pos < size) {
+    uint32_t end = findRungEnd(text, size, pos);
+    RungEntry rung;
+    memset(&rung, 0, sizeof(rung));
+    rung.hash = hashRung(text + pos, end - pos);
+    rung.textLength = end - pos;
+    rung.codeOffset = *outBufPos;
+    rung.stateIn = packPeepholeState(state);
+    rung.firstLine = line;
+    rung.firstInstruction = lines->count;
+    const RungEntry *cached =
+        findRung(cache, rung.hash, rung.textLength, rung.stateIn);
+    if (cached != NULL) {
+      if (expandConstants(cache->previous.text, &cache->pool,
+                          cached->codeOffset,
+                          cached->codeOffset + cached->codeSize, out,
+                          outBufPos) != noError) {
+        return criticalError;
+      }
+      if (!quiet) {
+        listInstructions(out->data, rung.codeOffset, *outBufPos, 1);
+      }
+      rung.inputSize = cached->inputSize;
+      rung.outputSize = cached->outputSize;
+      rung.memorySize = cached->memorySize;
+      rung.stateOut = cached->stateOut;
+      for (uint32_t i = 0; i < cached->numInstructions; i++) {
+        uint32_t cachedLine = cache->lines[cached->firstInstruction + i];
+        if (addLine(lines, cachedLine - cached->firstLine + line) !=
+            noError) {
+          return criticalError;
+        }
+      }
+      if (state != NULL) {
+        unpackPeepholeState(rung.stateOut, state);
+      }
+    } else {
+      ProgramHeader sizes; // regions used by this rung only
+      memset(&sizes, 0, sizeof(sizes));
+      if (compileInstructions(text, pos, end, out, outBufPos, &sizes, quiet,
+                              state, lines, line) != noError) {
+        return criticalError;
+      }
+      rung.stateOut = packPeepholeState(state);
+      rung.inputSize = sizes.inputSize;
+      rung.outputSize = sizes.outputSize;
+      rung.memorySize = sizes.memorySize;
+      compiled++;
+    }
+    rung.codeSize = *outBufPos - rung.codeOffset;
+    rung.numInstructions = lines->count - rung.firstInstruction;
+    if (rung.inputSize > header->inputSize) {
+      header->inputSize = rung.inputSize;
+    }
+    if (rung.outputSize > header->outputSize) {
+      header->outputSize = rung.outputSize;
+    }
+    if (rung.memorySize > header->memorySize) {
+      header->memorySize = rung.memorySize;
+    }
+    if (addRung(rungs, &rung) != noError) {
+      return criticalError;
+    }
+    line += countLines(text, pos, end);
+    pos = end;
+  }
+  if (!quiet) {
+    printf("\nIncremental: %u of %u rungs compiled\n", compiled, rungs->count);
+  }
+  return noError;
+}
+
+/**
+ * Checks if two rungs have the same code, the indexes of their constants
+ * included.
+ *
+ * @param a A rung of the previous program.
+ * @param b A rung of the new program.
+ * @param previous The previous program.
+ * @param program The new program.
+ * @return 1 if they are the same.
+ */
+static uint8_t sameRung(const RungEntry *a, const RungEntry *b,
+                        const uint8_t *previous, const uint8_t *program) {
+  return a->hash == b->hash && a->textLength == b->textLength &&
+         a->stateIn == b->stateIn && a->codeSize == b->codeSize &&
+         memcmp(previous + a->codeOffset, program + b->codeOffset,
+                a->codeSize) == 0;
+}
+
+/**
+ * Finds the end of a run of changed rungs: the nearest pair of rungs that
+ * are the same in both programs, the fewest rungs replaced first.
+ *
+ * @param old The rungs of the previous program.
+ * @param i The first changed rung of the previous program.
+ * @param n The end of the rungs of the previous program to search.
+ * @param now The rungs of the new program.
+ * @param j The first changed rung of the new program.
+ * @param m The end of the rungs of the new program to search.
+ * @param previous The previous program.
+ * @param program The new program.
+ * @param oldStop Receives the end of the run in the previous program.
+ * @param newStop Receives the end of the run in the new program.
+ */
+static void findSameRungs(const RungEntry *old, uint32_t i, uint32_t n,
+                          const RungEntry *now, uint32_t j, uint32_t m,
+                          const uint8_t *previous, const uint8_t *program,
+                          uint32_t *oldStop, uint32_t *newStop) {
+  uint32_t limit = (n - i) + (m - j);
+  if (limit > MaxPatchSearch) {
+    limit = MaxPatchSearch;
+  }
+  for (uint32_t k = 1; k < limit; k++) {
+    for (uint32_t a = 0; a <= k; a++) {
+      uint32_t b = k - a;
+      if (i + a < n && j + b < m &&
+          sameRung(&old[i + a], &now[j + b], previous, program)) {
+        *oldStop = i + a;
+        *newStop = j + b;
+        return;
+      }
+    }
+  }
+  // Changed up to the end of the search
+  *oldStop = n;
+  *newStop = m;
+}
+
+/**
+ * Writes the patch from the previous program to the new one.
+ *
+ * @param cache The cache of the last compilation, with the previous
+ * program.
+ * @param rungs The rungs of the new program.
+ * @param outFilename The name of the output file.
+ * @param program The new program, with its checksum.
+ * @param header The header of the new program.
+ * @return The error code.
+ */
+uint8_t writePatch(const RungCache *cache, const RungList *rungs,
+                   const char *outFilename, const uint8_t *program,
+                   const ProgramHeader *header) {
+  char name[512];
+  if (getCompanionName(name, sizeof(name), outFilename, ".patch") != noError) {
+    return criticalError;
+  }
+  FILE *file = fopen(name, "w");
+  if (file == NULL) {
+    printf("Error opening file %s\n", name);
+    return criticalError;
+  }
+  const RungEntry *old = cache->entries;
+  uint32_t n = 0;
+  uint32_t oldEnd = HeaderSize;
+  if (cache->valid) {
+    ProgramHeader oldHeader;
+    if (readProgramHeader(cache->previous.text, &oldHeader) == 0) {
+      oldEnd = oldHeader.codeEnd;
+    }
+    n = cache->header.numRungs;
+    fprintf(file, "base %u 0x%08X\n", cache->header.programSize,
+            cache->header.programCheck);
+  } else {
+    fprintf(file, "base none\n");
+  }
+  const RungEntry *now = rungs->entries;
+  uint32_t m = rungs->count;
+  uint32_t newEnd = header->codeEnd;
+  fprintf(file, "target %u 0x%08X\n", header->programSize + 4,
+          readProgramCheck(program, header));
+  fprintf(file, "header %u %u %u\n", header->inputSize, header->outputSize,
+          header->memorySize);
+
+  // Rungs unchanged at the start and at the end
+  uint32_t prefix = 0;
+  const uint8_t *previous = cache->previous.text;
+  while (prefix < n && prefix < m &&
+         sameRung(&old[prefix], &now[prefix], previous, program)) {
+    prefix++;
+  }
+  uint32_t suffix = 0;
+  while (suffix < n - prefix && suffix < m - prefix &&
+         sameRung(&old[n - 1 - suffix], &now[m - 1 - suffix], previous,
+                  program)) {
+    suffix++;
+  }
+  if (!cache->valid) {
+    uint32_t newStart = m > 0 ? now[0].codeOffset : newEnd;
+    fprintf(file, "replace %u 0 %u %u rungs 0 0 0 %u\n", HeaderSize,
+            newStart, newEnd - newStart, m);
+  }
+  // One replace per run of changed rungs, the rungs between two runs are
+  // the same in both programs
+  uint32_t i = prefix;
+  uint32_t j = prefix;
+  while (cache->valid && (i < n - suffix || j < m - suffix)) {
+    uint32_t oldStop;
+    uint32_t newStop;
+    findSameRungs(old, i, n - suffix, now, j, m - suffix, previous, program,
+                  &oldStop, &newStop);
+    uint32_t oldStart = i < n ? old[i].codeOffset : oldEnd;
+    uint32_t newStart = j < m ? now[j].codeOffset : newEnd;
+    uint32_t oldNext = oldStop < n ? old[oldStop].codeOffset : oldEnd;
+    uint32_t newNext = newStop < m ? now[newStop].codeOffset : newEnd;
+    fprintf(file, "replace %u %u %u %u rungs %u %u %u %u\n", oldStart,
+            oldNext - oldStart, newStart, newNext - newStart, i,
+            oldStop - i, j, newStop - j);
+    i = oldStop;
+    j = newStop;
+    while (i < n - suffix && j < m - suffix &&
+           sameRung(&old[i], &now[j], previous, program)) {
+      i++;
+      j++;
+    }
+  }
+  if (fclose(file) != 0) {
+    printf("Error writing file %s\n", name);
+    remove(name);
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Saves the cache of the rungs of the program just compiled.
+ *
+ * @param rungs The rungs of the program.
+ * @param lines The source line of each instruction of the program.
+ * @param outFilename The name of the output file.
+ * @param program The program, with its checksum.
+ * @param size The size of the program with its checksum.
+ * @param optimized The program is compiled with the optimizer.
+ * @return The error code.
+ */
+uint8_t saveRungCache(const RungList *rungs, const LineMap *lines,
+                      const char *outFilename, const uint8_t *program,
+                      uint32_t size, uint8_t optimized) {
+  char name[512];
+  ProgramHeader header;
+  if (getCompanionName(name, sizeof(name), outFilename, ".cache") != noError ||
+      readProgramHeader(program, &header) != 0) {
+    return criticalError;
+  }
+  RungCacheHeader cacheHeader;
+  memset(&cacheHeader, 0, sizeof(cacheHeader));
+  cacheHeader.magic = RungCacheMagic;
+  cacheHeader.version = RungCacheVersion;
+  cacheHeader.numRungs = rungs->count;
+  cacheHeader.programSize = size;
+  cacheHeader.programCheck = readProgramCheck(program, &header);
+  cacheHeader.optimized = optimized;
+  cacheHeader.numLines = lines->count;
+  FILE *file = fopen(name, "wb");
+  if (file == NULL) {
+    printf("Error opening file %s\n", name);
+    return criticalError;
+  }
+  uint8_t ok =
+      fwrite(&cacheHeader, sizeof(cacheHeader), 1, file) == 1 &&
+      fwrite(rungs->entries, sizeof(RungEntry), rungs->count, file) ==
+          rungs->count &&
+      fwrite(lines->lines, sizeof(uint32_t), lines->count, file) ==
+          lines->count;
+  if (fclose(file) != 0 || !ok) {
+    printf("Error writing file %s\n", name);
+    remove(name);
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Releases the cache and unmaps the previous program.
+ *
+ * @param cache The cache.
+ */
+void freeRungCache(RungCache *cache) {
+  free(cache->entries);
+  free(cache->lines);
+  free(cache->slots);
+  unmapSourceFile(&cache->previous);
+  cache->entries = NULL;
+  cache->lines = NULL;
+  cache->slots = NULL;
+  cache->valid = 0;
+}
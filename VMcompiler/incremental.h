@@ -0,0 +1,120 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "VMCompiler.h"
+#include "peephole.h"
+#include "lines.h"
+
+/*
+Incremental compilation (-i).
+
+The source is split into rungs: a rung starts at a line whose first token
+is LD or LDN and takes the following lines up to the next one (comments
+and blank lines included). Each rung is identified by the FNV-1a hash and
+the length of its text, and by the state of the optimizer when it starts
+(see peephole.h).
+
+The cache, output.bin.cache, lists the rungs of the last compilation with
+the position and the size of their code in output.bin, the region sizes
+they use and the source lines of their instructions (see lines.h), which
+move with the first line of the rung. A rung found in the cache is copied
+from the previous output.bin, its constants expanded inline from the
+constant pool, only the new or edited rungs are tokenized and encoded. The
+code of a rung does not depend on its position (addresses are absolute)
+and the constants used by the previous program keep their index in the
+pool, the new ones are added after them (see constants.h), so an unchanged
+rung is encoded as before. The program is the one of a full compilation
+but for the order of the pool; without a cache, it is byte for byte the
+same. The cache is only used when output.bin is still the program it
+describes (same size and CRC), otherwise everything is compiled.
+
+The patch, output.bin.patch, describes the change from the previous
+program to the new one for online change, as text:
+
+    base <size> <crc>        previous program (size with the checksum)
+    target <size> <crc>      new program
+    header <inputs> <outputs> <memories>
+    replace <old offset> <old size> <new offset> <new size>
+            rungs <old first> <old count> <new first> <new count>
+
+There is one replace line per run of changed rungs, in the order of the
+program. The code before the first run, between two runs and after the
+last one is the same in both programs, moved by the sizes replaced before
+it. The constants of an unchanged rung do not move in the pool, unless
+the pool is packed again because an index would not fit 16 bits: then
+the rungs whose constants moved are replaced too. A run ends
+at the nearest pair of rungs that are the same in both programs, searched
+over at most MaxPatchSearch rungs, otherwise it goes to the last changed
+rung. The header, the constant pool and the section table after the code
+always change with the size of the program. There is no replace line
+when the code did not change; without a valid cache the base is "none"
+and the whole code is replaced.
+*/
+
+#define RungCacheMagic 0x4352494C // "LIRC"
+#define RungCacheVersion 3
+#define MaxPatchSearch 4096 // Rungs searched for the end of a changed run
+
+typedef struct stRungEntry {
+  uint64_t hash;       // FNV-1a of the text of the rung
+  uint32_t textLength; // Length of the text
+  uint32_t codeOffset; // Position of the code in the program
+  uint32_t codeSize;   // Size of the code
+  uint16_t inputSize;  // Sizes of the regions used by the rung
+  uint16_t outputSize;
+  uint16_t memorySize;
+  uint16_t reserved;
+  uint32_t stateIn;    // State of the optimizer when the rung starts
+  uint32_t stateOut;   // and when it ends
+  uint32_t firstLine;        // Line of the source where the rung starts
+  uint32_t firstInstruction; // Position of its lines in the line map
+  uint32_t numInstructions;  // Instructions of the rung, one line each
+} RungEntry;
+
+typedef struct stRungCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t numRungs;
+  uint32_t programSize;  // Size of the program with its checksum
+  uint32_t programCheck; // CRC32C of the program
+  uint32_t optimized;    // Compiled with the optimizer
+  uint32_t numLines;     // Source lines of the instructions, after the rungs
+} RungCacheHeader;
+
+// Cache of the last compilation
+typedef struct stRungCache {
+  RungCacheHeader header;
+  RungEntry *entries;
+  uint32_t *lines;     // Source line of each instruction of the entries
+  uint32_t *slots;     // Hash table of the entries, index + 1, 0 when empty
+  uint32_t numSlots;   // Power of 2
+  SourceFile previous; // Previous program, the code of the entries
+  SectionEntry pool;   // Its constant pool
+  uint8_t valid;
+} RungCache;
+
+// Rungs of the program being compiled
+typedef struct stRungList {
+  RungEntry *entries;
+  uint32_t count;
+  uint32_t capacity;
+} RungList;
+
+// Function prototypes
+uint8_t startsRung(const uint8_t *text, uint32_t size, uint32_t pos);
+uint8_t loadRungCache(RungCache *cache, const char *outFilename,
+                      uint8_t optimized);
+uint8_t compileIncremental(RungCache *cache, const uint8_t *text,
+                           uint32_t size, OutputBuffer *out,
+                           uint32_t *outBufPos, ProgramHeader *header,
+                           uint8_t quiet, PeepholeState *state,
+                           RungList *rungs, LineMap *lines);
+uint8_t writePatch(const RungCache *cache, const RungList *rungs,
+                   const char *outFilename, const uint8_t *program,
+                   const ProgramHeader *header);
+uint8_t saveRungCache(const RungList *rungs, const LineMap *lines,
+                      const char *outFilename, const uint8_t *program,
+                      uint32_t size, uint8_t optimized);
+void freeRungCache(RungCache *cache);
+
+#endif // INCREMENTAL_H
@@ -0,0 +1,106 @@
+#include "lines.h"
+
+/**
+ * Initializes an empty map.
+ *
+ * @param map The map.
+ */
+void initLineMap(LineMap *map) {
+  memset(map, 0, sizeof(*map));
+}
+
+/**
+ * Adds the line of the next instruction.
+ *
+ * @param map The map.
+ * @param line The source line, from 1.
+ * @return The error code.
+ */
+uint8_t addLine(LineMap *map, uint32_t line) {
+  if (map->count == map->capacity) {
+    uint32_t capacity = map->capacity > 0 ? map->capacity * 2 : 256;
+    uint32_t *lines =
+        (uint32_t *)realloc(map->lines, capacity * sizeof(uint32_t));
+    if (lines == NULL) {
+      printf("Error allocating memory for the line map\n");
+      return criticalError;
+    }
+    map->lines = lines;
+    map->capacity = capacity;
+  }
+  map->lines[map->count++] = line;
+  return noError;
+}
+
+/**
+ * Counts the ends of line of a range of the source.
+ *
+ * @param text The source.
+ * @param start The start of the range.
+ * @param end The end of the range.
+ * @return The number of lines that end in the range.
+ */
+uint32_t countLines(const uint8_t *text, uint32_t start, uint32_t end) {
+  uint32_t count = 0;
+  while (start < end) {
+    const uint8_t *next =
+        (const uint8_t *)memchr(text + start, '\n', end - start);
+    if (next == NULL) {
+      break;
+    }
+    count++;
+    start = (uint32_t)(next - text) + 1;
+  }
+  return count;
+}
+
+/**
+ * Writes the line map of a program, output.bin.lines.
+ *
+ * @param outFilename The name of the output file.
+ * @param program The program, with its checksum.
+ * @param header The header of the program.
+ * @param files The source files, in the order of the code.
+ * @param maps The lines of the instructions of each file.
+ * @param count The number of files.
+ * @return The error code.
+ */
+uint8_t writeLineMap(const char *outFilename, const uint8_t *program,
+                     const ProgramHeader *header, const char **files,
+                     const LineMap *maps, uint32_t count) {
+  char name[512];
+  if ((size_t)snprintf(name, sizeof(name), "%s.lines", outFilename) >=
+      sizeof(name)) {
+    printf("Error: file name too long %s\n", outFilename);
+    return criticalError;
+  }
+  FILE *file = fopen(name, "w");
+  if (file == NULL) {
+    printf("Error opening file %s\n", name);
+    return criticalError;
+  }
+  fprintf(file, "program %u 0x%08X\n", header->programSize + 4,
+          readProgramCheck(program, header));
+  for (uint32_t i = 0; i < count; i++) {
+    fprintf(file, "file %s %u\n", files[i], maps[i].count);
+    for (uint32_t j = 0; j < maps[i].count; j++) {
+      fprintf(file, "%u\n", maps[i].lines[j]);
+    }
+  }
+  if (fclose(file) != 0) {
+    printf("Error writing file %s\n", name);
+    remove(name);
+    return criticalError;
+  }
+  return noError;
+}
+
+/**
+ * Releases the map.
+ *
+ * @param map The map.
+ */
+void freeLineMap(LineMap *map) {
+  free(map->lines);
+  initLineMap(map);
+}
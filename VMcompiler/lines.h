@@ -0,0 +1,42 @@
+#ifndef LINES_H
+#define LINES_H
+
+#include "VMCompiler.h"
+
+/*
+Source line map of program.bin, written next to it as output.bin.lines.
+
+Each instruction of the program comes from one line of the IL source, the
+line of the instruction as written; the optimizer keeps it when it rewrites
+the instruction (see peephole.h) and the instructions it removes have none.
+The map follows the instructions of program.bin, in the order of the code,
+so the profiler of the VM can print the source line of the n-th
+instruction it measures (see profiler.h).
+
+The map is text:
+
+    program <size> <crc>      program described (size with the checksum)
+    file <name> <count>       a source file and the number of its
+                              instructions, in the order of the code sections
+    <line>                    the line of each instruction, from 1
+
+The incremental compilation keeps the lines of each rung in its cache,
+relative to the first line of the rung (see incremental.h).
+*/
+
+struct stLineMap {
+  uint32_t *lines; // Source line of each instruction, from 1
+  uint32_t count;
+  uint32_t capacity;
+};
+
+// Function prototypes
+void initLineMap(LineMap *map);
+uint8_t addLine(LineMap *map, uint32_t line);
+uint32_t countLines(const uint8_t *text, uint32_t start, uint32_t end);
+uint8_t writeLineMap(const char *outFilename, const uint8_t *program,
+                     const ProgramHeader *header, const char **files,
+                     const LineMap *maps, uint32_t count);
+void freeLineMap(LineMap *map);
+
+#endif // LINES_H
@@ -0,0 +1,238 @@
+#include "link.h"
+#include "peephole.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * Gets the number of cores available.
+ *
+ * @return The number of cores, at least 1.
+ */
+uint8_t getNumCores(void) {
+  long cores;
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  cores = (long)info.dwNumberOfProcessors;
+#else
+  cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (cores < 1) {
+    return 1;
+  }
+  return cores > MaxCompileThreads ? MaxCompileThreads : (uint8_t)cores;
+}
+
+/**
+ * Compiles one source file into the buffer of its module.
+ *
+ * @param module The module, its file name set.
+ * @param optimize Optimizes the instructions (see peephole.h).
+ */
+static void compileModule(Module *module, uint8_t optimize) {
+  SourceFile source;
+  PeepholeState state; // every file starts with nothing known
+  resetPeepholeState(&state);
+  module->codeSize = 0;
+  module->sizes.inputSize = InputSize;
+  module->sizes.outputSize = OutputSize;
+  module->sizes.memorySize = MemorySize;
+  if (mapSourceFile(module->filename, &source) != noError) {
+    module->error = 1;
+    return;
+  }
+  if (compileInstructions(source.text, 0, source.size, &module->code,
+                          &module->codeSize, &module->sizes, 1,
+                          optimize ? &state : NULL, &module->lines,
+                          1) != noError) {
+    module->error = 1;
+  }
+  unmapSourceFile(&source);
+}
+
+/**
+ * Compiles files until there is none left.
+ *
+ * @param set The files.
+ */
+static void runCompileWorker(ModuleSet *set) {
+  for (;;) {
+    uint32_t i = __atomic_fetch_add(&set->next, 1, __ATOMIC_RELAXED);
+    if (i >= set->count) {
+      return;
+    }
+    compileModule(&set->modules[i], set->optimize);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI compileThread(LPVOID arg) {
+  runCompileWorker((ModuleSet *)arg);
+  return 0;
+}
+#else
+static void *compileThread(void *arg) {
+  runCompileWorker((ModuleSet *)arg);
+  return NULL;
+}
+#endif
+
+/**
+ * Compiles the source files on a pool of threads. The calling thread is
+ * one of them.
+ *
+ * @param modules The modules, their file names set and the rest zeroed.
+ * @param count The number of modules.
+ * @param numThreads The number of threads, at most MaxCompileThreads.
+ * @param optimize Optimizes the instructions (see peephole.h).
+ * @return The error code, criticalError if a file did not compile.
+ */
+uint8_t compileModules(Module *modules, uint32_t count, uint8_t numThreads,
+                       uint8_t optimize) {
+  ModuleSet set = {modules, count, 0, optimize};
+  ThreadHandle threads[MaxCompileThreads];
+  uint8_t started = 0;
+  if (numThreads > count) {
+    numThreads = (uint8_t)count;
+  }
+  while (started + 1 < numThreads) {
+#ifdef _WIN32
+    threads[started] = CreateThread(NULL, 0, compileThread, &set, 0, NULL);
+    uint8_t failed = threads[started] == NULL;
+#else
+    uint8_t failed =
+        pthread_create(&threads[started], NULL, compileThread, &set) != 0;
+#endif
+    if (failed) {
+      // The threads started and this one compile the rest
+      break;
+    }
+    started++;
+  }
+  runCompileWorker(&set);
+  for (uint8_t i = 0; i < started; i++) {
+#ifdef _WIN32
+    WaitForSingleObject((HANDLE)threads[i], INFINITE);
+    CloseHandle((HANDLE)threads[i]);
+#else
+    pthread_join(threads[i], NULL);
+#endif
+  }
+  uint8_t result = noError;
+  for (uint32_t i = 0; i < count; i++) {
+    if (modules[i].error) {
+      printf("Error compiling %s\n", modules[i].filename);
+      result = criticalError;
+    }
+  }
+  return result;
+}
+
+/**
+ * Gets the name of the section of a source file: the file name without
+ * the directory and the extension, truncated to SectionNameSize.
+ *
+ * @param filename The name of the source file.
+ * @param name Receives the name, SectionNameSize + 1 bytes.
+ */
+void getSectionName(const char *filename, char *name) {
+  const char *start = filename;
+  for (const char *c = filename; *c != '\0'; c++) {
+    if (*c == '/' || *c == '\\') {
+      start = c + 1;
+    }
+  }
+  const char *dot = strrchr(start, '.');
+  size_t length = dot != NULL && dot != start ? (size_t)(dot - start)
+                                              : strlen(start);
+  if (length > SectionNameSize) {
+    length = SectionNameSize;
+  }
+  memcpy(name, start, length);
+  name[length] = '\0';
+}
+
+/**
+ * Copies the code of the modules one after the other into the program.
+ *
+ * @param modules The compiled modules.
+ * @param count The number of modules.
+ * @param out The output buffer.
+ * @param outBufPos The position in the output buffer, moved after the code.
+ * @param header The header, its sizes grow with the sizes of the modules.
+ * @param sections Receives one code section per module.
+ * @return The error code.
+ */
+uint8_t linkModules(Module *modules, uint32_t count, OutputBuffer *out,
+                    uint32_t *outBufPos, ProgramHeader *header,
+                    SectionEntry *sections) {
+  for (uint32_t i = 0; i < count; i++) {
+    const Module *module = &modules[i];
+    if (reserveOutput(out, *outBufPos, module->codeSize) != noError) {
+      return criticalError;
+    }
+    if (module->codeSize > 0) {
+      memcpy(out->data + *outBufPos, module->code.data, module->codeSize);
+    }
+    sections[i].offset = *outBufPos;
+    sections[i].size = module->codeSize;
+    sections[i].type = SectionCode;
+    getSectionName(module->filename, sections[i].name);
+    *outBufPos += module->codeSize;
+    if (module->sizes.inputSize > header->inputSize) {
+      header->inputSize = module->sizes.inputSize;
+    }
+    if (module->sizes.outputSize > header->outputSize) {
+      header->outputSize = module->sizes.outputSize;
+    }
+    if (module->sizes.memorySize > header->memorySize) {
+      header->memorySize = module->sizes.memorySize;
+    }
+  }
+  return noError;
+}
+
+/**
+ * Appends the section table after the code and the constant pool and sets
+ * its fields of the header.
+ *
+ * @param out The output buffer.
+ * @param outBufPos The position after the pool, moved after the table.
+ * @param header The header, its end of the instructions set.
+ * @param sections The sections.
+ * @param count The number of sections.
+ * @return The error code.
+ */
+uint8_t writeSectionTable(OutputBuffer *out, uint32_t *outBufPos,
+                          ProgramHeader *header, const SectionEntry *sections,
+                          uint16_t count) {
+  uint32_t tableSize = (uint32_t)count * SectionEntrySize;
+  if (reserveOutput(out, *outBufPos, tableSize) != noError) {
+    return criticalError;
+  }
+  header->sectionTablePos = *outBufPos;
+  header->numSections = count;
+  for (uint16_t i = 0; i < count; i++) {
+    writeSectionEntry(out->data, header, i, &sections[i]);
+  }
+  *outBufPos += tableSize;
+  return noError;
+}
+
+/**
+ * Releases the buffers and the line maps of the modules.
+ *
+ * @param modules The modules.
+ * @param count The number of modules.
+ */
+void freeModules(Module *modules, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    free(modules[i].code.data);
+    modules[i].code.data = NULL;
+    freeLineMap(&modules[i].lines);
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include "VMCompiler.h"
+#include "lines.h"
+
+/*
+Compilation of several source files, one per POU or machine section.
+
+The files are compiled in parallel: each worker thread takes the next file
+not compiled yet (one atomic counter), maps it and encodes it into its own
+output buffer. The code does not depend on its position, so linking only
+copies the code of the files one after the other, in the order of the
+command line, and describes each file with a code section in the section
+table of program.bin (see programFormat.h). The region sizes of the
+program are the largest used by the files. The constants of all the files
+share the constant pool of the program, built after linking (see
+constants.h).
+
+The instructions are listed after linking, in the order of the files; the
+errors and warnings are printed while compiling, the file with an error is
+named after all the workers have finished.
+*/
+
+#define MaxCompileThreads 64
+
+#ifdef _WIN32
+typedef void *ThreadHandle; // HANDLE of the thread
+#else
+#include <pthread.h>
+typedef pthread_t ThreadHandle;
+#endif
+
+typedef struct stModule {
+  const char *filename;
+  OutputBuffer code;   // Instructions of the file, from position 0
+  uint32_t codeSize;
+  ProgramHeader sizes; // Region sizes used by the file
+  LineMap lines;       // Source line of each instruction
+  uint8_t error;
+} Module;
+
+// Files shared by the workers
+typedef struct stModuleSet {
+  Module *modules;
+  uint32_t count;
+  uint32_t next; // Next file to compile (atomic)
+  uint8_t optimize;
+} ModuleSet;
+
+// Function prototypes
+uint8_t getNumCores(void);
+uint8_t compileModules(Module *modules, uint32_t count, uint8_t numThreads,
+                       uint8_t optimize);
+uint8_t linkModules(Module *modules, uint32_t count, OutputBuffer *out,
+                    uint32_t *outBufPos, ProgramHeader *header,
+                    SectionEntry *sections);
+void getSectionName(const char *filename, char *name);
+uint8_t writeSectionTable(OutputBuffer *out, uint32_t *outBufPos,
+                          ProgramHeader *header, const SectionEntry *sections,
+                          uint16_t count);
+void freeModules(Module *modules, uint32_t count);
+
+#endif // LINK_H
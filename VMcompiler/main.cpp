@@ -1,10 +1,11 @@
 /* This program is used to read a text file with machine language instructions and convert 
-it into a binary file. The binary file consists of a 2-byte header indicating the size of 
-the program, followed by the instructions, and finally a 4-byte checksum. The program is 
+it into a binary file. The binary file consists of a header with the size of the program
+(see programFormat.h), followed by the instructions, the constant pool, the section table
+(one section per input file and one for the pool) and finally a 4-byte checksum. The program is 
 composed of instructions with 0 or more operands, where each operand is composed of 3 bytes. 
 The first byte represents the memory type (3 bits), register type (2 bits), and bit number (3 bits). 
-The other 2 bytes represent the operand address for register types I, Q, M, and the operand value 
-for register type K, which can range from 1 to 8 bytes. The input file should contain the instructions 
+The other 2 bytes represent the operand address for register types I, Q, M, and the index of the 
+constant in the constant pool for register type K (see constants.h). The input file should contain the instructions 
 in text format, where each instruction consists of the instruction name followed by the operands 
 separated by spaces. For example:
 LD IX1.0, which loads bit 0 of input register 1.
@@ -16,47 +17,178 @@ and save them into a binary file.
 */
 
 #include "VMCompiler.h"
+#include "mnemonics.h"
+#include "incremental.h"
+#include "link.h"
+#include "peephole.h"
+#include "constants.h"
+#include "lines.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /**
- * Gets the size of a file.
- * 
- * @param filename The name of the file to get the size of.
- * @return The size of the file.
+ * Maps a source file into memory, read only.
+ *
+ * The tokenizer reads the source directly from the mapping, so the file is
+ * neither copied nor scanned to find its size.
+ *
+ * @param filename The name of the file to map.
+ * @param source The mapping.
+ * @return The error code.
 */
-uint32_t getProgramSizeFromFile(const char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (file == NULL) {
+uint8_t mapSourceFile(const char *filename, SourceFile *source) {
+  source->text = NULL;
+  source->size = 0;
+  source->handle = NULL;
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
     printf("Error opening file %s\n", filename);
-    return 0;
+    return criticalError;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart > UINT32_MAX) {
+    printf("Error: file %s is too large\n", filename);
+    CloseHandle(file);
+    return criticalError;
+  }
+  source->size = (uint32_t)size.QuadPart;
+  if (source->size > 0) {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL) {
+      source->text =
+          (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      source->handle = mapping;
+    }
+  }
+  CloseHandle(file);
+#else
+  int file = open(filename, O_RDONLY);
+  if (file < 0) {
+    printf("Error opening file %s\n", filename);
+    return criticalError;
+  }
+  struct stat info;
+  if (fstat(file, &info) != 0 || (uint64_t)info.st_size > UINT32_MAX) {
+    printf("Error: file %s is too large\n", filename);
+    close(file);
+    return criticalError;
+  }
+  source->size = (uint32_t)info.st_size;
+  if (source->size > 0) {
+    void *text = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (text != MAP_FAILED) {
+      source->text = (const uint8_t *)text;
+      madvise(text, source->size, MADV_SEQUENTIAL);
+    }
   }
-  uint32_t size = 0;
-  while (!feof(file)) {
-    fgetc(file);
-    size++;
+  close(file);
+#endif
+  if (source->size > 0 && source->text == NULL) {
+    printf("Error mapping file %s\n", filename);
+    return criticalError;
   }
-  fclose(file);
-  return size;
+  return noError;
 }
 
 /**
- * Reads a program from a file.
- * 
- * @param filename The name of the file to read the program from.
- * @param buffer The buffer to read the program into.
+ * Unmaps a source file.
+ *
+ * @param source The mapping.
+*/
+void unmapSourceFile(SourceFile *source) {
+  if (source->text == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(source->text);
+  CloseHandle((HANDLE)source->handle);
+#else
+  munmap((void *)source->text, source->size);
+#endif
+  source->text = NULL;
+}
+
+/**
+ * Makes room in the output buffer, doubling its capacity as needed.
+ *
+ * @param out The output buffer.
+ * @param used The bytes already written.
+ * @param bytes The bytes to be written after them.
+ * @return The error code.
+*/
+uint8_t reserveOutput(OutputBuffer *out, uint32_t used, uint32_t bytes) {
+  uint64_t needed = (uint64_t)used + bytes;
+  if (needed <= out->capacity) {
+    return noError;
+  }
+  if (needed > UINT32_MAX) {
+    printf("Error: the program is larger than 4 GB\n");
+    return criticalError;
+  }
+  uint64_t capacity = out->capacity > 0 ? out->capacity : 4096;
+  while (capacity < needed) {
+    capacity *= 2;
+  }
+  if (capacity > UINT32_MAX) {
+    capacity = UINT32_MAX;
+  }
+  uint8_t *data = (uint8_t *)realloc(out->data, (size_t)capacity);
+  if (data == NULL) {
+    printf("Error: allocating memory for the program\n");
+    return criticalError;
+  }
+  out->data = data;
+  out->capacity = (uint32_t)capacity;
+  return noError;
+}
+
+/**
+ * Writes the compiled program to a file.
+ *
+ * The program is written to a temporary file that then replaces the
+ * output file, so a VM running the old file (mapped in memory, and
+ * possibly reloading it) never sees it truncated or half written.
+ *
+ * @param filename The name of the output file.
+ * @param program The program, with its checksum.
+ * @param size The size in bytes.
  * @return The error code.
 */
-uint8_t readProgramFromFile(const char *filename, uint8_t *buffer) {
-  FILE *file = fopen(filename, "r");
+uint8_t writeProgramFile(const char *filename, const uint8_t *program,
+                         uint32_t size) {
+  char tmpFilename[512];
+  snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", filename);
+  FILE *file = fopen(tmpFilename, "wb");
   if (file == NULL) {
-    printf("Error opening file %s\n", filename);
+    printf("Error opening file %s\n", tmpFilename);
     return criticalError;
   }
-  uint16_t i = 0;
-  while (!feof(file)) {
-    buffer[i] = fgetc(file);
-    i++;
+  uint8_t written = fwrite(program, 1, size, file) == size;
+  if (fclose(file) != 0 || !written) {
+    printf("Error writing file %s\n", tmpFilename);
+    remove(tmpFilename);
+    return criticalError;
+  }
+#ifdef _WIN32
+  uint8_t replaced =
+      MoveFileExA(tmpFilename, filename, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  uint8_t replaced = rename(tmpFilename, filename) == 0;
+#endif
+  if (!replaced) {
+    printf("Error replacing file %s\n", filename);
+    remove(tmpFilename);
+    return criticalError;
   }
-  fclose(file);
   return noError;
 }
 
@@ -74,35 +206,65 @@ uint8_t getNumOp(uint8_t inst) {
     NumOpADD, NumOpSUB, NumOpMUL, NumOpDIV, NumOpMOD,
     NumOpGT, NumOpGE, NumOpEQ, NumOpNE, NumOpLT,
     NumOpLE, NumOpCTU, NumOpCTD, NumOpTON, NumOpTOF,
-    NumOpTP, NumOpRTRIGGER, NumOpFTRIGGER, NumOpq
+    NumOpq, NumOpTP, NumOpRTRIGGER, NumOpFTRIGGER
   };
   return(n[inst]);
 }
 
 /**
- * Gets the next token from a buffer.
+ * Checks if a character separates tokens.
  *
- * @param pos The position in the buffer to get the token from.
- * @param buffer The buffer to get the token from.
- * @param token The token to store the result in.
+ * @param c The character.
+ * @return 1 for blanks and the end of the text.
  */
-void getNextToken(uint32_t *pos, uint8_t *buffer, char *token) {
-  uint8_t i = 0;
-  while (buffer[*pos] == ' ' || buffer[*pos] == '\n' || buffer[*pos] == '\t' || buffer[*pos] == '#') {
+static inline uint8_t isBlank(uint8_t c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\0';
+}
+
+/**
+ * Skips the blanks and the comments.
+ *
+ * @param pos The position in the buffer, moved to the next token.
+ * @param buffer The buffer.
+ * @param size The size of the buffer.
+ */
+void skipBlanks(uint32_t *pos, const uint8_t *buffer, uint32_t size) {
+  while (*pos < size && (isBlank(buffer[*pos]) || buffer[*pos] == '#')) {
     if(buffer[*pos] == '#') {
-      while (buffer[*pos] != '\n' && buffer[*pos] != '\0') {
+      while (*pos < size && buffer[*pos] != '\n') {
         (*pos)++;
       }
+      continue;
     }
     (*pos)++;
   }
-    
-  while (buffer[*pos] != ' ' && buffer[*pos] != '\n' && buffer[*pos] != '\t' && buffer[*pos] != '\0') {
+}
+
+/**
+ * Gets the next token from a buffer.
+ *
+ * @param pos The position in the buffer to get the token from.
+ * @param buffer The buffer to get the token from.
+ * @param size The size of the buffer.
+ * @param token The token to store the result in, MaxTokenSize bytes.
+ * @return The error code.
+ */
+uint8_t getNextToken(uint32_t *pos, const uint8_t *buffer, uint32_t size,
+                     char *token) {
+  uint8_t i = 0;
+  skipBlanks(pos, buffer, size);
+  while (*pos < size && !isBlank(buffer[*pos])) {
+    if (i == MaxTokenSize - 1) {
+      token[i] = '\0';
+      printf("Error: Token too long %s...\n", token);
+      return criticalError;
+    }
     token[i] = buffer[*pos];
     i++;
     (*pos)++;
   }
   token[i] = '\0';
+  return noError;
 }
 
 /**
@@ -161,103 +323,52 @@ uint8_t get16bitNumberFromToken(uint8_t *pos, char *token, uint16_t *value) {
  */
 uint8_t getOperandFromToken(char *token, Operand *operand, uint64_t *Kn) {
   uint16_t tmp = 0;
+  uint16_t address = 0;
   uint8_t i = 0;
   (*Kn) = 0;
-  if (token[i] == 'I') {
-    operand->registertype = I;
-  } else if (token[i] == 'Q') {
-    operand->registertype = Q;
-  } else if (token[i] == 'M') {
-    operand->registertype = M;
-  } else if (token[i] == 'K') {
-    operand->registertype = K;
-  } else {
+  operand->bitNumber = 0; // Only bit operands have one, it is encoded anyway
+  operand->registertype = RegisterCodes.codes[(uint8_t)token[i]];
+  if (operand->registertype == InvalidCode) {
     printf("Error: Invalid register type %c\n", token[i]);
     return criticalError;
   }
   i++;
+  operand->memorytype = MemoryTypeCodes.codes[(uint8_t)token[i]];
+  if (operand->memorytype == InvalidCode) {
+    printf("Error: Invalid memory type %c\n", token[i]);
+    return criticalError;
+  }
+  i++;
   if(operand->registertype == K) {
-    if (token[i] == 'X') {
-      operand->memorytype = X;
-    } else if (token[i] == 'B') {
-      operand->memorytype = B;
-    } else if (token[i] == 'W') {
-      operand->memorytype = W;
-    } else if (token[i] == 'D') {
-      operand->memorytype = D;
-    } else if (token[i] == 'L') {
-      operand->memorytype = L;
-    } else if (token[i] == 'R') {
-      operand->memorytype = R;
-    } else {
-      printf("Error: Invalid memory type %c\n", token[i]);
-      return criticalError;
-    }
-    i++;
     if(get64bitNumberFromToken(&i, token, Kn, operand->memorytype) != noError) {
       return criticalError;
     }
     operand->address = 0;
     return noError;
-  } else {
-     if (token[i] == 'X') {
-      operand->memorytype = X;
+  }
+  if(get16bitNumberFromToken(&i, token, &address) != noError) {
+    return criticalError;
+  }
+  operand->address = address;
+  if (operand->memorytype == X) {
+    if(token[i] == '.') {
       i++;
-      if(get16bitNumberFromToken(&i, token, &operand->address) != noError) {
+      if(get16bitNumberFromToken(&i, token, &tmp) != noError) {
         return criticalError;
-      }
-      if(token[i] == '.') {
-        i++;
-        if(get16bitNumberFromToken(&i, token, &tmp) != noError) {
-          return criticalError;
+      } else {
+        if(tmp>=0 && tmp<=7) {
+          operand->bitNumber = tmp;
         } else {
-          if(tmp>=0 && tmp<=7) {
-            operand->bitNumber = tmp;
-          } else {
-            printf("Error: Invalid bit number %d\n", tmp);
-            return criticalError;
-          }
+          printf("Error: Invalid bit number %d\n", tmp);
+          return criticalError;
         }
-      } else {
-        printf("Error: Invalid token %s\n", token);
-        return criticalError;
-      }
-    } else if (token[i] == 'B') {
-      operand->memorytype = B;
-      i++;
-      if(get16bitNumberFromToken(&i, token, &operand->address) != noError) {
-        return criticalError;
-      }
-    } else if (token[i] == 'W') {
-      operand->memorytype = W;
-      i++;
-      if(get16bitNumberFromToken(&i, token, &operand->address) != noError) {
-        return criticalError;
-      }
-    } else if (token[i] == 'D') {
-      operand->memorytype = D;
-      i++;
-      if(get16bitNumberFromToken(&i, token, &operand->address) != noError) {
-        return criticalError;
-      }
-    } else if (token[i] == 'L') {
-      operand->memorytype = L;
-      i++;
-      if(get16bitNumberFromToken(&i, token, &operand->address) != noError) {
-        return criticalError;
-      }
-    } else if (token[i] == 'R') {
-      operand->memorytype = R;
-      i++;
-      if(get16bitNumberFromToken(&i, token, &operand->address) != noError) {
-        return criticalError;
       }
     } else {
-      printf("Error: Invalid memory type %c\n", token[i]);
+      printf("Error: Invalid token %s\n", token);
       return criticalError;
     }
-    return noError;
   }
+  return noError;
 }
 
 /**
@@ -266,21 +377,19 @@ uint8_t getOperandFromToken(char *token, Operand *operand, uint64_t *Kn) {
  * @param inst The instruction to get.
  * @param pos The position in the buffer to get the instruction from.
  * @param buffer The buffer to get the instruction from.
+ * @param size The size of the buffer.
  * @return The error code.
  */
- uint8_t getInstruction(Instruction *inst, uint32_t *pos, uint8_t *buffer, uint64_t Kn[]) {
-  char token[30]; // buffer to store the token.
-  getNextToken(pos, buffer, token);
-  uint8_t opcode = 0;
-  uint8_t i;
-  for (i = 0; i < NumInstructions; i++) {
-    if (strcmp(token, InstNames[i]) == 0) {
-      opcode = i;
-      break;
-    }
+ uint8_t getInstruction(Instruction *inst, uint32_t *pos, const uint8_t *buffer,
+                        uint32_t size, uint64_t Kn[]) {
+  char token[MaxTokenSize]; // buffer to store the token.
+  if(getNextToken(pos, buffer, size, token) != noError) {
+    return criticalError;
   }
+  uint8_t i;
+  uint8_t opcode = findOpcode(token);
   // check if the instruction is valid
-  if(i==NumInstructions) {
+  if(opcode == InvalidCode) {
     printf("Error: Invalid instruction %s\n", token);
     return criticalError;
   }
@@ -288,7 +397,9 @@ uint8_t getOperandFromToken(char *token, Operand *operand, uint64_t *Kn) {
   inst->opcode = opcode;
   inst->num_operands = num_operands;
   for (i = 0; i < num_operands; i++) {
-    getNextToken(pos, buffer, token);
+    if(getNextToken(pos, buffer, size, token) != noError) {
+      return criticalError;
+    }
     if(getOperandFromToken(token, &inst->operands[i], &Kn[i]) != noError) {
       return criticalError;
     }
@@ -296,6 +407,47 @@ uint8_t getOperandFromToken(char *token, Operand *operand, uint64_t *Kn) {
   return noError;
 }
 
+/**
+ * Gets the size in bytes of a memory type.
+ *
+ * @param memorytype The memory type.
+ * @return The size in bytes.
+ */
+uint8_t getMemoryTypeSize(uint8_t memorytype) {
+  static const uint8_t sizes[] = {1, 1, 2, 4, 8, 4}; // X, B, W, D, L, R
+  if(memorytype > R) {
+    return 0;
+  }
+  return sizes[memorytype];
+}
+
+/**
+ * Grows the sizes of the header to cover the operands of an instruction.
+ *
+ * @param inst The instruction.
+ * @param header The header of the program.
+ */
+void updateRegionSizes(Instruction *inst, ProgramHeader *header) {
+  uint8_t num_operands = getNumOp(inst->opcode);
+  for (uint8_t i = 0; i < num_operands; i++) {
+    uint16_t *size;
+    if(inst->operands[i].registertype == I) {
+      size = &header->inputSize;
+    } else if(inst->operands[i].registertype == Q) {
+      size = &header->outputSize;
+    } else if(inst->operands[i].registertype == M) {
+      size = &header->memorySize;
+    } else {
+      continue;
+    }
+    uint32_t end = (uint32_t)inst->operands[i].address +
+                   getMemoryTypeSize(inst->operands[i].memorytype);
+    if(end > *size) {
+      *size = (uint16_t)end;
+    }
+  }
+}
+
 /**
  * Verifies if an instruction is valid.
  * 
@@ -306,21 +458,13 @@ uint8_t verifyInstruction(Instruction *inst) {
   uint8_t ret=noError;
   uint8_t num_operands = getNumOp(inst->opcode);
   for (uint8_t i = 0; i < num_operands; i++) {
-    if(inst->operands[i].registertype == I) {
-      if(inst->operands[i].address >= InputSize) {
-        printf("Error: Invalid input address %d\n", inst->operands[i].address);
-        return criticalError;
-      }
-    } else if(inst->operands[i].registertype == Q) {
-      if(inst->operands[i].address >= OutputSize) {
-        printf("Error: Invalid output address %d\n", inst->operands[i].address);
-        return criticalError;
-      }
-    } else if(inst->operands[i].registertype == M) {
-      if(inst->operands[i].address >= MemorySize) {
-        printf("Error: Invalid memory address %d\n", inst->operands[i].address);
-        return criticalError;
-      }
+    if(inst->operands[i].registertype == K) {
+      continue;
+    }
+    if((uint32_t)inst->operands[i].address +
+       getMemoryTypeSize(inst->operands[i].memorytype) > MaxRegionSize) {
+      printf("Error: Invalid address %d\n", inst->operands[i].address);
+      return criticalError;
     }
   }
   if(num_operands == 2) {
@@ -356,7 +500,7 @@ uint8_t verifyInstruction(Instruction *inst) {
  * @param address The address in the memory to get the byte from.
  * @return The value of the byte.
  */
-int16_t getWordFromAddress(uint8_t *memory, uint16_t address) {
+int16_t getWordFromAddress(uint8_t *memory, uint32_t address) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   return (u.i16[0]);
@@ -369,7 +513,7 @@ int16_t getWordFromAddress(uint8_t *memory, uint16_t address) {
  * @param address The address in the memory to set the byte in.
  * @param value The value to set the byte to.
  */
-void setWordInAddress(uint8_t *memory, uint16_t address, int16_t value) {
+void setWordInAddress(uint8_t *memory, uint32_t address, int16_t value) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   u.i16[0] = value;
@@ -382,7 +526,7 @@ void setWordInAddress(uint8_t *memory, uint16_t address, int16_t value) {
  * @param address The address in the memory to get the double word from.
  * @return The value of the double word.
  */
-int32_t getDoubleWordFromAddress(uint8_t *memory, uint16_t address) {
+int32_t getDoubleWordFromAddress(uint8_t *memory, uint32_t address) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   return (u.i32[0]);
@@ -395,7 +539,7 @@ int32_t getDoubleWordFromAddress(uint8_t *memory, uint16_t address) {
  * @param address The address in the memory to set the double word in.
  * @param value The value to set the double word to.
  */
-void setDoubleWordInAddress(uint8_t *memory, uint16_t address, uint32_t value) {
+void setDoubleWordInAddress(uint8_t *memory, uint32_t address, uint32_t value) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   u.i32[0] = value;
@@ -408,7 +552,7 @@ void setDoubleWordInAddress(uint8_t *memory, uint16_t address, uint32_t value) {
  * @param address The address in the memory to get the long word from.
  * @return The value of the long word.
  */
-int64_t getLongWordFromAddress(uint8_t *memory, uint16_t address) {
+int64_t getLongWordFromAddress(uint8_t *memory, uint32_t address) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   return (u.i64[0]);
@@ -421,7 +565,7 @@ int64_t getLongWordFromAddress(uint8_t *memory, uint16_t address) {
  * @param address The address in the memory to set the long word in.
  * @param value The value to set the long word to.
  */
-void setLongWordInAddress(uint8_t *memory, uint16_t address, uint64_t value) {
+void setLongWordInAddress(uint8_t *memory, uint32_t address, uint64_t value) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   u.i64[0] = value;
@@ -434,7 +578,7 @@ void setLongWordInAddress(uint8_t *memory, uint16_t address, uint64_t value) {
  * @param address The address in the memory to get the float from.
  * @return The value of the float.
  */
-float getFloatFromAddress(uint8_t *memory, uint16_t address) {
+float getFloatFromAddress(uint8_t *memory, uint32_t address) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   return (u.f[0]);
@@ -447,7 +591,7 @@ float getFloatFromAddress(uint8_t *memory, uint16_t address) {
  * @param address The address in the memory to set the float in.
  * @param value The value to set the float to.
  */
-void setFloatInAddress(uint8_t *memory, uint16_t address, float value) {
+void setFloatInAddress(uint8_t *memory, uint32_t address, float value) {
   DataUnion u;
   u.u8 = (uint8_t *)(memory + address);
   u.f[0] = value;
@@ -465,7 +609,7 @@ void setFloatInAddress(uint8_t *memory, uint16_t address, float value) {
  * @param operand2 The third operand.
  * @return The new position in the buffer after encoding the instruction.
  */
-uint16_t encodeInstruction(uint8_t *buffer, uint16_t bufPos, uint8_t opperation,
+uint32_t encodeInstruction(uint8_t *buffer, uint32_t bufPos, uint8_t opperation,
                            Operand operand[], uint64_t Kn[]) {
   buffer[bufPos] = opperation;
   uint8_t num_operands = getNumOp(opperation);
@@ -623,10 +767,12 @@ void printInstruction(Instruction instr, uint8_t *program) {
  * @param buffer The buffer containing the program.
  * @return The size of the program.
  */
-uint16_t getProgramSize(uint8_t *buffer) {
-  DataUnion u;
-  u.u8 = buffer;
-  return (u.u16[0]);
+uint32_t getProgramSize(uint8_t *buffer) {
+  ProgramHeader header;
+  if (readProgramHeader(buffer, &header) != 0) {
+    return 0;
+  }
+  return header.programSize;
 }
 
 /**
@@ -636,33 +782,27 @@ uint16_t getProgramSize(uint8_t *buffer) {
  * @return The error code.
  */
 uint8_t verifyProgramIntegrity(uint8_t *buffer) {
-	uint32_t calculatedSize = 0;
-	uint32_t spectedSize;
-	uint16_t programSize = getProgramSize(buffer);
-	for (uint16_t i = 0; i < programSize; i++) {
-		calculatedSize += buffer[i];
+	ProgramHeader header;
+	if (readProgramHeader(buffer, &header) != 0) {
+		return criticalError;
 	}
-	spectedSize = getDoubleWordFromAddress(buffer,programSize);
-	if(calculatedSize == spectedSize)
+	if(computeProgramCheck(buffer, &header) == readProgramCheck(buffer, &header))
 	return noError;
 	else
 	return criticalError;
 }
 
 /**
- * Encodes the program checksum.
+ * Encodes the program checksum (the CRC32C of the current version).
  *
  * @param program The program to encode the checksum for.
  */
 void encodeProgramCS(uint8_t *program) {
-  uint16_t size = getProgramSize(program);
-  uint32_t sum = 0;
-  for (uint16_t i = 0; i < size; i++) {
-    sum += program[i];
+  ProgramHeader header;
+  if (readProgramHeader(program, &header) != 0) {
+    return;
   }
-  DataUnion u;
-  u.u8 = (program + size);
-  u.u32[0] = sum;
+  writeProgramCheck(program, &header);
 }
 
 /**
@@ -671,9 +811,9 @@ void encodeProgramCS(uint8_t *program) {
  * @param program The program to print.
  * @param size The size of the program.
  */
-void printProgramInHEX(uint8_t *program, uint16_t size) {
+void printProgramInHEX(uint8_t *program, uint32_t size) {
   printf("\n{");
-  for (uint16_t i = 0; i < size; i++) {
+  for (uint32_t i = 0; i < size; i++) {
     printf("0x%02X", program[i]);
     if (i < size - 1)
       printf(",");
@@ -688,9 +828,9 @@ void printProgramInHEX(uint8_t *program, uint16_t size) {
  * @param pos The position in the buffer to read the instruction from.
  * @return The instruction read from the buffer.
  */
-Instruction readInstruction(uint8_t *buffer, uint16_t *position) {
+Instruction readInstruction(uint8_t *buffer, uint32_t *position) {
   Instruction instr;
-  uint16_t pos = (*position);
+  uint32_t pos = (*position);
   instr.opcode = buffer[pos];
   instr.num_operands = getNumOp(instr.opcode);
   pos++;
@@ -701,7 +841,7 @@ Instruction readInstruction(uint8_t *buffer, uint16_t *position) {
     pos++;
     if(instr.operands[i].registertype != K)
     {
-      instr.operands[i].address = getWordFromAddress(buffer, pos);
+      instr.operands[i].address = (uint16_t)getWordFromAddress(buffer, pos);
       pos += 2;
     }
     else
@@ -725,90 +865,456 @@ Instruction readInstruction(uint8_t *buffer, uint16_t *position) {
   return instr;
 }
 
-///////////////////////////////////////////////////////////////////////////////////
-// Main function
-///////////////////////////////////////////////////////////////////////////////////
-int main() {
-  // file name
-  const char *filename = "program.il";
-
-  // dynamically allocate a buffer to store the program
-  uint16_t programSize = getProgramSizeFromFile(filename);
-  uint8_t *program = (uint8_t *)malloc(programSize);
-  if (program == NULL) {
-    printf("Error: allocating memory for the program\n");
+/**
+ * Checks if an instruction of the source starts a rung: LD or LDN first in
+ * its line (see incremental.h).
+ *
+ * @param text The source.
+ * @param start The start of the range compiled, the start of a line.
+ * @param end The end of the range.
+ * @param pos The position of the instruction.
+ * @return 1 if it starts a rung.
+ */
+static uint8_t isRungStart(const uint8_t *text, uint32_t start, uint32_t end,
+                           uint32_t pos) {
+  uint32_t line = pos;
+  while (line > start && (text[line - 1] == ' ' || text[line - 1] == '\t')) {
+    line--;
+  }
+  if (line > start && text[line - 1] != '\n') {
     return 0;
   }
+  return startsRung(text, end, line);
+}
 
-  // read the program from the file
-  if (readProgramFromFile(filename, program) != noError) {
-    printf("Error: reading the program from file\n");
-    return 0;
+/**
+ * Optimizes the instructions of a rung and encodes them into the output
+ * buffer.
+ *
+ * @param rung The instructions, read from the source.
+ * @param out The output buffer.
+ * @param outBufPos The position in the output buffer, moved after the code.
+ * @param header The header, its sizes grow with the addresses used.
+ * @param quiet Does not print the compiled instructions.
+ * @param state The state of the optimizer, NULL to encode the instructions
+ * as written.
+ * @param lines Receives the source line of each instruction encoded.
+ * @return The error code.
+ */
+static uint8_t encodeRung(RungBuffer *rung, OutputBuffer *out,
+                          uint32_t *outBufPos, ProgramHeader *header,
+                          uint8_t quiet, PeepholeState *state,
+                          LineMap *lines) {
+  if (state != NULL) {
+    optimizeRung(rung, state);
+  }
+  for (uint32_t i = 0; i < rung->count; i++) {
+    SourceInstruction *source = &rung->items[i];
+    if(reserveOutput(out, *outBufPos, MaxEncodedSize) != noError) {
+      return criticalError;
+    }
+    uint32_t testBufPos = *outBufPos;
+    *outBufPos = encodeInstruction(out->data, *outBufPos, source->instr.opcode,
+                                   source->instr.operands, source->Kn);
+
+    // read the instruction from the output buffer to test the decoding and print it
+    Instruction testInstr = readInstruction(out->data, &testBufPos);
+    if (!quiet) {
+      printInstruction(testInstr, out->data);
+    }
+    updateRegionSizes(&testInstr, header);
+    if (addLine(lines, source->line) != noError) {
+      return criticalError;
+    }
   }
+  rung->count = 0;
+  return noError;
+}
 
-  program[programSize-1] = '\0'; // add a null terminator to the end of the program
-  char token[30]; // buffer to store the token.
+/**
+ * Compiles the instructions of a range of the source.
+ *
+ * @param text The source.
+ * @param start The position of the range in the source.
+ * @param end The end of the range.
+ * @param out The output buffer.
+ * @param outBufPos The position in the output buffer, moved after the code.
+ * @param header The header, its sizes grow with the addresses used.
+ * @param quiet Does not print the compiled instructions.
+ * @param state The state of the optimizer when the range starts, then
+ * when it ends; NULL to encode the instructions as written.
+ * @param lines Receives the source line of each instruction encoded.
+ * @param line The line of the source at the start of the range, from 1.
+ * @return The error code.
+ */
+uint8_t compileInstructions(const uint8_t *text, uint32_t start, uint32_t end,
+                            OutputBuffer *out, uint32_t *outBufPos,
+                            ProgramHeader *header, uint8_t quiet,
+                            PeepholeState *state, LineMap *lines,
+                            uint32_t line) {
+  uint32_t bufPos = start;
+  uint32_t linePos = start; // the lines are counted up to here
+  RungBuffer rung = {NULL, 0, 0};
+  uint8_t result = noError;
+  for (;;) {
+    skipBlanks(&bufPos, text, end);
 
-  // read the program from the buffer
-  uint32_t bufPos = 0;    
-  uint16_t testBufPos = 2; // start after the size of the program
-  uint8_t outBuffer[10000];
-  uint16_t outBufPos = 2; // start after the size of the program
-  Instruction instr;
-  Instruction testInstr;
-  uint64_t Kn[10];
-  printf("\nCompiling: %s\n\n", filename);
-  while (program[bufPos] != '\0') {
-    while(program[bufPos] == ' ' || program[bufPos+1] == '\t' || program[bufPos] == '\n') {
-      bufPos++;      
-    }
-    
-    if(program[bufPos] == '\0') break;
-
-    if(program[bufPos] == '#') {
-      while(program[bufPos] != '\n') {
-        bufPos++;
+    // the instructions are optimized and encoded a rung at a time
+    if(rung.count > 0 &&
+       (bufPos >= end || state == NULL || isRungStart(text, start, end, bufPos))) {
+      if(encodeRung(&rung, out, outBufPos, header, quiet, state, lines) != noError) {
+        result = criticalError;
+        break;
       }
-      continue;
     }
-    
-    // get the instruction from the buffer
-    if(getInstruction(&instr, &bufPos, program, Kn) != noError) {
-      return 0;
+    if(bufPos >= end) break;
+
+    // get the instruction from the source
+    if(reserveRungBuffer(&rung) != noError) {
+      result = criticalError;
+      break;
+    }
+    SourceInstruction *source = &rung.items[rung.count];
+    line += countLines(text, linePos, bufPos);
+    linePos = bufPos;
+    source->line = line;
+    if(getInstruction(&source->instr, &bufPos, text, end, source->Kn) != noError) {
+      result = criticalError;
+      break;
     }
-    
-    // encode the instruction into the output buffer
-    outBufPos = encodeInstruction(outBuffer, outBufPos, instr.opcode, instr.operands, Kn);
-    
-    // read the instruction from the output buffer to test the decoding and print it
-    testInstr = readInstruction(outBuffer, &testBufPos);
-    printInstruction(testInstr, outBuffer); 
 
-     // verify if the instruction is valid
-    if(verifyInstruction(&testInstr) == criticalError) {
-      return 0;
+    // verify if the instruction is valid, as written
+    if(verifyInstruction(&source->instr) == criticalError) {
+      result = criticalError;
+      break;
     }
+    rung.count++;
   }
+  free(rung.items);
+  return result;
+}
 
-  // add final size to the output buffer
-  DataUnion u;
-  u.u8 = outBuffer;
-  u.u16[0] = outBufPos;
+/**
+ * Prints the instructions of a range of the program.
+ *
+ * @param program The program.
+ * @param start The position of the first instruction.
+ * @param end The end of the range.
+ * @param warnings Prints the warnings of verifyInstruction too.
+ */
+void listInstructions(uint8_t *program, uint32_t start, uint32_t end,
+                      uint8_t warnings) {
+  uint32_t pos = start;
+  while (pos < end) {
+    Instruction instr = readInstruction(program, &pos);
+    printInstruction(instr, program);
+    if (warnings) {
+      verifyInstruction(&instr);
+    }
+  }
+}
+
+/**
+ * Moves the K constants of the code to the constant pool of the program
+ * (see constants.h): the code is encoded again after the header of the
+ * program, with the index of its constants, and the pool follows it.
+ *
+ * @param code The code, with the constants inline, from the end of the
+ * header.
+ * @param codeEnd The end of the code.
+ * @param out The output buffer of the program, with room for the header.
+ * @param outBufPos The position after the header, moved after the pool.
+ * @param header The header, its end of the instructions set.
+ * @param sections The code sections, moved with their code; the section of
+ * the pool is added after them.
+ * @param numSections The number of sections, one more with a pool.
+ * @param rungs The rungs of an incremental compilation, moved with their
+ * code; NULL otherwise.
+ * @param cache The cache of an incremental compilation, the constants of
+ * the previous program keep their index; NULL otherwise.
+ * @return The error code.
+ */
+static uint8_t packConstants(OutputBuffer *code, uint32_t codeEnd,
+                             OutputBuffer *out, uint32_t *outBufPos,
+                             ProgramHeader *header, SectionEntry *sections,
+                             uint16_t *numSections, RungList *rungs,
+                             const RungCache *cache) {
+  ConstantPool pool;
+  initConstantPool(&pool);
+  uint8_t result = noError;
+  if (cache != NULL && cache->valid) {
+    for (uint32_t i = 0; result == noError && i < cache->header.numRungs;
+         i++) {
+      const RungEntry *entry = &cache->entries[i];
+      result = keepConstants(&pool, cache->previous.text, &cache->pool,
+                             entry->codeOffset,
+                             entry->codeOffset + entry->codeSize);
+    }
+  }
+  if (result == noError) {
+    result = collectConstants(&pool, code->data, HeaderSize, codeEnd);
+  }
+  if (result == noError) {
+    result = layoutConstantPool(&pool);
+  }
+  if (result == warning) {
+    // the new constants do not fit after the previous ones, packed again
+    freeConstantPool(&pool);
+    result = collectConstants(&pool, code->data, HeaderSize, codeEnd);
+    if (result == noError) {
+      result = layoutConstantPool(&pool);
+    }
+  }
+  if (rungs != NULL) {
+    // a single section, made of the rungs
+    for (uint32_t i = 0; result == noError && i < rungs->count; i++) {
+      RungEntry *rung = &rungs->entries[i];
+      uint32_t offset = *outBufPos;
+      result = indexConstants(&pool, code->data, rung->codeOffset,
+                              rung->codeOffset + rung->codeSize, out,
+                              outBufPos);
+      rung->codeOffset = offset;
+      rung->codeSize = *outBufPos - offset;
+    }
+    sections[0].offset = HeaderSize;
+    sections[0].size = *outBufPos - HeaderSize;
+  } else {
+    for (uint16_t i = 0; result == noError && i < *numSections; i++) {
+      uint32_t offset = *outBufPos;
+      result = indexConstants(&pool, code->data, sections[i].offset,
+                              sections[i].offset + sections[i].size, out,
+                              outBufPos);
+      sections[i].offset = offset;
+      sections[i].size = *outBufPos - offset;
+    }
+  }
+  header->codeEnd = *outBufPos;
+  if (result == noError && pool.count > 0) {
+    result = writeConstantPool(&pool, out, outBufPos, &sections[*numSections]);
+    (*numSections)++;
+  }
+  freeConstantPool(&pool);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+// Main function
+///////////////////////////////////////////////////////////////////////////////////
+/*
+Command line: VMcompiler [-q] [-n] [-i] [-j threads] [-o output.bin] [input.il ...]
+  -q  quiet, does not print the compiled instructions
+  -n  does not optimize, encodes the instructions as written (see peephole.h)
+  -i  incremental, compiles only the rungs changed since the last -i
+      compilation and writes the patch output.bin.patch (see incremental.h),
+      one input file only
+  -j  number of threads compiling the input files, the number of cores by
+      default (see link.h)
+  -o  output file; without it a second file name ending in .bin is the
+      output file, as in VMcompiler input.il output.bin
+Several input files are linked into one program, one section per file.
+The default files are program.il and program.bin.
+The exit status is 0 when the program and its companion files are written,
+1 on any error.
+*/
+int main(int argc, char *argv[]) {
+  // file names
+  const char *defaultInput = "program.il";
+  const char **inputs = &defaultInput;
+  uint32_t numInputs = 1;
+  const char *outFilename = "program.bin";
+  uint8_t quiet = 0;
+  uint8_t incremental = 0;
+  uint8_t optimize = 1;
+  uint8_t numThreads = getNumCores();
+  uint8_t output = 0;
+  int arg = 1;
+  while (arg < argc && argv[arg][0] == '-') {
+    if (strcmp(argv[arg], "-q") == 0) {
+      quiet = 1;
+    } else if (strcmp(argv[arg], "-n") == 0) {
+      optimize = 0;
+    } else if (strcmp(argv[arg], "-i") == 0) {
+      incremental = 1;
+    } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc &&
+               atoi(argv[arg + 1]) > 0) {
+      int threads = atoi(argv[++arg]);
+      numThreads = threads > MaxCompileThreads ? MaxCompileThreads
+                                               : (uint8_t)threads;
+    } else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+      outFilename = argv[++arg];
+      output = 1;
+    } else {
+      printf("Usage: %s [-q] [-n] [-i] [-j threads] [-o output.bin] "
+             "[input.il ...]\n", argv[0]);
+      return 1;
+    }
+    arg++;
+  }
+  if (arg < argc) {
+    inputs = (const char **)&argv[arg];
+    numInputs = (uint32_t)(argc - arg);
+    // An input is never overwritten: only a .bin name is taken as the output
+    size_t length = strlen(inputs[numInputs - 1]);
+    if (!output && numInputs == 2 && length >= 4 &&
+        strcmp(inputs[1] + length - 4, ".bin") == 0) {
+      outFilename = inputs[1];
+      numInputs = 1;
+    }
+  }
+  if (numInputs >= MaxSections) {
+    printf("Error: more than %d input files\n", MaxSections - 1);
+    return 1;
+  }
+  if (incremental && numInputs > 1) {
+    printf("Error: -i compiles one input file\n");
+    return 1;
+  }
+
+  // read the program from the source, the constants inline
+  OutputBuffer code = {NULL, 0};   // grows as the instructions are added
+  uint32_t codeEnd = HeaderSize; // start after the header
+  if (reserveOutput(&code, 0, HeaderSize) != noError) {
+    return 1;
+  }
+  ProgramHeader header; // the sizes grow with the addresses used
+  header.inputSize = InputSize;
+  header.outputSize = OutputSize;
+  header.memorySize = MemorySize;
+  // one more section for the constant pool
+  SectionEntry *sections =
+      (SectionEntry *)calloc(numInputs + 1, sizeof(SectionEntry));
+  if (sections == NULL) {
+    printf("Error allocating memory for the sections\n");
+    return 1;
+  }
+  // the source line of each instruction, one map per file
+  LineMap *lines = (LineMap *)calloc(numInputs, sizeof(LineMap));
+  if (lines == NULL) {
+    printf("Error allocating memory for the line map\n");
+    return 1;
+  }
+  RungCache cache;
+  RungList rungs = {NULL, 0, 0};
+  if (numInputs == 1) {
+    // map the source, the tokenizer reads it in place
+    const char *filename = inputs[0];
+    SourceFile source;
+    if (mapSourceFile(filename, &source) != noError) {
+      return 1;
+    }
+    const uint8_t *text = source.text;
+    uint32_t textSize = source.size;
+    if (!quiet) {
+      printf("\nCompiling: %s\n\n", filename);
+    }
+    PeepholeState state;
+    resetPeepholeState(&state);
+    PeepholeState *peephole = optimize ? &state : NULL;
+    if (incremental) {
+      // only the rungs changed since the last compilation are compiled
+      loadRungCache(&cache, outFilename, optimize);
+      if (compileIncremental(&cache, text, textSize, &code, &codeEnd,
+                             &header, quiet, peephole, &rungs,
+                             &lines[0]) != noError) {
+        return 1;
+      }
+    } else if (compileInstructions(text, 0, textSize, &code, &codeEnd,
+                                   &header, quiet, peephole, &lines[0],
+                                   1) != noError) {
+      return 1;
+    }
+    unmapSourceFile(&source);
+    sections[0].offset = HeaderSize;
+    sections[0].size = codeEnd - HeaderSize;
+    sections[0].type = SectionCode;
+    getSectionName(filename, sections[0].name);
+  } else {
+    // compile the files in parallel and link them in the given order
+    Module *modules = (Module *)calloc(numInputs, sizeof(Module));
+    if (modules == NULL) {
+      printf("Error allocating memory for the input files\n");
+      return 1;
+    }
+    for (uint32_t i = 0; i < numInputs; i++) {
+      modules[i].filename = inputs[i];
+    }
+    if (compileModules(modules, numInputs, numThreads, optimize) != noError ||
+        linkModules(modules, numInputs, &code, &codeEnd, &header,
+                    sections) != noError) {
+      return 1;
+    }
+    for (uint32_t i = 0; i < numInputs; i++) {
+      lines[i] = modules[i].lines; // the map outlives the module
+      initLineMap(&modules[i].lines);
+    }
+    freeModules(modules, numInputs);
+    free(modules);
+    if (!quiet) {
+      for (uint32_t i = 0; i < numInputs; i++) {
+        printf("\nCompiling: %s\n\n", inputs[i]);
+        listInstructions(code.data, sections[i].offset,
+                         sections[i].offset + sections[i].size, 0);
+      }
+    }
+  }
+
+  // move the constants to the constant pool, the code refers to them by
+  // index
+  OutputBuffer out = {NULL, 0};
+  uint32_t outBufPos = HeaderSize;
+  uint16_t numSections = (uint16_t)numInputs;
+  if (reserveOutput(&out, 0, HeaderSize) != noError ||
+      packConstants(&code, codeEnd, &out, &outBufPos, &header, sections,
+                    &numSections, incremental ? &rungs : NULL,
+                    incremental ? &cache : NULL) != noError) {
+    return 1;
+  }
+  free(code.data);
+
+  // add the section table and the header with the final size
+  if (writeSectionTable(&out, &outBufPos, &header, sections, numSections) !=
+      noError) {
+    return 1;
+  }
+  free(sections);
+  header.programSize = outBufPos;
+  writeProgramHeader(out.data, &header);
 
   // encode the checksum of the program
-  encodeProgramCS(outBuffer);
+  if (reserveOutput(&out, outBufPos, 4) != noError) {
+    return 1;
+  }
+  encodeProgramCS(out.data);
 
   // save de program to a file
-  FILE *file = fopen("program.bin", "wb");
-  if (file == NULL) {
-    printf("Error opening file program.bin\n");
-    return 0;
+  if (writeProgramFile(outFilename, out.data, outBufPos + 4) != noError) {
+    return 1;
+  }
+  // the source line of each instruction, for the profiler of the VM
+  uint8_t result =
+      writeLineMap(outFilename, out.data, &header, inputs, lines, numInputs);
+  if (incremental) {
+    // the patch is relative to the previous program, still mapped
+    if (writePatch(&cache, &rungs, outFilename, out.data, &header) !=
+        noError) {
+      result = criticalError;
+    }
+    if (saveRungCache(&rungs, &lines[0], outFilename, out.data,
+                      outBufPos + 4, optimize) != noError) {
+      result = criticalError;
+    }
+    freeRungCache(&cache);
+    free(rungs.entries);
+  }
+  for (uint32_t i = 0; i < numInputs; i++) {
+    freeLineMap(&lines[i]);
   }
-  fwrite(outBuffer, 1, outBufPos+4, file);
-  fclose(file);
+  free(lines);
 
-  printf("\nCompiled successfully");
-  printProgramInHEX(outBuffer, outBufPos+4);
-  return 0;
+  if (!quiet) {
+    printf("\nCompiled successfully");
+    printProgramInHEX(out.data, outBufPos+4);
+  }
+  free(out.data);
+  return result == noError ? 0 : 1;
 }
-
@@ -0,0 +1,126 @@
+#ifndef MNEMONICS_H
+#define MNEMONICS_H
+
+#include <stdint.h>
+#include "VMCompiler.h"
+
+/*
+Lookup tables of the tokenizer, built by the C++ compiler from InstNames.
+
+Mnemonics: perfect hash. The FNV-1a hash of the mnemonic, with a seed
+searched at build time so that no two mnemonics of InstNames share a slot,
+selects one of MnemonicSlots slots holding opcode + 1 (0 for an empty
+slot). A lookup is one hash and one strcmp against the only candidate,
+instead of a strcmp against every mnemonic.
+
+Operand prefixes: the register letter (I, Q, M, K) and the memory type
+letter (X, B, W, D, L, R) index 256-entry tables holding their codes, or
+InvalidCode.
+*/
+
+#define MnemonicSlots 256 // Power of 2, the slot is the top byte of the hash
+#define InvalidCode 0xFF
+
+typedef struct stMnemonicTable {
+  uint32_t seed;
+  uint8_t slots[MnemonicSlots]; // Opcode + 1, 0 when empty
+} MnemonicTable;
+
+typedef struct stCodeTable {
+  uint8_t codes[256]; // Code of each character, InvalidCode if none
+} CodeTable;
+
+/**
+ * Hashes a mnemonic (FNV-1a).
+ *
+ * @param text The mnemonic, null terminated.
+ * @param seed The offset basis.
+ * @return The hash.
+ */
+constexpr uint32_t hashMnemonic(const char *text, uint32_t seed) {
+  uint32_t hash = seed;
+  while (*text != '\0') {
+    hash = (hash ^ (uint8_t)*text) * 16777619u;
+    text++;
+  }
+  return hash;
+}
+
+constexpr uint32_t getMnemonicSlot(uint32_t hash) { return hash >> 24; }
+
+/**
+ * Searches a seed without collisions among InstNames and fills the slots.
+ *
+ * @return The table.
+ */
+constexpr MnemonicTable buildMnemonicTable() {
+  MnemonicTable table = {};
+  for (uint32_t seed = 2166136261u;; seed++) {
+    bool perfect = true;
+    for (uint32_t s = 0; s < MnemonicSlots; s++) {
+      table.slots[s] = 0;
+    }
+    for (uint8_t i = 0; i < NumInstructions && perfect; i++) {
+      uint32_t slot = getMnemonicSlot(hashMnemonic(InstNames[i], seed));
+      if (table.slots[slot] != 0) {
+        perfect = false;
+      }
+      table.slots[slot] = (uint8_t)(i + 1);
+    }
+    if (perfect) {
+      table.seed = seed;
+      return table;
+    }
+  }
+}
+
+/**
+ * Builds the table of codes of a set of characters.
+ *
+ * @param characters The characters, the code of each one is its position.
+ * @return The table.
+ */
+constexpr CodeTable buildCodeTable(const char *characters) {
+  CodeTable table = {};
+  for (uint32_t c = 0; c < 256; c++) {
+    table.codes[c] = InvalidCode;
+  }
+  for (uint8_t i = 0; characters[i] != '\0'; i++) {
+    table.codes[(uint8_t)characters[i]] = i;
+  }
+  return table;
+}
+
+constexpr MnemonicTable Mnemonics = buildMnemonicTable();
+constexpr CodeTable RegisterCodes = buildCodeTable("IQMK");
+constexpr CodeTable MemoryTypeCodes = buildCodeTable("XBWDLR");
+
+static_assert(sizeof(InstNames) / sizeof(*InstNames) == NumInstructions,
+              "InstNames must list every instruction");
+static_assert(RegisterCodes.codes['I'] == I && RegisterCodes.codes['Q'] == Q &&
+                  RegisterCodes.codes['M'] == M && RegisterCodes.codes['K'] == K,
+              "The register letters must match the register types");
+static_assert(MemoryTypeCodes.codes['X'] == X &&
+                  MemoryTypeCodes.codes['B'] == B &&
+                  MemoryTypeCodes.codes['W'] == W &&
+                  MemoryTypeCodes.codes['D'] == D &&
+                  MemoryTypeCodes.codes['L'] == L &&
+                  MemoryTypeCodes.codes['R'] == R,
+              "The memory type letters must match the memory types");
+
+/**
+ * Finds the opcode of a mnemonic.
+ *
+ * @param token The mnemonic.
+ * @return The opcode, or InvalidCode if the token is not a mnemonic.
+ */
+inline uint8_t findOpcode(const char *token) {
+  uint8_t entry =
+      Mnemonics.slots[getMnemonicSlot(hashMnemonic(token, Mnemonics.seed))];
+  if (entry == 0 || strcmp(token, InstNames[entry - 1]) != 0) {
+    return InvalidCode;
+  }
+  return (uint8_t)(entry - 1);
+}
+
+#endif // MNEMONICS_H
@@ -0,0 +1,452 @@
+#include "peephole.h"
+
+/**
+ * Resets the state to nothing known, at the start of a file.
+ *
+ * @param state The state.
+ */
+void resetPeepholeState(PeepholeState *state) {
+  memset(state, 0, sizeof(*state));
+}
+
+/**
+ * Packs the state into 32 bits, the same state gives the same value.
+ *
+ * @param state The state, may be NULL when the optimizer is disabled.
+ * @return The packed state.
+ */
+uint32_t packPeepholeState(const PeepholeState *state) {
+  if (state == NULL) {
+    return 0;
+  }
+  uint32_t packed = state->acc;
+  if (state->hasBit) {
+    packed |= 1u << 2 | (uint32_t)state->bit.registertype << 3 |
+              (uint32_t)state->bit.bitNumber << 5 |
+              (uint32_t)(state->bit.address & 0xFFFF) << 8;
+  }
+  return packed;
+}
+
+/**
+ * Unpacks a state packed by packPeepholeState.
+ *
+ * @param packed The packed state.
+ * @param state Receives the state.
+ */
+void unpackPeepholeState(uint32_t packed, PeepholeState *state) {
+  resetPeepholeState(state);
+  state->acc = packed & 0x03;
+  if (packed & (1u << 2)) {
+    state->hasBit = 1;
+    state->bit.memorytype = X;
+    state->bit.registertype = (packed >> 3) & 0x03;
+    state->bit.bitNumber = (packed >> 5) & 0x07;
+    state->bit.address = packed >> 8;
+  }
+}
+
+/**
+ * Makes room for one more instruction in a rung.
+ *
+ * @param rung The rung.
+ * @return The error code.
+ */
+uint8_t reserveRungBuffer(RungBuffer *rung) {
+  if (rung->count < rung->capacity) {
+    return noError;
+  }
+  uint32_t capacity = rung->capacity > 0 ? rung->capacity * 2 : 64;
+  SourceInstruction *items = (SourceInstruction *)realloc(
+      rung->items, capacity * sizeof(SourceInstruction));
+  if (items == NULL) {
+    printf("Error allocating memory for the rung\n");
+    return criticalError;
+  }
+  rung->items = items;
+  rung->capacity = capacity;
+  return noError;
+}
+
+/**
+ * Checks if an operand is a bit that only the program writes (M or Q).
+ *
+ * @param operand The operand.
+ * @return 1 if it is.
+ */
+static uint8_t isProgramBit(const Operand *operand) {
+  return operand->memorytype == X &&
+         (operand->registertype == M || operand->registertype == Q);
+}
+
+/**
+ * Checks if an operand is a bit of the process image (not a constant).
+ *
+ * @param operand The operand.
+ * @return 1 if it is.
+ */
+static uint8_t isBitOperand(const Operand *operand) {
+  return operand->memorytype == X && operand->registertype != K;
+}
+
+/**
+ * Checks if two operands are the same bit.
+ *
+ * @param a An operand.
+ * @param b The other operand.
+ * @return 1 if they are.
+ */
+static uint8_t sameBit(const Operand *a, const Operand *b) {
+  return a->memorytype == X && b->memorytype == X &&
+         a->registertype == b->registertype && a->address == b->address &&
+         a->bitNumber == b->bitNumber;
+}
+
+/**
+ * Checks if an instruction uses the byte of a bit, read or write.
+ *
+ * @param instr The instruction.
+ * @param bit The bit.
+ * @return 1 if one of its operands covers the byte of the bit.
+ */
+static uint8_t usesByteOf(const Instruction *instr, const Operand *bit) {
+  for (uint8_t i = 0; i < instr->num_operands; i++) {
+    const Operand *operand = &instr->operands[i];
+    if (operand->registertype == bit->registertype &&
+        operand->address <= bit->address &&
+        bit->address < operand->address +
+                           getMemoryTypeSize(operand->memorytype)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Gets the mask of the bytes of a constant of a memory type.
+ *
+ * @param memorytype The memory type.
+ * @return The mask.
+ */
+static uint64_t getConstantMask(uint8_t memorytype) {
+  uint8_t size = getMemoryTypeSize(memorytype);
+  return size >= 8 ? ~0ull : (1ull << (size * 8)) - 1;
+}
+
+/**
+ * Computes an ADD, SUB or MUL of two constants as the VM does, in the
+ * type of the result.
+ *
+ * @param opcode InstADD, InstSUB or InstMUL.
+ * @param memorytype The type of the operands and of the result.
+ * @param a The first constant.
+ * @param b The second constant.
+ * @return The result, as a constant of the type.
+ */
+static uint64_t foldConstants(uint8_t opcode, uint8_t memorytype, uint64_t a,
+                              uint64_t b) {
+  if (memorytype == R) {
+    float x, y;
+    uint32_t bits = (uint32_t)a;
+    memcpy(&x, &bits, 4);
+    bits = (uint32_t)b;
+    memcpy(&y, &bits, 4);
+    float result = opcode == InstADD ? x + y : opcode == InstSUB ? x - y : x * y;
+    memcpy(&bits, &result, 4);
+    return bits;
+  }
+  // Unsigned arithmetic wraps as the signed arithmetic of the VM
+  uint64_t result = opcode == InstADD ? a + b : opcode == InstSUB ? a - b : a * b;
+  return result & getConstantMask(memorytype);
+}
+
+/**
+ * Checks if an operand is a constant of a type with a given value.
+ *
+ * @param source The instruction.
+ * @param i The index of the operand.
+ * @param memorytype The type.
+ * @param value The value.
+ * @return 1 if it is.
+ */
+static uint8_t isConstant(const SourceInstruction *source, uint8_t i,
+                          uint8_t memorytype, uint64_t value) {
+  const Operand *operand = &source->instr.operands[i];
+  return operand->registertype == K && operand->memorytype == memorytype &&
+         (source->Kn[i] & getConstantMask(memorytype)) == value;
+}
+
+/**
+ * Turns an instruction into MOV.
+ *
+ * @param source The instruction.
+ * @param operand The source operand of the MOV.
+ * @param Kn Its constant.
+ */
+static void makeMove(SourceInstruction *source, const Operand *operand,
+                     uint64_t Kn) {
+  Operand destination = source->instr.operands[2];
+  source->instr.opcode = InstMOV;
+  source->instr.num_operands = NumOpMOV;
+  source->instr.operands[0] = *operand;
+  source->instr.operands[1] = destination;
+  source->Kn[0] = Kn;
+  source->Kn[1] = 0;
+}
+
+/**
+ * Folds an ADD, SUB or MUL of constants, or by the neutral constant, into
+ * a MOV.
+ *
+ * @param source The instruction.
+ */
+static void foldArithmetic(SourceInstruction *source) {
+  Instruction *instr = &source->instr;
+  uint8_t type = instr->operands[2].memorytype;
+  const Operand *a = &instr->operands[0];
+  const Operand *b = &instr->operands[1];
+  if (a->registertype == K && b->registertype == K && a->memorytype == type &&
+      b->memorytype == type) {
+    Operand constant = *a;
+    makeMove(source, &constant,
+             foldConstants(instr->opcode, type, source->Kn[0], source->Kn[1]));
+    return;
+  }
+  // x + 0, 0 + x, x - 0, x * 1 and 1 * x, not for floats (-0.0 + 0.0)
+  if (type == R || a->memorytype != type || b->memorytype != type) {
+    return;
+  }
+  uint64_t neutral = instr->opcode == InstMUL ? 1 : 0;
+  if (isConstant(source, 1, type, neutral)) {
+    Operand operand = *a;
+    makeMove(source, &operand, source->Kn[0]);
+  } else if (instr->opcode != InstSUB && isConstant(source, 0, type, neutral)) {
+    Operand operand = *b;
+    makeMove(source, &operand, source->Kn[1]);
+  }
+}
+
+/**
+ * Rewrites a logic instruction with a bit operand when the accumulator is
+ * known.
+ *
+ * @param instr The instruction, AND, ANDN, OR, ORN, XOR or XORN.
+ * @param acc AccZero or AccOne.
+ * @return 1 if the instruction is removed.
+ */
+static uint8_t foldLogic(Instruction *instr, uint8_t acc) {
+  uint8_t one = acc == AccOne;
+  switch (instr->opcode) {
+  case InstAND: // 0 AND x = 0, 1 AND x = x
+    instr->opcode = InstLD;
+    return !one;
+  case InstANDN:
+    instr->opcode = InstLDN;
+    return !one;
+  case InstOR: // 1 OR x = 1, 0 OR x = x
+    instr->opcode = InstLD;
+    return one;
+  case InstORN:
+    instr->opcode = InstLDN;
+    return one;
+  case InstXOR: // 0 XOR x = x, 1 XOR x = NOT x
+    instr->opcode = one ? InstLDN : InstLD;
+    return 0;
+  case InstXORN:
+    instr->opcode = one ? InstLD : InstLDN;
+    return 0;
+  }
+  return 0;
+}
+
+/**
+ * Follows the accumulator through the rung and removes or rewrites the
+ * instructions that do not change the result.
+ *
+ * @param rung The rung.
+ * @param state The state when the rung starts, then when it ends.
+ */
+static void forwardPass(RungBuffer *rung, PeepholeState *state) {
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < rung->count; i++) {
+    SourceInstruction *source = &rung->items[i];
+    Instruction *instr = &source->instr;
+    const Operand *operand = &instr->operands[0];
+    uint8_t remove = 0;
+    switch (instr->opcode) {
+    case InstAND:
+    case InstANDN:
+    case InstOR:
+    case InstORN:
+    case InstXOR:
+    case InstXORN:
+      if (!isBitOperand(operand)) {
+        state->acc = AccUnknown;
+        state->hasBit = 0;
+        break;
+      }
+      if (state->acc == AccZero || state->acc == AccOne) {
+        remove = foldLogic(instr, state->acc);
+        if (remove) {
+          break;
+        }
+        // Now a LD or LDN
+      } else {
+        // AND of a bit is always 0 or 1
+        if (instr->opcode == InstAND || instr->opcode == InstANDN) {
+          state->acc = AccBoolean;
+        }
+        state->hasBit = 0;
+        break;
+      }
+      // fall through
+    case InstLD:
+    case InstLDN:
+      if (operand->memorytype != X) {
+        break; // Does nothing
+      }
+      if (operand->registertype == K) {
+        uint8_t one = (source->Kn[0] & 0xFF) != 0;
+        uint8_t acc = (one ^ (instr->opcode == InstLDN)) ? AccOne : AccZero;
+        if (state->acc == acc) {
+          remove = 1;
+          break;
+        }
+        state->acc = acc;
+        state->hasBit = 0;
+        break;
+      }
+      if (instr->opcode == InstLD && state->hasBit &&
+          sameBit(operand, &state->bit)) {
+        remove = 1;
+        break;
+      }
+      state->acc = AccBoolean;
+      state->hasBit = instr->opcode == InstLD && isProgramBit(operand);
+      state->bit = *operand;
+      break;
+    case InstNOT:
+      // NOT NOT leaves 0 and 1 as they are
+      if (i + 1 < rung->count && rung->items[i + 1].instr.opcode == InstNOT &&
+          state->acc != AccUnknown) {
+        i++;
+        remove = 1;
+        break;
+      }
+      state->acc = state->acc == AccZero  ? AccOne
+                   : state->acc == AccOne ? AccZero
+                                          : AccBoolean;
+      state->hasBit = 0;
+      break;
+    case InstST:
+      if (!isProgramBit(operand)) {
+        break;
+      }
+      if (state->hasBit && sameBit(operand, &state->bit)) {
+        remove = 1;
+        break;
+      }
+      // A value other than 0 and 1 is stored as 1
+      state->hasBit = state->acc != AccUnknown;
+      state->bit = *operand;
+      break;
+    case InstADD:
+    case InstSUB:
+    case InstMUL:
+      if (state->acc != AccZero) {
+        foldArithmetic(source);
+      }
+      // fall through
+    case InstS:
+    case InstR:
+    case InstMOV:
+    case InstDIV:
+    case InstMOD:
+      // Run only with the accumulator at 1
+      if (state->acc == AccZero) {
+        remove = 1;
+      } else if (state->hasBit && usesByteOf(instr, &state->bit)) {
+        state->hasBit = 0;
+      }
+      break;
+    case InstGT:
+    case InstGE:
+    case InstEQ:
+    case InstNE:
+    case InstLT:
+    case InstLE:
+      if (state->acc == AccZero) {
+        remove = 1;
+        break;
+      }
+      state->acc = state->acc == AccUnknown ? AccUnknown : AccBoolean;
+      state->hasBit = 0;
+      break;
+    case InstANDp:
+    case InstANDNp:
+    case InstORp:
+    case InstORNp:
+    case InstXORp:
+    case InstXORNp:
+    case Instq:
+      state->acc = AccUnknown;
+      state->hasBit = 0;
+      break;
+    default:
+      // STN, timers, counters and triggers do not change the accumulator
+      if (state->hasBit && usesByteOf(instr, &state->bit)) {
+        state->hasBit = 0;
+      }
+      break;
+    }
+    if (!remove) {
+      rung->items[kept++] = *source;
+    }
+  }
+  rung->count = kept;
+}
+
+/**
+ * Removes the stores to M bits stored again later in the rung, with no
+ * instruction using their byte in between.
+ *
+ * @param rung The rung.
+ */
+static void removeDeadStores(RungBuffer *rung) {
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < rung->count; i++) {
+    const Instruction *instr = &rung->items[i].instr;
+    uint8_t dead = 0;
+    if ((instr->opcode == InstST || instr->opcode == InstSTN) &&
+        instr->operands[0].memorytype == X &&
+        instr->operands[0].registertype == M) {
+      const Operand *bit = &instr->operands[0];
+      for (uint32_t j = i + 1; j < rung->count; j++) {
+        const Instruction *next = &rung->items[j].instr;
+        if ((next->opcode == InstST || next->opcode == InstSTN) &&
+            sameBit(&next->operands[0], bit)) {
+          dead = 1;
+          break;
+        }
+        if (usesByteOf(next, bit)) {
+          break;
+        }
+      }
+    }
+    if (!dead) {
+      rung->items[kept++] = rung->items[i];
+    }
+  }
+  rung->count = kept;
+}
+
+/**
+ * Optimizes the instructions of a rung.
+ *
+ * @param rung The rung, its instructions are rewritten.
+ * @param state The state when the rung starts, then when it ends.
+ */
+void optimizeRung(RungBuffer *rung, PeepholeState *state) {
+  forwardPass(rung, state);
+  removeDeadStores(rung);
+}
@@ -0,0 +1,69 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "VMCompiler.h"
+
+/*
+Peephole optimizer, between getInstruction and encodeInstruction (-n
+disables it).
+
+The instructions are collected rung by rung (see incremental.h) and
+rewritten before they are encoded. A forward pass follows what is known
+about the accumulator:
+  - LD x after LD x or ST x, and ST x after LD x or ST x, are removed
+    while the accumulator still holds the value of the bit x (M and Q bits
+    only, the program is the only writer)
+  - NOT NOT is removed when the accumulator is 0 or 1 (NOT maps any other
+    value to 0)
+  - after a LD KX1 guard, LD KX1 is removed, AND x becomes LD x, ANDN x
+    becomes LDN x, OR x is removed, and so on; after LD KX0 the
+    instructions that only run with the accumulator at 1 (S, R, MOV,
+    arithmetic, comparisons) are removed
+  - ADD, SUB and MUL of two constants of the type of the result become a
+    MOV of the result, with the arithmetic of the VM (wrapping); adding 0
+    or multiplying by 1 an operand of the type of the result becomes a MOV
+Then a backward pass removes the ST and STN to M bits stored again later
+in the rung without any instruction using their byte in between.
+
+What is known about the accumulator when a rung starts is the state left
+by the previous rung (PeepholeState), the code of a rung depends only on
+its text and that state. The incremental compilation keeps the state of
+each rung in its cache, so its programs stay the same as the programs of a
+full compilation. Every file starts from an unknown state, so the code of
+a file does not depend on the files linked before it.
+*/
+
+// What is known about the accumulator
+#define AccUnknown 0 // Any value
+#define AccZero 1
+#define AccOne 2
+#define AccBoolean 3 // 0 or 1
+
+typedef struct stPeepholeState {
+  uint8_t acc;     // AccUnknown, AccZero, AccOne or AccBoolean
+  uint8_t hasBit;  // The accumulator holds the value of bit
+  Operand bit;     // M or Q bit
+} PeepholeState;
+
+// Instruction as read from the source, with its constants
+typedef struct stSourceInstruction {
+  Instruction instr;
+  uint64_t Kn[MaxOpers];
+  uint32_t line; // Source line, kept when the instruction is rewritten
+} SourceInstruction;
+
+// Instructions of a rung
+typedef struct stRungBuffer {
+  SourceInstruction *items;
+  uint32_t count;
+  uint32_t capacity;
+} RungBuffer;
+
+// Function prototypes
+void resetPeepholeState(PeepholeState *state);
+uint32_t packPeepholeState(const PeepholeState *state);
+void unpackPeepholeState(uint32_t packed, PeepholeState *state);
+uint8_t reserveRungBuffer(RungBuffer *rung);
+void optimizeRung(RungBuffer *rung, PeepholeState *state);
+
+#endif // PEEPHOLE_H